@@ -24,6 +24,11 @@
 #include "libgadu.h"
 
 unsigned char *gg_deflate(const char *in, size_t *out_lenp);
+unsigned char *gg_deflate_session(struct gg_session *gs, const char *in, size_t offset, size_t *out_lenp);
+unsigned char *gg_deflate_source(struct gg_session *gs, int (*source)(struct gg_session *gs, const char **buf, size_t *len, void *data), void *data, size_t offset, size_t *out_lenp);
 char *gg_inflate(const unsigned char *in, size_t length);
+char *gg_inflate_session(struct gg_session *gs, const unsigned char *in, size_t length, size_t size_hint);
+int gg_inflate_sink(struct gg_session *gs, const unsigned char *in, size_t length, int (*sink)(const char *buf, size_t len, void *data), void *data);
+void gg_deflate_free_session(struct gg_session *gs);
 
 #endif /* LIBGADU_DEFLATE_H */
@@ -23,5 +23,6 @@
 #include "libgadu.h"
 
 char *gg_encoding_convert(const char *src, gg_encoding_t src_encoding, gg_encoding_t dst_encoding, int src_length, int dst_length);
+const char *gg_encoding_convert_session(struct gg_session *gs, const char *src, gg_encoding_t src_encoding, gg_encoding_t dst_encoding, int src_length);
 
 #endif /* LIBGADU_SESSION_H */
@@ -34,6 +34,7 @@
 #ifdef _WIN32
 #  include <io.h>
 #  define gg_file_close _close
+#  define gg_file_sync _commit
 #  define lseek _lseek
 #  define open _open
 #  define read _read
@@ -45,6 +46,7 @@
 #  endif
 #  include <unistd.h>
 #  define gg_file_close close
+#  define gg_file_sync fsync
 #endif
 
 #ifndef S_IWUSR
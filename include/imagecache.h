@@ -0,0 +1,42 @@
+/* $Id$ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License Version
+ *  2.1 as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+ *  USA.
+ */
+
+#ifndef LIBGADU_IMAGECACHE_H
+#define LIBGADU_IMAGECACHE_H
+
+#include "libgadu.h"
+
+/**
+ * \internal Obrazek przechowywany w pamięci podręcznej.
+ */
+struct gg_image_cache_entry {
+	uint32_t size;			/**< Rozmiar obrazka */
+	uint32_t crc32;			/**< Suma kontrolna CRC32 */
+	char *filename;			/**< Nazwa pliku */
+	char *image;			/**< Treść obrazka */
+	int local;			/**< Flaga obrazka wysłanego przez aplikację */
+
+	struct gg_image_cache_entry *prev;	/**< Poprzedni (częściej używany) element listy */
+	struct gg_image_cache_entry *next;	/**< Kolejny (rzadziej używany) element listy */
+	struct gg_image_cache_entry *hash_next;	/**< Kolejny element w tablicy mieszającej */
+};
+
+int gg_image_cache_add(uint32_t size, uint32_t crc32, const char *filename, const char *image, int local);
+const struct gg_image_cache_entry *gg_image_cache_find(uint32_t size, uint32_t crc32);
+
+#endif /* LIBGADU_IMAGECACHE_H */
@@ -38,6 +38,49 @@ int gg_resolve(int *fd, int *pid, const char *hostname);
 int gg_resolve_pthread(int *fd, void **resolver, const char *hostname);
 void gg_resolve_pthread_cleanup(void *resolver, int kill);
 
+int gg_send_packet_buffer(struct gg_session *sess, int type, char *buf, size_t length);
+
+#define GG_EVENT_MSG_DECODE_TEXT 1
+#define GG_EVENT_MSG_DECODE_XHTML 2
+
+int gg_event_msg_decode(struct gg_event_msg *msg, const char *html, const char *plain, gg_encoding_t encoding, int what);
+
+#define GG_IMAGE_QUEUE_HASH_SIZE 256
+
+/** \internal Maksymalna długość danych pakietu z częścią obrazka */
+#define GG_IMAGE_REPLY_FRAGMENT 1910
+
+/**
+ * \internal Obrazek kolejkowany do wysłania.
+ */
+struct gg_image_send {
+	uin_t recipient;		/**< Numer adresata */
+	char *filename;			/**< Nazwa pliku */
+	const char *image;		/**< Bufor aplikacji z obrazkiem */
+	uint32_t size;			/**< Rozmiar obrazka */
+	uint32_t crc32;			/**< Suma kontrolna obrazka */
+	uint32_t offset;		/**< Rozmiar wysłanych danych */
+	void (*done)(struct gg_session *gs, const char *image, int result, void *data);	/**< Funkcja wywoływana po zakończeniu */
+	void *data;			/**< Dane prywatne funkcji */
+
+	struct gg_image_send *next;	/**< Kolejny element listy */
+};
+
+int gg_image_send_next(struct gg_session *sess);
+void gg_image_send_free(struct gg_session *sess, struct gg_image_send *is, int result);
+
+int gg_image_queue_add(struct gg_session *s, struct gg_image_queue *q);
+struct gg_image_queue *gg_image_queue_find(struct gg_session *s, uin_t sender, uint32_t size, uint32_t crc32);
+
+struct in_addr;
+
+void gg_http_dns_ref(void);
+void gg_http_dns_unref(void);
+int gg_http_dns_find(const char *hostname, struct in_addr *addr);
+struct gg_http *gg_http_prepare(const char *hostname, int port, int async, const char *method, const char *path, const char *header);
+int gg_http_park(struct gg_http *h);
+int gg_http_resume(struct gg_http *h);
+
 int gg_login_hash_sha1_2(const char *password, uint32_t seed, uint8_t *result);
 
 #ifdef HAVE_UINT64_T
@@ -0,0 +1,28 @@
+/* $Id$ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License Version
+ *  2.1 as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+ *  USA.
+ */
+
+#ifndef LIBGADU_JOURNAL_H
+#define LIBGADU_JOURNAL_H
+
+#include "libgadu.h"
+
+int gg_dcc7_journal_find(const struct gg_dcc7 *dcc, unsigned int *offset);
+void gg_dcc7_journal_progress(struct gg_dcc7 *dcc);
+void gg_dcc7_journal_finish(struct gg_dcc7 *dcc, int complete);
+
+#endif /* LIBGADU_JOURNAL_H */
@@ -22,34 +22,18 @@
 #include <sys/types.h>
 #include "libgadu.h"
 
-#if 0
-
 struct gg_message {
-	uin_t *recipients;
-	size_t recipient_count;
-	char *text;
-	char *html;
-	char *attributes;
-	size_t attributes_length;
-	uint32_t msgclass;
-	uint32_t seq;
+	uint32_t msgclass;	/**< Klasa wiadomości */
+	uint32_t seq;		/**< Numer sekwencyjny ostatnio wysłanej wiadomości */
 
-	int auto_convert;
-	char *text_converted;
-	char *html_converted;
+	char *packet;		/**< Gotowy pakiet \c GG_SEND_MSG80 do wysłania */
+	size_t packet_length;	/**< Długość pakietu */
 };
 
-#define GG_MESSAGE_CHECK(gm, result) \
-	if ((gm) == NULL) { \
-		errno = EINVAL; \
-		return (result); \
-	}
-
-int gg_message_init(gg_message_t *gm, int msgclass, int seq, uin_t *recipients, size_t recipient_count, char *text, char *xhtml, char *attributes, size_t attributes_length, int auto_convert);
-
-#endif
-
 size_t gg_message_html_to_text(char *dst, unsigned char *format, size_t *format_len, const char *html, gg_encoding_t encoding);
 size_t gg_message_text_to_html(char *dst, const char *src, gg_encoding_t encoding, const unsigned char *format, size_t format_len);
+char *gg_message_html_to_text_alloc(const char *html, gg_encoding_t encoding, unsigned char **format, size_t *format_len, size_t format_offset);
+size_t gg_message_text_to_html_bound(size_t src_len, size_t format_len);
+char *gg_message_text_to_html_alloc(const char *src, gg_encoding_t encoding, const unsigned char *format, size_t format_len);
 
 #endif /* LIBGADU_MESSAGE_H */
@@ -0,0 +1,42 @@
+/* $Id$ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License Version
+ *  2.1 as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+ *  USA.
+ */
+
+#ifndef LIBGADU_PUBDIR50CACHE_H
+#define LIBGADU_PUBDIR50CACHE_H
+
+#include "libgadu.h"
+
+/**
+ * \internal Odpowiedź katalogu publicznego oczekująca na przekazanie
+ * aplikacji.
+ */
+struct gg_pubdir50_ready {
+	char *packet;			/**< Treść pakietu odpowiedzi */
+	size_t length;			/**< Długość pakietu odpowiedzi */
+
+	struct gg_pubdir50_ready *next;	/**< Kolejny element listy */
+};
+
+int gg_pubdir50_cache_request(struct gg_session *sess, uint32_t seq, const char *packet, size_t length);
+void gg_pubdir50_cache_cancel(struct gg_session *sess, uint32_t seq);
+void gg_pubdir50_cache_reply(struct gg_session *sess, const char *packet, size_t length);
+void gg_pubdir50_cache_check(void);
+void gg_pubdir50_cache_disconnect(struct gg_session *sess);
+void gg_pubdir50_cache_free_session(struct gg_session *sess);
+
+#endif /* LIBGADU_PUBDIR50CACHE_H */
@@ -35,14 +35,19 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#ifndef _WIN32
+#  include <sys/time.h>
+#endif
 
 #include "libgadu.h"
 #include "protocol.h"
 #include "resolver.h"
 #include "internal.h"
+#include "journal.h"
 #include "debug.h"
 
 #ifdef _MSC_VER
@@ -56,6 +61,171 @@
 #define gg_debug_dump_dcc(dcc, level, buf, len) \
 	gg_debug_dump(((dcc) != NULL) ? (dcc)->sess : NULL, level, buf, len)
 
+/**
+ * \internal Minimalny rozmiar tablic mieszających połączeń bezpośrednich.
+ * Musi być potęgą dwójki.
+ */
+#define GG_DCC7_HASH_MIN_SIZE 16
+
+/**
+ * \internal Sprawdza, czy identyfikator połączenia jest pusty.
+ *
+ * \param id Identyfikator połączenia
+ *
+ * \return 1 jeśli identyfikator jest pusty, 0 w przeciwnym wypadku
+ */
+static int gg_dcc7_id_empty(const gg_dcc7_id_t *id)
+{
+	return !memcmp(id, "\0\0\0\0\0\0\0\0", sizeof(*id));
+}
+
+/**
+ * \internal Wyznacza wartość funkcji mieszającej dla identyfikatora
+ * połączenia (FNV-1a).
+ *
+ * \param id Identyfikator połączenia
+ *
+ * \return Wartość funkcji mieszającej
+ */
+static unsigned int gg_dcc7_hash_id(const gg_dcc7_id_t *id)
+{
+	uint32_t hash = 2166136261U;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(id->id); i++) {
+		hash ^= id->id[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/**
+ * \internal Wyznacza wartość funkcji mieszającej dla numeru Gadu-Gadu.
+ *
+ * \param uin Numer Gadu-Gadu
+ *
+ * \return Wartość funkcji mieszającej
+ */
+static unsigned int gg_dcc7_hash_uin(uin_t uin)
+{
+	uint32_t hash = uin * 2654435761U;
+
+	return hash ^ (hash >> 16);
+}
+
+/**
+ * \internal Dodaje połączenie do tablic mieszających sesji.
+ *
+ * Połączenia bez przydzielonego identyfikatora są dodawane jedynie do
+ * tablicy według numeru drugiej strony.
+ *
+ * \param sess Struktura sesji
+ * \param dcc Struktura połączenia
+ */
+static void gg_dcc7_hash_link(struct gg_session *sess, struct gg_dcc7 *dcc)
+{
+	unsigned int mask = sess->dcc7_hash_size - 1;
+	unsigned int idx;
+
+	if (!gg_dcc7_id_empty(&dcc->cid)) {
+		idx = gg_dcc7_hash_id(&dcc->cid) & mask;
+		dcc->hash_id_next = sess->dcc7_hash_id[idx];
+		sess->dcc7_hash_id[idx] = dcc;
+	} else
+		dcc->hash_id_next = NULL;
+
+	idx = gg_dcc7_hash_uin(dcc->peer_uin) & mask;
+	dcc->hash_uin_next = sess->dcc7_hash_uin[idx];
+	sess->dcc7_hash_uin[idx] = dcc;
+}
+
+/**
+ * \internal Usuwa połączenie z tablicy mieszającej według identyfikatora.
+ *
+ * \param sess Struktura sesji
+ * \param dcc Struktura połączenia
+ */
+static void gg_dcc7_hash_unlink_id(struct gg_session *sess, struct gg_dcc7 *dcc)
+{
+	struct gg_dcc7 **tmp;
+
+	if (gg_dcc7_id_empty(&dcc->cid))
+		return;
+
+	tmp = &sess->dcc7_hash_id[gg_dcc7_hash_id(&dcc->cid) & (sess->dcc7_hash_size - 1)];
+
+	for (; *tmp != NULL; tmp = &(*tmp)->hash_id_next) {
+		if (*tmp == dcc) {
+			*tmp = dcc->hash_id_next;
+			break;
+		}
+	}
+
+	dcc->hash_id_next = NULL;
+}
+
+/**
+ * \internal Usuwa połączenie z tablic mieszających sesji.
+ *
+ * \param sess Struktura sesji
+ * \param dcc Struktura połączenia
+ */
+static void gg_dcc7_hash_unlink(struct gg_session *sess, struct gg_dcc7 *dcc)
+{
+	struct gg_dcc7 **tmp;
+
+	gg_dcc7_hash_unlink_id(sess, dcc);
+
+	tmp = &sess->dcc7_hash_uin[gg_dcc7_hash_uin(dcc->peer_uin) & (sess->dcc7_hash_size - 1)];
+
+	for (; *tmp != NULL; tmp = &(*tmp)->hash_uin_next) {
+		if (*tmp == dcc) {
+			*tmp = dcc->hash_uin_next;
+			break;
+		}
+	}
+
+	dcc->hash_uin_next = NULL;
+}
+
+/**
+ * \internal Zmienia rozmiar tablic mieszających sesji i rozmieszcza w nich
+ * ponownie wszystkie połączenia.
+ *
+ * \param sess Struktura sesji
+ * \param size Nowy rozmiar (potęga dwójki)
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+static int gg_dcc7_hash_resize(struct gg_session *sess, unsigned int size)
+{
+	struct gg_dcc7 **hash_id, **hash_uin;
+	struct gg_dcc7 *tmp;
+
+	hash_id = calloc(size, sizeof(struct gg_dcc7*));
+	hash_uin = calloc(size, sizeof(struct gg_dcc7*));
+
+	if (hash_id == NULL || hash_uin == NULL) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_dcc7_hash_resize() not enough memory\n");
+		free(hash_id);
+		free(hash_uin);
+		return -1;
+	}
+
+	free(sess->dcc7_hash_id);
+	free(sess->dcc7_hash_uin);
+
+	sess->dcc7_hash_id = hash_id;
+	sess->dcc7_hash_uin = hash_uin;
+	sess->dcc7_hash_size = size;
+
+	for (tmp = sess->dcc7_list; tmp != NULL; tmp = tmp->next)
+		gg_dcc7_hash_link(sess, tmp);
+
+	return 0;
+}
+
 /**
  * \internal Dodaje połączenie bezpośrednie do sesji.
  *
@@ -68,14 +238,30 @@ static int gg_dcc7_session_add(struct gg_session *sess, struct gg_dcc7 *dcc)
 {
 	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_dcc7_session_add(%p, %p)\n", sess, dcc);
 
-	if (!sess || !dcc || dcc->next) {
+	if (!sess || !dcc || dcc->next || dcc->prev || sess->dcc7_list == dcc) {
 		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_dcc7_session_add() invalid parameters\n");
 		errno = EINVAL;
 		return -1;
 	}
 
+	if (sess->dcc7_hash_size == 0) {
+		if (gg_dcc7_hash_resize(sess, GG_DCC7_HASH_MIN_SIZE) == -1)
+			return -1;
+	} else if (sess->dcc7_count >= sess->dcc7_hash_size) {
+		/* Jeśli się nie uda, zostajemy przy dotychczasowym rozmiarze. */
+		gg_dcc7_hash_resize(sess, sess->dcc7_hash_size * 2);
+	}
+
+	dcc->prev = NULL;
 	dcc->next = sess->dcc7_list;
+
+	if (sess->dcc7_list != NULL)
+		sess->dcc7_list->prev = dcc;
+
 	sess->dcc7_list = dcc;
+	sess->dcc7_count++;
+
+	gg_dcc7_hash_link(sess, dcc);
 
 	return 0;
 }
@@ -90,8 +276,6 @@ static int gg_dcc7_session_add(struct gg_session *sess, struct gg_dcc7 *dcc)
  */
 static int gg_dcc7_session_remove(struct gg_session *sess, struct gg_dcc7 *dcc)
 {
-	struct gg_dcc7 *tmp;
-
 	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_dcc7_session_remove(%p, %p)\n", sess, dcc);
 
 	if (sess == NULL || dcc == NULL) {
@@ -100,27 +284,57 @@ static int gg_dcc7_session_remove(struct gg_session *sess, struct gg_dcc7 *dcc)
 		return -1;
 	}
 
-	if (sess->dcc7_list == dcc) {
-		sess->dcc7_list = dcc->next;
-		dcc->next = NULL;
-		return 0;
+	if (dcc->prev == NULL && sess->dcc7_list != dcc) {
+		errno = ENOENT;
+		return -1;
 	}
 
-	for (tmp = sess->dcc7_list; tmp != NULL; tmp = tmp->next) {
-		if (tmp->next == dcc) {
-			tmp->next = dcc->next;
-			dcc->next = NULL;
-			return 0;
-		}
-	}
+	gg_dcc7_hash_unlink(sess, dcc);
 
-	errno = ENOENT;
-	return -1;
+	if (dcc->prev != NULL)
+		dcc->prev->next = dcc->next;
+	else
+		sess->dcc7_list = dcc->next;
+
+	if (dcc->next != NULL)
+		dcc->next->prev = dcc->prev;
+
+	dcc->next = NULL;
+	dcc->prev = NULL;
+	sess->dcc7_count--;
+
+	return 0;
+}
+
+/**
+ * \internal Zmienia identyfikator połączenia przypisanego do sesji.
+ *
+ * \param sess Struktura sesji
+ * \param dcc Struktura połączenia
+ * \param id Nowy identyfikator połączenia
+ */
+static void gg_dcc7_session_set_id(struct gg_session *sess, struct gg_dcc7 *dcc, gg_dcc7_id_t id)
+{
+	unsigned int idx;
+
+	gg_dcc7_hash_unlink_id(sess, dcc);
+
+	dcc->cid = id;
+
+	if (gg_dcc7_id_empty(&dcc->cid))
+		return;
+
+	idx = gg_dcc7_hash_id(&dcc->cid) & (sess->dcc7_hash_size - 1);
+	dcc->hash_id_next = sess->dcc7_hash_id[idx];
+	sess->dcc7_hash_id[idx] = dcc;
 }
 
 /**
  * \internal Zwraca strukturę połączenia o danym identyfikatorze.
  *
+ * Jeśli identyfikator jest pusty, szukane jest połączenie z danym numerem,
+ * oczekujące na akceptację.
+ *
  * \param sess Struktura sesji
  * \param id Identyfikator połączenia
  * \param uin Numer nadawcy lub odbiorcy
@@ -130,17 +344,23 @@ static int gg_dcc7_session_remove(struct gg_session *sess, struct gg_dcc7 *dcc)
 static struct gg_dcc7 *gg_dcc7_session_find(struct gg_session *sess, gg_dcc7_id_t id, uin_t uin)
 {
 	struct gg_dcc7 *tmp;
-	int empty;
 
 	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_dcc7_session_find(%p, ..., %d)\n", sess, (int) uin);
 
-	empty = !memcmp(&id, "\0\0\0\0\0\0\0\0", 8);
+	if (sess->dcc7_hash_size == 0)
+		return NULL;
+
+	if (gg_dcc7_id_empty(&id)) {
+		tmp = sess->dcc7_hash_uin[gg_dcc7_hash_uin(uin) & (sess->dcc7_hash_size - 1)];
 
-	for (tmp = sess->dcc7_list; tmp; tmp = tmp->next) {
-		if (empty) {
-			if (tmp->peer_uin == uin && !tmp->state == GG_STATE_WAITING_FOR_ACCEPT)
+		for (; tmp != NULL; tmp = tmp->hash_uin_next) {
+			if (tmp->peer_uin == uin && tmp->state == GG_STATE_WAITING_FOR_ACCEPT)
 				return tmp;
-		} else {
+		}
+	} else {
+		tmp = sess->dcc7_hash_id[gg_dcc7_hash_id(&id) & (sess->dcc7_hash_size - 1)];
+
+		for (; tmp != NULL; tmp = tmp->hash_id_next) {
 			if (!memcmp(&tmp->cid, &id, sizeof(id)))
 				return tmp;
 		}
@@ -149,6 +369,297 @@ static struct gg_dcc7 *gg_dcc7_session_find(struct gg_session *sess, gg_dcc7_id_
 	return NULL;
 }
 
+/**
+ * \internal Globalny limit szybkości połączeń bezpośrednich w bajtach na
+ * sekundę.
+ */
+static unsigned int gg_dcc7_global_rate;
+
+/**
+ * \internal Liczba bajtów, które mogą przesłać wszystkie połączenia
+ * w ramach globalnego limitu szybkości.
+ */
+static unsigned int gg_dcc7_global_rate_tokens;
+
+/**
+ * \internal Czas ostatniego uzupełnienia globalnego limitu w milisekundach.
+ */
+static unsigned int gg_dcc7_global_rate_time;
+
+/**
+ * \internal Suma wag wszystkich aktywnych połączeń bezpośrednich.
+ */
+static unsigned int gg_dcc7_global_rate_weight;
+
+/**
+ * \internal Zwraca bieżący czas w milisekundach.
+ *
+ * Wartość się przekręca, więc ma sens jedynie różnica dwóch wyników.
+ *
+ * \return Czas w milisekundach
+ */
+static unsigned int gg_dcc7_rate_clock(void)
+{
+#ifdef _WIN32
+	return GetTickCount();
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (unsigned int) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+/**
+ * \internal Zwraca wagę połączenia przy podziale limitów szybkości.
+ *
+ * \param dcc Struktura połączenia
+ *
+ * \return Waga połączenia
+ */
+static unsigned int gg_dcc7_rate_weight(const struct gg_dcc7 *dcc)
+{
+	return (dcc->rate_weight != 0) ? dcc->rate_weight : 1;
+}
+
+/**
+ * \internal Uwzględnia połączenie w sumach wag sesji i globalnej.
+ *
+ * Wywoływane po rozpoczęciu przesyłania pliku.
+ *
+ * \param dcc Struktura połączenia
+ */
+static void gg_dcc7_rate_start(struct gg_dcc7 *dcc)
+{
+	if (dcc->rate_active)
+		return;
+
+	gg_dcc7_global_rate_weight += gg_dcc7_rate_weight(dcc);
+
+	if (dcc->sess != NULL)
+		dcc->sess->dcc7_rate_weight += gg_dcc7_rate_weight(dcc);
+
+	/* pełne wiadro, które zostanie przycięte do udziału połączenia */
+	dcc->rate_tokens = (unsigned int) -1;
+	dcc->rate_time = gg_dcc7_rate_clock();
+	dcc->rate_active = 1;
+}
+
+/**
+ * \internal Usuwa połączenie z sum wag sesji i globalnej.
+ *
+ * Wywoływane po zakończeniu przesyłania pliku lub zwolnieniu połączenia.
+ *
+ * \param dcc Struktura połączenia
+ */
+static void gg_dcc7_rate_stop(struct gg_dcc7 *dcc)
+{
+	if (!dcc->rate_active)
+		return;
+
+	gg_dcc7_global_rate_weight -= gg_dcc7_rate_weight(dcc);
+
+	if (dcc->sess != NULL)
+		dcc->sess->dcc7_rate_weight -= gg_dcc7_rate_weight(dcc);
+
+	dcc->rate_active = 0;
+}
+
+/**
+ * \internal Uzupełnia wiadro żetonów.
+ *
+ * Wiadro przyrasta o \c rate żetonów na sekundę i mieści najwyżej
+ * \c rate żetonów, czyli limit na jedną sekundę.
+ *
+ * \param tokens Wskaźnik na liczbę żetonów
+ * \param time Wskaźnik na czas ostatniego uzupełnienia
+ * \param rate Limit szybkości
+ * \param now Bieżący czas w milisekundach
+ */
+static void gg_dcc7_rate_refill(unsigned int *tokens, unsigned int *time, unsigned int rate, unsigned int now)
+{
+	unsigned int elapsed = now - *time;
+	unsigned int add, frac;
+
+	if (elapsed >= 1000) {
+		*tokens = rate;
+		*time = now;
+		return;
+	}
+
+	/* rate * elapsed / 1000 bez przepełnienia, bo elapsed < 1000 */
+	add = rate / 1000 * elapsed + rate % 1000 * elapsed / 1000;
+	frac = rate % 1000 * elapsed % 1000;
+
+	/* przesuwamy czas tylko o wykorzystaną część, czyli o add * 1000 / rate
+	 * milisekund, żeby częste wywołania nie gubiły ułamków żetonów */
+	if (add > 0)
+		*time += elapsed - frac / rate - ((frac % rate != 0) ? 1 : 0);
+
+	if (*tokens > rate || add >= rate - *tokens) {
+		*tokens = rate;
+		*time = now;
+	} else {
+		*tokens += add;
+	}
+}
+
+/**
+ * \internal Wyznacza udział połączenia we wspólnym limicie.
+ *
+ * \param rate Limit szybkości
+ * \param weight Waga połączenia
+ * \param total Suma wag wszystkich połączeń objętych limitem
+ *
+ * \return Udział połączenia w bajtach na sekundę
+ */
+static unsigned int gg_dcc7_rate_share(unsigned int rate, unsigned int weight, unsigned int total)
+{
+	unsigned int share;
+
+	if (total <= weight)
+		return rate;
+
+	/* zmniejszamy wagi, aż iloczyn zmieści się w unsigned int, co
+	 * zachowuje proporcję z dokładnością wystarczającą dla limitu */
+	while (weight > UINT_MAX / rate) {
+		weight >>= 1;
+		total >>= 1;
+	}
+
+	share = rate * weight / total;
+
+	return (share != 0) ? share : 1;
+}
+
+/**
+ * \internal Wyznacza, ile danych może przesłać połączenie, uwzględniając
+ * limity szybkości połączenia, sesji i globalny.
+ *
+ * Każdy limit jest wiadrem żetonów. Wiadro połączenia przyrasta w tempie
+ * jego własnego limitu lub udziału w limicie sesji i globalnym,
+ * proporcjonalnego do wagi, zależnie od tego, co mniejsze. Wiadra sesji
+ * i globalne ograniczają łączną szybkość połączeń.
+ *
+ * \param dcc Struktura połączenia
+ * \param len Maksymalny rozmiar porcji danych
+ *
+ * \return Rozmiar porcji danych lub 0, jeśli należy poczekać
+ */
+static size_t gg_dcc7_rate_allowance(struct gg_dcc7 *dcc, size_t len)
+{
+	struct gg_session *sess = dcc->sess;
+	unsigned int weight = gg_dcc7_rate_weight(dcc);
+	unsigned int rate, share, now;
+
+	if (dcc->rate == 0 && (sess == NULL || sess->dcc7_rate == 0) && gg_dcc7_global_rate == 0)
+		return len;
+
+	gg_dcc7_rate_start(dcc);
+
+	now = gg_dcc7_rate_clock();
+	rate = dcc->rate;
+
+	if (sess != NULL && sess->dcc7_rate != 0) {
+		share = gg_dcc7_rate_share(sess->dcc7_rate, weight, sess->dcc7_rate_weight);
+
+		if (rate == 0 || share < rate)
+			rate = share;
+
+		gg_dcc7_rate_refill(&sess->dcc7_rate_tokens, &sess->dcc7_rate_time, sess->dcc7_rate, now);
+
+		if (len > sess->dcc7_rate_tokens)
+			len = sess->dcc7_rate_tokens;
+	}
+
+	if (gg_dcc7_global_rate != 0) {
+		share = gg_dcc7_rate_share(gg_dcc7_global_rate, weight, gg_dcc7_global_rate_weight);
+
+		if (rate == 0 || share < rate)
+			rate = share;
+
+		gg_dcc7_rate_refill(&gg_dcc7_global_rate_tokens, &gg_dcc7_global_rate_time, gg_dcc7_global_rate, now);
+
+		if (len > gg_dcc7_global_rate_tokens)
+			len = gg_dcc7_global_rate_tokens;
+	}
+
+	gg_dcc7_rate_refill(&dcc->rate_tokens, &dcc->rate_time, rate, now);
+
+	if (len > dcc->rate_tokens)
+		len = dcc->rate_tokens;
+
+	return len;
+}
+
+/**
+ * \internal Pobiera żetony za przesłane dane.
+ *
+ * \param dcc Struktura połączenia
+ * \param len Liczba przesłanych bajtów
+ */
+static void gg_dcc7_rate_update(struct gg_dcc7 *dcc, size_t len)
+{
+	if (!dcc->rate_active)
+		return;
+
+	dcc->rate_tokens -= (len < dcc->rate_tokens) ? len : dcc->rate_tokens;
+
+	if (dcc->sess != NULL)
+		dcc->sess->dcc7_rate_tokens -= (len < dcc->sess->dcc7_rate_tokens) ? len : dcc->sess->dcc7_rate_tokens;
+
+	gg_dcc7_global_rate_tokens -= (len < gg_dcc7_global_rate_tokens) ? len : gg_dcc7_global_rate_tokens;
+}
+
+/**
+ * \internal Wstrzymuje przesyłanie danych do uzupełnienia limitu.
+ *
+ * Zamiast obserwować deskryptor, aplikacja ma wywołać \c gg_dcc7_watch_fd()
+ * po upłynięciu \c timeout.
+ *
+ * \param dcc Struktura połączenia
+ */
+static void gg_dcc7_rate_throttle(struct gg_dcc7 *dcc)
+{
+	gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() rate limit reached, waiting\n");
+
+	dcc->check = GG_CHECK_NONE;
+	dcc->timeout = 1;
+	dcc->soft_timeout = 1;
+}
+
+/**
+ * \internal Obsługuje wybudzenie połączenia wstrzymanego przez limit.
+ *
+ * Po wybudzeniu deskryptor nie musi być gotowy, więc zamiast przesyłać
+ * dane, funkcja przywraca jego obserwowanie.
+ *
+ * \param dcc Struktura połączenia
+ * \param check Obserwowany kierunek
+ * \param timeout Czas oczekiwania na deskryptor
+ *
+ * \return 1 jeśli połączenie było wstrzymane, 0 w przeciwnym wypadku
+ */
+static int gg_dcc7_rate_wake(struct gg_dcc7 *dcc, int check, int timeout)
+{
+	if (dcc->check != GG_CHECK_NONE)
+		return 0;
+
+	if (gg_dcc7_rate_allowance(dcc, 1) == 0) {
+		gg_dcc7_rate_throttle(dcc);
+		return 1;
+	}
+
+	gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() rate limit refilled, resuming\n");
+
+	dcc->check = check;
+	dcc->timeout = timeout;
+	dcc->soft_timeout = 0;
+
+	return 1;
+}
+
 /**
  * \internal Rozpoczyna proces pobierania adresu
  *
@@ -634,7 +1145,7 @@ int gg_dcc7_handle_id(struct gg_session *sess, struct gg_event *e, const void *p
 		if (tmp->state != GG_STATE_REQUESTING_ID || tmp->dcc_type != (int) gg_fix32(p->type))
 			continue;
 		
-		tmp->cid = p->id;
+		gg_dcc7_session_set_id(sess, tmp, p->id);
 
 		switch (tmp->dcc_type) {
 			case GG_DCC7_TYPE_FILE:
@@ -931,6 +1442,9 @@ int gg_dcc7_handle_new(struct gg_session *sess, struct gg_event *e, const void *
 			dcc->filename[GG_DCC7_FILENAME_LEN] = 0;
 			memcpy(dcc->hash, p->hash, GG_DCC7_HASH_LEN);
 
+			if (gg_dcc7_journal_find(dcc, &dcc->offset) == 0)
+				gg_debug_session(sess, GG_DEBUG_MISC, "// gg_dcc7_handle_new() found in journal, proposing offset %u\n", dcc->offset);
+
 			e->type = GG_EVENT_DCC7_NEW;
 			e->event.dcc7_new = dcc;
 
@@ -995,11 +1509,13 @@ static int gg_dcc7_postauth_fixup(struct gg_dcc7 *dcc)
 		case GG_SESSION_DCC7_GET:
 			dcc->state = GG_STATE_GETTING_FILE;
 			dcc->check = GG_CHECK_READ;
+			gg_dcc7_rate_start(dcc);
 			return 0;
 
 		case GG_SESSION_DCC7_SEND:
 			dcc->state = GG_STATE_SENDING_FILE;
 			dcc->check = GG_CHECK_WRITE;
+			gg_dcc7_rate_start(dcc);
 			return 0;
 
 		case GG_SESSION_DCC7_VOICE:
@@ -1255,11 +1771,23 @@ struct gg_event *gg_dcc7_watch_fd(struct gg_dcc7 *dcc)
 
 			if (dcc->offset >= dcc->size) {
 				gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() offset >= size, finished\n");
+				gg_dcc7_rate_stop(dcc);
 				e->type = GG_EVENT_DCC7_DONE;
 				e->event.dcc7_done.dcc7 = dcc;
 				return e;
 			}
 
+			if (gg_dcc7_rate_wake(dcc, GG_CHECK_WRITE, GG_DCC7_TIMEOUT_SEND))
+				return e;
+
+			if ((chunk = dcc->size - dcc->offset) > sizeof(buf))
+				chunk = sizeof(buf);
+
+			if ((chunk = gg_dcc7_rate_allowance(dcc, chunk)) == 0) {
+				gg_dcc7_rate_throttle(dcc);
+				return e;
+			}
+
 			if (dcc->seek && lseek(dcc->file_fd, dcc->offset, SEEK_SET) == (off_t) -1) {
 				gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() lseek() failed (%s)\n", strerror(errno));
 				e->type = GG_EVENT_DCC7_ERROR;
@@ -1267,9 +1795,6 @@ struct gg_event *gg_dcc7_watch_fd(struct gg_dcc7 *dcc)
 				return e;
 			}
 
-			if ((chunk = dcc->size - dcc->offset) > sizeof(buf))
-				chunk = sizeof(buf);
-
 			if ((res = read(dcc->file_fd, buf, chunk)) < 1) {
 				gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() read() failed (res=%d, %s)\n", res, strerror(errno));
 				e->type = GG_EVENT_DCC7_ERROR;
@@ -1285,9 +1810,11 @@ struct gg_event *gg_dcc7_watch_fd(struct gg_dcc7 *dcc)
 			}
 
 			dcc->offset += res;
+			gg_dcc7_rate_update(dcc, res);
 
 			if (dcc->offset >= dcc->size) {
 				gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() finished\n");
+				gg_dcc7_rate_stop(dcc);
 				e->type = GG_EVENT_DCC7_DONE;
 				e->event.dcc7_done.dcc7 = dcc;
 				return e;
@@ -1296,6 +1823,7 @@ struct gg_event *gg_dcc7_watch_fd(struct gg_dcc7 *dcc)
 			dcc->state = GG_STATE_SENDING_FILE;
 			dcc->check = GG_CHECK_WRITE;
 			dcc->timeout = GG_DCC7_TIMEOUT_SEND;
+			dcc->soft_timeout = 0;
 
 			return e;
 		}
@@ -1303,45 +1831,70 @@ struct gg_event *gg_dcc7_watch_fd(struct gg_dcc7 *dcc)
 		case GG_STATE_GETTING_FILE:
 		{
 			char buf[1024];
+			size_t chunk;
 			int res, wres;
 
 			gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() GG_STATE_GETTING_FILE (offset=%d, size=%d)\n", dcc->offset, dcc->size);
 
 			if (dcc->offset >= dcc->size) {
 				gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() finished\n");
+				gg_dcc7_rate_stop(dcc);
 				e->type = GG_EVENT_DCC7_DONE;
 				e->event.dcc7_done.dcc7 = dcc;
 				return e;
 			}
 
-			if ((res = recv(dcc->fd, buf, sizeof(buf), 0)) < 1) {
+			if (gg_dcc7_rate_wake(dcc, GG_CHECK_READ, GG_DCC7_TIMEOUT_GET))
+				return e;
+
+			if ((chunk = gg_dcc7_rate_allowance(dcc, sizeof(buf))) == 0) {
+				gg_dcc7_rate_throttle(dcc);
+				return e;
+			}
+
+			if ((res = recv(dcc->fd, buf, chunk, 0)) < 1) {
 				gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() recv() failed (fd=%d, res=%d, %s)\n", dcc->fd, res, strerror(errno));
 				e->type = GG_EVENT_DCC7_ERROR;
 				e->event.dcc_error = (res == -1) ? GG_ERROR_DCC7_NET : GG_ERROR_DCC7_EOF;
 				return e;
 			}
 
-			/* XXX zapisywać do skutku? */
+			if (dcc->sink != NULL) {
+				if (dcc->sink(dcc, buf, res, dcc->sink_data) == -1) {
+					gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() sink failed\n");
+					e->type = GG_EVENT_DCC7_ERROR;
+					e->event.dcc_error = GG_ERROR_DCC7_FILE;
+					return e;
+				}
+			} else {
+				/* XXX zapisywać do skutku? */
 
-			if ((wres = write(dcc->file_fd, buf, res)) < res) {
-				gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() write() failed (fd=%d, res=%d, %s)\n", dcc->file_fd, wres, strerror(errno));
-				e->type = GG_EVENT_DCC7_ERROR;
-				e->event.dcc_error = GG_ERROR_DCC7_FILE;
-				return e;
+				if ((wres = write(dcc->file_fd, buf, res)) < res) {
+					gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() write() failed (fd=%d, res=%d, %s)\n", dcc->file_fd, wres, strerror(errno));
+					e->type = GG_EVENT_DCC7_ERROR;
+					e->event.dcc_error = GG_ERROR_DCC7_FILE;
+					return e;
+				}
 			}
 
 			dcc->offset += res;
+			gg_dcc7_rate_update(dcc, res);
 
 			if (dcc->offset >= dcc->size) {
 				gg_debug_dcc(dcc, GG_DEBUG_MISC, "// gg_dcc7_watch_fd() finished\n");
+				gg_dcc7_rate_stop(dcc);
+				gg_dcc7_journal_finish(dcc, 1);
 				e->type = GG_EVENT_DCC7_DONE;
 				e->event.dcc7_done.dcc7 = dcc;
 				return e;
 			}
 
+			gg_dcc7_journal_progress(dcc);
+
 			dcc->state = GG_STATE_GETTING_FILE;
 			dcc->check = GG_CHECK_READ;
 			dcc->timeout = GG_DCC7_TIMEOUT_GET;
+			dcc->soft_timeout = 0;
 
 			return e;
 		}
@@ -1533,12 +2086,16 @@ void gg_dcc7_free(struct gg_dcc7 *dcc)
 	if (!dcc)
 		return;
 
+	gg_dcc7_journal_finish(dcc, dcc->offset >= dcc->size);
+
 	if (dcc->fd != -1)
 		close(dcc->fd);
 
 	if (dcc->file_fd != -1)
 		gg_file_close(dcc->file_fd);
 
+	gg_dcc7_rate_stop(dcc);
+
 	if (dcc->sess)
 		gg_dcc7_session_remove(dcc->sess, dcc);
 
@@ -1547,3 +2104,148 @@ void gg_dcc7_free(struct gg_dcc7 *dcc)
 	free(dcc);
 }
 
+/**
+ * Ustawia limit szybkości przesyłania pliku.
+ *
+ * \param dcc Struktura połączenia
+ * \param rate Limit w bajtach na sekundę lub 0, jeśli bez ograniczeń
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup dcc7
+ */
+int gg_dcc7_set_rate(struct gg_dcc7 *dcc, unsigned int rate)
+{
+	gg_debug_dcc(dcc, GG_DEBUG_FUNCTION, "** gg_dcc7_set_rate(%p, %u)\n", dcc, rate);
+
+	if (dcc == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	dcc->rate = rate;
+
+	return 0;
+}
+
+/**
+ * Ustawia wagę połączenia przy podziale limitów szybkości sesji
+ * i globalnego.
+ *
+ * Połączenie otrzymuje część limitu proporcjonalną do swojej wagi
+ * względem sumy wag wszystkich trwających połączeń objętych limitem.
+ *
+ * \param dcc Struktura połączenia
+ * \param weight Waga połączenia (domyślnie 1)
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup dcc7
+ */
+int gg_dcc7_set_weight(struct gg_dcc7 *dcc, unsigned int weight)
+{
+	int active;
+
+	gg_debug_dcc(dcc, GG_DEBUG_FUNCTION, "** gg_dcc7_set_weight(%p, %u)\n", dcc, weight);
+
+	if (dcc == NULL || weight == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	active = dcc->rate_active;
+
+	gg_dcc7_rate_stop(dcc);
+
+	dcc->rate_weight = weight;
+
+	if (active)
+		gg_dcc7_rate_start(dcc);
+
+	return 0;
+}
+
+/**
+ * Ustawia funkcję odbierającą dane pliku.
+ *
+ * Zamiast zapisywać odebrane dane do deskryptora \c file_fd, biblioteka
+ * przekazuje każdą odebraną porcję danych do podanej funkcji, bez
+ * dodatkowego kopiowania. Pozwala to np. przesłać plik dalej, skompresować
+ * go lub wyznaczyć jego skrót w trakcie odbierania. Funkcja powinna zwrócić
+ * 0 lub -1 w przypadku błędu, co przerwie połączenie z błędem
+ * \c GG_ERROR_DCC7_FILE.
+ *
+ * \param dcc Struktura połączenia
+ * \param sink Funkcja odbierająca dane lub \c NULL, by zapisywać do \c file_fd
+ * \param data Dane prywatne przekazywane do funkcji
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup dcc7
+ */
+int gg_dcc7_set_sink(struct gg_dcc7 *dcc, int (*sink)(struct gg_dcc7 *dcc, const char *buf, size_t len, void *data), void *data)
+{
+	gg_debug_dcc(dcc, GG_DEBUG_FUNCTION, "** gg_dcc7_set_sink(%p, %p, %p)\n", dcc, sink, data);
+
+	if (dcc == NULL || dcc->type != GG_SESSION_DCC7_GET) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	dcc->sink = sink;
+	dcc->sink_data = data;
+
+	return 0;
+}
+
+/**
+ * Ustawia limit szybkości wszystkich połączeń bezpośrednich sesji.
+ *
+ * Limit jest dzielony między trwające połączenia proporcjonalnie do ich wag.
+ *
+ * \param gs Struktura sesji
+ * \param rate Limit w bajtach na sekundę lub 0, jeśli bez ograniczeń
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup dcc7
+ */
+int gg_session_set_dcc7_rate(struct gg_session *gs, unsigned int rate)
+{
+	gg_debug_session(gs, GG_DEBUG_FUNCTION, "** gg_session_set_dcc7_rate(%p, %u)\n", gs, rate);
+
+	if (gs == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	gs->dcc7_rate = rate;
+	gs->dcc7_rate_tokens = rate;
+	gs->dcc7_rate_time = gg_dcc7_rate_clock();
+
+	return 0;
+}
+
+/**
+ * Ustawia globalny limit szybkości połączeń bezpośrednich.
+ *
+ * Limit obejmuje wszystkie połączenia wszystkich sesji i jest dzielony
+ * między nie proporcjonalnie do ich wag.
+ *
+ * \param rate Limit w bajtach na sekundę lub 0, jeśli bez ograniczeń
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup dcc7
+ */
+int gg_global_set_dcc7_rate(unsigned int rate)
+{
+	gg_debug(GG_DEBUG_FUNCTION, "** gg_global_set_dcc7_rate(%u)\n", rate);
+
+	gg_dcc7_global_rate = rate;
+	gg_dcc7_global_rate_tokens = rate;
+	gg_dcc7_global_rate_time = gg_dcc7_rate_clock();
+
+	return 0;
+}
+
@@ -24,6 +24,7 @@
  * \brief Funkcje kompresji Deflate
  */
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -34,54 +35,140 @@
 #include <zlib.h>
 #endif
 
+/** \internal Początkowy rozmiar bufora danych kompresowanych porcjami */
+#define GG_DEFLATE_CHUNK 16384
+
+#ifdef GG_CONFIG_HAVE_ZLIB
+
 /**
- * \internal Kompresuje dane wejściowe algorytmem Deflate z najwyższym
- * stopniem kompresji, tak samo jak oryginalny klient.
- * 
- * Wynik funkcji należy zwolnić za pomocą \c free.
+ * \internal Zwraca kontekst kompresji sesji, przygotowany do kolejnego użycia.
  *
- * \param in Ciąg znaków do skompresowania, zakończony \c \\0
- * \param out_lenp Wskaźnik na zmienną, do której zostanie zapisana
- *                 długość bufora wynikowego
+ * Kontekst jest tworzony przy pierwszym użyciu, a później jedynie
+ * zerowany, co pozwala uniknąć przydzielania pamięci na słownik i tablice
+ * przy każdej synchronizacji listy kontaktów.
  *
- * \return Skompresowany ciąg znaków lub \c NULL w przypadku niepowodzenia.
+ * \param gs Struktura sesji
+ *
+ * \return Kontekst kompresji lub \c NULL w przypadku błędu
  */
-unsigned char *gg_deflate(const char *in, size_t *out_lenp)
+static z_stream *gg_deflate_stream(struct gg_session *gs)
 {
-#ifdef GG_CONFIG_HAVE_ZLIB
+	z_stream *strm = gs->deflate_stream;
+	int level, ret;
+
+	level = (gs->deflate_level >= 0) ? gs->deflate_level : Z_BEST_COMPRESSION;
+
+	if (strm != NULL) {
+		ret = deflateReset(strm);
+
+		if (ret == Z_OK)
+			ret = deflateParams(strm, level, Z_DEFAULT_STRATEGY);
+
+		if (ret != Z_OK) {
+			gg_debug_session(gs, GG_DEBUG_MISC, "// gg_deflate_stream() deflateReset() failed (%d)\n", ret);
+			return NULL;
+		}
+
+		return strm;
+	}
+
+	strm = malloc(sizeof(z_stream));
+
+	if (strm == NULL)
+		return NULL;
+
+	memset(strm, 0, sizeof(z_stream));
+
+	ret = deflateInit(strm, level);
+
+	if (ret != Z_OK) {
+		gg_debug_session(gs, GG_DEBUG_MISC, "// gg_deflate_stream() deflateInit() failed (%d)\n", ret);
+		free(strm);
+		return NULL;
+	}
+
+	gs->deflate_stream = strm;
+
+	return strm;
+}
+
+/**
+ * \internal Zwraca kontekst dekompresji sesji, przygotowany do kolejnego
+ * użycia.
+ *
+ * \param gs Struktura sesji
+ *
+ * \return Kontekst dekompresji lub \c NULL w przypadku błędu
+ */
+static z_stream *gg_inflate_stream(struct gg_session *gs)
+{
+	z_stream *strm = gs->inflate_stream;
 	int ret;
-	z_stream strm;
-	unsigned char *out, *out2;
-	size_t out_len;
 
-	if (in == NULL || out_lenp == NULL)
+	if (strm != NULL) {
+		ret = inflateReset(strm);
+
+		if (ret != Z_OK) {
+			gg_debug_session(gs, GG_DEBUG_MISC, "// gg_inflate_stream() inflateReset() failed (%d)\n", ret);
+			return NULL;
+		}
+
+		return strm;
+	}
+
+	strm = malloc(sizeof(z_stream));
+
+	if (strm == NULL)
 		return NULL;
 
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	strm.avail_in = strlen(in);
-	strm.next_in = (unsigned char*) in;
+	memset(strm, 0, sizeof(z_stream));
+
+	ret = inflateInit(strm);
 
-	ret = deflateInit(&strm, Z_BEST_COMPRESSION);
 	if (ret != Z_OK) {
-		gg_debug(GG_DEBUG_MISC, "// gg_deflate() deflateInit() failed (%d)\n", ret);
+		gg_debug_session(gs, GG_DEBUG_MISC, "// gg_inflate_stream() inflateInit() failed (%d)\n", ret);
+		free(strm);
 		return NULL;
 	}
 
-	out_len = deflateBound(&strm, strm.avail_in);
-	out = malloc(out_len);
+	gs->inflate_stream = strm;
+
+	return strm;
+}
+
+/**
+ * \internal Kompresuje dane za pomocą podanego kontekstu.
+ *
+ * \param strm Zainicjowany kontekst kompresji
+ * \param in Ciąg znaków do skompresowania, zakończony \c \\0
+ * \param offset Liczba bajtów do zarezerwowania przed skompresowanymi danymi
+ * \param out_lenp Wskaźnik na zmienną, do której zostanie zapisana
+ *                 długość skompresowanych danych
+ *
+ * \return Bufor wynikowy lub \c NULL w przypadku niepowodzenia.
+ */
+static unsigned char *gg_deflate_run(z_stream *strm, const char *in, size_t offset, size_t *out_lenp)
+{
+	unsigned char *out, *out2;
+	size_t out_len;
+	int ret;
+
+	strm->avail_in = strlen(in);
+	strm->next_in = (unsigned char*) in;
+
+	out_len = deflateBound(strm, strm->avail_in);
+	out = malloc(offset + out_len);
 
 	if (out == NULL) {
 		gg_debug(GG_DEBUG_MISC, "// gg_deflate() not enough memory for output data (%d)\n", out_len);
-		goto fail;
+		return NULL;
 	}
 
-	strm.avail_out = out_len;
-	strm.next_out = out;
+	strm->avail_out = out_len;
+	strm->next_out = out + offset;
 
 	for (;;) {
-		ret = deflate(&strm, Z_FINISH);
+		ret = deflate(strm, Z_FINISH);
 		
 		if (ret == Z_STREAM_END)
 			break;
@@ -90,7 +177,7 @@ unsigned char *gg_deflate(const char *in, size_t *out_lenp)
 		 * ale dokumentacja zlib nie wyklucza takiej możliwości */
 		if (ret == Z_OK) {
 			out_len *= 2;
-			out2 = realloc(out, out_len);
+			out2 = realloc(out, offset + out_len);
 			
 			if (out2 == NULL) {
 				gg_debug(GG_DEBUG_MISC, "// gg_deflate() not enough memory for output data (%d)\n", out_len);
@@ -99,33 +186,296 @@ unsigned char *gg_deflate(const char *in, size_t *out_lenp)
 			
 			out = out2;
 			
-			strm.avail_out = out_len / 2;
-			strm.next_out = out + out_len / 2;
+			strm->avail_out = out_len / 2;
+			strm->next_out = out + offset + out_len / 2;
 		} else {
-			gg_debug(GG_DEBUG_MISC, "// gg_deflate() deflate() failed (ret=%d, msg=%s)\n", ret, strm.msg != NULL ? strm.msg : "no error message provided");
+			gg_debug(GG_DEBUG_MISC, "// gg_deflate() deflate() failed (ret=%d, msg=%s)\n", ret, strm->msg != NULL ? strm->msg : "no error message provided");
 			goto fail;
 		}
 	}
 
-	out_len = strm.total_out;
-	out2 = realloc(out, out_len);
+	*out_lenp = strm->total_out;
 
-	if (out2 == NULL) {
-		gg_debug(GG_DEBUG_MISC, "// gg_deflate() not enough memory for output data (%d)\n", out_len);
-		goto fail;
+	return out;
+
+fail:
+	free(out);
+	return NULL;
+}
+
+/**
+ * \internal Dekompresuje dane za pomocą podanego kontekstu.
+ *
+ * \param strm Zainicjowany kontekst dekompresji
+ * \param in Bufor danych skompresowanych algorytmem Deflate
+ * \param length Długość bufora wejściowego
+ * \param size_hint Przewidywana długość wyniku lub 0, jeśli nieznana
+ *
+ * \return Zdekompresowany ciąg znaków, zakończony \c \\0,
+ *         lub \c NULL w przypadku niepowodzenia.
+ */
+static char *gg_inflate_run(z_stream *strm, const unsigned char *in, size_t length, size_t size_hint)
+{
+	char *out = NULL, *out2;
+	size_t out_len, out_used = 0;
+	int ret;
+
+	strm->avail_in = length;
+	strm->next_in = (unsigned char*) in;
+
+	/* rezerwujemy ostatni znak na NULL-a, więc przy trafnej podpowiedzi
+	 * wystarczy jeden przebieg */
+	out_len = (size_hint != 0) ? size_hint + 1 : 2048;
+
+	do {
+		if (out_used == out_len || out == NULL) {
+			if (out != NULL)
+				out_len *= 2;
+
+			out2 = realloc(out, out_len);
+			
+			if (out2 == NULL) {
+				gg_debug(GG_DEBUG_MISC, "// gg_inflate() not enough memory for output data (%d)\n", out_len);
+				goto fail;
+			}
+			
+			out = out2;
+		}
+
+		strm->avail_out = out_len - out_used;
+		strm->next_out = (unsigned char*) out + out_used;
+		
+		ret = inflate(strm, Z_NO_FLUSH);
+		
+		if (ret != Z_OK && ret != Z_STREAM_END) {
+			gg_debug(GG_DEBUG_MISC, "// gg_inflate() inflate() failed (ret=%d, msg=%s)\n", ret, strm->msg != NULL ? strm->msg : "no error message provided");
+			goto fail;
+		}
+
+		out_used = out_len - strm->avail_out;
+	} while (ret != Z_STREAM_END);
+
+	if (out_used == out_len) {
+		out2 = realloc(out, out_len + 1);
+
+		if (out2 == NULL) {
+			gg_debug(GG_DEBUG_MISC, "// gg_inflate() not enough memory for output data (%d)\n", out_len + 1);
+			goto fail;
+		}
+
+		out = out2;
+	} else if (out_used + 1 < out_len) {
+		out2 = realloc(out, out_used + 1);
+
+		if (out2 != NULL)
+			out = out2;
 	}
 
-	*out_lenp = out_len;
-	deflateEnd(&strm);
+	out[out_used] = '\0';
 
-	return out2;
+	return out;
 
 fail:
+	free(out);
+	return NULL;
+}
+
+#endif /* GG_CONFIG_HAVE_ZLIB */
+
+/**
+ * \internal Kompresuje dane wejściowe algorytmem Deflate z najwyższym
+ * stopniem kompresji, tak samo jak oryginalny klient.
+ * 
+ * Wynik funkcji należy zwolnić za pomocą \c free.
+ *
+ * \param in Ciąg znaków do skompresowania, zakończony \c \\0
+ * \param out_lenp Wskaźnik na zmienną, do której zostanie zapisana
+ *                 długość bufora wynikowego
+ *
+ * \return Skompresowany ciąg znaków lub \c NULL w przypadku niepowodzenia.
+ */
+unsigned char *gg_deflate(const char *in, size_t *out_lenp)
+{
+#ifdef GG_CONFIG_HAVE_ZLIB
+	int ret;
+	z_stream strm;
+	unsigned char *out, *out2;
+
+	if (in == NULL || out_lenp == NULL)
+		return NULL;
+
 	*out_lenp = 0;
+
+	memset(&strm, 0, sizeof(strm));
+
+	ret = deflateInit(&strm, Z_BEST_COMPRESSION);
+	if (ret != Z_OK) {
+		gg_debug(GG_DEBUG_MISC, "// gg_deflate() deflateInit() failed (%d)\n", ret);
+		return NULL;
+	}
+
+	out = gg_deflate_run(&strm, in, 0, out_lenp);
+
 	deflateEnd(&strm);
-	free(out);
+
+	if (out == NULL)
+		return NULL;
+
+	out2 = realloc(out, *out_lenp);
+
+	if (out2 == NULL && *out_lenp != 0) {
+		gg_debug(GG_DEBUG_MISC, "// gg_deflate() not enough memory for output data (%d)\n", *out_lenp);
+		free(out);
+		*out_lenp = 0;
+		return NULL;
+	}
+
+	return out2;
+#else
+	return NULL;
 #endif
+}
+
+/**
+ * \internal Kompresuje dane wejściowe algorytmem Deflate w kontekście sesji.
+ *
+ * Używa kontekstu kompresji sesji, tworzonego raz i zerowanego przed
+ * każdym użyciem, ze stopniem kompresji ustawionym przez
+ * \c gg_session_set_compression_level(). Wynik nie jest zmniejszany do
+ * rzeczywistej długości, bo zwykle od razu trafia do pakietu, dla którego
+ * nagłówka można zarezerwować miejsce na początku bufora.
+ *
+ * Wynik funkcji należy zwolnić za pomocą \c free.
+ *
+ * \param gs Struktura sesji
+ * \param in Ciąg znaków do skompresowania, zakończony \c \\0
+ * \param offset Liczba bajtów do zarezerwowania przed skompresowanymi danymi
+ * \param out_lenp Wskaźnik na zmienną, do której zostanie zapisana
+ *                 długość skompresowanych danych (bez \p offset)
+ *
+ * \return Bufor wynikowy lub \c NULL w przypadku niepowodzenia.
+ */
+unsigned char *gg_deflate_session(struct gg_session *gs, const char *in, size_t offset, size_t *out_lenp)
+{
+#ifdef GG_CONFIG_HAVE_ZLIB
+	z_stream *strm;
+
+	if (gs == NULL || in == NULL || out_lenp == NULL)
+		return NULL;
+
+	*out_lenp = 0;
+
+	strm = gg_deflate_stream(gs);
+
+	if (strm == NULL)
+		return NULL;
+
+	return gg_deflate_run(strm, in, offset, out_lenp);
+#else
+	return NULL;
+#endif
+}
+
+/**
+ * \internal Kompresuje w kontekście sesji dane pobierane porcjami z funkcji
+ * zwrotnej.
+ *
+ * Funkcja \p source jest wywoływana wielokrotnie i za każdym razem powinna
+ * zwrócić 0, ustawiając \p buf i \p len na kolejny fragment danych. Pusty
+ * fragment oznacza koniec danych, a wartość -1 przerywa kompresję. Fragment
+ * musi być dostępny jedynie do następnego wywołania funkcji, więc w pamięci
+ * znajdują się wyłącznie dane skompresowane.
+ *
+ * Wynik funkcji należy zwolnić za pomocą \c free.
+ *
+ * \param gs Struktura sesji
+ * \param source Funkcja zwracająca kolejne fragmenty danych
+ * \param data Dane prywatne przekazywane do funkcji
+ * \param offset Liczba bajtów do zarezerwowania przed skompresowanymi danymi
+ * \param out_lenp Wskaźnik na zmienną, do której zostanie zapisana
+ *                 długość skompresowanych danych (bez \p offset)
+ *
+ * \return Bufor wynikowy lub \c NULL w przypadku niepowodzenia.
+ */
+unsigned char *gg_deflate_source(struct gg_session *gs, int (*source)(struct gg_session *gs, const char **buf, size_t *len, void *data), void *data, size_t offset, size_t *out_lenp)
+{
+#ifdef GG_CONFIG_HAVE_ZLIB
+	z_stream *strm;
+	unsigned char *out, *out2;
+	size_t out_len;
+	int flush, ret;
+
+	if (gs == NULL || source == NULL || out_lenp == NULL)
+		return NULL;
+
+	*out_lenp = 0;
+
+	strm = gg_deflate_stream(gs);
+
+	if (strm == NULL)
+		return NULL;
+
+	out_len = GG_DEFLATE_CHUNK;
+	out = malloc(offset + out_len);
+
+	if (out == NULL) {
+		gg_debug_session(gs, GG_DEBUG_MISC, "// gg_deflate_source() not enough memory for output data (%d)\n", out_len);
+		return NULL;
+	}
+
+	strm->avail_out = out_len;
+	strm->next_out = out + offset;
+
+	do {
+		const char *buf = NULL;
+		size_t len = 0;
+
+		if (source(gs, &buf, &len, data) == -1) {
+			gg_debug_session(gs, GG_DEBUG_MISC, "// gg_deflate_source() source failed\n");
+			goto fail;
+		}
+
+		flush = (len == 0) ? Z_FINISH : Z_NO_FLUSH;
+
+		strm->avail_in = len;
+		strm->next_in = (unsigned char*) buf;
+
+		do {
+			if (strm->avail_out == 0) {
+				out2 = realloc(out, offset + out_len * 2);
+
+				if (out2 == NULL) {
+					gg_debug_session(gs, GG_DEBUG_MISC, "// gg_deflate_source() not enough memory for output data (%d)\n", out_len * 2);
+					goto fail;
+				}
+
+				out = out2;
+
+				strm->avail_out = out_len;
+				strm->next_out = out + offset + out_len;
+
+				out_len *= 2;
+			}
+
+			ret = deflate(strm, flush);
+
+			if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+				gg_debug_session(gs, GG_DEBUG_MISC, "// gg_deflate_source() deflate() failed (ret=%d, msg=%s)\n", ret, strm->msg != NULL ? strm->msg : "no error message provided");
+				goto fail;
+			}
+		} while (strm->avail_in != 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+	} while (flush != Z_FINISH);
+
+	*out_lenp = strm->total_out;
+
+	return out;
+
+fail:
+	free(out);
 	return NULL;
+#else
+	return NULL;
+#endif
 }
 
 /**
@@ -146,18 +496,12 @@ char *gg_inflate(const unsigned char *in, size_t length)
 #ifdef GG_CONFIG_HAVE_ZLIB
 	int ret;
 	z_stream strm;
-	char *out = NULL, *out2;
-	size_t out_len = 1024;
-	int first = 1;
+	char *out;
 
 	if (in == NULL)
 		return NULL;
 
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	strm.avail_in = length;
-	strm.next_in = (unsigned char*) in;
+	memset(&strm, 0, sizeof(strm));
 
 	ret = inflateInit(&strm);
 	if (ret != Z_OK) {
@@ -165,55 +509,159 @@ char *gg_inflate(const unsigned char *in, size_t length)
 		return NULL;
 	}
 
+	out = gg_inflate_run(&strm, in, length, 0);
+
+	inflateEnd(&strm);
+
+	return out;
+#else
+	return NULL;
+#endif
+}
+
+/**
+ * \internal Dekompresuje dane wejściowe w formacie Deflate w kontekście sesji.
+ *
+ * Używa kontekstu dekompresji sesji, a bufor wynikowy od razu ma rozmiar
+ * wskazany przez podpowiedź, więc przy trafnej podpowiedzi (np. długości
+ * poprzednio odebranej listy kontaktów) nie jest powiększany.
+ *
+ * Wynik funkcji należy zwolnić za pomocą \c free.
+ *
+ * \param gs Struktura sesji
+ * \param in Bufor danych skompresowanych algorytmem Deflate
+ * \param length Długość bufora wejściowego
+ * \param size_hint Przewidywana długość wyniku lub 0, jeśli nieznana
+ *
+ * \note Dokleja \c \\0 na końcu bufora wynikowego.
+ *
+ * \return Zdekompresowany ciąg znaków, zakończony \c \\0,
+ *         lub \c NULL w przypadku niepowodzenia.
+ */
+char *gg_inflate_session(struct gg_session *gs, const unsigned char *in, size_t length, size_t size_hint)
+{
+#ifdef GG_CONFIG_HAVE_ZLIB
+	z_stream *strm;
+
+	if (gs == NULL || in == NULL)
+		return NULL;
+
+	strm = gg_inflate_stream(gs);
+
+	if (strm == NULL)
+		return NULL;
+
+	return gg_inflate_run(strm, in, length, size_hint);
+#else
+	return NULL;
+#endif
+}
+
+/**
+ * \internal Dekompresuje dane wejściowe w formacie Deflate porcjami.
+ *
+ * Zamiast gromadzić cały wynik w pamięci, przekazuje każdą zdekompresowaną
+ * porcję danych do podanej funkcji, więc zużycie pamięci nie zależy od
+ * rozmiaru wyniku.
+ *
+ * \param gs Struktura sesji
+ * \param in Bufor danych skompresowanych algorytmem Deflate
+ * \param length Długość bufora wejściowego
+ * \param sink Funkcja odbierająca dane, zwracająca 0 lub -1, by przerwać
+ * \param data Dane prywatne przekazywane do funkcji
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+int gg_inflate_sink(struct gg_session *gs, const unsigned char *in, size_t length, int (*sink)(const char *buf, size_t len, void *data), void *data)
+{
+#ifdef GG_CONFIG_HAVE_ZLIB
+	int ret;
+	z_stream *strm;
+	unsigned char out[4096];
+
+	if (gs == NULL || in == NULL || sink == NULL)
+		return -1;
+
+	strm = gg_inflate_stream(gs);
+
+	if (strm == NULL)
+		return -1;
+
+	strm->avail_in = length;
+	strm->next_in = (unsigned char*) in;
+
 	do {
-		out_len *= 2;
-		out2 = realloc(out, out_len);
-		
-		if (out2 == NULL) {
-			gg_debug(GG_DEBUG_MISC, "// gg_inflate() not enough memory for output data (%d)\n", out_len);
-			goto fail;
-		}
-		
-		out = out2;
-		
-		if (first) {
-			strm.avail_out = out_len;
-			strm.next_out = (unsigned char*) out;
-		} else {
-			strm.avail_out = out_len / 2;
-			strm.next_out = (unsigned char*) out + out_len / 2;
-		}
-		
-		ret = inflate(&strm, Z_NO_FLUSH);
-		
+		strm->avail_out = sizeof(out);
+		strm->next_out = out;
+
+		ret = inflate(strm, Z_NO_FLUSH);
+
 		if (ret != Z_OK && ret != Z_STREAM_END) {
-			gg_debug(GG_DEBUG_MISC, "// gg_inflate() inflate() failed (ret=%d, msg=%s)\n", ret, strm.msg != NULL ? strm.msg : "no error message provided");
-			goto fail;
+			gg_debug(GG_DEBUG_MISC, "// gg_inflate_sink() inflate() failed (ret=%d, msg=%s)\n", ret, strm->msg != NULL ? strm->msg : "no error message provided");
+			return -1;
+		}
+
+		if (strm->avail_out < sizeof(out) && sink((const char*) out, sizeof(out) - strm->avail_out, data) == -1) {
+			gg_debug(GG_DEBUG_MISC, "// gg_inflate_sink() sink failed\n");
+			return -1;
 		}
-		
-		first = 0;
 	} while (ret != Z_STREAM_END);
 
-	/* rezerwujemy ostatni znak na NULL-a */
-	out_len = strm.total_out + 1;
-	out2 = realloc(out, out_len);
+	return 0;
+#else
+	return -1;
+#endif
+}
 
-	if (out2 == NULL) {
-		gg_debug(GG_DEBUG_MISC, "// gg_inflate() not enough memory for output data (%d)\n", out_len);
-		goto fail;
+/**
+ * \internal Zwalnia konteksty kompresji i dekompresji sesji.
+ *
+ * \param gs Struktura sesji
+ */
+void gg_deflate_free_session(struct gg_session *gs)
+{
+#ifdef GG_CONFIG_HAVE_ZLIB
+	if (gs->deflate_stream != NULL) {
+		deflateEnd(gs->deflate_stream);
+		free(gs->deflate_stream);
+		gs->deflate_stream = NULL;
 	}
 
-	out = out2;
-	out[out_len - 1] = '\0';
+	if (gs->inflate_stream != NULL) {
+		inflateEnd(gs->inflate_stream);
+		free(gs->inflate_stream);
+		gs->inflate_stream = NULL;
+	}
+#endif
+}
 
-	inflateEnd(&strm);
+/**
+ * Ustawia stopień kompresji listy kontaktów wysyłanej przez
+ * \c gg_userlist100_request().
+ *
+ * Domyślnie, tak jak oryginalny klient, biblioteka używa najwyższego
+ * stopnia kompresji, który dla dużych list kontaktów w formacie XML jest
+ * jednak wielokrotnie wolniejszy od niższych przy niewiele mniejszym
+ * wyniku.
+ *
+ * \param gs Struktura sesji
+ * \param level Stopień kompresji od 0 (bez kompresji) do 9 (najwyższy)
+ *              lub -1, by przywrócić domyślny
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup importexport
+ */
+int gg_session_set_compression_level(struct gg_session *gs, int level)
+{
+	gg_debug_session(gs, GG_DEBUG_FUNCTION, "** gg_session_set_compression_level(%p, %d);\n", gs, level);
 
-	return out;
+	if (gs == NULL || level < -1 || level > 9) {
+		errno = EINVAL;
+		return -1;
+	}
 
-fail:
-	inflateEnd(&strm);
-	free(out);
-#endif
-	return NULL;
-}
+	gs->deflate_level = level;
 
+	return 0;
+}
@@ -19,7 +19,14 @@
 
 #include "strman.h"
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <limits.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define GG_ENCODING_SSE2
+#endif
 
 #include "libgadu.h"
 #include "encoding.h"
@@ -54,122 +61,284 @@ static const uint16_t table_cp1250[] =
 };
 
 /**
- * \internal Zamienia tekst kodowany CP1250 na UTF-8.
+ * \internal Indeks bloków tablicy konwersji Unikodu na CP1250.
  *
- * \param src Tekst źródłowy w CP1250.
- * \param src_length Długość ciągu źródłowego (nigdy ujemna).
- * \param dst_length Długość ciągu docelowego (jeśli -1, nieograniczona).
+ * Dla kodu znaku podzielonego przez 64 zawiera numer bloku w tablicy
+ * \c table_cp1250_rev. Blok zerowy jest pusty. Obie tablice są
+ * odwrotnością \c table_cp1250 i należy je zmieniać razem z nią.
+ */
+static const unsigned char table_cp1250_rev_index[133] =
+{
+	0, 0, 1, 2, 3, 4, 0, 0, 0, 0, 0, 5, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	6, 0, 7, 0, 8,
+};
+
+/**
+ * \internal Bloki tablicy konwersji Unikodu na CP1250.
  *
- * \return Zaalokowany bufor z tekstem w UTF-8.
+ * Zero oznacza znak, którego nie da się zapisać w CP1250.
  */
-static char *gg_encoding_convert_cp1250_utf8(const char *src, int src_length, int dst_length)
+static const unsigned char table_cp1250_rev[9][64] =
 {
-	int i, j, len;
-	char *result = NULL;
+	{
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0xa0, 0x00, 0x00, 0x00, 0xa4, 0x00, 0xa6, 0xa7, 0xa8, 0xa9, 0x00, 0xab, 0xac, 0xad, 0xae, 0x00,
+		0xb0, 0xb1, 0x00, 0x00, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0x00, 0x00, 0xbb, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x00, 0xc1, 0xc2, 0x00, 0xc4, 0x00, 0x00, 0xc7, 0x00, 0xc9, 0x00, 0xcb, 0x00, 0xcd, 0xce, 0x00,
+		0x00, 0x00, 0x00, 0xd3, 0xd4, 0x00, 0xd6, 0xd7, 0x00, 0x00, 0xda, 0x00, 0xdc, 0xdd, 0x00, 0xdf,
+		0x00, 0xe1, 0xe2, 0x00, 0xe4, 0x00, 0x00, 0xe7, 0x00, 0xe9, 0x00, 0xeb, 0x00, 0xed, 0xee, 0x00,
+		0x00, 0x00, 0x00, 0xf3, 0xf4, 0x00, 0xf6, 0xf7, 0x00, 0x00, 0xfa, 0x00, 0xfc, 0xfd, 0x00, 0x00,
+	},
+	{
+		0x00, 0x00, 0xc3, 0xe3, 0xa5, 0xb9, 0xc6, 0xe6, 0x00, 0x00, 0x00, 0x00, 0xc8, 0xe8, 0xcf, 0xef,
+		0xd0, 0xf0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xca, 0xea, 0xcc, 0xec, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc5, 0xe5, 0x00, 0x00, 0xbc, 0xbe, 0x00,
+	},
+	{
+		0x00, 0xa3, 0xb3, 0xd1, 0xf1, 0x00, 0x00, 0xd2, 0xf2, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0xd5, 0xf5, 0x00, 0x00, 0xc0, 0xe0, 0x00, 0x00, 0xd8, 0xf8, 0x8c, 0x9c, 0x00, 0x00, 0xaa, 0xba,
+		0x8a, 0x9a, 0xde, 0xfe, 0x8d, 0x9d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xd9, 0xf9,
+		0xdb, 0xfb, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x8f, 0x9f, 0xaf, 0xbf, 0x8e, 0x9e, 0x00,
+	},
+	{
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xa1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xa2, 0xff, 0x00, 0xb2, 0x00, 0xbd, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x96, 0x97, 0x00, 0x00, 0x00, 0x91, 0x92, 0x82, 0x00, 0x93, 0x94, 0x84, 0x00,
+		0x86, 0x87, 0x95, 0x00, 0x00, 0x00, 0x85, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x89, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x8b, 0x9b, 0x00, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	},
+	{
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x99, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	},
+};
 
-	for (i = 0, len = 0; (src[i] != 0) && (i < src_length); i++) {
-		uint16_t uc;
+/**
+ * \internal Zamienia znak unikodowy na CP1250.
+ *
+ * \param uc Kod znaku spoza zakresu ASCII.
+ *
+ * \return Znak w CP1250 lub 0, jeśli nie istnieje.
+ */
+static inline unsigned char gg_encoding_unicode_to_cp1250(uint32_t uc)
+{
+	if (uc >= sizeof(table_cp1250_rev_index) * 64)
+		return 0;
 
-		if ((unsigned char) src[i] < 0x80)
-			uc = (unsigned char) src[i];
-		else
-			uc = table_cp1250[(unsigned char) src[i] - 128];
+	return table_cp1250_rev[table_cp1250_rev_index[uc >> 6]][uc & 63];
+}
 
-		if (uc < 0x80)
-			len += 1;
-		else if (uc < 0x800)
-			len += 2;
-		else
-			len += 3;
+/**
+ * \internal Zwraca długość początkowego ciągu znaków ASCII różnych od zera.
+ *
+ * Ponieważ większość przesyłanych tekstów składa się wyłącznie ze znaków
+ * ASCII, są one sprawdzane po 16 bajtów (SSE2, jeśli kompilator je
+ * udostępnia) lub po całym słowie maszynowym.
+ *
+ * \param src Tekst źródłowy.
+ * \param length Maksymalna długość.
+ *
+ * \return Liczba początkowych znaków ASCII.
+ */
+static int gg_encoding_ascii_length(const char *src, int length)
+{
+	int i = 0;
+
+#ifdef GG_ENCODING_SSE2
+	while (i + 16 <= length) {
+		__m128i chunk;
+
+		chunk = _mm_loadu_si128((const __m128i*) (src + i));
+
+		if ((_mm_movemask_epi8(chunk) | _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_setzero_si128()))) != 0)
+			break;
+
+		i += 16;
 	}
+#endif
 
-	if ((dst_length != -1) && (len > dst_length))
-		len = dst_length;
+	while (i + (int) sizeof(unsigned long) <= length) {
+		const unsigned long ones = (unsigned long) -1 / 0xff;
+		const unsigned long highs = ones * 0x80;
+		unsigned long word;
 
-	result = malloc(len + 1);
+		memcpy(&word, src + i, sizeof(word));
 
-	if (result == NULL) 
-		return NULL;
+		/* Bajty spoza ASCII lub bajty zerowe */
+		if (((word | ((word - ones) & ~word)) & highs) != 0)
+			break;
+
+		i += sizeof(word);
+	}
+
+	while (i < length && src[i] != 0 && (unsigned char) src[i] < 0x80)
+		i++;
+
+	return i;
+}
 
-	for (i = 0, j = 0; (src[i] != 0) && (i < src_length) && (j < len); i++) {
+/**
+ * \internal Zamienia tekst kodowany CP1250 na UTF-8 w podanym buforze.
+ *
+ * Jeśli wynik nie mieści się w buforze, zostaje obcięty na granicy znaku,
+ * ale zwracana jest pełna długość tekstu docelowego.
+ *
+ * \param src Tekst źródłowy w CP1250.
+ * \param src_length Długość ciągu źródłowego (nigdy ujemna).
+ * \param result Bufor docelowy (może być \c NULL, jeśli \p size wynosi 0).
+ * \param size Rozmiar bufora docelowego razem z kończącym zerem.
+ *
+ * \return Długość całego tekstu docelowego.
+ */
+static int gg_encoding_convert_cp1250_utf8_buf(const char *src, int src_length, char *result, int size)
+{
+	int i, j, len, ascii;
+
+	len = (size > 0) ? (size - 1) : 0;
+
+	for (i = 0, j = 0; (i < src_length) && (src[i] != 0); i++) {
 		uint16_t uc;
+		int uc_len;
 
-		if ((unsigned char) src[i] < 0x80)
-			uc = (unsigned char) src[i];
+		if ((unsigned char) src[i] < 0x80) {
+			ascii = gg_encoding_ascii_length(src + i, src_length - i);
+
+			if (j < len)
+				memcpy(result + j, src + i, (ascii < len - j) ? ascii : (len - j));
+
+			j += ascii;
+			i += ascii - 1;
+			continue;
+		}
+
+		uc = table_cp1250[(unsigned char) src[i] - 128];
+
+		if (uc < 0x80)
+			uc_len = 1;
+		else if (uc < 0x800)
+			uc_len = 2;
 		else
-			uc = table_cp1250[(unsigned char) src[i] - 128];
+			uc_len = 3;
+
+		/* Nie tniemy znaku w środku, a po obcięciu nic już nie
+		 * zapisujemy, tylko liczymy długość. */
+		if (j + uc_len > len) {
+			if (j < len)
+				len = j;
+			j += uc_len;
+			continue;
+		}
 
-		if (uc < 0x80) 
+		if (uc_len == 1)
 			result[j++] = (char) uc;
-		else if (uc < 0x800) {
-			if (j + 1 > len)
-				break;
+		else if (uc_len == 2) {
 			result[j++] = 0xc0 | ((uc >> 6) & 0x1f);
 			result[j++] = 0x80 | (uc & 0x3f);
 		} else {
-			if (j + 2 > len)
-				break;
 			result[j++] = 0xe0 | ((uc >> 12) & 0x1f);
 			result[j++] = 0x80 | ((uc >> 6) & 0x3f);
 			result[j++] = 0x80 | (uc & 0x3f);
 		}
 	}
 
-	result[j] = 0;
+	if (size > 0)
+		result[(j < len) ? j : len] = 0;
 
-	return result;
+	return j;
 }
 
 /**
- * \internal Zamienia tekst kodowany UTF-8 na CP1250.
+ * \internal Zamienia tekst kodowany UTF-8 na CP1250 w podanym buforze.
+ *
+ * Tekst w CP1250 nigdy nie jest dłuższy niż w UTF-8, więc bufor
+ * o długości \p src_length wystarczy zawsze, a konwersja odbywa się
+ * w jednym przebiegu. Jeśli wynik nie mieści się w buforze, zostaje
+ * obcięty, ale zwracana jest pełna długość tekstu docelowego.
  *
  * \param src Tekst źródłowy w UTF-8.
  * \param src_length Długość ciągu źródłowego (nigdy ujemna).
- * \param dst_length Długość ciągu docelowego (jeśli -1, nieograniczona).
+ * \param result Bufor docelowy (może być \c NULL, jeśli \p size wynosi 0).
+ * \param size Rozmiar bufora docelowego razem z kończącym zerem.
  *
- * \return Zaalokowany bufor z tekstem w CP1250.
+ * \return Długość całego tekstu docelowego.
  */
-static char *gg_encoding_convert_utf8_cp1250(const char *src, int src_length, int dst_length)
+static int gg_encoding_convert_utf8_cp1250_buf(const char *src, int src_length, char *result, int size)
 {
-	char *result;
-	int i, j, len, uc_left = 0;
+	int i, j, len, ascii, uc_left = 0;
 	uint32_t uc = 0, uc_min = 0;
 
-	for (i = 0, len = 0; (src[i] != 0) && (i < src_length); i++) {
-		if ((src[i] & 0xc0) != 0x80)
-			len++;
-	}
+	len = (size > 0) ? (size - 1) : 0;
 
-	if ((dst_length != -1) && (len > dst_length))
-		len = dst_length;
+	/* Nieprawidłowa sekwencja może dać dwa znaki zapytania naraz, więc
+	 * każdy zapis trzeba sprawdzać osobno. */
 
-	result = malloc(len + 1);
+#define GG_ENCODING_PUT(c) \
+	do { \
+		if (j < len) \
+			result[j] = (c); \
+		j++; \
+	} while (0)
 
-	if (result == NULL)
-		return NULL;
+	for (i = 0, j = 0; (i < src_length) && (src[i] != 0); i++) {
+		if (uc_left == 0 && (unsigned char) src[i] < 0x80) {
+			ascii = gg_encoding_ascii_length(src + i, src_length - i);
+
+			if (j < len)
+				memcpy(result + j, src + i, (ascii < len - j) ? ascii : (len - j));
 
-	for (i = 0, j = 0; (src[i] != 0) && (i < src_length) && (j < len); i++) {
-		if ((unsigned char) src[i] >= 0xf5) {
+			j += ascii;
+			i += ascii - 1;
+		} else if ((unsigned char) src[i] >= 0xf5) {
 			if (uc_left != 0) 
-				result[j++] = '?';
+				GG_ENCODING_PUT('?');
 			/* Restricted sequences */
-			result[j++] = '?';
+			GG_ENCODING_PUT('?');
 			uc_left = 0;
 		} else if ((src[i] & 0xf8) == 0xf0) {
 			if (uc_left != 0) 
-				result[j++] = '?';
+				GG_ENCODING_PUT('?');
 			uc = src[i] & 0x07;
 			uc_left = 3;
 			uc_min = 0x10000;
 		} else if ((src[i] & 0xf0) == 0xe0) {
 			if (uc_left != 0) 
-				result[j++] = '?';
+				GG_ENCODING_PUT('?');
 			uc = src[i] & 0x0f;
 			uc_left = 2;
 			uc_min = 0x800;
 		} else if ((src[i] & 0xe0) == 0xc0) {
 			if (uc_left != 0) 
-				result[j++] = '?';
+				GG_ENCODING_PUT('?');
 			uc = src[i] & 0x1f;
 			uc_left = 1;
 			uc_min = 0x80;
@@ -180,38 +349,96 @@ static char *gg_encoding_convert_utf8_cp1250(const char *src, int src_length, in
 				uc_left--;
 
 				if (uc_left == 0) {
-					int valid = 0;
-					int k;
-
-					if (uc >= uc_min) {
-						for (k = 0; k < 128; k++) {
-							if (uc == table_cp1250[k]) {
-								result[j++] = k + 128;
-								valid = 1;
-								break;
-							}
-						}
-					}
-
-					if (!valid && uc != 0xfeff)	/* Byte Order Mark */
-						result[j++] = '?';
+					unsigned char c = 0;
+
+					if (uc >= uc_min)
+						c = gg_encoding_unicode_to_cp1250(uc);
+
+					if (c != 0)
+						GG_ENCODING_PUT(c);
+					else if (uc != 0xfeff)	/* Byte Order Mark */
+						GG_ENCODING_PUT('?');
 				}
 			}
 		} else {
 			if (uc_left != 0) {
-				result[j++] = '?';
+				GG_ENCODING_PUT('?');
 				uc_left = 0;
 			}
-			result[j++] = src[i];
+			GG_ENCODING_PUT(src[i]);
 		}
 	}
 
 	if ((uc_left != 0) && (src[i] == 0))
-		result[j++] = '?';
+		GG_ENCODING_PUT('?');
 
-	result[j] = 0;
+#undef GG_ENCODING_PUT
 
-	return result;
+	if (size > 0)
+		result[(j < len) ? j : len] = 0;
+
+	return j;
+}
+
+/**
+ * Zamienia kodowanie tekstu, zapisując wynik w podanym buforze.
+ *
+ * Funkcja działa podobnie do \c snprintf(). Jeśli wynik nie mieści się
+ * w buforze, zostaje obcięty (nigdy w środku znaku UTF-8 powstałego
+ * z konwersji) i zakończony zerem, a zwracana wartość pozwala
+ * przydzielić bufor o właściwym rozmiarze i powtórzyć wywołanie.
+ *
+ * \param src Tekst źródłowy.
+ * \param src_encoding Kodowanie tekstu źródłowego.
+ * \param dst_encoding Kodowanie tekstu docelowego.
+ * \param src_length Długość ciągu źródłowego w bajtach (jeśli -1, zostanie obliczona na podstawie zawartości \p src).
+ * \param dst Bufor docelowy (może być \c NULL, jeśli \p dst_size wynosi 0).
+ * \param dst_size Rozmiar bufora docelowego w bajtach, razem z kończącym zerem.
+ *
+ * \return Długość całego tekstu docelowego bez kończącego zera lub -1
+ *         w przypadku błędu.
+ *
+ * \ingroup helper
+ */
+int gg_encoding_convert_buf(const char *src, gg_encoding_t src_encoding, gg_encoding_t dst_encoding, int src_length, char *dst, size_t dst_size)
+{
+	int size;
+
+	if (src == NULL || (dst == NULL && dst_size != 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size = (dst_size > INT_MAX) ? INT_MAX : (int) dst_size;
+
+	if (src_length == -1)
+		src_length = strlen(src);
+
+	if (dst_encoding == src_encoding) {
+		const char *end;
+		int len;
+
+		end = memchr(src, 0, src_length);
+		len = (end != NULL) ? (int) (end - src) : src_length;
+
+		if (size > 0) {
+			int copy = (len < size - 1) ? len : (size - 1);
+
+			memcpy(dst, src, copy);
+			dst[copy] = 0;
+		}
+
+		return len;
+	}
+
+	if (dst_encoding == GG_ENCODING_CP1250 && src_encoding == GG_ENCODING_UTF8)
+		return gg_encoding_convert_utf8_cp1250_buf(src, src_length, dst, size);
+
+	if (dst_encoding == GG_ENCODING_UTF8 && src_encoding == GG_ENCODING_CP1250)
+		return gg_encoding_convert_cp1250_utf8_buf(src, src_length, dst, size);
+
+	errno = EINVAL;
+	return -1;
 }
 
 /**
@@ -228,6 +455,7 @@ static char *gg_encoding_convert_utf8_cp1250(const char *src, int src_length, in
 char *gg_encoding_convert(const char *src, gg_encoding_t src_encoding, gg_encoding_t dst_encoding, int src_length, int dst_length)
 {
 	char *result;
+	int len;
 
 	if (src == NULL) {
 		errno = EINVAL;
@@ -242,8 +470,6 @@ char *gg_encoding_convert(const char *src, gg_encoding_t src_encoding, gg_encodi
 		src_length = strlen(src);
 
 	if (dst_encoding == src_encoding) {
-		int len;
-
 		if (dst_length == -1)
 			len = src_length;
 		else
@@ -260,13 +486,89 @@ char *gg_encoding_convert(const char *src, gg_encoding_t src_encoding, gg_encodi
 		return result;
 	}
 
-	if (dst_encoding == GG_ENCODING_CP1250 && src_encoding == GG_ENCODING_UTF8)
-		return gg_encoding_convert_utf8_cp1250(src, src_length, dst_length);
+	if (dst_encoding == GG_ENCODING_CP1250 && src_encoding == GG_ENCODING_UTF8) {
+		/* Wynik nie będzie dłuższy niż tekst źródłowy */
+		len = src_length;
+	} else if (dst_encoding == GG_ENCODING_UTF8 && src_encoding == GG_ENCODING_CP1250) {
+		len = gg_encoding_convert_cp1250_utf8_buf(src, src_length, NULL, 0);
+	} else {
+		errno = EINVAL;
+		return NULL;
+	}
 
-	if (dst_encoding == GG_ENCODING_UTF8 && src_encoding == GG_ENCODING_CP1250)
-		return gg_encoding_convert_cp1250_utf8(src, src_length, dst_length);
+	if ((dst_length != -1) && (len > dst_length))
+		len = dst_length;
 
-	errno = EINVAL;
-	return NULL;
+	result = malloc(len + 1);
+
+	if (result == NULL)
+		return NULL;
+
+	if (gg_encoding_convert_buf(src, src_encoding, dst_encoding, src_length, result, len + 1) == -1) {
+		free(result);
+		return NULL;
+	}
+
+	return result;
 }
 
+/**
+ * \internal Zamienia kodowanie tekstu, zapisując wynik w buforze sesji.
+ *
+ * Służy do konwersji tekstów tymczasowych, które zaraz zostaną skopiowane
+ * do pakietu lub innej struktury. Wynik jest ważny do następnego wywołania
+ * funkcji dla tej samej sesji.
+ *
+ * \param gs Struktura sesji
+ * \param src Tekst źródłowy.
+ * \param src_encoding Kodowanie tekstu źródłowego.
+ * \param dst_encoding Kodowanie tekstu docelowego.
+ * \param src_length Długość ciągu źródłowego w bajtach (jeśli -1, zostanie obliczona na podstawie zawartości \p src).
+ *
+ * \return Wskaźnik na tekst w kodowaniu docelowym lub \c NULL w przypadku błędu.
+ */
+const char *gg_encoding_convert_session(struct gg_session *gs, const char *src, gg_encoding_t src_encoding, gg_encoding_t dst_encoding, int src_length)
+{
+	int len;
+
+	if (gs == NULL || src == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (src_length == -1)
+		src_length = strlen(src);
+
+	if (dst_encoding == GG_ENCODING_CP1250 && src_encoding == GG_ENCODING_UTF8)
+		len = src_length;
+	else if (dst_encoding == src_encoding)
+		len = src_length;
+	else
+		len = gg_encoding_convert_buf(src, src_encoding, dst_encoding, src_length, NULL, 0);
+
+	if (len == -1)
+		return NULL;
+
+	if ((size_t) len + 1 > gs->encoding_buf_size) {
+		char *tmp;
+		size_t size;
+
+		size = (gs->encoding_buf_size != 0) ? gs->encoding_buf_size : 256;
+
+		while (size < (size_t) len + 1)
+			size *= 2;
+
+		tmp = realloc(gs->encoding_buf, size);
+
+		if (tmp == NULL)
+			return NULL;
+
+		gs->encoding_buf = tmp;
+		gs->encoding_buf_size = size;
+	}
+
+	if (gg_encoding_convert_buf(src, src_encoding, dst_encoding, src_length, gs->encoding_buf, gs->encoding_buf_size) == -1)
+		return NULL;
+
+	return gs->encoding_buf;
+}
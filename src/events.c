@@ -36,9 +36,11 @@
 #include "protocol.h"
 #include "internal.h"
 #include "encoding.h"
+#include "message.h"
 #include "debug.h"
 #include "session.h"
 #include "resolver.h"
+#include "pubdir50cache.h"
 
 #include <errno.h>
 #include <string.h>
@@ -79,6 +81,7 @@ void gg_event_free(struct gg_event *e)
 			free(e->event.msg.formats);
 			free(e->event.msg.recipients);
 			free(e->event.msg.xhtml_message);
+			free(e->event.msg.raw);
 			break;
 
 		case GG_EVENT_NOTIFY:
@@ -171,8 +174,294 @@ void gg_event_free(struct gg_event *e)
 	free(e);
 }
 
+/**
+ * Włącza lub wyłącza opóźnione dekodowanie treści odebranych wiadomości.
+ *
+ * Po włączeniu zdarzenia \c GG_EVENT_MSG i \c GG_EVENT_MULTILOGON_MSG
+ * zawierają jedynie surową treść wiadomości, a pola \c message,
+ * \c xhtml_message i \c formats są wypełniane dopiero przy pierwszym
+ * wywołaniu \c gg_event_msg_get_message(), \c gg_event_msg_get_xhtml()
+ * lub \c gg_event_msg_get_formats(). Pozwala to uniknąć konwersji, których
+ * wyniki nie są aplikacji potrzebne.
+ *
+ * \param gs Struktura sesji
+ * \param enabled Flaga włączenia opóźnionego dekodowania
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup events
+ */
+int gg_session_set_lazy_messages(struct gg_session *gs, int enabled)
+{
+	gg_debug_session(gs, GG_DEBUG_FUNCTION, "** gg_session_set_lazy_messages(%p, %d);\n", gs, enabled);
+
+	if (gs == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	gs->lazy_messages = (enabled != 0);
+
+	return 0;
+}
+
+/**
+ * \internal Dekoduje treść wiadomości do postaci oczekiwanej przez aplikację.
+ *
+ * Już zdekodowane pola nie są ponownie wypełniane.
+ *
+ * \param msg Struktura zdarzenia wiadomości
+ * \param html Treść wiadomości w formacie HTML w UTF-8 lub \c NULL
+ * \param plain Treść wiadomości w postaci czystego tekstu w CP1250
+ * \param encoding Docelowe kodowanie treści
+ * \param what Suma logiczna \c GG_EVENT_MSG_DECODE_TEXT
+ *             i \c GG_EVENT_MSG_DECODE_XHTML
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+int gg_event_msg_decode(struct gg_event_msg *msg, const char *html, const char *plain, gg_encoding_t encoding, int what)
+{
+	if ((what & GG_EVENT_MSG_DECODE_TEXT) && msg->message == NULL) {
+		if (encoding == GG_ENCODING_CP1250) {
+			msg->message = (unsigned char*) strdup(plain);
+		} else if (html != NULL) {
+			unsigned char *formats = NULL;
+			size_t formats_length;
+
+			msg->message = (unsigned char*) gg_message_html_to_text_alloc(html, GG_ENCODING_UTF8, &formats, &formats_length, 0);
+
+			if (msg->message != NULL) {
+				free(msg->formats);
+				msg->formats_length = formats_length;
+				msg->formats = formats;
+			}
+		} else {
+			msg->message = (unsigned char*) gg_encoding_convert(plain, GG_ENCODING_CP1250, encoding, -1, -1);
+		}
+
+		if (msg->message == NULL) {
+			gg_debug(GG_DEBUG_MISC, "// gg_event_msg_decode() out of memory\n");
+			return -1;
+		}
+	}
+
+	if ((what & GG_EVENT_MSG_DECODE_XHTML) && msg->xhtml_message == NULL) {
+		if (html != NULL) {
+			msg->xhtml_message = gg_encoding_convert(html, GG_ENCODING_UTF8, encoding, -1, -1);
+		} else {
+			if (gg_event_msg_decode(msg, html, plain, encoding, GG_EVENT_MSG_DECODE_TEXT) == -1)
+				return -1;
+
+			msg->xhtml_message = gg_message_text_to_html_alloc((char*) msg->message, encoding, msg->formats, msg->formats_length);
+		}
+
+		if (msg->xhtml_message == NULL) {
+			gg_debug(GG_DEBUG_MISC, "// gg_event_msg_decode() out of memory\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \internal Dekoduje wskazane pola zdarzenia z zachowanej surowej treści.
+ *
+ * \param msg Struktura zdarzenia wiadomości
+ * \param what Suma logiczna \c GG_EVENT_MSG_DECODE_TEXT
+ *             i \c GG_EVENT_MSG_DECODE_XHTML
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+static int gg_event_msg_decode_raw(struct gg_event_msg *msg, int what)
+{
+	const char *html;
+
+	if (msg->raw == NULL)
+		return 0;
+
+	html = (msg->raw_plain_offset > 0) ? msg->raw : NULL;
+
+	if (gg_event_msg_decode(msg, html, msg->raw + msg->raw_plain_offset, msg->raw_encoding, what) == -1) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* Wszystko zdekodowane, surowa treść nie jest już potrzebna. */
+	if (msg->message != NULL && msg->xhtml_message != NULL) {
+		free(msg->raw);
+		msg->raw = NULL;
+	}
+
+	return 0;
+}
+
+/**
+ * Zwraca treść odebranej wiadomości w postaci czystego tekstu.
+ *
+ * Przy opóźnionym dekodowaniu (patrz \c gg_session_set_lazy_messages())
+ * treść jest dekodowana przy pierwszym wywołaniu. Zwrócony bufor należy
+ * do zdarzenia i jest zwalniany przez \c gg_event_free().
+ *
+ * \param msg Struktura zdarzenia wiadomości
+ *
+ * \return Treść wiadomości lub \c NULL w przypadku błędu
+ *
+ * \ingroup events
+ */
+const unsigned char *gg_event_msg_get_message(struct gg_event_msg *msg)
+{
+	if (msg == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (gg_event_msg_decode_raw(msg, GG_EVENT_MSG_DECODE_TEXT) == -1)
+		return NULL;
+
+	return msg->message;
+}
+
+/**
+ * Zwraca treść odebranej wiadomości w formacie XHTML.
+ *
+ * Przy opóźnionym dekodowaniu (patrz \c gg_session_set_lazy_messages())
+ * treść jest dekodowana przy pierwszym wywołaniu. Zwrócony bufor należy
+ * do zdarzenia i jest zwalniany przez \c gg_event_free().
+ *
+ * \param msg Struktura zdarzenia wiadomości
+ *
+ * \return Treść wiadomości lub \c NULL w przypadku błędu
+ *
+ * \ingroup events
+ */
+const char *gg_event_msg_get_xhtml(struct gg_event_msg *msg)
+{
+	if (msg == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (gg_event_msg_decode_raw(msg, GG_EVENT_MSG_DECODE_XHTML) == -1)
+		return NULL;
+
+	return msg->xhtml_message;
+}
+
+/**
+ * Zwraca informacje o formatowaniu tekstu odebranej wiadomości.
+ *
+ * Ponieważ formatowanie odnosi się do czystego tekstu, przy opóźnionym
+ * dekodowaniu (patrz \c gg_session_set_lazy_messages()) dekodowana jest
+ * również treść wiadomości.
+ *
+ * \param msg Struktura zdarzenia wiadomości
+ * \param length Wskaźnik na długość informacji o formatowaniu
+ *
+ * \return Informacje o formatowaniu lub \c NULL, jeśli ich brak lub
+ *         wystąpił błąd
+ *
+ * \ingroup events
+ */
+const void *gg_event_msg_get_formats(struct gg_event_msg *msg, int *length)
+{
+	if (msg == NULL || length == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	*length = 0;
+
+	if (gg_event_msg_decode_raw(msg, GG_EVENT_MSG_DECODE_TEXT) == -1)
+		return NULL;
+
+	*length = msg->formats_length;
+
+	return msg->formats;
+}
+
 /** \cond internal */
 
+/**
+ * \internal Oblicza indeks obrazka w tablicy mieszającej.
+ *
+ * \param sender Nadawca obrazka
+ * \param size Rozmiar obrazka
+ * \param crc32 Suma kontrolna obrazka
+ *
+ * \return Indeks w tablicy mieszającej
+ */
+static unsigned int gg_image_queue_hash(uin_t sender, uint32_t size, uint32_t crc32)
+{
+	return ((sender * 2654435761U) ^ size ^ crc32) % GG_IMAGE_QUEUE_HASH_SIZE;
+}
+
+/**
+ * \internal Dodaje obrazek do kolejki odbieranych obrazków.
+ *
+ * Obrazek trafia na początek listy \c images oraz na koniec swojego
+ * kubełka w tablicy mieszającej, dzięki czemu przy kilku żądaniach tego
+ * samego obrazka odpowiedzi trafiają do nich w kolejności wysłania.
+ *
+ * \param s Struktura sesji
+ * \param q Struktura obrazka
+ *
+ * \return 0 jeśli się powiodło, -1 jeśli wystąpił błąd
+ */
+int gg_image_queue_add(struct gg_session *s, struct gg_image_queue *q)
+{
+	struct gg_image_queue **qq;
+
+	if (s->images_hash == NULL) {
+		s->images_hash = calloc(GG_IMAGE_QUEUE_HASH_SIZE, sizeof(struct gg_image_queue*));
+
+		if (s->images_hash == NULL)
+			return -1;
+	}
+
+	for (qq = &s->images_hash[gg_image_queue_hash(q->sender, q->size, q->crc32)]; *qq != NULL; qq = &(*qq)->hash_next)
+		;
+
+	*qq = q;
+	q->hash_next = NULL;
+
+	q->prev = NULL;
+	q->next = s->images;
+
+	if (s->images != NULL)
+		s->images->prev = q;
+
+	s->images = q;
+	s->images_size += q->size;
+
+	return 0;
+}
+
+/**
+ * \internal Szuka obrazka w kolejce odbieranych obrazków.
+ *
+ * \param s Struktura sesji
+ * \param sender Nadawca obrazka
+ * \param size Rozmiar obrazka
+ * \param crc32 Suma kontrolna obrazka
+ *
+ * \return Struktura obrazka lub \c NULL, jeśli nie znaleziono
+ */
+struct gg_image_queue *gg_image_queue_find(struct gg_session *s, uin_t sender, uint32_t size, uint32_t crc32)
+{
+	struct gg_image_queue *q;
+
+	if (s->images_hash == NULL)
+		return NULL;
+
+	for (q = s->images_hash[gg_image_queue_hash(sender, size, crc32)]; q != NULL; q = q->hash_next) {
+		if (q->sender == sender && q->size == size && q->crc32 == crc32)
+			return q;
+	}
+
+	return NULL;
+}
+
 /**
  * \internal Usuwa obrazek z kolejki do wysłania.
  *
@@ -189,19 +478,31 @@ int gg_image_queue_remove(struct gg_session *s, struct gg_image_queue *q, int fr
 		return -1;
 	}
 
-	if (s->images == q)
-		s->images = q->next;
-	else {
-		struct gg_image_queue *qq;
+	if (s->images_hash != NULL) {
+		struct gg_image_queue **qq;
 
-		for (qq = s->images; qq; qq = qq->next) {
-			if (qq->next == q) {
-				qq->next = q->next;
+		for (qq = &s->images_hash[gg_image_queue_hash(q->sender, q->size, q->crc32)]; *qq != NULL; qq = &(*qq)->hash_next) {
+			if (*qq == q) {
+				*qq = q->hash_next;
 				break;
 			}
 		}
 	}
 
+	if (s->images == q)
+		s->images = q->next;
+	else if (q->prev != NULL)
+		q->prev->next = q->next;
+
+	if (q->next != NULL)
+		q->next->prev = q->prev;
+
+	q->next = NULL;
+	q->prev = NULL;
+	q->hash_next = NULL;
+
+	s->images_size -= q->size;
+
 	if (freeq) {
 		free(q->image);
 		free(q->filename);
@@ -1336,9 +1637,73 @@ static gg_action_t gg_handle_connected(struct gg_session *sess, struct gg_event
 #else
 	struct gg_header *gh;
 
+	/* zapytania katalogu publicznego, na które czekamy, mogły zostać
+	 * wysłane przez sesję, która już nie dostanie odpowiedzi */
+
+	gg_pubdir50_cache_check();
+
 	if (gg_send_queued_data(sess) == -1)
 		return GG_ACTION_FAIL;
 
+	/* obrazki z pamięci podręcznej mają pierwszeństwo, bo żądanie
+	 * gg_image_request() zostało obsłużone bez udziału serwera */
+
+	if (sess->images_ready != NULL) {
+		struct gg_image_queue *q = sess->images_ready;
+
+		sess->images_ready = q->next;
+
+		e->type = GG_EVENT_IMAGE_REPLY;
+		e->event.image_reply.sender = q->sender;
+		e->event.image_reply.size = q->size;
+		e->event.image_reply.crc32 = q->crc32;
+		e->event.image_reply.filename = q->filename;
+		e->event.image_reply.image = q->image;
+
+		free(q);
+
+		sess->check = GG_CHECK_READ;
+
+		if (sess->send_buf != NULL || sess->images_ready != NULL || sess->images_send != NULL || sess->pubdir50_ready != NULL)
+			sess->check |= GG_CHECK_WRITE;
+
+		return GG_ACTION_WAIT;
+	}
+
+	/* podobnie odpowiedzi katalogu publicznego z pamięci podręcznej
+	 * lub na zapytania wysłane przez inne sesje */
+
+	if (sess->pubdir50_ready != NULL) {
+		struct gg_pubdir50_ready *pr = sess->pubdir50_ready;
+		int res;
+
+		sess->pubdir50_ready = pr->next;
+
+		res = gg_pubdir50_handle_reply_sess(sess, e, pr->packet, pr->length);
+
+		free(pr->packet);
+		free(pr);
+
+		if (res == -1)
+			return GG_ACTION_FAIL;
+
+		sess->check = GG_CHECK_READ;
+
+		if (sess->send_buf != NULL || sess->images_ready != NULL || sess->images_send != NULL || sess->pubdir50_ready != NULL)
+			sess->check |= GG_CHECK_WRITE;
+
+		return GG_ACTION_WAIT;
+	}
+
+	/* kolejną część obrazka wysyłamy dopiero po opróżnieniu kolejki, żeby
+	 * pakiety wysyłane w międzyczasie przez aplikację nie czekały na cały
+	 * obrazek */
+
+	if (sess->send_buf == NULL && sess->images_send != NULL) {
+		if (gg_image_send_next(sess) == -1)
+			return GG_ACTION_FAIL;
+	}
+
 	gh = gg_recv_packet(sess);
 
 	if (gh == NULL) {
@@ -1363,7 +1728,7 @@ static gg_action_t gg_handle_connected(struct gg_session *sess, struct gg_event
 
 	sess->check = GG_CHECK_READ;
 
-	if (sess->send_buf != NULL)
+	if (sess->send_buf != NULL || sess->images_ready != NULL || sess->images_send != NULL || sess->pubdir50_ready != NULL)
 		sess->check |= GG_CHECK_WRITE;
 
 	return GG_ACTION_WAIT;
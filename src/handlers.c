@@ -41,6 +41,8 @@
 #include "message.h"
 #include "internal.h"
 #include "deflate.h"
+#include "imagecache.h"
+#include "pubdir50cache.h"
 
 #include <errno.h>
 #include <stdlib.h>
@@ -356,6 +358,8 @@ static int gg_session_handle_pubdir50_reply(struct gg_session *gs, uint32_t type
 {
 	gg_debug_session(gs, GG_DEBUG_MISC, "// gg_watch_fd_connected() received pubdir/search reply\n");
 
+	gg_pubdir50_cache_reply(gs, ptr, len);
+
 	return gg_pubdir50_handle_reply_sess(gs, ge, ptr, len);
 }
 
@@ -381,32 +385,61 @@ static int gg_session_handle_userlist_reply(struct gg_session *gs, uint32_t type
 		reply_type = GG_USERLIST_PUT_REPLY;
 	}
 
-	if (len > 1) {
-		unsigned int reply_len = (gs->userlist_reply != NULL) ? strlen(gs->userlist_reply) : 0;
-		char *tmp;
-
+	if (len > 1 && gs->userlist_sink != NULL) {
+		if (gs->userlist_sink(gs, GG_EVENT_USERLIST, ptr + 1, len - 1, gs->userlist_sink_data) == -1) {
+			gg_debug_session(gs, GG_DEBUG_MISC, "// gg_watch_fd_connected() userlist sink failed\n");
+			return -1;
+		}
+	} else if (len > 1) {
 		gg_debug_session(gs, GG_DEBUG_MISC, "userlist_reply=%p, len=%d\n", gs->userlist_reply, len);
 
-		tmp = realloc(gs->userlist_reply, reply_len + len);
+		/* Bufor rośnie dwukrotnie, żeby składanie długiej listy
+		 * z wielu pakietów nie wymagało kopiowania jej za każdym razem. */
 
-		if (tmp == NULL) {
-			gg_debug_session(gs, GG_DEBUG_MISC, "// gg_watch_fd_connected() out of memory\n");
-			return -1;
+		if (gs->userlist_reply_len + len > gs->userlist_reply_size) {
+			size_t size;
+			char *tmp;
+
+			size = (gs->userlist_reply_size != 0) ? gs->userlist_reply_size : 2048;
+
+			while (size < gs->userlist_reply_len + len)
+				size *= 2;
+
+			tmp = realloc(gs->userlist_reply, size);
+
+			if (tmp == NULL) {
+				gg_debug_session(gs, GG_DEBUG_MISC, "// gg_watch_fd_connected() out of memory\n");
+				return -1;
+			}
+
+			gs->userlist_reply = tmp;
+			gs->userlist_reply_size = size;
 		}
 
-		gs->userlist_reply = tmp;
-		memcpy(gs->userlist_reply + reply_len, ptr + 1, len - 1);
-		gs->userlist_reply[reply_len + len - 1] = 0;
+		memcpy(gs->userlist_reply + gs->userlist_reply_len, ptr + 1, len - 1);
+		gs->userlist_reply_len += len - 1;
+		gs->userlist_reply[gs->userlist_reply_len] = 0;
 	}
 
 	if (reply_type == GG_USERLIST_GET_MORE_REPLY)
 		return 0;
 
+	if (gs->userlist_reply != NULL && gs->userlist_reply_len + 1 < gs->userlist_reply_size) {
+		char *tmp;
+
+		tmp = realloc(gs->userlist_reply, gs->userlist_reply_len + 1);
+
+		if (tmp != NULL)
+			gs->userlist_reply = tmp;
+	}
+
 	ge->type = GG_EVENT_USERLIST;
 	ge->event.userlist.type = reply_type;
 	ge->event.userlist.reply = gs->userlist_reply;
 
 	gs->userlist_reply = NULL;
+	gs->userlist_reply_len = 0;
+	gs->userlist_reply_size = 0;
 
 	return 0;
 }
@@ -483,7 +516,7 @@ static int gg_session_handle_dcc7_info(struct gg_session *gs, uint32_t type, con
 static void gg_image_queue_parse(struct gg_event *e, const char *p, unsigned int len, struct gg_session *sess, uin_t sender)
 {
 	const struct gg_msg_image_reply *i = (const void*) p;
-	struct gg_image_queue *q, *qq;
+	struct gg_image_queue *q;
 
 	if (!p || !sess || !e) {
 		errno = EFAULT;
@@ -492,12 +525,7 @@ static void gg_image_queue_parse(struct gg_event *e, const char *p, unsigned int
 
 	/* znajdź dany obrazek w kolejce danej sesji */
 
-	for (qq = sess->images, q = NULL; qq; qq = qq->next) {
-		if (sender == qq->sender && i->size == qq->size && i->crc32 == qq->crc32) {
-			q = qq;
-			break;
-		}
-	}
+	q = gg_image_queue_find(sess, sender, i->size, i->crc32);
 
 	if (!q) {
 		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_queue_parse() unknown image from %d, size=%d, crc32=%.8x\n", sender, i->size, i->crc32);
@@ -506,6 +534,7 @@ static void gg_image_queue_parse(struct gg_event *e, const char *p, unsigned int
 
 	if (p[0] == GG_MSG_OPTION_IMAGE_REPLY) {
 		q->done = 0;
+		q->crc32_done = 0;
 
 		len -= sizeof(struct gg_msg_image_reply);
 		p += sizeof(struct gg_msg_image_reply);
@@ -533,9 +562,21 @@ static void gg_image_queue_parse(struct gg_event *e, const char *p, unsigned int
 	memcpy(q->image + q->done, p, len);
 	q->done += len;
 
+	if (sess->images_verify)
+		q->crc32_done = gg_crc32(q->crc32_done, (const unsigned char*) p, len);
+
 	/* jeśli skończono odbierać obrazek, wygeneruj zdarzenie */
 
+	if (q->done >= q->size && sess->images_verify && q->crc32_done != q->crc32) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_queue_parse() invalid checksum of image from %d, expected %.8x, got %.8x\n", sender, q->crc32, q->crc32_done);
+		gg_image_queue_remove(sess, q, 1);
+		return;
+	}
+
 	if (q->done >= q->size) {
+		if (gg_image_cache_add(q->size, q->crc32, q->filename, q->image, 0) == -1)
+			gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_queue_parse() unable to add image to cache\n");
+
 		e->type = GG_EVENT_IMAGE_REPLY;
 		e->event.image_reply.sender = sender;
 		e->event.image_reply.size = q->size;
@@ -654,6 +695,7 @@ static int gg_handle_recv_msg_options(struct gg_session *sess, struct gg_event *
 			case GG_MSG_OPTION_IMAGE_REQUEST:
 			{
 				const struct gg_msg_image_request *i = (const void*) p;
+				const struct gg_image_cache_entry *ce;
 
 				if (p + sizeof(*i) > packet_end) {
 					gg_debug_session(sess, GG_DEBUG_MISC, "// gg_handle_recv_msg() packet out of bounds (3)\n");
@@ -665,6 +707,21 @@ static int gg_handle_recv_msg_options(struct gg_session *sess, struct gg_event *
 					goto malformed;
 				}
 
+				ce = gg_image_cache_find(gg_fix32(i->size), gg_fix32(i->crc32));
+
+				/* odpowiadamy sami tylko obrazkami wysłanymi wcześniej
+				 * przez aplikację, żeby nie udostępniać obrazków
+				 * odebranych od innych rozmówców */
+
+				if (ce != NULL && ce->local) {
+					gg_debug_session(sess, GG_DEBUG_MISC, "// gg_handle_recv_msg_options() replying with cached image\n");
+
+					if (gg_image_reply(sess, sender, ce->filename, ce->image, ce->size) == -1)
+						goto fail;
+
+					goto handled;
+				}
+
 				e->event.image_request.sender = sender;
 				e->event.image_request.size = gg_fix32(i->size);
 				e->event.image_request.crc32 = gg_fix32(i->crc32);
@@ -765,7 +822,6 @@ static int gg_session_handle_recv_msg(struct gg_session *sess, uint32_t type, co
 	const struct gg_recv_msg *r = (const struct gg_recv_msg*) packet;
 	const char *payload = packet + sizeof(struct gg_recv_msg);
 	const char *payload_end = packet + length;
-	size_t len;
 
 	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_handle_recv_msg(%p, %d, %p);\n", packet, length, e);
 
@@ -815,16 +871,13 @@ static int gg_session_handle_recv_msg(struct gg_session *sess, uint32_t type, co
 		goto fail;
 	}
 
-	len = gg_message_text_to_html(NULL, (char*) e->event.msg.message, sess->encoding, e->event.msg.formats, e->event.msg.formats_length);
-	e->event.msg.xhtml_message = malloc(len + 1);
+	e->event.msg.xhtml_message = gg_message_text_to_html_alloc((char*) e->event.msg.message, sess->encoding, e->event.msg.formats, e->event.msg.formats_length);
 
 	if (e->event.msg.xhtml_message == NULL) {
 		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_session_handle_recv_msg() out of memory\n");
 		goto fail;
 	}
 
-	gg_message_text_to_html(e->event.msg.xhtml_message, (char*) e->event.msg.message, sess->encoding, e->event.msg.formats, e->event.msg.formats_length);
-
 	gg_session_send_msg_ack(sess, gg_fix32(r->seq));
 	return 0;
 
@@ -910,64 +963,31 @@ static int gg_session_handle_recv_msg_80(struct gg_session *sess, uint32_t type,
 		}
 	}
 
-	if (sess->encoding == GG_ENCODING_CP1250) {
-		e->event.msg.message = (unsigned char*) strdup(packet + offset_plain);
-
-		if (e->event.msg.message == NULL) {
-			gg_debug_session(sess, GG_DEBUG_MISC, "// gg_session_handle_recv_msg_80() out of memory\n");
-			goto fail;
-		}
-	} else {
-		if (offset_plain > sizeof(struct gg_recv_msg80)) {
-			size_t len, fmt_len;
-
-			len = gg_message_html_to_text(NULL, NULL, &fmt_len, packet + sizeof(struct gg_recv_msg80), GG_ENCODING_UTF8);
-			e->event.msg.message = malloc(len + 1);
-
-			if (e->event.msg.message == NULL) {
-				gg_debug_session(sess, GG_DEBUG_MISC, "// gg_session_handle_recv_msg_80() out of memory\n");
-				goto fail;
-			}
-
-			free(e->event.msg.formats);
-			e->event.msg.formats_length = fmt_len;
-			e->event.msg.formats = malloc(fmt_len);
-
-			if (e->event.msg.formats == NULL) {
-				gg_debug_session(sess, GG_DEBUG_MISC, "// gg_session_handle_recv_msg_80() out of memory\n");
-				goto fail;
-			}
-
-			gg_message_html_to_text((char*) e->event.msg.message, e->event.msg.formats, NULL, packet + sizeof(struct gg_recv_msg80), GG_ENCODING_UTF8);
-		} else {
-			e->event.msg.message = (unsigned char*) gg_encoding_convert(packet + offset_plain, GG_ENCODING_CP1250, sess->encoding, -1, -1);
+	if (sess->lazy_messages) {
+		size_t raw_length;
 
-			if (e->event.msg.message == NULL) {
-				gg_debug_session(sess, GG_DEBUG_MISC, "// gg_session_handle_recv_msg_80() out of memory\n");
-				goto fail;
-			}
-		}
-	}
+		raw_length = offset_plain - sizeof(struct gg_recv_msg80) + strlen(packet + offset_plain) + 1;
 
-	if (offset_plain > sizeof(struct gg_recv_msg80)) {
-		e->event.msg.xhtml_message = gg_encoding_convert(packet + sizeof(struct gg_recv_msg80), GG_ENCODING_UTF8, sess->encoding, -1, -1);
+		e->event.msg.raw = malloc(raw_length);
 
-		if (e->event.msg.xhtml_message == NULL) {
+		if (e->event.msg.raw == NULL) {
 			gg_debug_session(sess, GG_DEBUG_MISC, "// gg_session_handle_recv_msg_80() out of memory\n");
 			goto fail;
 		}
+
+		memcpy(e->event.msg.raw, packet + sizeof(struct gg_recv_msg80), raw_length);
+		e->event.msg.raw_plain_offset = offset_plain - sizeof(struct gg_recv_msg80);
+		e->event.msg.raw_encoding = sess->encoding;
 	} else {
-		size_t len;
+		const char *html = NULL;
 
-		len = gg_message_text_to_html(NULL, (char*) e->event.msg.message, sess->encoding, e->event.msg.formats, e->event.msg.formats_length);
-		e->event.msg.xhtml_message = malloc(len + 1);
+		if (offset_plain > sizeof(struct gg_recv_msg80))
+			html = packet + sizeof(struct gg_recv_msg80);
 
-		if (e->event.msg.xhtml_message == NULL) {
+		if (gg_event_msg_decode(&e->event.msg, html, packet + offset_plain, sess->encoding, GG_EVENT_MSG_DECODE_TEXT | GG_EVENT_MSG_DECODE_XHTML) == -1) {
 			gg_debug_session(sess, GG_DEBUG_MISC, "// gg_session_handle_recv_msg_80() out of memory\n");
 			goto fail;
 		}
-
-		gg_message_text_to_html(e->event.msg.xhtml_message, (char*) e->event.msg.message, sess->encoding, e->event.msg.formats, e->event.msg.formats_length);
 	}
 
 	gg_session_send_msg_ack(sess, gg_fix32(r->seq));
@@ -978,6 +998,7 @@ fail:
 	free(e->event.msg.xhtml_message);
 	free(e->event.msg.recipients);
 	free(e->event.msg.formats);
+	free(e->event.msg.raw);
 	return -1;
 
 malformed:
@@ -1734,6 +1755,22 @@ static int gg_session_handle_userlist_100_version(struct gg_session *gs, uint32_
 	return 0;
 }
 
+/**
+ * \internal Przekazuje zdekompresowany fragment listy kontaktów aplikacji.
+ *
+ * \param buf Bufor z danymi
+ * \param len Długość danych
+ * \param data Struktura sesji
+ *
+ * \return Wynik funkcji odbierającej listę kontaktów
+ */
+static int gg_session_userlist_100_sink(const char *buf, size_t len, void *data)
+{
+	struct gg_session *gs = data;
+
+	return gs->userlist_sink(gs, GG_EVENT_USERLIST100_REPLY, buf, len, gs->userlist_sink_data);
+}
+
 /**
  * \internal Obsługuje pakiet GG_USERLIST100_REPLY.
  *
@@ -1746,13 +1783,21 @@ static int gg_session_handle_userlist_100_reply(struct gg_session *gs, uint32_t
 
 	gg_debug_session(gs, GG_DEBUG_MISC, "// gg_watch_fd_connected() received userlist 100 reply\n");
 
-	if (len > sizeof(*reply)) {
-		data = gg_inflate((const unsigned char*) ptr + sizeof(*reply), len - sizeof(*reply));
+	if (len > sizeof(*reply) && gs->userlist_sink != NULL) {
+		if (gg_inflate_sink(gs, (const unsigned char*) ptr + sizeof(*reply), len - sizeof(*reply), gg_session_userlist_100_sink, gs) == -1) {
+			gg_debug_session(gs, GG_DEBUG_MISC, "// gg_handle_userlist_100_reply() gg_inflate_sink() failed\n");
+			return -1;
+		}
+	} else if (len > sizeof(*reply)) {
+		data = gg_inflate_session(gs, (const unsigned char*) ptr + sizeof(*reply), len - sizeof(*reply), gs->inflate_size_hint);
 		
 		if (data == NULL) {
-			gg_debug_session(gs, GG_DEBUG_MISC, "// gg_handle_userlist_100_reply() gg_inflate() failed\n");
+			gg_debug_session(gs, GG_DEBUG_MISC, "// gg_handle_userlist_100_reply() gg_inflate_session() failed\n");
 			return -1;
 		}
+
+		/* Kolejna wersja listy kontaktów będzie zapewne podobnej długości. */
+		gs->inflate_size_hint = strlen(data);
 	}
 
 	ge->type = GG_EVENT_USERLIST100_REPLY;
@@ -26,13 +26,630 @@
 
 #include "strman.h"
 #include "network.h"
+#ifdef sun
+#  include <sys/filio.h>
+#endif
 #include "libgadu.h"
 #include "resolver.h"
+#include "internal.h"
 
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+/** \internal Rozmiar porcji danych odczytywanych z gniazda */
+#define GG_HTTP_READ_SIZE 4096
+
+/** \internal Czas, po którym bezczynne połączenie jest zamykane */
+#define GG_HTTP_POOL_TIMEOUT 15
+
+/** \internal Czas przechowywania rozwiązanych nazw serwerów */
+#define GG_HTTP_DNS_TTL 60
+
+/**
+ * \internal Bezczynne połączenie HTTP oczekujące na kolejne zapytanie.
+ */
+struct gg_http_pool_entry {
+	char *host;		/**< Nazwa serwera */
+	int port;		/**< Port serwera */
+	int fd;			/**< Deskryptor połączenia */
+	time_t time;		/**< Czas zakończenia ostatniego zapytania */
+
+	struct gg_http_pool_entry *next;	/**< Kolejny element listy */
+};
+
+/** \internal Lista bezczynnych połączeń */
+static struct gg_http_pool_entry *gg_http_pool;
+
+/** \internal Maksymalna liczba bezczynnych połączeń z jednym serwerem */
+static unsigned int gg_http_pool_limit;
+
+/**
+ * \internal Rozwiązana nazwa serwera.
+ */
+struct gg_http_dns_entry {
+	char *hostname;		/**< Nazwa serwera */
+	struct in_addr addr;	/**< Adres serwera */
+	time_t time;		/**< Czas rozwiązania nazwy */
+
+	struct gg_http_dns_entry *next;	/**< Kolejny element listy */
+};
+
+/** \internal Lista rozwiązanych nazw serwerów */
+static struct gg_http_dns_entry *gg_http_dns;
+
+/** \internal Liczba użytkowników pamięci podręcznej nazw serwerów */
+static int gg_http_dns_refs;
+
+/**
+ * \internal Włącza wspólną pamięć podręczną nazw serwerów.
+ *
+ * Pamięć podręczna jest używana tylko wtedy, gdy istnieje obiekt
+ * \c gg_http_multi, więc pojedyncze połączenia zachowują się jak dotąd.
+ */
+void gg_http_dns_ref(void)
+{
+	gg_http_dns_refs++;
+}
+
+/**
+ * \internal Wyłącza wspólną pamięć podręczną nazw serwerów.
+ *
+ * Po zwolnieniu ostatniego użytkownika pamięć podręczna jest opróżniana.
+ */
+void gg_http_dns_unref(void)
+{
+	if (gg_http_dns_refs == 0 || --gg_http_dns_refs != 0)
+		return;
+
+	while (gg_http_dns != NULL) {
+		struct gg_http_dns_entry *de = gg_http_dns;
+
+		gg_http_dns = de->next;
+		free(de->hostname);
+		free(de);
+	}
+}
+
+/**
+ * \internal Szuka adresu serwera w pamięci podręcznej.
+ *
+ * \param hostname Nazwa serwera
+ * \param addr Wskaźnik na zmienną, do której zostanie zapisany adres
+ *
+ * \return 1 jeśli znaleziono adres, 0 w przeciwnym wypadku
+ */
+int gg_http_dns_find(const char *hostname, struct in_addr *addr)
+{
+	struct gg_http_dns_entry **dep = &gg_http_dns;
+	time_t now;
+
+	if (gg_http_dns_refs == 0)
+		return 0;
+
+	now = time(NULL);
+
+	while (*dep != NULL) {
+		struct gg_http_dns_entry *de = *dep;
+
+		if (now - de->time > GG_HTTP_DNS_TTL) {
+			*dep = de->next;
+			free(de->hostname);
+			free(de);
+			continue;
+		}
+
+		if (strcmp(de->hostname, hostname) == 0) {
+			*addr = de->addr;
+			return 1;
+		}
+
+		dep = &de->next;
+	}
+
+	return 0;
+}
+
+/**
+ * \internal Zapisuje adres serwera w pamięci podręcznej.
+ *
+ * \param hostname Nazwa serwera
+ * \param addr Adres serwera
+ */
+static void gg_http_dns_add(const char *hostname, struct in_addr addr)
+{
+	struct gg_http_dns_entry *de;
+
+	if (gg_http_dns_refs == 0 || hostname == NULL)
+		return;
+
+	for (de = gg_http_dns; de != NULL; de = de->next) {
+		if (strcmp(de->hostname, hostname) == 0) {
+			de->addr = addr;
+			de->time = time(NULL);
+			return;
+		}
+	}
+
+	de = malloc(sizeof(struct gg_http_dns_entry));
+
+	if (de == NULL)
+		return;
+
+	de->hostname = strdup(hostname);
+
+	if (de->hostname == NULL) {
+		free(de);
+		return;
+	}
+
+	de->addr = addr;
+	de->time = time(NULL);
+	de->next = gg_http_dns;
+	gg_http_dns = de;
+}
+
+/**
+ * \internal Włącza lub wyłącza tryb nieblokujący gniazda.
+ *
+ * \param fd Deskryptor gniazda
+ * \param async Flaga trybu nieblokującego
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+static int gg_http_set_async(int fd, int async)
+{
+#ifdef FIONBIO
+	int value = (async) ? 1 : 0;
+
+	return ioctl(fd, FIONBIO, &value);
+#else
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+
+	if (flags == -1)
+		return -1;
+
+	return fcntl(fd, F_SETFL, (async) ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+#endif
+}
+
+/**
+ * \internal Zamyka bezczynne połączenie i zwalnia element listy.
+ *
+ * \param pe Element listy
+ */
+static void gg_http_pool_entry_free(struct gg_http_pool_entry *pe)
+{
+	close(pe->fd);
+	free(pe->host);
+	free(pe);
+}
+
+/**
+ * \internal Pobiera bezczynne połączenie z danym serwerem.
+ *
+ * Połączenia zamknięte przez serwer lub bezczynne zbyt długo są przy okazji
+ * usuwane.
+ *
+ * \param host Nazwa serwera
+ * \param port Port serwera
+ * \param async Flaga połączenia asynchronicznego
+ *
+ * \return Deskryptor połączenia lub -1, jeśli nie ma bezczynnego połączenia
+ */
+static int gg_http_pool_get(const char *host, int port, int async)
+{
+	struct gg_http_pool_entry **pep = &gg_http_pool;
+	time_t now = time(NULL);
+
+	while (*pep != NULL) {
+		struct gg_http_pool_entry *pe = *pep;
+		char ch;
+		int res;
+
+		if (now - pe->time > GG_HTTP_POOL_TIMEOUT) {
+			*pep = pe->next;
+			gg_http_pool_entry_free(pe);
+			continue;
+		}
+
+		if (pe->port != port || strcmp(pe->host, host) != 0) {
+			pep = &pe->next;
+			continue;
+		}
+
+		*pep = pe->next;
+
+		/* gniazda w puli są nieblokujące, więc jeśli serwer niczego
+		 * nie wysłał ani nie zamknął połączenia, dostaniemy EAGAIN */
+
+		res = recv(pe->fd, &ch, 1, MSG_PEEK);
+
+		if (res != -1 || errno != EAGAIN || gg_http_set_async(pe->fd, async) == -1) {
+			gg_debug(GG_DEBUG_MISC, "// gg_http_pool_get() connection to %s:%d closed by server\n", host, port);
+			gg_http_pool_entry_free(pe);
+			continue;
+		}
+
+		res = pe->fd;
+		free(pe->host);
+		free(pe);
+
+		return res;
+	}
+
+	return -1;
+}
+
+/**
+ * \internal Odkłada połączenie do ponownego wykorzystania.
+ *
+ * Jeśli z serwerem jest już dość bezczynnych połączeń, połączenie jest
+ * zamykane.
+ *
+ * \param h Struktura połączenia
+ */
+static void gg_http_pool_put(struct gg_http *h)
+{
+	struct gg_http_pool_entry *pe;
+	unsigned int count = 0;
+
+	for (pe = gg_http_pool; pe != NULL; pe = pe->next) {
+		if (pe->port == h->port && strcmp(pe->host, h->pool_host) == 0)
+			count++;
+	}
+
+	pe = NULL;
+
+	if (count < gg_http_pool_limit && gg_http_set_async(h->fd, 1) != -1)
+		pe = malloc(sizeof(struct gg_http_pool_entry));
+
+	if (pe != NULL && (pe->host = strdup(h->pool_host)) == NULL) {
+		free(pe);
+		pe = NULL;
+	}
+
+	if (pe == NULL) {
+		gg_debug(GG_DEBUG_MISC, "=> http, we're done, closing socket\n");
+		close(h->fd);
+		h->fd = -1;
+		return;
+	}
+
+	gg_debug(GG_DEBUG_MISC, "=> http, we're done, keeping connection to %s:%d\n", h->pool_host, h->port);
+
+	pe->port = h->port;
+	pe->fd = h->fd;
+	pe->time = time(NULL);
+	pe->next = gg_http_pool;
+	gg_http_pool = pe;
+
+	h->fd = -1;
+}
+
+/**
+ * Ustawia liczbę bezczynnych połączeń HTTP utrzymywanych z każdym serwerem.
+ *
+ * Po włączeniu zapytania wysyłane przez \c gg_http_connect() i korzystające
+ * z niej usługi katalogu publicznego proszą serwer o utrzymanie połączenia.
+ * Jeśli serwer się zgodzi i poda długość odpowiedzi, połączenie jest po
+ * odebraniu odpowiedzi odkładane i wykorzystywane przy kolejnym zapytaniu
+ * do tego samego serwera, bez rozwiązywania nazwy i nawiązywania
+ * połączenia. Bezczynne połączenia są zamykane po 15 sekundach.
+ *
+ * Zmiana ustawienia zamyka wszystkie bezczynne połączenia. Pula nie jest
+ * chroniona przed jednoczesnym dostępem, więc dopóki jest włączona,
+ * wszystkie połączenia HTTP, również usług katalogu publicznego, muszą
+ * być obsługiwane przez jeden wątek.
+ *
+ * \param limit Maksymalna liczba bezczynnych połączeń z jednym serwerem
+ *              lub 0, by wyłączyć utrzymywanie połączeń
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup http
+ */
+int gg_global_set_http_pool(unsigned int limit)
+{
+	gg_debug(GG_DEBUG_FUNCTION, "** gg_global_set_http_pool(%u);\n", limit);
+
+	gg_http_pool_limit = limit;
+
+	while (gg_http_pool != NULL) {
+		struct gg_http_pool_entry *pe = gg_http_pool;
+
+		gg_http_pool = pe->next;
+		gg_http_pool_entry_free(pe);
+	}
+
+	return 0;
+}
+
+/**
+ * \internal Rozpoczyna rozwiązywanie nazwy serwera i łączenie się z nim.
+ *
+ * \param h Struktura połączenia
+ * \param hostname Nazwa serwera
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+static int gg_http_start(struct gg_http *h, const char *hostname)
+{
+	if (h->async) {
+		if (h->resolver_start(&h->fd, &h->resolver, hostname) == -1) {
+			gg_debug(GG_DEBUG_MISC, "// gg_http_connect() resolver failed\n");
+			errno = ENOENT;
+			return -1;
+		}
+
+		gg_debug(GG_DEBUG_MISC, "// gg_http_connect() resolver = %p\n", h->resolver);
+
+		h->state = GG_STATE_RESOLVING;
+		h->check = GG_CHECK_READ;
+		h->timeout = GG_DEFAULT_TIMEOUT;
+	} else {
+		struct in_addr *addr_list = NULL;
+		unsigned int addr_count;
+
+		if (gg_gethostbyname_real(hostname, &addr_list, &addr_count, 0) == -1 || addr_count == 0) {
+			gg_debug(GG_DEBUG_MISC, "// gg_http_connect() host not found\n");
+			free(addr_list);
+			errno = ENOENT;
+			return -1;
+		}
+
+		h->fd = gg_connect(&addr_list[0], h->port, 0);
+
+		if (h->fd == -1) {
+			gg_debug(GG_DEBUG_MISC, "// gg_http_connect() connection failed (errno=%d, %s)\n", errno, strerror(errno));
+			free(addr_list);
+			return -1;
+		}
+
+		free(addr_list);
+
+		h->state = GG_STATE_CONNECTING;
+	}
+
+	return 0;
+}
+
+/**
+ * \internal Rozpoczyna połączenie, wykorzystując bezczynne połączenie
+ * z serwerem lub zapamiętany adres serwera.
+ *
+ * \param h Struktura połączenia
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+static int gg_http_begin(struct gg_http *h)
+{
+	struct in_addr addr;
+
+	if (h->pool_host != NULL) {
+		h->fd = gg_http_pool_get(h->pool_host, h->port, h->async);
+
+		/* serwer mógł zamknąć połączenie w międzyczasie, więc
+		 * zachowujemy zapytanie do ponownego wysłania */
+
+		if (h->fd != -1 && (h->pool_query = strdup(h->query)) == NULL) {
+			close(h->fd);
+			h->fd = -1;
+		}
+
+		if (h->fd != -1) {
+			gg_debug(GG_DEBUG_MISC, "// gg_http_connect() reusing connection to %s:%d\n", h->hostname, h->port);
+
+			h->state = GG_STATE_SENDING_QUERY;
+			h->check = GG_CHECK_WRITE;
+			h->timeout = GG_DEFAULT_TIMEOUT;
+
+			return 0;
+		}
+	}
+
+	if (gg_http_dns_find(h->hostname, &addr)) {
+		gg_debug(GG_DEBUG_MISC, "// gg_http_connect() connecting to cached address %s:%d\n", inet_ntoa(addr), h->port);
+
+		h->fd = gg_connect(&addr, h->port, h->async);
+
+		if (h->fd == -1) {
+			gg_debug(GG_DEBUG_MISC, "// gg_http_connect() connection failed (errno=%d, %s)\n", errno, strerror(errno));
+			return -1;
+		}
+
+		h->state = GG_STATE_CONNECTING;
+		h->check = GG_CHECK_WRITE;
+		h->timeout = GG_DEFAULT_TIMEOUT;
+
+		return 0;
+	}
+
+	return gg_http_start(h, h->hostname);
+}
+
+/**
+ * \internal Wstrzymuje rozpoczęte połączenie asynchroniczne.
+ *
+ * Rozwiązywanie nazwy jest przerywane, a ponownie wykorzystane połączenie
+ * wraca do puli. Połączenie można wznowić funkcją \c gg_http_resume().
+ * Nie można wstrzymać połączenia, które zaczęło już wysyłać zapytanie,
+ * bo jego treść nie jest już dostępna w całości.
+ *
+ * \param h Struktura połączenia
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+int gg_http_park(struct gg_http *h)
+{
+	int sending;
+
+	/* ponownie wykorzystanym połączeniem mogło jeszcze nic nie zostać
+	 * wysłane, a zapytanie mamy wtedy w całości */
+
+	sending = (h->state == GG_STATE_SENDING_QUERY && h->pool_query != NULL && h->query != NULL && strlen(h->query) == strlen(h->pool_query));
+
+	if (h->state != GG_STATE_IDLE && h->state != GG_STATE_RESOLVING && h->state != GG_STATE_CONNECTING && !sending) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (h->state == GG_STATE_RESOLVING)
+		h->resolver_cleanup(&h->resolver, 1);
+
+	if (h->fd != -1) {
+		if (h->pool_query != NULL) {
+			gg_http_pool_put(h);
+		} else {
+			close(h->fd);
+			h->fd = -1;
+		}
+	}
+
+	free(h->pool_query);
+	h->pool_query = NULL;
+
+	h->state = GG_STATE_IDLE;
+	h->check = 0;
+
+	return 0;
+}
+
+/**
+ * \internal Wznawia połączenie wstrzymane funkcją \c gg_http_park().
+ *
+ * \param h Struktura połączenia
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+int gg_http_resume(struct gg_http *h)
+{
+	if (gg_http_begin(h) == -1) {
+		h->state = GG_STATE_ERROR;
+		h->error = GG_ERROR_CONNECTING;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * \internal Sprawdza, czy zapytanie można bezpiecznie wysłać ponownie.
+ *
+ * \param query Treść zapytania
+ *
+ * \return 1 jeśli powtórzenie zapytania nie zmienia stanu serwera, 0 jeśli
+ *         zmienia
+ */
+static int gg_http_idempotent(const char *query)
+{
+	return (strncmp(query, "GET ", 4) == 0 || strncmp(query, "HEAD ", 5) == 0);
+}
+
+/**
+ * \internal Nawiązuje nowe połączenie, gdy serwer zamknął ponownie
+ * wykorzystane połączenie przed wysłaniem odpowiedzi.
+ *
+ * Zapytania, które mogą zmienić stan serwera, są ponawiane tylko wtedy,
+ * gdy nie udało się ich wysłać.
+ *
+ * \param h Struktura połączenia
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+static int gg_http_retry(struct gg_http *h)
+{
+	gg_debug(GG_DEBUG_MISC, "=> http, reused connection closed, reconnecting\n");
+
+	close(h->fd);
+	h->fd = -1;
+
+	free(h->query);
+	h->query = h->pool_query;
+	h->pool_query = NULL;
+
+	return gg_http_start(h, h->hostname);
+}
+
+/**
+ * \internal Przygotowuje połączenie HTTP bez jego rozpoczynania.
+ *
+ * Parametry jak dla \c gg_http_connect(). Połączenie ma stan
+ * \c GG_STATE_IDLE i można je rozpocząć funkcją \c gg_http_resume().
+ *
+ * \return Zaalokowana struktura \c gg_http lub NULL, jeśli wystąpił błąd.
+ */
+struct gg_http *gg_http_prepare(const char *hostname, int port, int async, const char *method, const char *path, const char *header)
+{
+	struct gg_http *h;
+	const char *version = "1.0";
+
+	if (!hostname || !port || !method || !path || !header) {
+		gg_debug(GG_DEBUG_MISC, "// gg_http_prepare() invalid arguments\n");
+		errno = EFAULT;
+		return NULL;
+	}
+
+	if (!(h = malloc(sizeof(*h))))
+		return NULL;
+	memset(h, 0, sizeof(*h));
+
+	h->async = async;
+	h->port = port;
+	h->fd = -1;
+	h->type = GG_SESSION_HTTP;
+
+	gg_http_set_resolver(h, GG_RESOLVER_DEFAULT);
+
+	/* HTTP/1.1 domyślnie utrzymuje połączenie, ale serwer może wtedy
+	 * przesłać odpowiedź w częściach */
+	if (gg_http_pool_limit != 0)
+		version = "1.1";
+
+	if (gg_proxy_enabled) {
+		char *auth = gg_proxy_auth();
+
+		h->query = gg_saprintf("%s http://%s:%d%s HTTP/%s\r\n%s%s",
+				method, hostname, port, path, version,
+				(auth) ? auth : "", header);
+		hostname = gg_proxy_host;
+		h->port = port = gg_proxy_port;
+		free(auth);
+
+	} else {
+		h->query = gg_saprintf("%s %s HTTP/%s\r\n%s",
+				method, path, version, header);
+	}
+
+	if (h->query == NULL) {
+		gg_debug(GG_DEBUG_MISC, "// gg_http_prepare() not enough memory for query\n");
+		free(h);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	gg_debug(GG_DEBUG_MISC, "=> -----BEGIN-HTTP-QUERY-----\n%s\n=> -----END-HTTP-QUERY-----\n", h->query);
+
+	if (!(h->hostname = strdup(hostname))) {
+		gg_debug(GG_DEBUG_MISC, "// gg_http_prepare() not enough memory for hostname\n");
+		gg_http_free(h);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (gg_http_pool_limit != 0)
+		h->pool_host = strdup(hostname);
+
+	h->callback = gg_http_watch_fd;
+	h->destroy = gg_http_free;
+
+	return h;
+}
 
 /**
  * Rozpoczyna połączenie HTTP.
@@ -64,101 +681,241 @@ struct gg_http *gg_http_connect(const char *hostname, int port, int async, const
 {
 	struct gg_http *h;
 
-	if (!hostname || !port || !method || !path || !header) {
-		gg_debug(GG_DEBUG_MISC, "// gg_http_connect() invalid arguments\n");
-		errno = EFAULT;
+	h = gg_http_prepare(hostname, port, async, method, path, header);
+
+	if (h == NULL)
 		return NULL;
-	}
 
-	if (!(h = malloc(sizeof(*h))))
+	if (gg_http_begin(h) == -1) {
+		int errno2 = errno;
+
+		gg_http_free(h);
+		errno = errno2;
 		return NULL;
-	memset(h, 0, sizeof(*h));
+	}
 
-	h->async = async;
-	h->port = port;
-	h->fd = -1;
-	h->type = GG_SESSION_HTTP;
+	if (!async) {
+		while (h->state != GG_STATE_ERROR && h->state != GG_STATE_PARSING) {
+			if (gg_http_watch_fd(h) == -1)
+				break;
+		}
 
-	gg_http_set_resolver(h, GG_RESOLVER_DEFAULT);
+		if (h->state != GG_STATE_PARSING) {
+			gg_debug(GG_DEBUG_MISC, "// gg_http_connect() some strange error\n");
+			gg_http_free(h);
+			return NULL;
+		}
+	}
 
-	if (gg_proxy_enabled) {
-		char *auth = gg_proxy_auth();
+	return h;
+}
 
-		h->query = gg_saprintf("%s http://%s:%d%s HTTP/1.0\r\n%s%s",
-				method, hostname, port, path, (auth) ? auth :
-				"", header);
-		hostname = gg_proxy_host;
-		h->port = port = gg_proxy_port;
-		free(auth);
+/**
+ * \internal Stany analizy odpowiedzi przesyłanej w częściach.
+ */
+enum {
+	GG_HTTP_CHUNK_SIZE_START = 0,	/**< Początek rozmiaru części */
+	GG_HTTP_CHUNK_SIZE,		/**< Rozmiar części */
+	GG_HTTP_CHUNK_EXTENSION,	/**< Rozszerzenia do końca wiersza */
+	GG_HTTP_CHUNK_DATA,		/**< Treść części */
+	GG_HTTP_CHUNK_DATA_END,		/**< Koniec wiersza po treści części */
+	GG_HTTP_CHUNK_TRAILER,		/**< Początek wiersza nagłówka końcowego */
+	GG_HTTP_CHUNK_TRAILER_LINE,	/**< Wiersz nagłówka końcowego */
+	GG_HTTP_CHUNK_DONE		/**< Odebrano całą odpowiedź */
+};
 
-	} else {
-		h->query = gg_saprintf("%s %s HTTP/1.0\r\n%s",
-				method, path, header);
-	}
+/**
+ * \internal Przekazuje fragment treści odpowiedzi funkcji odbierającej lub
+ * dopisuje go do bufora.
+ *
+ * \param h Struktura połączenia
+ * \param buf Bufor z danymi
+ * \param len Długość danych
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+static int gg_http_body_append(struct gg_http *h, const char *buf, size_t len)
+{
+	if (h->body_sink != NULL) {
+		if (h->body_sink(h, buf, len, h->body_sink_data) == -1) {
+			gg_debug(GG_DEBUG_MISC, "=> http, body sink failed\n");
+			return -1;
+		}
 
-	if (h->query == NULL) {
-		gg_debug(GG_DEBUG_MISC, "// gg_http_connect() not enough memory for query\n");
-		free(h);
-		errno = ENOMEM;
-		return NULL;
+		h->body_done += len;
+
+		return 0;
 	}
 
-	gg_debug(GG_DEBUG_MISC, "=> -----BEGIN-HTTP-QUERY-----\n%s\n=> -----END-HTTP-QUERY-----\n", h->query);
+	if (h->body_done + len + 1 > h->body_alloc) {
+		unsigned int size = h->body_alloc * 2;
+		char *tmp;
 
-	if (async) {
-		if (h->resolver_start(&h->fd, &h->resolver, hostname) == -1) {
-			gg_debug(GG_DEBUG_MISC, "// gg_http_connect() resolver failed\n");
-			gg_http_free(h);
-			errno = ENOENT;
-			return NULL;
-		}
+		if (size < h->body_done + len + 1)
+			size = h->body_done + len + 1;
 
-		gg_debug(GG_DEBUG_MISC, "// gg_http_connect() resolver = %p\n", h->resolver);
+		gg_debug(GG_DEBUG_MISC, "=> http, enlarging body buffer (%d bytes)\n", size);
 
-		h->state = GG_STATE_RESOLVING;
-		h->check = GG_CHECK_READ;
-		h->timeout = GG_DEFAULT_TIMEOUT;
-	} else {
-		struct in_addr *addr_list = NULL;
-		unsigned int addr_count;
+		tmp = realloc(h->body, size);
 
-		if (gg_gethostbyname_real(hostname, &addr_list, &addr_count, 0) == -1 || addr_count == 0) {
-			gg_debug(GG_DEBUG_MISC, "// gg_http_connect() host not found\n");
-			gg_http_free(h);
-			free(addr_list);
-			errno = ENOENT;
-			return NULL;
+		if (tmp == NULL) {
+			gg_debug(GG_DEBUG_MISC, "=> http, not enough memory for data (%d needed)\n", size);
+			return -1;
 		}
 
-		h->fd = gg_connect(&addr_list[0], port, 0);
+		h->body = tmp;
+		h->body_alloc = size;
+	}
 
-		if (h->fd == -1) {
-			gg_debug(GG_DEBUG_MISC, "// gg_http_connect() connection failed (errno=%d, %s)\n", errno, strerror(errno));
-			gg_http_free(h);
-			free(addr_list);
-			return NULL;
+	memcpy(h->body + h->body_done, buf, len);
+	h->body_done += len;
+	h->body[h->body_done] = 0;
+
+	return 0;
+}
+
+/**
+ * \internal Analizuje kolejny fragment treści odpowiedzi.
+ *
+ * Odpowiedź przesyłana w częściach jest analizowana bajt po bajcie tylko
+ * w wierszach rozmiaru i nagłówkach końcowych, więc fragment może się
+ * kończyć w dowolnym miejscu.
+ *
+ * \param h Struktura połączenia
+ * \param buf Bufor z danymi
+ * \param len Długość danych
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+static int gg_http_body_feed(struct gg_http *h, const char *buf, size_t len)
+{
+	if (!h->chunked) {
+		if (h->keep_alive && h->body_done + len > h->body_size) {
+			gg_debug(GG_DEBUG_MISC, "=> http, too much data (%d bytes, %d needed)\n", h->body_done + len, h->body_size);
+			h->keep_alive = 0;
 		}
 
-		free(addr_list);
+		return gg_http_body_append(h, buf, len);
+	}
 
-		h->state = GG_STATE_CONNECTING;
+	while (len > 0) {
+		unsigned char ch = *buf;
+		size_t count;
+
+		switch (h->chunk_state) {
+			case GG_HTTP_CHUNK_SIZE_START:
+			case GG_HTTP_CHUNK_SIZE:
+				if (isxdigit(ch)) {
+					if (h->chunk_left > (UINT_MAX >> 4))
+						goto invalid;
+
+					h->chunk_left = h->chunk_left * 16 + (isdigit(ch) ? ch - '0' : tolower(ch) - 'a' + 10);
+					h->chunk_state = GG_HTTP_CHUNK_SIZE;
+				} else if (h->chunk_state == GG_HTTP_CHUNK_SIZE_START) {
+					goto invalid;
+				} else if (ch == '\n') {
+					h->chunk_state = (h->chunk_left != 0) ? GG_HTTP_CHUNK_DATA : GG_HTTP_CHUNK_TRAILER;
+				} else {
+					h->chunk_state = GG_HTTP_CHUNK_EXTENSION;
+				}
 
-		while (h->state != GG_STATE_ERROR && h->state != GG_STATE_PARSING) {
-			if (gg_http_watch_fd(h) == -1)
 				break;
-		}
 
-		if (h->state != GG_STATE_PARSING) {
-			gg_debug(GG_DEBUG_MISC, "// gg_http_connect() some strange error\n");
-			gg_http_free(h);
-			return NULL;
+			case GG_HTTP_CHUNK_EXTENSION:
+				if (ch == '\n')
+					h->chunk_state = (h->chunk_left != 0) ? GG_HTTP_CHUNK_DATA : GG_HTTP_CHUNK_TRAILER;
+
+				break;
+
+			case GG_HTTP_CHUNK_DATA:
+				count = (len < h->chunk_left) ? len : h->chunk_left;
+
+				if (gg_http_body_append(h, buf, count) == -1)
+					return -1;
+
+				h->chunk_left -= count;
+
+				if (h->chunk_left == 0)
+					h->chunk_state = GG_HTTP_CHUNK_DATA_END;
+
+				buf += count;
+				len -= count;
+
+				continue;
+
+			case GG_HTTP_CHUNK_DATA_END:
+				if (ch == '\n')
+					h->chunk_state = GG_HTTP_CHUNK_SIZE_START;
+				else if (ch != '\r')
+					goto invalid;
+
+				break;
+
+			case GG_HTTP_CHUNK_TRAILER:
+				if (ch == '\n')
+					h->chunk_state = GG_HTTP_CHUNK_DONE;
+				else if (ch != '\r')
+					h->chunk_state = GG_HTTP_CHUNK_TRAILER_LINE;
+
+				break;
+
+			case GG_HTTP_CHUNK_TRAILER_LINE:
+				if (ch == '\n')
+					h->chunk_state = GG_HTTP_CHUNK_TRAILER;
+
+				break;
+
+			default:
+				gg_debug(GG_DEBUG_MISC, "=> http, data after last chunk (%d bytes)\n", len);
+				h->keep_alive = 0;
+				return 0;
 		}
+
+		buf++;
+		len--;
 	}
 
-	h->callback = gg_http_watch_fd;
-	h->destroy = gg_http_free;
+	return 0;
 
-	return h;
+invalid:
+	gg_debug(GG_DEBUG_MISC, "=> http, invalid chunk\n");
+	return -1;
+}
+
+/**
+ * \internal Sprawdza, czy odebrano całą odpowiedź przed zamknięciem
+ * połączenia przez serwer.
+ *
+ * \param h Struktura połączenia
+ *
+ * \return 1 jeśli odebrano całą odpowiedź, 0 w przeciwnym wypadku
+ */
+static int gg_http_body_complete(struct gg_http *h)
+{
+	if (h->chunked)
+		return (h->chunk_state == GG_HTTP_CHUNK_DONE);
+
+	return (h->keep_alive && h->body_done == h->body_size);
+}
+
+/**
+ * \internal Kończy odbieranie odpowiedzi.
+ *
+ * \param h Struktura połączenia
+ */
+static void gg_http_finish(struct gg_http *h)
+{
+	h->body_size = h->body_done;
+
+	if (h->keep_alive) {
+		gg_http_pool_put(h);
+	} else {
+		gg_debug(GG_DEBUG_MISC, "=> http, we're done, closing socket\n");
+		close(h->fd);
+		h->fd = -1;
+	}
+
+	h->state = GG_STATE_PARSING;
 }
 
 #ifndef DOXYGEN
@@ -217,6 +974,8 @@ int gg_http_watch_fd(struct gg_http *h)
 		close(h->fd);
 		h->fd = -1;
 
+		gg_http_dns_add(h->hostname, addr);
+
 		gg_debug(GG_DEBUG_MISC, "=> http, connecting to %s:%d\n", inet_ntoa(addr), h->port);
 
 		h->fd = gg_connect(&addr, h->port, h->async);
@@ -260,6 +1019,10 @@ int gg_http_watch_fd(struct gg_http *h)
 
 		if (res == -1 && errno != EINTR && errno != EAGAIN) {
 			gg_debug(GG_DEBUG_MISC, "=> http, send() failed (len=%d, res=%d, errno=%d)\n", strlen(h->query), res, errno);
+
+			if (h->pool_query != NULL && gg_http_retry(h) == 0)
+				return 0;
+
 			gg_http_error(GG_ERROR_WRITING);
 		}
 
@@ -280,6 +1043,14 @@ int gg_http_watch_fd(struct gg_http *h)
 			free(h->query);
 			h->query = NULL;
 
+			/* serwer mógł wykonać zapytanie przed zamknięciem
+			 * połączenia, więc np. rejestracji nie powtarzamy */
+
+			if (h->pool_query != NULL && !gg_http_idempotent(h->pool_query)) {
+				free(h->pool_query);
+				h->pool_query = NULL;
+			}
+
 			h->state = GG_STATE_READING_HEADER;
 			h->check = GG_CHECK_READ;
 			h->timeout = GG_DEFAULT_TIMEOUT;
@@ -289,13 +1060,41 @@ int gg_http_watch_fd(struct gg_http *h)
 	}
 
 	if (h->state == GG_STATE_READING_HEADER) {
-		char buf[1024], *tmp;
+		unsigned int i, start, end = 0, left;
+		int has_length = 0;
+		char *line;
 		int res;
 
-		res = recv(h->fd, buf, sizeof(buf), 0);
+		/* bufor rośnie dwukrotnie, żeby długi nagłówek nie był
+		 * kopiowany przy każdym odczycie */
+
+		if (h->header_alloc - h->header_size < GG_HTTP_READ_SIZE + 1) {
+			size_t size;
+			char *tmp;
+
+			size = (h->header_alloc != 0) ? h->header_alloc * 2 : GG_HTTP_READ_SIZE + 1;
+
+			tmp = realloc(h->header, size);
+
+			if (tmp == NULL) {
+				gg_debug(GG_DEBUG_MISC, "=> http, not enough memory for header\n");
+				free(h->header);
+				h->header = NULL;
+				gg_http_error(GG_ERROR_READING);
+			}
+
+			h->header = tmp;
+			h->header_alloc = size;
+		}
+
+		res = recv(h->fd, h->header + h->header_size, GG_HTTP_READ_SIZE, 0);
 
 		if (res == -1 && errno != EINTR && errno != EAGAIN) {
 			gg_debug(GG_DEBUG_MISC, "=> http, reading header failed (errno=%d)\n", errno);
+
+			if (h->pool_query != NULL && gg_http_retry(h) == 0)
+				return 0;
+
 			if (h->header) {
 				free(h->header);
 				h->header = NULL;
@@ -310,6 +1109,10 @@ int gg_http_watch_fd(struct gg_http *h)
 
 		if (res == 0) {
 			gg_debug(GG_DEBUG_MISC, "=> http, connection reset by peer\n");
+
+			if (h->pool_query != NULL && gg_http_retry(h) == 0)
+				return 0;
+
 			if (h->header) {
 				free(h->header);
 				h->header = NULL;
@@ -319,98 +1122,142 @@ int gg_http_watch_fd(struct gg_http *h)
 
 		gg_debug(GG_DEBUG_MISC, "=> http, read %d bytes of header\n", res);
 
-		tmp = realloc(h->header, h->header_size + res + 1);
+		/* serwer zaczął odpowiadać, więc nie będziemy już ponawiać
+		 * zapytania */
 
-		if (tmp == NULL) {
-			gg_debug(GG_DEBUG_MISC, "=> http, not enough memory for header\n");
-			free(h->header);
-			h->header = NULL;
-			gg_http_error(GG_ERROR_READING);
-		}
+		free(h->pool_query);
+		h->pool_query = NULL;
 
-		h->header = tmp;
+		/* separator mógł się zacząć w poprzednio odebranych danych,
+		 * ale wcześniejszej części nagłówka nie trzeba przeglądać */
+
+		start = (h->header_size > 2) ? h->header_size - 2 : 0;
 
-		memcpy(h->header + h->header_size, buf, res);
 		h->header_size += res;
+		h->header[h->header_size] = 0;
 
 		gg_debug(GG_DEBUG_MISC, "=> http, header_buf=%p, header_size=%d\n", h->header, h->header_size);
 
-		h->header[h->header_size] = 0;
+		for (i = start; i < (unsigned int) h->header_size; i++) {
+			if (h->header[i] != '\n')
+				continue;
+
+			if (i + 1 < (unsigned int) h->header_size && h->header[i + 1] == '\n') {
+				end = i + 2;
+				break;
+			}
 
-		if ((tmp = strstr(h->header, "\r\n\r\n")) || (tmp = strstr(h->header, "\n\n"))) {
-			int sep_len = (*tmp == '\r') ? 4 : 2;
-			unsigned int left;
-			char *line;
+			if (i + 2 < (unsigned int) h->header_size && h->header[i + 1] == '\r' && h->header[i + 2] == '\n') {
+				end = i + 3;
+				break;
+			}
+		}
 
-			left = h->header_size - ((long)(tmp) - (long)(h->header) + sep_len);
+		if (end == 0)
+			return 0;
 
-			gg_debug(GG_DEBUG_MISC, "=> http, got all header (%d bytes, %d left)\n", h->header_size - left, left);
+		left = h->header_size - end;
 
-			/* HTTP/1.1 200 OK */
-			if (strlen(h->header) < 16 || strncmp(h->header + 9, "200", 3)) {
-				gg_debug(GG_DEBUG_MISC, "=> -----BEGIN-HTTP-HEADER-----\n%s\n=> -----END-HTTP-HEADER-----\n", h->header);
+		gg_debug(GG_DEBUG_MISC, "=> http, got all header (%d bytes, %d left)\n", end, left);
 
-				gg_debug(GG_DEBUG_MISC, "=> http, didn't get 200 OK -- no results\n");
-				free(h->header);
-				h->header = NULL;
-				gg_http_error(GG_ERROR_CONNECTING);
-			}
+		h->header[i] = 0;
 
-			h->body_size = 0;
-			line = h->header;
-			*tmp = 0;
+		if (i > 0 && h->header[i - 1] == '\r')
+			h->header[i - 1] = 0;
 
+		/* HTTP/1.1 200 OK */
+		if (strlen(h->header) < 16 || strncmp(h->header + 9, "200", 3)) {
 			gg_debug(GG_DEBUG_MISC, "=> -----BEGIN-HTTP-HEADER-----\n%s\n=> -----END-HTTP-HEADER-----\n", h->header);
 
-			while (line) {
-				if (!strncasecmp(line, "Content-length: ", 16)) {
-					h->body_size = atoi(line + 16);
-				}
-				line = strchr(line, '\n');
-				if (line)
-					line++;
-			}
+			gg_debug(GG_DEBUG_MISC, "=> http, didn't get 200 OK -- no results\n");
+			free(h->header);
+			h->header = NULL;
+			gg_http_error(GG_ERROR_CONNECTING);
+		}
 
-			if (h->body_size <= 0) {
-				gg_debug(GG_DEBUG_MISC, "=> http, content-length not found\n");
-				h->body_size = left;
-			}
+		h->body_size = 0;
+		line = h->header;
+
+		gg_debug(GG_DEBUG_MISC, "=> -----BEGIN-HTTP-HEADER-----\n%s\n=> -----END-HTTP-HEADER-----\n", h->header);
 
-			if (left > h->body_size) {
-				gg_debug(GG_DEBUG_MISC, "=> http, oversized reply (%d bytes needed, %d bytes left)\n", h->body_size, left);
-				h->body_size = left;
+		/* HTTP/1.1 domyślnie utrzymuje połączenie, HTTP/1.0 tylko
+		 * na wyraźną prośbę */
+		h->keep_alive = (h->pool_host != NULL && strncmp(h->header, "HTTP/1.1", 8) == 0);
+
+		while (line) {
+			if (!strncasecmp(line, "Content-length: ", 16)) {
+				h->body_size = atoi(line + 16);
+				has_length = 1;
+			}
+			if (!strncasecmp(line, "Transfer-Encoding: ", 19)) {
+				h->chunked = !strncasecmp(line + 19, "chunked", 7);
 			}
+			if (!strncasecmp(line, "Connection: ", 12) && h->pool_host != NULL) {
+				h->keep_alive = !strncasecmp(line + 12, "keep-alive", 10);
+			}
+			line = strchr(line, '\n');
+			if (line)
+				line++;
+		}
+
+		/* długość odpowiedzi przesyłanej w częściach wynika z samych
+		 * części, więc nagłówek Content-Length nie ma znaczenia */
+
+		if (h->chunked) {
+			h->body_size = 0;
+			has_length = 0;
+		}
+
+		/* bez długości odpowiedzi nie wiadomo, gdzie się kończy,
+		 * więc trzeba czekać na zamknięcie połączenia */
+		if (!has_length && !h->chunked)
+			h->keep_alive = 0;
+
+		gg_debug(GG_DEBUG_MISC, "=> http, body_size=%d, chunked=%d\n", h->body_size, h->chunked);
 
-			gg_debug(GG_DEBUG_MISC, "=> http, body_size=%d\n", h->body_size);
+		/* znając długość odpowiedzi od razu przydzielamy bufor
+		 * odpowiedniej wielkości */
 
-			if (!(h->body = malloc(h->body_size + 1))) {
-				gg_debug(GG_DEBUG_MISC, "=> http, not enough memory (%d bytes for body_buf)\n", h->body_size + 1);
+		if (h->body_sink == NULL) {
+			h->body_alloc = ((has_length) ? h->body_size : GG_HTTP_READ_SIZE) + 1;
+
+			if (h->body_alloc < left + 1)
+				h->body_alloc = left + 1;
+
+			if (!(h->body = malloc(h->body_alloc))) {
+				gg_debug(GG_DEBUG_MISC, "=> http, not enough memory (%d bytes for body_buf)\n", h->body_alloc);
 				free(h->header);
 				h->header = NULL;
 				gg_http_error(GG_ERROR_READING);
 			}
 
-			if (left) {
-				memcpy(h->body, tmp + sep_len, left);
-				h->body_done = left;
-			}
-
-			h->body[left] = 0;
+			h->body[0] = 0;
+		}
 
-			h->state = GG_STATE_READING_DATA;
-			h->check = GG_CHECK_READ;
-			h->timeout = GG_DEFAULT_TIMEOUT;
+		if (left != 0 && gg_http_body_feed(h, h->header + end, left) == -1) {
+			free(h->body);
+			h->body = NULL;
+			free(h->header);
+			h->header = NULL;
+			gg_http_error(GG_ERROR_READING);
 		}
 
+		h->state = GG_STATE_READING_DATA;
+		h->check = GG_CHECK_READ;
+		h->timeout = GG_DEFAULT_TIMEOUT;
+
+		if (gg_http_body_complete(h))
+			gg_http_finish(h);
+
 		return 0;
 	}
 
 	if (h->state == GG_STATE_READING_DATA) {
-		char buf[1024];
+		char buf[GG_HTTP_READ_SIZE];
 		int res;
 
 		res = recv(h->fd, buf, sizeof(buf), 0);
-		
+
 		if (res == -1 && errno != EINTR && errno != EAGAIN) {
 			gg_debug(GG_DEBUG_MISC, "=> http, reading body failed (errno=%d)\n", errno);
 			if (h->body) {
@@ -426,12 +1273,7 @@ int gg_http_watch_fd(struct gg_http *h)
 		}
 
 		if (res == 0) {
-			if (h->body_done >= h->body_size) {
-				gg_debug(GG_DEBUG_MISC, "=> http, we're done, closing socket\n");
-				h->state = GG_STATE_PARSING;
-				close(h->fd);
-				h->fd = -1;
-			} else {
+			if ((h->chunked && h->chunk_state != GG_HTTP_CHUNK_DONE) || (!h->chunked && h->body_done < h->body_size)) {
 				gg_debug(GG_DEBUG_MISC, "=> http, connection closed while reading (have %d, need %d)\n", h->body_done, h->body_size);
 				if (h->body) {
 					free(h->body);
@@ -440,33 +1282,25 @@ int gg_http_watch_fd(struct gg_http *h)
 				gg_http_error(GG_ERROR_READING);
 			}
 
+			h->keep_alive = 0;
+			gg_http_finish(h);
+
 			return 0;
 		}
 
 		gg_debug(GG_DEBUG_MISC, "=> http, read %d bytes of body\n", res);
 
-		if (h->body_done + res > h->body_size) {
-			char *tmp;
-
-			gg_debug(GG_DEBUG_MISC, "=> http, too much data (%d bytes, %d needed), enlarging buffer\n", h->body_done + res, h->body_size);
-
-			if (!(tmp = realloc(h->body, h->body_done + res + 1))) {
-				gg_debug(GG_DEBUG_MISC, "=> http, not enough memory for data (%d needed)\n", h->body_done + res + 1);
-				free(h->body);
-				h->body = NULL;
-				gg_http_error(GG_ERROR_READING);
-			}
-
-			h->body = tmp;
-			h->body_size = h->body_done + res;
+		if (gg_http_body_feed(h, buf, res) == -1) {
+			free(h->body);
+			h->body = NULL;
+			gg_http_error(GG_ERROR_READING);
 		}
 
-		h->body[h->body_done + res] = 0;
-		memcpy(h->body + h->body_done, buf, res);
-		h->body_done += res;
-
 		gg_debug(GG_DEBUG_MISC, "=> body_done=%d, body_size=%d\n", h->body_done, h->body_size);
 
+		if (gg_http_body_complete(h))
+			gg_http_finish(h);
+
 		return 0;
 	}
 
@@ -480,6 +1314,45 @@ int gg_http_watch_fd(struct gg_http *h)
 	return -1;
 }
 
+/**
+ * Ustawia funkcję odbierającą treść odpowiedzi HTTP.
+ *
+ * Zamiast gromadzić odpowiedź w polu \c body, kolejne fragmenty treści są
+ * przekazywane funkcji zaraz po odebraniu. Odpowiedź przesyłana w częściach
+ * jest przekazywana już bez informacji o podziale. Funkcję należy ustawić
+ * po rozpoczęciu połączenia asynchronicznego, a przed odebraniem nagłówka
+ * odpowiedzi.
+ *
+ * \param h Struktura połączenia
+ * \param sink Funkcja odbierająca treść lub \c NULL. Powinna zwrócić 0,
+ *             a w przypadku błędu -1, co przerywa połączenie
+ * \param data Dane przekazywane funkcji
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup http
+ */
+int gg_http_set_body_sink(struct gg_http *h, int (*sink)(struct gg_http *h, const char *buf, size_t len, void *data), void *data)
+{
+	gg_debug(GG_DEBUG_FUNCTION, "** gg_http_set_body_sink(%p, %p, %p);\n", h, sink, data);
+
+	if (h == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (h->state == GG_STATE_READING_DATA || h->state == GG_STATE_PARSING || h->state == GG_STATE_DONE || h->state == GG_STATE_ERROR) {
+		gg_debug(GG_DEBUG_MISC, "// gg_http_set_body_sink() reply already being read\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	h->body_sink = sink;
+	h->body_sink_data = data;
+
+	return 0;
+}
+
 /**
  * Kończy asynchroniczne połączenie HTTP.
  *
@@ -525,6 +1398,15 @@ void gg_http_free_fields(struct gg_http *h)
 
 	free(h->header);
 	h->header = NULL;
+
+	free(h->pool_host);
+	h->pool_host = NULL;
+
+	free(h->pool_query);
+	h->pool_query = NULL;
+
+	free(h->hostname);
+	h->hostname = NULL;
 }
 
 /**
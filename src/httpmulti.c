@@ -0,0 +1,570 @@
+/* $Id$ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License Version
+ *  2.1 as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+ *  USA.
+ */
+
+/**
+ * \file httpmulti.c
+ *
+ * \brief Obsługa wielu jednoczesnych połączeń HTTP
+ */
+
+#include "network.h"
+#ifndef _WIN32
+#  include <sys/select.h>
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libgadu.h"
+#include "internal.h"
+#include "debug.h"
+
+/**
+ * \internal Stan połączenia obsługiwanego przez \c gg_http_multi.
+ */
+enum {
+	GG_HTTP_MULTI_QUEUED = 0,	/**< Czeka na zwolnienie miejsca */
+	GG_HTTP_MULTI_RUNNING,		/**< W trakcie */
+	GG_HTTP_MULTI_FINISHED		/**< Zakończone, czeka na odebranie */
+};
+
+/**
+ * \internal Połączenie obsługiwane przez \c gg_http_multi.
+ */
+struct gg_http_multi_item {
+	struct gg_http *h;		/**< Struktura połączenia */
+	char *hostname;			/**< Nazwa serwera w chwili dodania */
+	int port;			/**< Port serwera w chwili dodania */
+	int state;			/**< Stan połączenia */
+	int ready;			/**< Flaga zmian na deskryptorze */
+	time_t last;			/**< Czas ostatniej aktywności */
+
+	struct gg_http_multi_item *next;	/**< Kolejny element listy */
+};
+
+/**
+ * Zbiór jednocześnie obsługiwanych połączeń HTTP.
+ *
+ * Tworzony przez \c gg_http_multi_new(), zwalniany przez
+ * \c gg_http_multi_free().
+ *
+ * \ingroup http
+ */
+struct gg_http_multi {
+	unsigned int host_limit;		/**< Maksymalna liczba połączeń z jednym serwerem lub 0 */
+	struct gg_http_multi_item *items;	/**< Lista połączeń w kolejności dodania */
+	struct gg_http_multi_item *items_tail;	/**< Ostatni element listy */
+};
+
+/**
+ * \internal Sprawdza, czy połączenie zostało zakończone.
+ *
+ * \param h Struktura połączenia
+ *
+ * \return 1 jeśli połączenie zostało zakończone, 0 w przeciwnym wypadku
+ */
+static int gg_http_multi_finished(struct gg_http *h)
+{
+	if (h->state == GG_STATE_DONE || h->state == GG_STATE_ERROR)
+		return 1;
+
+	/* zwykłe zapytania HTTP kończą się na odebraniu odpowiedzi */
+	return (h->type == GG_SESSION_HTTP && h->state == GG_STATE_PARSING);
+}
+
+/**
+ * \internal Sprawdza, czy można rozpocząć kolejne połączenie z serwerem.
+ *
+ * Połączenie nie jest rozpoczynane, jeśli osiągnięto limit połączeń
+ * z serwerem lub gdy nazwa serwera jest właśnie rozwiązywana dla innego
+ * połączenia.
+ *
+ * \param m Zbiór połączeń
+ * \param item Połączenie
+ *
+ * \return 1 jeśli można rozpocząć połączenie, 0 w przeciwnym wypadku
+ */
+static int gg_http_multi_may_run(struct gg_http_multi *m, struct gg_http_multi_item *item)
+{
+	struct gg_http_multi_item *i;
+	unsigned int running = 0;
+	int resolving = 0;
+	struct in_addr addr;
+
+	for (i = m->items; i != NULL; i = i->next) {
+		if (i == item || i->state != GG_HTTP_MULTI_RUNNING || i->port != item->port || strcmp(i->hostname, item->hostname) != 0)
+			continue;
+
+		running++;
+
+		if (i->h->state == GG_STATE_RESOLVING)
+			resolving = 1;
+	}
+
+	if (m->host_limit != 0 && running >= m->host_limit)
+		return 0;
+
+	if (resolving && !gg_http_dns_find(item->hostname, &addr))
+		return 0;
+
+	return 1;
+}
+
+/**
+ * \internal Rozpoczyna oczekujące połączenia z danym serwerem, na ile
+ * pozwalają limity.
+ *
+ * \param m Zbiór połączeń
+ * \param hostname Nazwa serwera
+ * \param port Port serwera
+ */
+static void gg_http_multi_fill(struct gg_http_multi *m, const char *hostname, int port)
+{
+	struct gg_http_multi_item *i;
+
+	for (i = m->items; i != NULL; i = i->next) {
+		if (i->state != GG_HTTP_MULTI_QUEUED || i->port != port || strcmp(i->hostname, hostname) != 0)
+			continue;
+
+		if (!gg_http_multi_may_run(m, i))
+			break;
+
+		gg_debug(GG_DEBUG_MISC, "// gg_http_multi() starting queued request to %s:%d\n", hostname, port);
+
+		i->last = time(NULL);
+		i->ready = 0;
+
+		if (gg_http_resume(i->h) == -1)
+			i->state = GG_HTTP_MULTI_FINISHED;
+		else
+			i->state = GG_HTTP_MULTI_RUNNING;
+	}
+}
+
+/**
+ * Tworzy zbiór jednocześnie obsługiwanych połączeń HTTP.
+ *
+ * Połączenia dodane do zbioru są obsługiwane jednym wywołaniem
+ * \c gg_http_multi_perform(). Połączenia z tym samym serwerem
+ * rozwiązują jego nazwę tylko raz, a po przekroczeniu limitu czekają na
+ * zakończenie wcześniejszych. Dopóki istnieje jakikolwiek zbiór, nazwy
+ * serwerów są zapamiętywane przez 60 sekund dla wszystkich połączeń
+ * tworzonych przez \c gg_http_connect().
+ *
+ * \param host_limit Maksymalna liczba jednoczesnych połączeń z jednym
+ *                   serwerem lub 0, jeśli bez ograniczeń
+ *
+ * \return Zaalokowana struktura lub \c NULL w przypadku błędu
+ *
+ * \ingroup http
+ */
+struct gg_http_multi *gg_http_multi_new(unsigned int host_limit)
+{
+	struct gg_http_multi *m;
+
+	gg_debug(GG_DEBUG_FUNCTION, "** gg_http_multi_new(%u);\n", host_limit);
+
+	m = malloc(sizeof(struct gg_http_multi));
+
+	if (m == NULL) {
+		gg_debug(GG_DEBUG_MISC, "// gg_http_multi_new() out of memory\n");
+		return NULL;
+	}
+
+	memset(m, 0, sizeof(struct gg_http_multi));
+
+	m->host_limit = host_limit;
+
+	gg_http_dns_ref();
+
+	return m;
+}
+
+/**
+ * Dodaje połączenie do zbioru.
+ *
+ * Połączenie musi być asynchroniczne i nie może być obsługiwane
+ * w inny sposób do chwili odebrania go funkcją \c gg_http_multi_next().
+ * Można dodawać zarówno połączenia utworzone przez \c gg_http_connect(),
+ * jak i operacje katalogu publicznego czy pobieranie tokenu. Połączenie
+ * czekające na swoją kolej ma stan \c GG_STATE_IDLE.
+ *
+ * Rozpoczęte już połączenie, które musi czekać na swoją kolej, jest
+ * przerywane i rozpoczynane ponownie później. Połączenie, które zaczęło
+ * już wysyłać zapytanie, jest obsługiwane od razu, z przekroczeniem
+ * limitu. Zwykłe zapytania lepiej więc tworzyć funkcją
+ * \c gg_http_multi_connect().
+ *
+ * \param m Zbiór połączeń
+ * \param h Struktura połączenia
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup http
+ */
+int gg_http_multi_add(struct gg_http_multi *m, struct gg_http *h)
+{
+	struct gg_http_multi_item *item;
+
+	gg_debug(GG_DEBUG_FUNCTION, "** gg_http_multi_add(%p, %p);\n", m, h);
+
+	if (m == NULL || h == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (!h->async || h->hostname == NULL || h->callback == NULL) {
+		gg_debug(GG_DEBUG_MISC, "// gg_http_multi_add() not an asynchronous http connection\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	item = malloc(sizeof(struct gg_http_multi_item));
+
+	if (item == NULL) {
+		gg_debug(GG_DEBUG_MISC, "// gg_http_multi_add() out of memory\n");
+		return -1;
+	}
+
+	memset(item, 0, sizeof(struct gg_http_multi_item));
+
+	item->hostname = strdup(h->hostname);
+
+	if (item->hostname == NULL) {
+		gg_debug(GG_DEBUG_MISC, "// gg_http_multi_add() out of memory\n");
+		free(item);
+		return -1;
+	}
+
+	item->h = h;
+	item->port = h->port;
+	item->last = time(NULL);
+
+	if (gg_http_multi_finished(h)) {
+		item->state = GG_HTTP_MULTI_FINISHED;
+	} else if (!gg_http_multi_may_run(m, item) && gg_http_park(h) == 0) {
+		gg_debug(GG_DEBUG_MISC, "// gg_http_multi_add() queueing request to %s:%d\n", item->hostname, item->port);
+		item->state = GG_HTTP_MULTI_QUEUED;
+	} else if (h->state == GG_STATE_IDLE) {
+		if (gg_http_resume(h) == -1)
+			item->state = GG_HTTP_MULTI_FINISHED;
+		else
+			item->state = GG_HTTP_MULTI_RUNNING;
+	} else {
+		struct in_addr addr;
+
+		/* nazwa mogła zostać rozwiązana, zanim dodano połączenie */
+
+		if (h->state == GG_STATE_RESOLVING && gg_http_dns_find(item->hostname, &addr)) {
+			gg_http_park(h);
+
+			if (gg_http_resume(h) == -1) {
+				item->state = GG_HTTP_MULTI_FINISHED;
+			} else {
+				item->state = GG_HTTP_MULTI_RUNNING;
+			}
+		} else {
+			item->state = GG_HTTP_MULTI_RUNNING;
+		}
+	}
+
+	if (m->items_tail != NULL)
+		m->items_tail->next = item;
+	else
+		m->items = item;
+
+	m->items_tail = item;
+
+	return 0;
+}
+
+/**
+ * Tworzy połączenie HTTP i dodaje je do zbioru.
+ *
+ * Działa jak asynchroniczne \c gg_http_connect(), ale połączenie jest
+ * rozpoczynane dopiero wtedy, gdy pozwalają na to limity zbioru.
+ *
+ * \param m Zbiór połączeń
+ * \param hostname Adres serwera
+ * \param port Port serwera
+ * \param method Metoda HTTP
+ * \param path Ścieżka do zasobu (musi być poprzedzona znakiem '/')
+ * \param header Nagłówek zapytania plus ewentualne dane dla POST
+ *
+ * \return Zaalokowana struktura \c gg_http lub \c NULL w przypadku błędu
+ *
+ * \ingroup http
+ */
+struct gg_http *gg_http_multi_connect(struct gg_http_multi *m, const char *hostname, int port, const char *method, const char *path, const char *header)
+{
+	struct gg_http *h;
+
+	gg_debug(GG_DEBUG_FUNCTION, "** gg_http_multi_connect(%p, \"%s\", %d, ...);\n", m, (hostname) ? hostname : "(null)", port);
+
+	if (m == NULL) {
+		errno = EFAULT;
+		return NULL;
+	}
+
+	h = gg_http_prepare(hostname, port, 1, method, path, header);
+
+	if (h == NULL)
+		return NULL;
+
+	if (gg_http_multi_add(m, h) == -1) {
+		int errno2 = errno;
+
+		gg_http_free(h);
+		errno = errno2;
+		return NULL;
+	}
+
+	return h;
+}
+
+/**
+ * Obsługuje połączenia ze zbioru.
+ *
+ * Funkcja czeka na zmiany na deskryptorach wszystkich trwających połączeń,
+ * wywołuje dla nich funkcje obsługi i rozpoczyna połączenia czekające na
+ * swoją kolej. Zakończone połączenia należy odebrać funkcją
+ * \c gg_http_multi_next().
+ *
+ * \param m Zbiór połączeń
+ * \param timeout Maksymalny czas oczekiwania w milisekundach lub -1, by
+ *                czekać bez ograniczeń. Funkcja wraca wcześniej, jeśli
+ *                minie czas oczekiwania któregoś z połączeń.
+ *
+ * \return Liczba niezakończonych połączeń lub -1 w przypadku błędu
+ *
+ * \ingroup http
+ */
+int gg_http_multi_perform(struct gg_http_multi *m, int timeout)
+{
+	struct gg_http_multi_item *i;
+	struct timeval tv;
+	fd_set rd, wd;
+	int max_fd = -1, res, count = 0, wait = -1;
+	time_t now;
+
+	gg_debug(GG_DEBUG_FUNCTION, "** gg_http_multi_perform(%p, %d);\n", m, timeout);
+
+	if (m == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	FD_ZERO(&rd);
+	FD_ZERO(&wd);
+
+	now = time(NULL);
+
+	for (i = m->items; i != NULL; i = i->next) {
+		if (i->state == GG_HTTP_MULTI_FINISHED)
+			continue;
+
+		count++;
+
+		if (i->state != GG_HTTP_MULTI_RUNNING)
+			continue;
+
+		/* nie czekamy dłużej, niż zostało do przekroczenia czasu
+		 * połączenia, bo sprawdzamy go dopiero po select() */
+
+		if (i->h->timeout > 0) {
+			int left = (int) (i->last + i->h->timeout + 1 - now);
+
+			if (left < 0)
+				left = 0;
+
+			if (left < INT_MAX / 1000 && (wait == -1 || left * 1000 < wait))
+				wait = left * 1000;
+		}
+
+		if (i->h->fd == -1)
+			continue;
+
+#ifndef _WIN32
+		if (i->h->fd >= FD_SETSIZE) {
+			gg_debug(GG_DEBUG_MISC, "// gg_http_multi_perform() descriptor %d too large\n", i->h->fd);
+			errno = EMFILE;
+			return -1;
+		}
+#endif
+
+		if ((i->h->check & GG_CHECK_READ))
+			FD_SET(i->h->fd, &rd);
+
+		if ((i->h->check & GG_CHECK_WRITE))
+			FD_SET(i->h->fd, &wd);
+
+		if (i->h->fd > max_fd)
+			max_fd = i->h->fd;
+	}
+
+	if (count == 0)
+		return 0;
+
+	if (wait != -1 && (timeout == -1 || timeout > wait))
+		timeout = wait;
+
+	tv.tv_sec = (timeout > 0) ? timeout / 1000 : 0;
+	tv.tv_usec = (timeout > 0) ? (timeout % 1000) * 1000 : 0;
+
+	res = select(max_fd + 1, &rd, &wd, NULL, (timeout != -1) ? &tv : NULL);
+
+	if (res == -1) {
+		if (errno == EINTR)
+			return count;
+
+		gg_debug(GG_DEBUG_MISC, "// gg_http_multi_perform() select() failed (errno=%d, %s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	/* najpierw zbieramy gotowe deskryptory, bo rozpoczęte w międzyczasie
+	 * połączenia mogą dostać numer deskryptora zakończonego połączenia */
+
+	for (i = m->items; i != NULL; i = i->next) {
+		i->ready = (i->state == GG_HTTP_MULTI_RUNNING && i->h->fd != -1 && (FD_ISSET(i->h->fd, &rd) || FD_ISSET(i->h->fd, &wd)));
+	}
+
+	now = time(NULL);
+
+	for (i = m->items; i != NULL; i = i->next) {
+		struct gg_http *h = i->h;
+
+		if (i->state != GG_HTTP_MULTI_RUNNING)
+			continue;
+
+		if (i->ready) {
+			int prev_state = h->state;
+
+			i->ready = 0;
+			i->last = now;
+
+			if (h->callback(h) == -1 || gg_http_multi_finished(h)) {
+				gg_debug(GG_DEBUG_MISC, "// gg_http_multi_perform() request to %s:%d finished\n", i->hostname, i->port);
+				i->state = GG_HTTP_MULTI_FINISHED;
+				gg_http_multi_fill(m, i->hostname, i->port);
+			} else if (prev_state == GG_STATE_RESOLVING && h->state != GG_STATE_RESOLVING) {
+				gg_http_multi_fill(m, i->hostname, i->port);
+			}
+		} else if (h->timeout > 0 && now - i->last > h->timeout) {
+			gg_debug(GG_DEBUG_MISC, "// gg_http_multi_perform() request to %s:%d timed out\n", i->hostname, i->port);
+
+			gg_http_stop(h);
+			h->error = (h->state == GG_STATE_RESOLVING) ? GG_ERROR_RESOLVING : (h->state == GG_STATE_CONNECTING) ? GG_ERROR_CONNECTING : GG_ERROR_READING;
+			h->state = GG_STATE_ERROR;
+			i->state = GG_HTTP_MULTI_FINISHED;
+			gg_http_multi_fill(m, i->hostname, i->port);
+		}
+	}
+
+	for (count = 0, i = m->items; i != NULL; i = i->next) {
+		if (i->state != GG_HTTP_MULTI_FINISHED)
+			count++;
+	}
+
+	return count;
+}
+
+/**
+ * Odbiera zakończone połączenie ze zbioru.
+ *
+ * Połączenia są zwracane w kolejności dodania. Wynik należy sprawdzić tak
+ * samo jak przy pojedynczym połączeniu, a strukturę zwolnić funkcją
+ * właściwą dla danej operacji.
+ *
+ * \param m Zbiór połączeń
+ *
+ * \return Zakończone połączenie lub \c NULL, jeśli żadne się nie zakończyło
+ *
+ * \ingroup http
+ */
+struct gg_http *gg_http_multi_next(struct gg_http_multi *m)
+{
+	struct gg_http_multi_item *i, *prev = NULL;
+
+	if (m == NULL) {
+		errno = EFAULT;
+		return NULL;
+	}
+
+	for (i = m->items; i != NULL; prev = i, i = i->next) {
+		struct gg_http *h;
+
+		if (i->state != GG_HTTP_MULTI_FINISHED)
+			continue;
+
+		if (prev != NULL)
+			prev->next = i->next;
+		else
+			m->items = i->next;
+
+		if (m->items_tail == i)
+			m->items_tail = prev;
+
+		h = i->h;
+
+		free(i->hostname);
+		free(i);
+
+		return h;
+	}
+
+	return NULL;
+}
+
+/**
+ * Zwalnia zbiór połączeń.
+ *
+ * Połączenia, które nie zostały odebrane funkcją \c gg_http_multi_next(),
+ * są przerywane i zwalniane.
+ *
+ * \param m Zbiór połączeń
+ *
+ * \ingroup http
+ */
+void gg_http_multi_free(struct gg_http_multi *m)
+{
+	gg_debug(GG_DEBUG_FUNCTION, "** gg_http_multi_free(%p);\n", m);
+
+	if (m == NULL)
+		return;
+
+	while (m->items != NULL) {
+		struct gg_http_multi_item *i = m->items;
+
+		m->items = i->next;
+
+		if (i->h->destroy != NULL)
+			i->h->destroy(i->h);
+		else
+			gg_http_free(i->h);
+
+		free(i->hostname);
+		free(i);
+	}
+
+	gg_http_dns_unref();
+
+	free(m);
+}
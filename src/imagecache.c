@@ -0,0 +1,313 @@
+/* $Id$ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License Version
+ *  2.1 as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+ *  USA.
+ */
+
+/**
+ * \file imagecache.c
+ *
+ * \brief Pamięć podręczna obrazków
+ *
+ * Obrazki są identyfikowane przez rozmiar i sumę kontrolną, więc ten sam
+ * obrazek odebrany od jednego rozmówcy może posłużyć do obsługi żądań
+ * kierowanych do innych. Pamięć podręczna jest wspólna dla wszystkich
+ * sesji, ma ograniczony rozmiar, a przy jego przekroczeniu usuwane są
+ * najdawniej używane obrazki.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgadu.h"
+#include "imagecache.h"
+#include "debug.h"
+
+/** \internal Liczba kubełków tablicy mieszającej */
+#define GG_IMAGE_CACHE_HASH_SIZE 1024
+
+/** \internal Tablica mieszająca obrazków */
+static struct gg_image_cache_entry *gg_image_cache_hash[GG_IMAGE_CACHE_HASH_SIZE];
+
+/** \internal Najczęściej używany obrazek */
+static struct gg_image_cache_entry *gg_image_cache_head;
+
+/** \internal Najrzadziej używany obrazek */
+static struct gg_image_cache_entry *gg_image_cache_tail;
+
+/** \internal Łączny rozmiar przechowywanych obrazków */
+static size_t gg_image_cache_size;
+
+/** \internal Maksymalny rozmiar pamięci podręcznej lub 0, jeśli wyłączona */
+static size_t gg_image_cache_limit;
+
+/**
+ * \internal Oblicza indeks obrazka w tablicy mieszającej.
+ *
+ * \param size Rozmiar obrazka
+ * \param crc32 Suma kontrolna obrazka
+ *
+ * \return Indeks w tablicy mieszającej
+ */
+static unsigned int gg_image_cache_index(uint32_t size, uint32_t crc32)
+{
+	return ((size * 2654435761U) ^ crc32) % GG_IMAGE_CACHE_HASH_SIZE;
+}
+
+/**
+ * \internal Zwraca ilość pamięci zajmowanej przez obrazek.
+ *
+ * \param size Rozmiar obrazka
+ * \param filename Nazwa pliku
+ *
+ * \return Rozmiar w bajtach
+ */
+static size_t gg_image_cache_cost(uint32_t size, const char *filename)
+{
+	return sizeof(struct gg_image_cache_entry) + size + strlen(filename) + 1;
+}
+
+/**
+ * \internal Usuwa obrazek z listy używanych obrazków.
+ *
+ * \param ce Obrazek
+ */
+static void gg_image_cache_unlink(struct gg_image_cache_entry *ce)
+{
+	if (ce->prev != NULL)
+		ce->prev->next = ce->next;
+	else
+		gg_image_cache_head = ce->next;
+
+	if (ce->next != NULL)
+		ce->next->prev = ce->prev;
+	else
+		gg_image_cache_tail = ce->prev;
+
+	ce->prev = NULL;
+	ce->next = NULL;
+}
+
+/**
+ * \internal Wstawia obrazek na początek listy używanych obrazków.
+ *
+ * \param ce Obrazek
+ */
+static void gg_image_cache_link(struct gg_image_cache_entry *ce)
+{
+	ce->prev = NULL;
+	ce->next = gg_image_cache_head;
+
+	if (gg_image_cache_head != NULL)
+		gg_image_cache_head->prev = ce;
+	else
+		gg_image_cache_tail = ce;
+
+	gg_image_cache_head = ce;
+}
+
+/**
+ * \internal Usuwa obrazek z pamięci podręcznej i zwalnia go.
+ *
+ * \param ce Obrazek
+ */
+static void gg_image_cache_remove(struct gg_image_cache_entry *ce)
+{
+	struct gg_image_cache_entry **cep;
+
+	for (cep = &gg_image_cache_hash[gg_image_cache_index(ce->size, ce->crc32)]; *cep != NULL; cep = &(*cep)->hash_next) {
+		if (*cep == ce) {
+			*cep = ce->hash_next;
+			break;
+		}
+	}
+
+	gg_image_cache_unlink(ce);
+
+	gg_image_cache_size -= gg_image_cache_cost(ce->size, ce->filename);
+
+	free(ce->filename);
+	free(ce->image);
+	free(ce);
+}
+
+/**
+ * \internal Usuwa najdawniej używane obrazki, aż zwolni się podana ilość
+ * pamięci.
+ *
+ * \param needed Wymagana ilość wolnej pamięci
+ */
+static void gg_image_cache_evict(size_t needed)
+{
+	while (gg_image_cache_tail != NULL && gg_image_cache_size + needed > gg_image_cache_limit)
+		gg_image_cache_remove(gg_image_cache_tail);
+}
+
+/**
+ * \internal Szuka obrazka w pamięci podręcznej.
+ *
+ * Znaleziony obrazek staje się najczęściej używanym. Wynik jest ważny do
+ * następnego wywołania funkcji dodającej obrazki lub zmieniającej rozmiar
+ * pamięci podręcznej.
+ *
+ * \param size Rozmiar obrazka
+ * \param crc32 Suma kontrolna obrazka
+ *
+ * \return Obrazek lub \c NULL, jeśli nie znaleziono
+ */
+const struct gg_image_cache_entry *gg_image_cache_find(uint32_t size, uint32_t crc32)
+{
+	struct gg_image_cache_entry *ce;
+
+	if (gg_image_cache_limit == 0)
+		return NULL;
+
+	for (ce = gg_image_cache_hash[gg_image_cache_index(size, crc32)]; ce != NULL; ce = ce->hash_next) {
+		if (ce->size == size && ce->crc32 == crc32) {
+			if (ce != gg_image_cache_head) {
+				gg_image_cache_unlink(ce);
+				gg_image_cache_link(ce);
+			}
+
+			return ce;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * \internal Dodaje kopię obrazka do pamięci podręcznej.
+ *
+ * Suma kontrolna obrazków odebranych od rozmówców jest sprawdzana, żeby
+ * jeden rozmówca nie mógł podsunąć fałszywej treści obsługującej żądania
+ * kierowane do innych. Jeśli obrazek już się w pamięci znajduje, a dodaje
+ * go aplikacja, jego treść zastępuje zapamiętaną. Obrazki większe niż cała
+ * pamięć podręczna są pomijane.
+ *
+ * \param size Rozmiar obrazka
+ * \param crc32 Suma kontrolna obrazka
+ * \param filename Nazwa pliku
+ * \param image Treść obrazka
+ * \param local Flaga obrazka wysłanego przez aplikację
+ *
+ * \return 0 jeśli się powiodło lub obrazek pominięto, -1 w przypadku błędu
+ */
+int gg_image_cache_add(uint32_t size, uint32_t crc32, const char *filename, const char *image, int local)
+{
+	struct gg_image_cache_entry *ce;
+	unsigned int index;
+	size_t cost;
+
+	if (gg_image_cache_limit == 0 || filename == NULL || image == NULL)
+		return 0;
+
+	if (!local && gg_crc32(0, (const unsigned char*) image, size) != crc32) {
+		gg_debug(GG_DEBUG_MISC, "// gg_image_cache_add() invalid checksum, expected %.8x\n", crc32);
+		return 0;
+	}
+
+	ce = (struct gg_image_cache_entry*) gg_image_cache_find(size, crc32);
+
+	if (ce != NULL) {
+		if (!local)
+			return 0;
+
+		/* suma CRC32 nie chroni przed podrobieniem, więc treść od
+		 * rozmówcy nie może udawać obrazka aplikacji */
+		if (!ce->local && (memcmp(ce->image, image, size) != 0 || strcmp(ce->filename, filename) != 0)) {
+			gg_debug(GG_DEBUG_MISC, "// gg_image_cache_add() replacing received image with local one\n");
+			gg_image_cache_remove(ce);
+		} else {
+			ce->local = 1;
+			return 0;
+		}
+	}
+
+	cost = gg_image_cache_cost(size, filename);
+
+	if (cost > gg_image_cache_limit)
+		return 0;
+
+	ce = malloc(sizeof(struct gg_image_cache_entry));
+
+	if (ce == NULL)
+		return -1;
+
+	memset(ce, 0, sizeof(struct gg_image_cache_entry));
+
+	ce->size = size;
+	ce->crc32 = crc32;
+	ce->local = (local != 0);
+	ce->filename = strdup(filename);
+	ce->image = malloc(size);
+
+	if (ce->filename == NULL || (ce->image == NULL && size != 0)) {
+		gg_debug(GG_DEBUG_MISC, "// gg_image_cache_add() not enough memory\n");
+		free(ce->filename);
+		free(ce->image);
+		free(ce);
+		return -1;
+	}
+
+	memcpy(ce->image, image, size);
+
+	gg_image_cache_evict(cost);
+
+	index = gg_image_cache_index(size, crc32);
+	ce->hash_next = gg_image_cache_hash[index];
+	gg_image_cache_hash[index] = ce;
+
+	gg_image_cache_link(ce);
+
+	gg_image_cache_size += cost;
+
+	return 0;
+}
+
+/**
+ * Ustawia rozmiar wspólnej dla wszystkich sesji pamięci podręcznej
+ * obrazków.
+ *
+ * Obrazki odebrane w odpowiedzi na \c gg_image_request() są zapamiętywane,
+ * a kolejne żądania tego samego obrazka, również od innych rozmówców i
+ * w innych sesjach, są obsługiwane bez udziału serwera. Obrazki wysłane
+ * funkcją \c gg_image_reply() są zapamiętywane i wysyłane automatycznie
+ * w odpowiedzi na kolejne żądania rozmówców, bez generowania zdarzenia
+ * \c GG_EVENT_IMAGE_REQUEST. Przy przekroczeniu rozmiaru usuwane są
+ * najdawniej używane obrazki.
+ *
+ * Pamięć podręczna jest wspólna dla wszystkich sesji i nie jest chroniona
+ * przed jednoczesnym dostępem, więc dopóki jest włączona, sesje należy
+ * obsługiwać z jednego wątku.
+ *
+ * \param size Maksymalny rozmiar pamięci podręcznej w bajtach lub 0, by ją
+ *             wyłączyć i zwolnić
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup messages
+ */
+int gg_global_set_image_cache(size_t size)
+{
+	gg_debug(GG_DEBUG_FUNCTION, "** gg_global_set_image_cache(%u);\n", (unsigned int) size);
+
+	gg_image_cache_limit = size;
+
+	gg_image_cache_evict(0);
+
+	return 0;
+}
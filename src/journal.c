@@ -0,0 +1,443 @@
+/* $Id$ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License Version
+ *  2.1 as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+ *  USA.
+ */
+
+/**
+ * \file journal.c
+ *
+ * \brief Dziennik wznawiania odbierania plików przez połączenia bezpośrednie
+ *
+ * Dziennik jest plikiem złożonym z nagłówka i wpisów o stałej długości.
+ * Każdy wpis opisuje jeden częściowo odebrany plik (skrót, rozmiar, nazwa)
+ * i położenie, do którego dane zostały trwale zapisane na dysku. Wpisy są
+ * nadpisywane w miejscu, a zwolnione wpisy są wykorzystywane ponownie.
+ */
+
+#include "fileio.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libgadu.h"
+#include "journal.h"
+#include "debug.h"
+
+/** \internal Nagłówek pliku dziennika */
+#define GG_DCC7_JOURNAL_MAGIC "GGDCC7J\001"
+
+/** \internal Długość nagłówka pliku dziennika */
+#define GG_DCC7_JOURNAL_MAGIC_LEN 8
+
+/** \internal Długość wpisu w pliku dziennika */
+#define GG_DCC7_JOURNAL_RECORD_LEN (12 + GG_DCC7_HASH_LEN + GG_DCC7_FILENAME_LEN + 1)
+
+/**
+ * \internal Minimalny odstęp w sekundach między zapisami postępu jednego
+ * połączenia. Każdy zapis wymaga synchronizacji odbieranego pliku
+ * i dziennika, więc są one grupowane.
+ */
+#define GG_DCC7_JOURNAL_INTERVAL 2
+
+/**
+ * \internal Wpis dziennika.
+ */
+struct gg_dcc7_journal_entry {
+	int used;			/**< Flaga zajętości wpisu */
+	unsigned int size;		/**< Rozmiar pliku */
+	unsigned int offset;		/**< Położenie zapisane w dzienniku */
+	unsigned char hash[GG_DCC7_HASH_LEN];	/**< Skrót SHA1 pliku */
+	unsigned char filename[GG_DCC7_FILENAME_LEN + 1];	/**< Nazwa pliku */
+
+	struct gg_dcc7 *owner;		/**< Połączenie korzystające z wpisu */
+	time_t checkpoint;		/**< Czas ostatniego zapisu postępu */
+};
+
+/** \internal Deskryptor pliku dziennika */
+static int gg_dcc7_journal_fd = -1;
+
+/** \internal Wpisy dziennika */
+static struct gg_dcc7_journal_entry *gg_dcc7_journal_entries;
+
+/** \internal Liczba wpisów dziennika */
+static unsigned int gg_dcc7_journal_count;
+
+/**
+ * \internal Sprawdza, czy wpis dotyczy pliku przesyłanego połączeniem.
+ *
+ * \param entry Wpis dziennika
+ * \param dcc Struktura połączenia
+ *
+ * \return 1 jeśli wpis dotyczy pliku, 0 w przeciwnym wypadku
+ */
+static int gg_dcc7_journal_match(const struct gg_dcc7_journal_entry *entry, const struct gg_dcc7 *dcc)
+{
+	return entry->used && entry->size == dcc->size &&
+		!memcmp(entry->hash, dcc->hash, GG_DCC7_HASH_LEN) &&
+		!strcmp((const char*) entry->filename, (const char*) dcc->filename);
+}
+
+/**
+ * \internal Zapisuje wpis do pliku dziennika.
+ *
+ * \param index Indeks wpisu
+ * \param sync Flaga wymuszenia zapisu na dysk
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+static int gg_dcc7_journal_write(unsigned int index, int sync)
+{
+	const struct gg_dcc7_journal_entry *entry = &gg_dcc7_journal_entries[index];
+	unsigned char buf[GG_DCC7_JOURNAL_RECORD_LEN];
+	uint32_t tmp;
+
+	memset(buf, 0, sizeof(buf));
+
+	tmp = gg_fix32(entry->used);
+	memcpy(buf, &tmp, sizeof(tmp));
+	tmp = gg_fix32(entry->size);
+	memcpy(buf + 4, &tmp, sizeof(tmp));
+	tmp = gg_fix32(entry->offset);
+	memcpy(buf + 8, &tmp, sizeof(tmp));
+	memcpy(buf + 12, entry->hash, GG_DCC7_HASH_LEN);
+	memcpy(buf + 12 + GG_DCC7_HASH_LEN, entry->filename, GG_DCC7_FILENAME_LEN + 1);
+
+	if (lseek(gg_dcc7_journal_fd, GG_DCC7_JOURNAL_MAGIC_LEN + index * GG_DCC7_JOURNAL_RECORD_LEN, SEEK_SET) == (off_t) -1 ||
+	    write(gg_dcc7_journal_fd, buf, sizeof(buf)) != sizeof(buf)) {
+		gg_debug(GG_DEBUG_MISC, "// gg_dcc7_journal_write() write failed (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	if (sync && gg_file_sync(gg_dcc7_journal_fd) == -1) {
+		gg_debug(GG_DEBUG_MISC, "// gg_dcc7_journal_write() sync failed (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * \internal Wczytuje wpisy z pliku dziennika.
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+static int gg_dcc7_journal_load(void)
+{
+	unsigned char buf[GG_DCC7_JOURNAL_RECORD_LEN];
+	char magic[GG_DCC7_JOURNAL_MAGIC_LEN];
+	int res;
+
+	res = read(gg_dcc7_journal_fd, magic, sizeof(magic));
+
+	if (res == 0) {
+		if (write(gg_dcc7_journal_fd, GG_DCC7_JOURNAL_MAGIC, GG_DCC7_JOURNAL_MAGIC_LEN) != GG_DCC7_JOURNAL_MAGIC_LEN)
+			return -1;
+
+		return 0;
+	}
+
+	if (res != sizeof(magic) || memcmp(magic, GG_DCC7_JOURNAL_MAGIC, GG_DCC7_JOURNAL_MAGIC_LEN) != 0) {
+		gg_debug(GG_DEBUG_MISC, "// gg_dcc7_journal_load() invalid journal header\n");
+		errno = EINVAL;
+		return -1;
+	}
+
+	while (read(gg_dcc7_journal_fd, buf, sizeof(buf)) == sizeof(buf)) {
+		struct gg_dcc7_journal_entry *tmp, *entry;
+		uint32_t val;
+
+		tmp = realloc(gg_dcc7_journal_entries, (gg_dcc7_journal_count + 1) * sizeof(struct gg_dcc7_journal_entry));
+
+		if (tmp == NULL)
+			return -1;
+
+		gg_dcc7_journal_entries = tmp;
+		entry = &gg_dcc7_journal_entries[gg_dcc7_journal_count++];
+
+		memset(entry, 0, sizeof(struct gg_dcc7_journal_entry));
+
+		memcpy(&val, buf, sizeof(val));
+		entry->used = gg_fix32(val) ? 1 : 0;
+		memcpy(&val, buf + 4, sizeof(val));
+		entry->size = gg_fix32(val);
+		memcpy(&val, buf + 8, sizeof(val));
+		entry->offset = gg_fix32(val);
+		memcpy(entry->hash, buf + 12, GG_DCC7_HASH_LEN);
+		memcpy(entry->filename, buf + 12 + GG_DCC7_HASH_LEN, GG_DCC7_FILENAME_LEN);
+		entry->filename[GG_DCC7_FILENAME_LEN] = 0;
+	}
+
+	return 0;
+}
+
+/**
+ * \internal Zamyka plik dziennika i zwalnia wpisy.
+ */
+static void gg_dcc7_journal_close(void)
+{
+	if (gg_dcc7_journal_fd != -1) {
+		gg_file_sync(gg_dcc7_journal_fd);
+		gg_file_close(gg_dcc7_journal_fd);
+	}
+
+	gg_dcc7_journal_fd = -1;
+
+	free(gg_dcc7_journal_entries);
+	gg_dcc7_journal_entries = NULL;
+	gg_dcc7_journal_count = 0;
+}
+
+/**
+ * Ustawia plik dziennika wznawiania odbierania plików.
+ *
+ * Dziennik przechowuje informacje o częściowo odebranych plikach, dzięki
+ * czemu po ponownym zaoferowaniu tego samego pliku biblioteka proponuje
+ * położenie, od którego należy wznowić odbieranie. Jeśli plik nie istnieje,
+ * zostanie utworzony.
+ *
+ * \param path Ścieżka pliku dziennika lub \c NULL, by zamknąć dziennik
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup dcc7
+ */
+int gg_global_set_dcc7_journal(const char *path)
+{
+	gg_debug(GG_DEBUG_FUNCTION, "** gg_global_set_dcc7_journal(\"%s\");\n", (path != NULL) ? path : "(null)");
+
+	gg_dcc7_journal_close();
+
+	if (path == NULL)
+		return 0;
+
+	gg_dcc7_journal_fd = open(path, O_RDWR | O_CREAT, 0600);
+
+	if (gg_dcc7_journal_fd == -1) {
+		gg_debug(GG_DEBUG_MISC, "// gg_global_set_dcc7_journal() unable to open journal (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	if (gg_dcc7_journal_load() == -1) {
+		int errno_copy = errno;
+
+		gg_dcc7_journal_close();
+		errno = errno_copy;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * \internal Szuka w dzienniku położenia, od którego można wznowić
+ * odbieranie pliku.
+ *
+ * \param dcc Struktura połączenia
+ * \param offset Wskaźnik na zmienną, do której zostanie zapisane położenie
+ *
+ * \return 0 jeśli znaleziono wpis, -1 w przeciwnym wypadku
+ */
+int gg_dcc7_journal_find(const struct gg_dcc7 *dcc, unsigned int *offset)
+{
+	unsigned int i;
+
+	if (gg_dcc7_journal_fd == -1 || dcc == NULL)
+		return -1;
+
+	for (i = 0; i < gg_dcc7_journal_count; i++) {
+		if (gg_dcc7_journal_match(&gg_dcc7_journal_entries[i], dcc) && gg_dcc7_journal_entries[i].offset <= dcc->size) {
+			*offset = gg_dcc7_journal_entries[i].offset;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * \internal Zwraca indeks wpisu używanego przez połączenie lub przypisuje
+ * połączeniu nowy wpis.
+ *
+ * \param dcc Struktura połączenia
+ *
+ * \return Indeks wpisu lub -1 w przypadku błędu
+ */
+static int gg_dcc7_journal_entry(struct gg_dcc7 *dcc)
+{
+	struct gg_dcc7_journal_entry *entry;
+	unsigned int i;
+	int index = -1;
+
+	/* zapamiętany indeks jest nieaktualny po ponownym otwarciu dziennika,
+	 * bo wpisy nie mają wtedy właścicieli */
+
+	i = dcc->journal_index - 1;
+
+	if (dcc->journal_index != 0 && i < gg_dcc7_journal_count && gg_dcc7_journal_entries[i].owner == dcc)
+		return i;
+
+	dcc->journal_index = 0;
+
+	/* pierwszy wpis zawiera już odebrane dane, więc podobnie jak przy
+	 * kolejnych zapisach plik musi trafić na dysk przed dziennikiem */
+
+	if (dcc->file_fd == -1 || gg_file_sync(dcc->file_fd) == -1) {
+		gg_debug_session(dcc->sess, GG_DEBUG_MISC, "// gg_dcc7_journal_entry() unable to sync file\n");
+		return -1;
+	}
+
+	for (i = 0; i < gg_dcc7_journal_count; i++) {
+		if (gg_dcc7_journal_match(&gg_dcc7_journal_entries[i], dcc)) {
+			/* Ten sam plik odbiera już inne połączenie. */
+			if (gg_dcc7_journal_entries[i].owner != NULL)
+				return -1;
+
+			index = i;
+			break;
+		}
+	}
+
+	for (i = 0; index == -1 && i < gg_dcc7_journal_count; i++) {
+		if (!gg_dcc7_journal_entries[i].used)
+			index = i;
+	}
+
+	if (index == -1) {
+		entry = realloc(gg_dcc7_journal_entries, (gg_dcc7_journal_count + 1) * sizeof(struct gg_dcc7_journal_entry));
+
+		if (entry == NULL)
+			return -1;
+
+		gg_dcc7_journal_entries = entry;
+		index = gg_dcc7_journal_count++;
+	}
+
+	entry = &gg_dcc7_journal_entries[index];
+
+	memset(entry, 0, sizeof(struct gg_dcc7_journal_entry));
+	entry->used = 1;
+	entry->size = dcc->size;
+	entry->offset = dcc->offset;
+	memcpy(entry->hash, dcc->hash, GG_DCC7_HASH_LEN);
+	memcpy(entry->filename, dcc->filename, GG_DCC7_FILENAME_LEN + 1);
+	entry->owner = dcc;
+	entry->checkpoint = time(NULL);
+
+	if (gg_dcc7_journal_write(index, 1) == -1) {
+		entry->used = 0;
+		entry->owner = NULL;
+		return -1;
+	}
+
+	dcc->journal_index = index + 1;
+
+	return index;
+}
+
+/**
+ * \internal Zapisuje do dziennika położenie odbieranego pliku.
+ *
+ * Przed zapisem plik jest synchronizowany z dyskiem, więc dziennik nigdy
+ * nie wskazuje danych, które mogły zostać utracone.
+ *
+ * \param index Indeks wpisu
+ * \param dcc Struktura połączenia
+ */
+static void gg_dcc7_journal_checkpoint(unsigned int index, struct gg_dcc7 *dcc)
+{
+	struct gg_dcc7_journal_entry *entry = &gg_dcc7_journal_entries[index];
+
+	if (entry->offset == dcc->offset)
+		return;
+
+	if (dcc->file_fd == -1 || gg_file_sync(dcc->file_fd) == -1) {
+		gg_debug_session(dcc->sess, GG_DEBUG_MISC, "// gg_dcc7_journal_checkpoint() unable to sync file\n");
+		return;
+	}
+
+	entry->offset = dcc->offset;
+	entry->checkpoint = time(NULL);
+
+	gg_dcc7_journal_write(index, 1);
+}
+
+/**
+ * \internal Uwzględnia postęp odbierania pliku w dzienniku.
+ *
+ * Postęp jest zapisywany nie częściej niż co \c GG_DCC7_JOURNAL_INTERVAL
+ * sekund. Pliki przekazywane funkcji ustawionej przez \c gg_dcc7_set_sink()
+ * nie trafiają do dziennika, bo biblioteka nie może ich synchronizować.
+ *
+ * \param dcc Struktura połączenia
+ */
+void gg_dcc7_journal_progress(struct gg_dcc7 *dcc)
+{
+	int index;
+
+	if (gg_dcc7_journal_fd == -1 || dcc == NULL || dcc->type != GG_SESSION_DCC7_GET || dcc->sink != NULL)
+		return;
+
+	if ((index = gg_dcc7_journal_entry(dcc)) == -1)
+		return;
+
+	if (time(NULL) - gg_dcc7_journal_entries[index].checkpoint < GG_DCC7_JOURNAL_INTERVAL)
+		return;
+
+	gg_dcc7_journal_checkpoint(index, dcc);
+}
+
+/**
+ * \internal Kończy korzystanie z dziennika przez połączenie.
+ *
+ * Jeśli plik został odebrany w całości, wpis jest zwalniany. W przeciwnym
+ * wypadku zapisywane jest ostatnie położenie.
+ *
+ * \param dcc Struktura połączenia
+ * \param complete Flaga odebrania całego pliku
+ */
+void gg_dcc7_journal_finish(struct gg_dcc7 *dcc, int complete)
+{
+	unsigned int i;
+
+	if (gg_dcc7_journal_fd == -1 || dcc == NULL || dcc->journal_index == 0)
+		return;
+
+	i = dcc->journal_index - 1;
+	dcc->journal_index = 0;
+
+	if (i >= gg_dcc7_journal_count || gg_dcc7_journal_entries[i].owner != dcc)
+		return;
+
+	if (complete) {
+		memset(&gg_dcc7_journal_entries[i], 0, sizeof(struct gg_dcc7_journal_entry));
+		gg_dcc7_journal_write(i, 1);
+	} else {
+		gg_dcc7_journal_checkpoint(i, dcc);
+		gg_dcc7_journal_entries[i].owner = NULL;
+	}
+}
+
+/*
+ * Local variables:
+ * c-indentation-style: k&r
+ * c-basic-offset: 8
+ * indent-tabs-mode: notnil
+ * End:
+ *
+ * vim: shiftwidth=8:
+ */
@@ -43,6 +43,8 @@
 #include "session.h"
 #include "message.h"
 #include "deflate.h"
+#include "imagecache.h"
+#include "pubdir50cache.h"
 
 #include <errno.h>
 #include <stdarg.h>
@@ -512,6 +514,49 @@ eagain:
 	return NULL;
 }
 
+/**
+ * \internal Wysyła zbudowany pakiet do serwera.
+ *
+ * Bufor musi zaczynać się od miejsca na nagłówek pakietu, który zostanie
+ * uzupełniony przez funkcję. Jeśli rozmiar pakietu jest za duży, by móc go
+ * wysłać za jednym razem, pozostała część zostanie zakolejkowana i wysłana,
+ * gdy będzie to możliwe.
+ *
+ * \param sess Struktura sesji
+ * \param type Rodzaj pakietu
+ * \param buf Bufor z pakietem
+ * \param length Długość pakietu razem z nagłówkiem
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+int gg_send_packet_buffer(struct gg_session *sess, int type, char *buf, size_t length)
+{
+	struct gg_header *h;
+	int res;
+
+	h = (struct gg_header*) buf;
+	h->type = gg_fix32(type);
+	h->length = gg_fix32(length - sizeof(struct gg_header));
+
+	gg_debug_session(sess, GG_DEBUG_DUMP, "// gg_send_packet(type=0x%.2x, length=%d)\n", gg_fix32(h->type), gg_fix32(h->length));
+	gg_debug_dump(sess, GG_DEBUG_DUMP, buf, length);
+
+	res = gg_write(sess, buf, length);
+
+	if (res == -1) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_send_packet() write() failed. res = %d, errno = %d (%s)\n", res, errno, strerror(errno));
+		return -1;
+	}
+
+	if (sess->async)
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_send_packet() partial write(), %d sent, %d left, %d total left\n", res, (int) length - res, sess->send_left);
+
+	if (sess->send_buf)
+		sess->check |= GG_CHECK_WRITE;
+
+	return 0;
+}
+
 /**
  * \internal Wysyła pakiet do serwera.
  *
@@ -528,7 +573,6 @@ eagain:
  */
 int gg_send_packet(struct gg_session *sess, int type, ...)
 {
-	struct gg_header *h;
 	char *tmp;
 	unsigned int tmp_length;
 	void *payload;
@@ -538,62 +582,48 @@ int gg_send_packet(struct gg_session *sess, int type, ...)
 
 	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_send_packet(%p, 0x%.2x, ...);\n", sess, type);
 
-	tmp_length = sizeof(struct gg_header);
+	/* Najpierw liczymy długość, żeby zbudować pakiet w jednym buforze,
+	 * zamiast powiększać go dla każdego fragmentu. */
 
-	if (!(tmp = malloc(tmp_length))) {
-		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_send_packet() not enough memory for packet header\n");
-		return -1;
-	}
+	tmp_length = sizeof(struct gg_header);
 
 	va_start(ap, type);
 
 	payload = va_arg(ap, void *);
 
 	while (payload) {
-		char *tmp2;
-
 		payload_length = va_arg(ap, unsigned int);
-
-		if (!(tmp2 = realloc(tmp, tmp_length + payload_length))) {
-			gg_debug_session(sess, GG_DEBUG_MISC, "// gg_send_packet() not enough memory for payload\n");
-			free(tmp);
-			va_end(ap);
-			return -1;
-		}
-
-		tmp = tmp2;
-
-		memcpy(tmp + tmp_length, payload, payload_length);
 		tmp_length += payload_length;
-
 		payload = va_arg(ap, void *);
 	}
 
 	va_end(ap);
 
-	h = (struct gg_header*) tmp;
-	h->type = gg_fix32(type);
-	h->length = gg_fix32(tmp_length - sizeof(struct gg_header));
+	if (!(tmp = malloc(tmp_length))) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_send_packet() not enough memory for packet\n");
+		return -1;
+	}
 
-	gg_debug_session(sess, GG_DEBUG_DUMP, "// gg_send_packet(type=0x%.2x, length=%d)\n", gg_fix32(h->type), gg_fix32(h->length));
-	gg_debug_dump(sess, GG_DEBUG_DUMP, tmp, tmp_length);
+	tmp_length = sizeof(struct gg_header);
 
-	res = gg_write(sess, tmp, tmp_length);
+	va_start(ap, type);
 
-	free(tmp);
+	payload = va_arg(ap, void *);
 
-	if (res == -1) {
-		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_send_packet() write() failed. res = %d, errno = %d (%s)\n", res, errno, strerror(errno));
-		return -1;
+	while (payload) {
+		payload_length = va_arg(ap, unsigned int);
+		memcpy(tmp + tmp_length, payload, payload_length);
+		tmp_length += payload_length;
+		payload = va_arg(ap, void *);
 	}
 
-	if (sess->async)
-		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_send_packet() partial write(), %d sent, %d left, %d total left\n", res, tmp_length - res, sess->send_left);
+	va_end(ap);
 
-	if (sess->send_buf)
-		sess->check |= GG_CHECK_WRITE;
+	res = gg_send_packet_buffer(sess, type, tmp, tmp_length);
 
-	return 0;
+	free(tmp);
+
+	return res;
 }
 
 /**
@@ -672,6 +702,8 @@ struct gg_session *gg_login(const struct gg_login_params *p)
 
 	memset(sess, 0, sizeof(struct gg_session));
 
+	sess->deflate_level = -1;
+
 	if (p->password == NULL || p->uin == 0) {
 		gg_debug(GG_DEBUG_MISC, "// gg_login() invalid arguments. uin and password needed\n");
 		errno = EFAULT;
@@ -940,6 +972,8 @@ void gg_logoff(struct gg_session *sess)
 		sess->send_buf = NULL;
 		sess->send_left = 0;
 	}
+
+	gg_pubdir50_cache_disconnect(sess);
 }
 
 /**
@@ -998,11 +1032,41 @@ void gg_free_session(struct gg_session *sess)
 	while (sess->images)
 		gg_image_queue_remove(sess, sess->images, 1);
 
+	free(sess->images_hash);
+
+	while (sess->images_send != NULL) {
+		struct gg_image_send *is = sess->images_send;
+
+		sess->images_send = is->next;
+
+		gg_image_send_free(sess, is, -1);
+	}
+
+	while (sess->images_ready != NULL) {
+		struct gg_image_queue *q = sess->images_ready;
+
+		sess->images_ready = q->next;
+
+		free(q->image);
+		free(q->filename);
+		free(q);
+	}
+
+	gg_pubdir50_cache_free_session(sess);
+
 	free(sess->send_buf);
 
 	for (dcc = sess->dcc7_list; dcc; dcc = dcc->next)
 		dcc->sess = NULL;
 
+	free(sess->dcc7_hash_id);
+	free(sess->dcc7_hash_uin);
+
+	free(sess->encoding_buf);
+	free(sess->userlist_reply);
+
+	gg_deflate_free_session(sess);
+
 	free(sess);
 }
 
@@ -1037,7 +1101,7 @@ int gg_change_status(struct gg_session *sess, int status)
 int gg_change_status_descr(struct gg_session *sess, int status, const char *descr)
 {
 	struct gg_new_status80 p;
-	char *new_descr = NULL;
+	const char *new_descr = NULL;
 	int descr_len = 0;
 	int res;
 
@@ -1056,7 +1120,7 @@ int gg_change_status_descr(struct gg_session *sess, int status, const char *desc
 	sess->status = status;
 
 	if (descr != NULL && sess->encoding != GG_ENCODING_UTF8) {
-		new_descr = gg_encoding_convert(descr, GG_ENCODING_CP1250, GG_ENCODING_UTF8, -1, -1);
+		new_descr = gg_encoding_convert_session(sess, descr, GG_ENCODING_CP1250, GG_ENCODING_UTF8, -1);
 
 		if (!new_descr)
 			return -1;
@@ -1079,8 +1143,6 @@ int gg_change_status_descr(struct gg_session *sess, int status, const char *desc
 			(new_descr) ? new_descr : descr, descr_len,
 			NULL);
 
-	free(new_descr);
-
 	if (GG_S_NA(status)) {
 		sess->state = GG_STATE_DISCONNECTING;
 		sess->timeout = GG_TIMEOUT_DISCONNECT;
@@ -1138,114 +1200,72 @@ int gg_change_status_flags(struct gg_session *sess, int flags)
 #ifndef DOXYGEN
 
 /**
- * \internal Wysyła wiadomość.
+ * \internal Buduje pakiet \c GG_SEND_MSG80.
  *
- * Zwraca losowy numer sekwencyjny, który można zignorować albo wykorzystać
- * do potwierdzenia.
+ * Pakiet jest składany w jednym buforze: nagłówek, struktura, HTML
+ * w UTF-8, tekst w CP1250, lista adresatów konferencji i atrybuty.
+ * Rozmiar bufora wynika z ograniczeń długości poszczególnych części,
+ * a każda z nich jest zapisywana od razu na swoje miejsce. Numer adresata,
+ * numer sekwencyjny i lista adresatów konferencji pozostają do uzupełnienia
+ * przed wysłaniem.
  *
  * \param sess Struktura sesji
  * \param msgclass Klasa wiadomości
  * \param recipients_count Liczba adresatów
- * \param recipients Wskaźnik do tablicy z numerami adresatów
  * \param message Treść wiadomości
  * \param format Informacje o formatowaniu
  * \param formatlen Długość informacji o formatowaniu
  * \param html_message Treść wiadomości HTML
+ * \param length Wskaźnik na zmienną, do której zostanie zapisana długość pakietu
+ * \param recipients_offset Wskaźnik na zmienną, do której zostanie zapisane położenie listy adresatów konferencji
  *
- * \return Numer sekwencyjny wiadomości lub -1 w przypadku błędu.
- *
- * \ingroup messages
+ * \return Zaalokowany bufor z pakietem lub \c NULL w przypadku błędu.
  */
-static int gg_send_message_common(struct gg_session *sess, int msgclass, int recipients_count, uin_t *recipients, const unsigned char *message, const unsigned char *format, int formatlen, const unsigned char *html_message)
+static char *gg_send_message_build(struct gg_session *sess, int msgclass, int recipients_count, const unsigned char *message, const unsigned char *format, int formatlen, const unsigned char *html_message, size_t *length, size_t *recipients_offset)
 {
 	struct gg_send_msg80 s80;
-	const char *cp_msg = NULL, *utf_html_msg = NULL;
-	char *recoded_msg = NULL, *recoded_html_msg = NULL;
+	const char *cp_src, *utf_msg = NULL;
+	const unsigned char *format_ = NULL;
+	size_t formatlen_ = 0;
+	char *tmp_msg = NULL, *packet = NULL;
 	unsigned char *generated_format = NULL;
-	int seq_no = -1;
-
-	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_send_message_common(%p, %d, %d, %p, %p, %p, %d, %p);\n", sess, msgclass, recipients_count, recipients, message, format, formatlen, html_message);
-
-	if (!sess) {
-		errno = EFAULT;
-		return -1;
-	}
-
-	if (sess->state != GG_STATE_CONNECTED) {
-		errno = ENOTCONN;
-		return -1;
-	}
-
-	if ((message == NULL && html_message == NULL) || recipients_count <= 0 || recipients_count > 0xffff || recipients == NULL || (format == NULL && formatlen != 0)) {
-		errno = EINVAL;
-		return -1;
-	}
+	size_t cp_len, html_bound, recipients_len, size, offset, offset_plain;
 
 	if (message == NULL) {
-		char *tmp_msg;
-		size_t len, fmt_len;
+		size_t fmt_len;
 		uint16_t fixed_fmt_len;
 
-		len = gg_message_html_to_text(NULL, NULL, &fmt_len, (const char*) html_message, sess->encoding);
-
-		tmp_msg = malloc(len + 1);
+		/* Zostawiamy miejsce na nagłówek atrybutów */
+		tmp_msg = gg_message_html_to_text_alloc((const char*) html_message, sess->encoding, &generated_format, &fmt_len, 3);
 
 		if (tmp_msg == NULL)
 			goto cleanup;
 
 		if (fmt_len != 0) {
-			generated_format = malloc(fmt_len + 3);
-
-			if (generated_format == NULL) {
-				free(tmp_msg);
-				goto cleanup;
-			}
-
 			generated_format[0] = '\x02';
 			fixed_fmt_len = gg_fix16(fmt_len);
 			memcpy(generated_format + 1, &fixed_fmt_len, sizeof(fixed_fmt_len));
-			gg_message_html_to_text(tmp_msg, generated_format + 3, NULL, (const char*) html_message, sess->encoding);
 
 			format = generated_format;
 			formatlen = fmt_len + 3;
 		} else {
-			gg_message_html_to_text(tmp_msg, NULL, NULL, (const char*) html_message, sess->encoding);
-
 			format = NULL;
 			formatlen = 0;
 		}
 
-		if (sess->encoding == GG_ENCODING_UTF8) {
-			cp_msg = recoded_msg = gg_encoding_convert(tmp_msg, sess->encoding, GG_ENCODING_CP1250, -1, -1);
-			free(tmp_msg);
-
-			if (cp_msg == NULL)
-				goto cleanup;
-		} else {
-			cp_msg = recoded_msg = tmp_msg;
-		}
+		cp_src = tmp_msg;
 	} else {
-		if (sess->encoding == GG_ENCODING_UTF8) {
-			cp_msg = recoded_msg = gg_encoding_convert((const char*) message, sess->encoding, GG_ENCODING_CP1250, -1, -1);
-
-			if (cp_msg == NULL)
-				goto cleanup;
-		} else {
-			cp_msg = (const char*) message;
-		}
+		cp_src = (const char*) message;
 	}
 
-	if (html_message == NULL) {
-		size_t len;
-		char *tmp;
-		const char *utf_msg;
-		const unsigned char *format_ = NULL;
-		size_t formatlen_ = 0;
+	/* Tekst w CP1250 nie będzie dłuższy niż w UTF-8 */
+	cp_len = strlen(cp_src);
 
+	if (html_message == NULL) {
 		if (sess->encoding == GG_ENCODING_UTF8) {
 			utf_msg = (const char*) message;
 		} else {
-			utf_msg = recoded_msg = gg_encoding_convert((const char*) message, sess->encoding, GG_ENCODING_UTF8, -1, -1);
+			utf_msg = gg_encoding_convert_session(sess, (const char*) message, sess->encoding, GG_ENCODING_UTF8, -1);
 
 			if (utf_msg == NULL)
 				goto cleanup;
@@ -1256,163 +1276,382 @@ static int gg_send_message_common(struct gg_session *sess, int msgclass, int rec
 			formatlen_ = formatlen - 3;
 		}
 
-		len = gg_message_text_to_html(NULL, utf_msg, GG_ENCODING_UTF8, format_, formatlen_);
+		html_bound = gg_message_text_to_html_bound(strlen(utf_msg), formatlen_);
+	} else {
+		/* Znak CP1250 zajmuje w UTF-8 co najwyżej 3 bajty */
+		html_bound = strlen((const char*) html_message);
 
-		tmp = malloc(len + 1);
+		if (sess->encoding != GG_ENCODING_UTF8)
+			html_bound *= 3;
 
-		if (tmp == NULL)
-			goto cleanup;
+		html_bound++;
+	}
 
-		gg_message_text_to_html(tmp, utf_msg, GG_ENCODING_UTF8, format_, formatlen_);
+	if (recipients_count > 1)
+		recipients_len = sizeof(struct gg_msg_recipients) + sizeof(uin_t) * (recipients_count - 1);
+	else
+		recipients_len = 0;
 
-		utf_html_msg = recoded_html_msg = tmp;
-	} else {
-		if (sess->encoding == GG_ENCODING_UTF8) {
-			utf_html_msg = (const char*) html_message;
-		} else {
-			utf_html_msg = recoded_html_msg = gg_encoding_convert((const char*) html_message, sess->encoding, GG_ENCODING_UTF8, -1, -1);
+	size = sizeof(struct gg_header) + sizeof(s80) + html_bound + cp_len + 1 + recipients_len + formatlen;
 
-			if (utf_html_msg == NULL)
-				goto cleanup;
-		}
+	if (html_bound == 0 || size < html_bound || (packet = malloc(size)) == NULL) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_send_message_build() not enough memory for packet\n");
+		errno = ENOMEM;
+		goto cleanup;
 	}
 
-	/* Drobne odchylenie od protokołu. Jeśli wysyłamy kilka
-	 * wiadomości w ciągu jednej sekundy, zwiększamy poprzednią
-	 * wartość, żeby każda wiadomość miała unikalny numer.
-	 */
+	offset = sizeof(struct gg_header) + sizeof(s80);
 
-	seq_no = time(NULL);
+	if (html_message == NULL)
+		offset += gg_message_text_to_html(packet + offset, utf_msg, GG_ENCODING_UTF8, format_, formatlen_) + 1;
+	else
+		offset += gg_encoding_convert_buf((const char*) html_message, sess->encoding, GG_ENCODING_UTF8, -1, packet + offset, html_bound) + 1;
 
-	if (seq_no <= sess->seq)
-		seq_no = sess->seq + 1;
+	offset_plain = offset;
 
-	sess->seq = seq_no;
+	offset += gg_encoding_convert_buf(cp_src, sess->encoding, GG_ENCODING_CP1250, cp_len, packet + offset, cp_len + 1) + 1;
 
-	s80.seq = gg_fix32(seq_no);
+	s80.recipient = 0;
+	s80.seq = 0;
 	s80.msgclass = gg_fix32(msgclass);
-	s80.offset_plain = gg_fix32(sizeof(s80) + strlen(utf_html_msg) + 1);
-	s80.offset_attr = gg_fix32(sizeof(s80) + strlen(utf_html_msg) + 1 + strlen(cp_msg) + 1);
+	s80.offset_plain = gg_fix32(offset_plain - sizeof(struct gg_header));
+	s80.offset_attr = gg_fix32(offset - sizeof(struct gg_header));
+
+	memcpy(packet + sizeof(struct gg_header), &s80, sizeof(s80));
 
 	if (recipients_count > 1) {
 		struct gg_msg_recipients r;
-		int i, j, k;
-		uin_t *recps;
 
 		r.flag = GG_MSG_OPTION_CONFERENCE;
 		r.count = gg_fix32(recipients_count - 1);
 
-		recps = malloc(sizeof(uin_t) * (recipients_count - 1));
+		memcpy(packet + offset, &r, sizeof(r));
+	}
 
-		if (!recps) {
-			seq_no = -1;
-			goto cleanup;
-		}
+	if (formatlen != 0)
+		memcpy(packet + offset + recipients_len, format, formatlen);
 
-		for (i = 0; i < recipients_count; i++) {
-			for (j = 0, k = 0; j < recipients_count; j++) {
-				if (j != i) {
-					recps[k] = gg_fix32(recipients[j]);
-					k++;
-				}
-			}
+	*length = offset + recipients_len + formatlen;
+	*recipients_offset = offset + sizeof(struct gg_msg_recipients);
 
-			s80.recipient = gg_fix32(recipients[i]);
+cleanup:
+	free(tmp_msg);
+	free(generated_format);
 
-			if (gg_send_packet(sess, GG_SEND_MSG80, &s80, sizeof(s80), utf_html_msg, strlen(utf_html_msg) + 1, cp_msg, strlen(cp_msg) + 1, &r, sizeof(r), recps, (recipients_count - 1) * sizeof(uin_t), format, formatlen, NULL) == -1)
-				seq_no = -1;
-		}
+	return packet;
+}
 
-		free(recps);
-	} else {
-		s80.recipient = gg_fix32(recipients[0]);
+/**
+ * \internal Przydziela numer sekwencyjny wiadomości.
+ *
+ * \param sess Struktura sesji
+ *
+ * \return Numer sekwencyjny
+ */
+static int gg_send_message_seq(struct gg_session *sess)
+{
+	int seq_no;
 
-		if (gg_send_packet(sess, GG_SEND_MSG80, &s80, sizeof(s80), utf_html_msg, strlen(utf_html_msg) + 1, cp_msg, strlen(cp_msg) + 1, format, formatlen, NULL) == -1)
-			seq_no = -1;
-	}
+	/* Drobne odchylenie od protokołu. Jeśli wysyłamy kilka
+	 * wiadomości w ciągu jednej sekundy, zwiększamy poprzednią
+	 * wartość, żeby każda wiadomość miała unikalny numer.
+	 */
 
-cleanup:
-	free(recoded_msg);
-	free(recoded_html_msg);
-	free(generated_format);
+	seq_no = time(NULL);
+
+	if (seq_no <= sess->seq)
+		seq_no = sess->seq + 1;
+
+	sess->seq = seq_no;
 
 	return seq_no;
 }
 
-#endif /* DOXYGEN */
-
 /**
- * Wysyła wiadomość do użytkownika.
- *
- * Zwraca losowy numer sekwencyjny, który można zignorować albo wykorzystać
- * do potwierdzenia.
+ * \internal Uzupełnia i wysyła zbudowany pakiet \c GG_SEND_MSG80.
  *
  * \param sess Struktura sesji
- * \param msgclass Klasa wiadomości
+ * \param packet Bufor z pakietem
+ * \param length Długość pakietu
  * \param recipient Numer adresata
- * \param message Treść wiadomości
- *
- * \return Numer sekwencyjny wiadomości lub -1 w przypadku błędu.
+ * \param seq_no Numer sekwencyjny wiadomości
  *
- * \ingroup messages
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
  */
-int gg_send_message(struct gg_session *sess, int msgclass, uin_t recipient, const unsigned char *message)
+static int gg_send_message_packet(struct gg_session *sess, char *packet, size_t length, uin_t recipient, int seq_no)
 {
-	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_send_message(%p, %d, %u, %p)\n", sess, msgclass, recipient, message);
+	struct gg_send_msg80 s80;
 
-	return gg_send_message_common(sess, msgclass, 1, &recipient, message, (const unsigned char*) "\x02\x06\x00\x00\x00\x08\x00\x00\x00", 9, NULL);
+	memcpy(&s80, packet + sizeof(struct gg_header), sizeof(s80));
+	s80.recipient = gg_fix32(recipient);
+	s80.seq = gg_fix32(seq_no);
+	memcpy(packet + sizeof(struct gg_header), &s80, sizeof(s80));
+
+	return gg_send_packet_buffer(sess, GG_SEND_MSG80, packet, length);
 }
 
 /**
- * Wysyła wiadomość formatowaną.
+ * \internal Wysyła wiadomość.
  *
  * Zwraca losowy numer sekwencyjny, który można zignorować albo wykorzystać
  * do potwierdzenia.
  *
  * \param sess Struktura sesji
  * \param msgclass Klasa wiadomości
- * \param recipient Numer adresata
+ * \param recipients_count Liczba adresatów
+ * \param recipients Wskaźnik do tablicy z numerami adresatów
  * \param message Treść wiadomości
  * \param format Informacje o formatowaniu
  * \param formatlen Długość informacji o formatowaniu
+ * \param html_message Treść wiadomości HTML
  *
  * \return Numer sekwencyjny wiadomości lub -1 w przypadku błędu.
  *
  * \ingroup messages
  */
-int gg_send_message_richtext(struct gg_session *sess, int msgclass, uin_t recipient, const unsigned char *message, const unsigned char *format, int formatlen)
+static int gg_send_message_common(struct gg_session *sess, int msgclass, int recipients_count, uin_t *recipients, const unsigned char *message, const unsigned char *format, int formatlen, const unsigned char *html_message)
 {
-	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_send_message_richtext(%p, %d, %u, %p, %p, %d);\n", sess, msgclass, recipient, message, format, formatlen);
+	char *packet;
+	size_t length, recipients_offset;
+	int seq_no, res = 0;
+	int i;
 
-	return gg_send_message_common(sess, msgclass, 1, &recipient, message, format, formatlen, NULL);
+	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_send_message_common(%p, %d, %d, %p, %p, %p, %d, %p);\n", sess, msgclass, recipients_count, recipients, message, format, formatlen, html_message);
+
+	if (!sess) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (sess->state != GG_STATE_CONNECTED) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	if ((message == NULL && html_message == NULL) || recipients_count <= 0 || recipients_count > 0xffff || recipients == NULL || (format == NULL && formatlen != 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	packet = gg_send_message_build(sess, msgclass, recipients_count, message, format, formatlen, html_message, &length, &recipients_offset);
+
+	if (packet == NULL)
+		return -1;
+
+	seq_no = gg_send_message_seq(sess);
+
+	/* Lista dla pierwszego adresata to wszyscy pozostali */
+	for (i = 1; i < recipients_count; i++) {
+		uin_t uin = gg_fix32(recipients[i]);
+
+		memcpy(packet + recipients_offset + (i - 1) * sizeof(uin_t), &uin, sizeof(uin_t));
+	}
+
+	for (i = 0; i < recipients_count; i++) {
+		/* Lista dla kolejnego adresata różni się od poprzedniej tylko
+		 * na jednej pozycji, gdzie zamiast niego pojawia się poprzedni. */
+		if (i > 0) {
+			uin_t uin = gg_fix32(recipients[i - 1]);
+
+			memcpy(packet + recipients_offset + (i - 1) * sizeof(uin_t), &uin, sizeof(uin_t));
+		}
+
+		if (gg_send_message_packet(sess, packet, length, recipients[i], seq_no) == -1)
+			res = -1;
+	}
+
+	free(packet);
+
+	return (res == 0) ? seq_no : -1;
 }
 
+#endif /* DOXYGEN */
+
 /**
- * Wysyła formatowaną wiadomość HTML.
+ * Przygotowuje wiadomość do wysłania do wielu adresatów.
  *
- * Zwraca losowy numer sekwencyjny, który można zignorować albo wykorzystać
- * do potwierdzenia.
+ * Treść wiadomości jest konwertowana i zapisywana w gotowym pakiecie
+ * tylko raz, a każde wywołanie \c gg_message_send() uzupełnia jedynie
+ * numer adresata i numer sekwencyjny. Parametry mają takie samo znaczenie
+ * jak dla \c gg_send_message_richtext() i \c gg_send_message_html().
+ * Wystarczy podać \p message lub \p html_message, brakująca postać
+ * zostanie wygenerowana. Jeśli podano jedynie \p message bez formatowania,
+ * wiadomość otrzyma domyślne atrybuty, tak jak w \c gg_send_message().
+ *
+ * Teksty są interpretowane zgodnie z kodowaniem sesji, ale przygotowaną
+ * wiadomość można wysłać przez dowolną sesję.
  *
  * \param sess Struktura sesji
  * \param msgclass Klasa wiadomości
- * \param recipient Numer adresata
- * \param html_message Treść wiadomości HTML
+ * \param message Treść wiadomości (może być \c NULL)
+ * \param format Informacje o formatowaniu (może być \c NULL)
+ * \param formatlen Długość informacji o formatowaniu
+ * \param html_message Treść wiadomości HTML (może być \c NULL)
  *
- * \return Numer sekwencyjny wiadomości lub -1 w przypadku błędu.
+ * \return Wiadomość do zwolnienia funkcją \c gg_message_free() lub \c NULL
+ *         w przypadku błędu.
  *
  * \ingroup messages
  */
-int gg_send_message_html(struct gg_session *sess, int msgclass, uin_t recipient, const unsigned char *html_message)
+gg_message_t *gg_message_prepare(struct gg_session *sess, int msgclass, const unsigned char *message, const unsigned char *format, int formatlen, const unsigned char *html_message)
 {
-	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_send_message_html(%p, %d, %u, %p);\n", sess, msgclass, recipient, html_message);
+	gg_message_t *gm;
+	size_t recipients_offset;
 
-	return gg_send_message_common(sess, msgclass, 1, &recipient, NULL, NULL, 0, html_message);
-}
+	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_message_prepare(%p, %d, %p, %p, %d, %p);\n", sess, msgclass, message, format, formatlen, html_message);
 
-/**
- * Wysyła wiadomość w ramach konferencji.
- *
- * Zwraca losowy numer sekwencyjny, który można zignorować albo wykorzystać
+	if (sess == NULL) {
+		errno = EFAULT;
+		return NULL;
+	}
+
+	if ((message == NULL && html_message == NULL) || (format == NULL && formatlen != 0) || formatlen < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	gm = calloc(1, sizeof(gg_message_t));
+
+	if (gm == NULL)
+		return NULL;
+
+	/* Tak jak gg_send_message(), sam tekst wysyłamy z domyślnymi
+	 * atrybutami */
+	if (message != NULL && html_message == NULL && format == NULL) {
+		format = (const unsigned char*) "\x02\x06\x00\x00\x00\x08\x00\x00\x00";
+		formatlen = 9;
+	}
+
+	gm->msgclass = msgclass;
+	gm->seq = (uint32_t) -1;
+	gm->packet = gg_send_message_build(sess, msgclass, 1, message, format, formatlen, html_message, &gm->packet_length, &recipients_offset);
+
+	if (gm->packet == NULL) {
+		free(gm);
+		return NULL;
+	}
+
+	return gm;
+}
+
+/**
+ * Wysyła przygotowaną wiadomość do użytkownika.
+ *
+ * Pakiet jest wysyłany bezpośrednio z bufora wiadomości, bez kopiowania
+ * jej treści. Przygotowanej wiadomości nie należy wysyłać jednocześnie
+ * z kilku wątków.
+ *
+ * \param sess Struktura sesji
+ * \param gm Wiadomość przygotowana przez \c gg_message_prepare()
+ * \param recipient Numer adresata
+ *
+ * \return Numer sekwencyjny wiadomości lub -1 w przypadku błędu.
+ *
+ * \ingroup messages
+ */
+int gg_message_send(struct gg_session *sess, gg_message_t *gm, uin_t recipient)
+{
+	int seq_no;
+
+	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_message_send(%p, %p, %u);\n", sess, gm, recipient);
+
+	if (sess == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (sess->state != GG_STATE_CONNECTED) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	if (gm == NULL || gm->packet == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	seq_no = gg_send_message_seq(sess);
+
+	if (gg_send_message_packet(sess, gm->packet, gm->packet_length, recipient, seq_no) == -1)
+		return -1;
+
+	gm->seq = seq_no;
+
+	return seq_no;
+}
+
+/**
+ * Wysyła wiadomość do użytkownika.
+ *
+ * Zwraca losowy numer sekwencyjny, który można zignorować albo wykorzystać
+ * do potwierdzenia.
+ *
+ * \param sess Struktura sesji
+ * \param msgclass Klasa wiadomości
+ * \param recipient Numer adresata
+ * \param message Treść wiadomości
+ *
+ * \return Numer sekwencyjny wiadomości lub -1 w przypadku błędu.
+ *
+ * \ingroup messages
+ */
+int gg_send_message(struct gg_session *sess, int msgclass, uin_t recipient, const unsigned char *message)
+{
+	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_send_message(%p, %d, %u, %p)\n", sess, msgclass, recipient, message);
+
+	return gg_send_message_common(sess, msgclass, 1, &recipient, message, (const unsigned char*) "\x02\x06\x00\x00\x00\x08\x00\x00\x00", 9, NULL);
+}
+
+/**
+ * Wysyła wiadomość formatowaną.
+ *
+ * Zwraca losowy numer sekwencyjny, który można zignorować albo wykorzystać
+ * do potwierdzenia.
+ *
+ * \param sess Struktura sesji
+ * \param msgclass Klasa wiadomości
+ * \param recipient Numer adresata
+ * \param message Treść wiadomości
+ * \param format Informacje o formatowaniu
+ * \param formatlen Długość informacji o formatowaniu
+ *
+ * \return Numer sekwencyjny wiadomości lub -1 w przypadku błędu.
+ *
+ * \ingroup messages
+ */
+int gg_send_message_richtext(struct gg_session *sess, int msgclass, uin_t recipient, const unsigned char *message, const unsigned char *format, int formatlen)
+{
+	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_send_message_richtext(%p, %d, %u, %p, %p, %d);\n", sess, msgclass, recipient, message, format, formatlen);
+
+	return gg_send_message_common(sess, msgclass, 1, &recipient, message, format, formatlen, NULL);
+}
+
+/**
+ * Wysyła formatowaną wiadomość HTML.
+ *
+ * Zwraca losowy numer sekwencyjny, który można zignorować albo wykorzystać
+ * do potwierdzenia.
+ *
+ * \param sess Struktura sesji
+ * \param msgclass Klasa wiadomości
+ * \param recipient Numer adresata
+ * \param html_message Treść wiadomości HTML
+ *
+ * \return Numer sekwencyjny wiadomości lub -1 w przypadku błędu.
+ *
+ * \ingroup messages
+ */
+int gg_send_message_html(struct gg_session *sess, int msgclass, uin_t recipient, const unsigned char *html_message)
+{
+	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_send_message_html(%p, %d, %u, %p);\n", sess, msgclass, recipient, html_message);
+
+	return gg_send_message_common(sess, msgclass, 1, &recipient, NULL, NULL, 0, html_message);
+}
+
+/**
+ * Wysyła wiadomość w ramach konferencji.
+ *
+ * Zwraca losowy numer sekwencyjny, który można zignorować albo wykorzystać
  * do potwierdzenia.
  *
  * \param sess Struktura sesji
@@ -1541,6 +1780,8 @@ int gg_image_request(struct gg_session *sess, uin_t recipient, int size, uint32_
 {
 	struct gg_send_msg s;
 	struct gg_msg_image_request r;
+	const struct gg_image_cache_entry *ce;
+	struct gg_image_queue *q;
 	char dummy = 0;
 	int res;
 
@@ -1561,55 +1802,236 @@ int gg_image_request(struct gg_session *sess, uin_t recipient, int size, uint32_
 		return -1;
 	}
 
-	s.recipient = gg_fix32(recipient);
-	s.seq = gg_fix32(0);
-	s.msgclass = gg_fix32(GG_CLASS_MSG);
+	ce = gg_image_cache_find(size, crc32);
 
-	r.flag = GG_MSG_OPTION_IMAGE_REQUEST;
-	r.size = gg_fix32(size);
-	r.crc32 = gg_fix32(crc32);
+	if (ce != NULL) {
+		struct gg_image_queue **qq;
 
-	res = gg_send_packet(sess, GG_SEND_MSG, &s, sizeof(s), &dummy, 1, &r, sizeof(r), NULL);
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_request() image found in cache\n");
 
-	if (!res) {
-		struct gg_image_queue *q = malloc(sizeof(*q));
-		char *buf;
+		q = malloc(sizeof(*q));
 
-		if (!q) {
+		if (q == NULL) {
 			gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_request() not enough memory for image queue\n");
 			return -1;
 		}
 
-		buf = malloc(size);
-		if (size && !buf)
-		{
+		memset(q, 0, sizeof(*q));
+
+		q->sender = recipient;
+		q->size = size;
+		q->crc32 = crc32;
+		q->done = size;
+		q->filename = strdup(ce->filename);
+		q->image = malloc(size);
+
+		if (q->filename == NULL || (size && !q->image)) {
 			gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_request() not enough memory for image\n");
+			free(q->filename);
+			free(q->image);
 			free(q);
 			return -1;
 		}
 
-		memset(q, 0, sizeof(*q));
+		memcpy(q->image, ce->image, size);
 
-		q->sender = recipient;
-		q->size = size;
-		q->crc32 = crc32;
-		q->image = buf;
+		/* zdarzenie zostanie wygenerowane przy najbliższym wywołaniu
+		 * gg_watch_fd(), więc prosimy o nie od razu */
 
-		if (!sess->images)
-			sess->images = q;
-		else {
-			struct gg_image_queue *qq;
+		for (qq = &sess->images_ready; *qq != NULL; qq = &(*qq)->next)
+			;
 
-			for (qq = sess->images; qq->next; qq = qq->next)
-				;
+		*qq = q;
 
-			qq->next = q;
-		}
+		sess->check |= GG_CHECK_WRITE;
+
+		return 0;
+	}
+
+	if (sess->images_limit != 0 && sess->images_size + size > sess->images_limit) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_request() image queue limit exceeded\n");
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	q = malloc(sizeof(*q));
+
+	if (!q) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_request() not enough memory for image queue\n");
+		return -1;
+	}
+
+	memset(q, 0, sizeof(*q));
+
+	q->sender = recipient;
+	q->size = size;
+	q->crc32 = crc32;
+	q->image = malloc(size);
+
+	if (size && !q->image) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_request() not enough memory for image\n");
+		free(q);
+		return -1;
+	}
+
+	s.recipient = gg_fix32(recipient);
+	s.seq = gg_fix32(0);
+	s.msgclass = gg_fix32(GG_CLASS_MSG);
+
+	r.flag = GG_MSG_OPTION_IMAGE_REQUEST;
+	r.size = gg_fix32(size);
+	r.crc32 = gg_fix32(crc32);
+
+	res = gg_send_packet(sess, GG_SEND_MSG, &s, sizeof(s), &dummy, 1, &r, sizeof(r), NULL);
+
+	if (res == 0 && gg_image_queue_add(sess, q) == -1) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_request() not enough memory for image queue\n");
+		res = -1;
+	}
+
+	if (res != 0) {
+		free(q->image);
+		free(q);
 	}
 
 	return res;
 }
 
+/**
+ * Ustawia limit pamięci przeznaczonej na odbierane obrazki.
+ *
+ * Bufor na obrazek jest przydzielany w całości w chwili wysłania żądania
+ * funkcją \c gg_image_request(). Jeśli łączny rozmiar obrazków oczekujących
+ * na odebranie przekroczyłby limit, żądanie nie zostanie wysłane, a funkcja
+ * zwróci błąd \c ENOBUFS.
+ *
+ * \param gs Struktura sesji
+ * \param limit Maksymalny łączny rozmiar odbieranych obrazków lub 0, jeśli
+ *              rozmiar nie ma być ograniczony
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup messages
+ */
+int gg_session_set_image_limit(struct gg_session *gs, size_t limit)
+{
+	gg_debug_session(gs, GG_DEBUG_FUNCTION, "** gg_session_set_image_limit(%p, %u);\n", gs, (unsigned int) limit);
+
+	if (gs == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	gs->images_limit = limit;
+
+	return 0;
+}
+
+/**
+ * Włącza lub wyłącza sprawdzanie sumy kontrolnej odbieranych obrazków.
+ *
+ * Suma kontrolna jest obliczana na bieżąco podczas odbierania kolejnych
+ * części obrazka. Obrazki, których suma nie zgadza się z żądaną, są
+ * odrzucane bez generowania zdarzenia \c GG_EVENT_IMAGE_REPLY.
+ *
+ * \param gs Struktura sesji
+ * \param enabled Flaga sprawdzania sumy kontrolnej
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup messages
+ */
+int gg_session_set_image_verify(struct gg_session *gs, int enabled)
+{
+	gg_debug_session(gs, GG_DEBUG_FUNCTION, "** gg_session_set_image_verify(%p, %d);\n", gs, enabled);
+
+	if (gs == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	gs->images_verify = (enabled != 0);
+
+	return 0;
+}
+
+/**
+ * \internal Sprawdza nazwę pliku obrazka i usuwa z niej ścieżkę.
+ *
+ * \param filename Nazwa pliku
+ *
+ * \return Nazwa pliku bez ścieżki lub \c NULL, jeśli jest niepoprawna
+ */
+static const char *gg_image_reply_filename(const char *filename)
+{
+	const char *tmp;
+
+	/* wytnij ścieżki, zostaw tylko nazwę pliku */
+	while ((tmp = strrchr(filename, '/')) || (tmp = strrchr(filename, '\\')))
+		filename = tmp + 1;
+
+	if (strlen(filename) < 1 || strlen(filename) > 1024)
+		return NULL;
+
+	return filename;
+}
+
+/**
+ * \internal Wysyła kolejną część obrazka.
+ *
+ * Pakiet jest budowany w jednym buforze razem z nagłówkiem, więc dane
+ * obrazka są kopiowane tylko raz. Pierwsza część zawiera nazwę pliku.
+ *
+ * \param sess Struktura sesji
+ * \param recipient Numer adresata
+ * \param filename Nazwa pliku
+ * \param image Bufor z obrazkiem
+ * \param size Rozmiar obrazka
+ * \param crc32 Suma kontrolna obrazka
+ * \param offset Położenie części w obrazku
+ *
+ * \return Liczba wysłanych bajtów obrazka lub -1 w przypadku błędu
+ */
+static int gg_image_reply_fragment(struct gg_session *sess, uin_t recipient, const char *filename, const char *image, uint32_t size, uint32_t crc32, uint32_t offset)
+{
+	char packet[sizeof(struct gg_header) + sizeof(struct gg_send_msg) + GG_IMAGE_REPLY_FRAGMENT];
+	struct gg_send_msg *s;
+	struct gg_msg_image_reply *r;
+	char *buf;
+	size_t buflen, chunklen;
+
+	s = (void*) (packet + sizeof(struct gg_header));
+	s->recipient = gg_fix32(recipient);
+	s->seq = gg_fix32(0);
+	s->msgclass = gg_fix32(GG_CLASS_MSG);
+
+	buf = packet + sizeof(struct gg_header) + sizeof(struct gg_send_msg);
+	buf[0] = 0;
+	r = (void*) &buf[1];
+
+	r->flag = (offset == 0) ? GG_MSG_OPTION_IMAGE_REPLY : GG_MSG_OPTION_IMAGE_REPLY_MORE;
+	r->size = gg_fix32(size);
+	r->crc32 = gg_fix32(crc32);
+
+	/* \0 + struct gg_msg_image_reply */
+	buflen = sizeof(struct gg_msg_image_reply) + 1;
+
+	/* w pierwszym kawałku jest nazwa pliku */
+	if (offset == 0) {
+		strcpy(buf + buflen, filename);
+		buflen += strlen(filename) + 1;
+	}
+
+	chunklen = (size - offset >= GG_IMAGE_REPLY_FRAGMENT - buflen) ? (GG_IMAGE_REPLY_FRAGMENT - buflen) : (size - offset);
+
+	memcpy(buf + buflen, image + offset, chunklen);
+
+	if (gg_send_packet_buffer(sess, GG_SEND_MSG, packet, sizeof(struct gg_header) + sizeof(struct gg_send_msg) + buflen + chunklen) == -1)
+		return -1;
+
+	return chunklen;
+}
+
 /**
  * Wysyła żądany obrazek.
  *
@@ -1625,10 +2047,7 @@ int gg_image_request(struct gg_session *sess, uin_t recipient, int size, uint32_
  */
 int gg_image_reply(struct gg_session *sess, uin_t recipient, const char *filename, const char *image, int size)
 {
-	struct gg_msg_image_reply *r;
-	struct gg_send_msg s;
-	const char *tmp;
-	char buf[1910];
+	uint32_t crc32, offset;
 	int res = -1;
 
 	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_image_reply(%p, %d, \"%s\", %p, %d);\n", sess, recipient, filename, image, size);
@@ -1648,53 +2067,193 @@ int gg_image_reply(struct gg_session *sess, uin_t recipient, const char *filenam
 		return -1;
 	}
 
-	/* wytnij ścieżki, zostaw tylko nazwę pliku */
-	while ((tmp = strrchr(filename, '/')) || (tmp = strrchr(filename, '\\')))
-		filename = tmp + 1;
+	filename = gg_image_reply_filename(filename);
 
-	if (strlen(filename) < 1 || strlen(filename) > 1024) {
+	if (filename == NULL) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	s.recipient = gg_fix32(recipient);
-	s.seq = gg_fix32(0);
-	s.msgclass = gg_fix32(GG_CLASS_MSG);
+	crc32 = gg_crc32(0, (const unsigned char*) image, size);
 
-	buf[0] = 0;
-	r = (void*) &buf[1];
+	if (gg_image_cache_add(size, crc32, filename, image, 1) == -1)
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_reply() unable to add image to cache\n");
 
-	r->flag = GG_MSG_OPTION_IMAGE_REPLY;
-	r->size = gg_fix32(size);
-	r->crc32 = gg_fix32(gg_crc32(0, (const unsigned char*) image, size));
+	for (offset = 0; offset < (uint32_t) size; offset += res) {
+		res = gg_image_reply_fragment(sess, recipient, filename, image, size, crc32, offset);
 
-	while (size > 0) {
-		size_t buflen, chunklen;
+		if (res == -1)
+			break;
+	}
 
-		/* \0 + struct gg_msg_image_reply */
-		buflen = sizeof(struct gg_msg_image_reply) + 1;
+	return (res == -1) ? -1 : 0;
+}
 
-		/* w pierwszym kawałku jest nazwa pliku */
-		if (r->flag == GG_MSG_OPTION_IMAGE_REPLY) {
-			strcpy(buf + buflen, filename);
-			buflen += strlen(filename) + 1;
-		}
+/**
+ * Kolejkuje wysłanie żądanego obrazka.
+ *
+ * W odróżnieniu od \c gg_image_reply(), obrazek nie jest wysyłany od razu
+ * w całości. Biblioteka odwołuje się do bufora aplikacji i wysyła kolejne
+ * części dopiero, gdy poprzednie zostaną przekazane do systemu, czyli
+ * w miarę możliwości zapisu do gniazda. Pakiety wysyłane w tym czasie przez
+ * aplikację, np. wiadomości, nie czekają na wysłanie całego obrazka. Kilka
+ * kolejkowanych obrazków jest wysyłanych na przemian.
+ *
+ * Bufor musi pozostać dostępny do czasu wywołania funkcji \p done, która
+ * otrzymuje wynik 0 po wysłaniu ostatniej części lub -1, jeśli wysyłanie
+ * zostało przerwane, np. przy zwalnianiu sesji. Funkcja jest wywoływana
+ * dokładnie raz, o ile \c gg_image_reply_queue() nie zwróciła błędu. Jeśli \p done jest równe
+ * \c NULL, aplikacja musi zapewnić dostępność bufora w inny sposób.
+ * W przypadku połączeń synchronicznych obrazek jest wysyłany od razu.
+ *
+ * \param sess Struktura sesji
+ * \param recipient Numer adresata
+ * \param filename Nazwa pliku
+ * \param image Bufor z obrazkiem
+ * \param size Rozmiar obrazka
+ * \param done Funkcja wywoływana po zakończeniu wysyłania lub \c NULL
+ * \param data Dane prywatne przekazywane do funkcji
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup messages
+ */
+int gg_image_reply_queue(struct gg_session *sess, uin_t recipient, const char *filename, const char *image, int size, void (*done)(struct gg_session *gs, const char *image, int result, void *data), void *data)
+{
+	struct gg_image_send *is, **isp;
 
-		chunklen = ((size_t) size >= sizeof(buf) - buflen) ? (sizeof(buf) - buflen) : (size_t) size;
+	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_image_reply_queue(%p, %d, \"%s\", %p, %d, %p, %p);\n", sess, recipient, filename, image, size, done, data);
 
-		memcpy(buf + buflen, image, chunklen);
-		size -= chunklen;
-		image += chunklen;
+	if (!sess || !filename || !image) {
+		errno = EFAULT;
+		return -1;
+	}
 
-		res = gg_send_packet(sess, GG_SEND_MSG, &s, sizeof(s), buf, buflen + chunklen, NULL);
+	if (!sess->async) {
+		if (gg_image_reply(sess, recipient, filename, image, size) == -1)
+			return -1;
 
-		if (res == -1)
-			break;
+		if (done != NULL)
+			done(sess, image, 0, data);
 
-		r->flag = GG_MSG_OPTION_IMAGE_REPLY_MORE;
+		return 0;
 	}
 
-	return res;
+	if (sess->state != GG_STATE_CONNECTED) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	if (size <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	filename = gg_image_reply_filename(filename);
+
+	if (filename == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	is = malloc(sizeof(struct gg_image_send));
+
+	if (is == NULL) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_reply_queue() not enough memory\n");
+		return -1;
+	}
+
+	memset(is, 0, sizeof(struct gg_image_send));
+
+	is->recipient = recipient;
+	is->filename = strdup(filename);
+	is->image = image;
+	is->size = size;
+	is->crc32 = gg_crc32(0, (const unsigned char*) image, size);
+	is->done = done;
+	is->data = data;
+
+	if (is->filename == NULL) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_reply_queue() not enough memory\n");
+		free(is);
+		return -1;
+	}
+
+	if (gg_image_cache_add(is->size, is->crc32, is->filename, image, 1) == -1)
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_image_reply_queue() unable to add image to cache\n");
+
+	for (isp = &sess->images_send; *isp != NULL; isp = &(*isp)->next)
+		;
+
+	*isp = is;
+
+	/* kolejne części wysyła gg_watch_fd(), gdy kolejka zostanie opróżniona */
+
+	sess->check |= GG_CHECK_WRITE;
+
+	return 0;
+}
+
+/**
+ * \internal Wysyła kolejną część pierwszego obrazka z kolejki.
+ *
+ * Po wysłaniu części obrazek trafia na koniec kolejki, a po wysłaniu
+ * ostatniej jest z niej usuwany. Jeśli w kolejce pozostały obrazki,
+ * ustawiana jest flaga oczekiwania na możliwość zapisu.
+ *
+ * \param sess Struktura sesji
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+int gg_image_send_next(struct gg_session *sess)
+{
+	struct gg_image_send *is = sess->images_send, **isp;
+	int res;
+
+	if (is == NULL)
+		return 0;
+
+	res = gg_image_reply_fragment(sess, is->recipient, is->filename, is->image, is->size, is->crc32, is->offset);
+
+	sess->images_send = is->next;
+	is->next = NULL;
+
+	if (res == -1) {
+		gg_image_send_free(sess, is, -1);
+		return -1;
+	}
+
+	is->offset += res;
+
+	if (is->offset < is->size) {
+		for (isp = &sess->images_send; *isp != NULL; isp = &(*isp)->next)
+			;
+
+		*isp = is;
+	} else {
+		gg_image_send_free(sess, is, 0);
+	}
+
+	if (sess->images_send != NULL)
+		sess->check |= GG_CHECK_WRITE;
+
+	return 0;
+}
+
+/**
+ * \internal Zwalnia obrazek z kolejki wysyłania i powiadamia aplikację.
+ *
+ * \param sess Struktura sesji
+ * \param is Obrazek usunięty wcześniej z kolejki
+ * \param result Wynik wysyłania przekazywany aplikacji
+ */
+void gg_image_send_free(struct gg_session *sess, struct gg_image_send *is, int result)
+{
+	if (is->done != NULL)
+		is->done(sess, is->image, result, is->data);
+
+	free(is->filename);
+	free(is);
 }
 
 /**
@@ -2041,7 +2600,8 @@ int gg_userlist_request(struct gg_session *sess, char type, const char *request)
 int gg_userlist100_request(struct gg_session *sess, char type, unsigned int version, char format_type, const char *request)
 {
 	struct gg_userlist100_request pkt;
-	unsigned char *zrequest;
+	const size_t offset = sizeof(struct gg_header) + sizeof(pkt);
+	unsigned char *packet;
 	size_t zrequest_len;
 	int ret;
 
@@ -2063,20 +2623,127 @@ int gg_userlist100_request(struct gg_session *sess, char type, unsigned int vers
 	if (request == NULL)
 		return gg_send_packet(sess, GG_USERLIST100_REQUEST, &pkt, sizeof(pkt), NULL);
 
-	zrequest = gg_deflate(request, &zrequest_len);
+	/* Kompresujemy od razu do bufora pakietu, zostawiając miejsce
+	 * na nagłówki. */
+
+	packet = gg_deflate_session(sess, request, offset, &zrequest_len);
+
+	if (packet == NULL) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_userlist100_request() gg_deflate_session() failed\n");
+		return -1;
+	}
+
+	memcpy(packet + sizeof(struct gg_header), &pkt, sizeof(pkt));
+
+	ret = gg_send_packet_buffer(sess, GG_USERLIST100_REQUEST, (char*) packet, offset + zrequest_len);
+
+	free(packet);
+
+	return ret;
+}
+
+/**
+ * Wysyła do serwera listę kontaktów pobieraną porcjami z funkcji zwrotnej.
+ *
+ * Działa podobnie do \c gg_userlist100_request(), ale zamiast kompletnej
+ * listy kontaktów przyjmuje funkcję, która przy kolejnych wywołaniach
+ * zwraca jej następne fragmenty, np. pojedyncze kontakty. Fragmenty są
+ * kompresowane od razu po pobraniu, więc w pamięci nie jest przechowywana
+ * cała lista, a jedynie jej skompresowana postać, z której składa się
+ * wysyłany pakiet.
+ *
+ * Funkcja zwrotna powinna ustawić wskaźnik \c buf i długość \c len na kolejny
+ * fragment i zwrócić 0. Fragment musi pozostać dostępny tylko do jej
+ * następnego wywołania. Ustawienie \c len na 0 oznacza koniec listy,
+ * a zwrócenie -1 przerywa wysyłanie bez wysłania czegokolwiek.
+ *
+ * \param sess Struktura sesji
+ * \param type Rodzaj zapytania
+ * \param version Numer ostatniej znanej programowi wersji listy kontaktów lub 0
+ * \param format_type Typ formatu listy kontaktów
+ * \param source Funkcja zwracająca kolejne fragmenty listy kontaktów
+ * \param data Dane prywatne przekazywane do funkcji
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup importexport
+ */
+int gg_userlist100_request_source(struct gg_session *sess, char type, unsigned int version, char format_type, int (*source)(struct gg_session *gs, const char **buf, size_t *len, void *data), void *data)
+{
+	struct gg_userlist100_request pkt;
+	const size_t offset = sizeof(struct gg_header) + sizeof(pkt);
+	unsigned char *packet;
+	size_t zrequest_len;
+	int ret;
+
+	gg_debug_session(sess, GG_DEBUG_FUNCTION, "** gg_userlist100_request_source(%p, %d, %u, %d, %p, %p);\n", sess, type, version, format_type, source, data);
 
-	if (zrequest == NULL) {
-		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_userlist100_request() gg_deflate() failed\n");
+	if (sess == NULL || source == NULL) {
+		errno = EFAULT;
 		return -1;
 	}
 
-	ret = gg_send_packet(sess, GG_USERLIST100_REQUEST, &pkt, sizeof(pkt), zrequest, zrequest_len, NULL);
+	if (sess->state != GG_STATE_CONNECTED) {
+		errno = ENOTCONN;
+		return -1;
+	}
 
-	free(zrequest);
+	pkt.type = type;
+	pkt.version = gg_fix32(version);
+	pkt.format_type = format_type;
+	pkt.unknown1 = 0x01;
+
+	packet = gg_deflate_source(sess, source, data, offset, &zrequest_len);
+
+	if (packet == NULL) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_userlist100_request_source() gg_deflate_source() failed\n");
+		return -1;
+	}
+
+	memcpy(packet + sizeof(struct gg_header), &pkt, sizeof(pkt));
+
+	ret = gg_send_packet_buffer(sess, GG_USERLIST100_REQUEST, (char*) packet, offset + zrequest_len);
+
+	free(packet);
 
 	return ret;
 }
 
+/**
+ * Ustawia funkcję odbierającą treść listy kontaktów.
+ *
+ * Zamiast gromadzić całą listę kontaktów w polu \c reply zdarzeń
+ * \c GG_EVENT_USERLIST i \c GG_EVENT_USERLIST100_REPLY, biblioteka
+ * przekazuje jej kolejne fragmenty do podanej funkcji od razu po odebraniu
+ * (w przypadku \c GG_EVENT_USERLIST100_REPLY po dekompresji). Parametr
+ * \c type funkcji określa rodzaj zdarzenia, którego dotyczą dane. Zdarzenie
+ * jest nadal generowane po odebraniu całej listy, ale jego pole \c reply
+ * ma wartość \c NULL. Funkcja powinna zwrócić 0 lub -1 w przypadku błędu,
+ * co przerwie połączenie.
+ *
+ * \param gs Struktura sesji
+ * \param sink Funkcja odbierająca dane lub \c NULL, by gromadzić je w zdarzeniu
+ * \param data Dane prywatne przekazywane do funkcji
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup importexport
+ */
+int gg_session_set_userlist_sink(struct gg_session *gs, int (*sink)(struct gg_session *gs, int type, const char *buf, size_t len, void *data), void *data)
+{
+	gg_debug_session(gs, GG_DEBUG_FUNCTION, "** gg_session_set_userlist_sink(%p, %p, %p);\n", gs, sink, data);
+
+	if (gs == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	gs->userlist_sink = sink;
+	gs->userlist_sink_data = data;
+
+	return 0;
+}
+
 /**
  * Informuje rozmówcę o pisaniu wiadomości.
  *
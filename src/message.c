@@ -30,47 +30,21 @@
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
-#include <ctype.h>
 
-#include "message.h"
-
-#if 0
-
-gg_message_t *gg_message_new(void)
-{
-	gg_message_t *gm;
-
-	gm = malloc(sizeof(gg_message_t));
-
-	if (gm == NULL)
-		return NULL;
-
-	memset(gm, 0, sizeof(gg_message_t));
-
-	gm->msgclass = GG_CLASS_CHAT;
-	gm->seq = (uint32_t) -1;
-
-	return gm;
-}
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define GG_MESSAGE_SSE2
+#endif
 
-int gg_message_init(gg_message_t *gm, int msgclass, int seq, uin_t *recipients, size_t recipient_count, char *text, char *html, char *attributes, size_t attributes_length, int auto_convert)
-{
-	GG_MESSAGE_CHECK(gm, -1);
-
-	memset(gm, 0, sizeof(gg_message_t));
-	gm->recipients = recipients;
-	gm->recipient_count = recipient_count;
-	gm->text = text;
-	gm->html = html;
-	gm->attributes = attributes;
-	gm->attributes_length = attributes_length;
-	gm->msgclass = msgclass;
-	gm->seq = seq;
-	gm->auto_convert = auto_convert;
-
-	return 0;
-}
+#include "message.h"
 
+/**
+ * Zwalnia zasoby wiadomości.
+ *
+ * \param gm Struktura wiadomości
+ *
+ * \ingroup messages
+ */
 void gg_message_free(gg_message_t *gm)
 {
 	if (gm == NULL) {
@@ -78,295 +52,151 @@ void gg_message_free(gg_message_t *gm)
 		return;
 	}	
 
-	free(gm->text);
-	free(gm->text_converted);
-	free(gm->html);
-	free(gm->html_converted);
-	free(gm->recipients);
-	free(gm->attributes);
+	free(gm->packet);
 
 	free(gm);
 }
 
-int gg_message_set_auto_convert(gg_message_t *gm, int auto_convert)
-{
-	GG_MESSAGE_CHECK(gm, -1);
-
-	gm->auto_convert = !!auto_convert;
-
-	if (!gm->auto_convert) {
-		free(gm->text_converted);
-		free(gm->html_converted);
-		gm->text_converted = NULL;
-		gm->html_converted = NULL;
-	}
-
-	return 0;
-}
-
-int gg_message_get_auto_convert(gg_message_t *gm)
-{
-	GG_MESSAGE_CHECK(gm, -1);
-
-	return gm->auto_convert;
-}
-
-int gg_message_set_recipients(gg_message_t *gm, const uin_t *recipients, size_t recipient_count)
-{
-	GG_MESSAGE_CHECK(gm, -1);
-
-	if (recipient_count >= INT_MAX / sizeof(uin_t)) {
-		errno = EINVAL;
-		return -1;
-	}	
-
-	if ((recipients == NULL) || (recipient_count == 0)) {
-		free(gm->recipients);
-		gm->recipients = NULL;
-		gm->recipient_count = 0;
-	} else {
-		uin_t *tmp;
-
-		tmp = realloc(gm->recipients, recipient_count * sizeof(uin_t));
-
-		if (tmp == NULL)
-			return -1;
-
-		memcpy(tmp, recipients, recipient_count * sizeof(uin_t));
-
-		gm->recipients = tmp;
-		gm->recipient_count = recipient_count;
-	}
-	
-	return 0;
-}
-
-int gg_message_set_recipient(gg_message_t *gm, uin_t recipient)
-{
-	return gg_message_set_recipients(gm, &recipient, 1);
-}
-
-int gg_message_get_recipients(gg_message_t *gm, const uin_t **recipients, size_t *recipient_count)
-{
-	GG_MESSAGE_CHECK(gm, -1);
-
-	if (recipients != NULL)
-		*recipients = gm->recipients;
-
-	if (recipient_count != NULL)
-		*recipient_count = gm->recipient_count;
-
-	return 0;
-}
-
-uin_t gg_message_get_recipient(gg_message_t *gm)
-{
-	GG_MESSAGE_CHECK(gm, (uin_t) -1);
-
-	if ((gm->recipients == NULL) || (gm->recipient_count < 1)) {
-		/* errno = XXX; */
-		return (uin_t) -1;
-	}
-
-	return gm->recipients[0];
-}
-
-int gg_message_set_class(gg_message_t *gm, uint32_t msgclass)
-{
-	GG_MESSAGE_CHECK(gm, -1);
-
-	gm->msgclass = msgclass;
-
-	return 0;
-}
-
-uint32_t gg_message_get_class(gg_message_t *gm)
-{
-	GG_MESSAGE_CHECK(gm, (uint32_t) -1);
-
-	return gm->msgclass;
-}
-
-int gg_message_set_seq(gg_message_t *gm, uint32_t seq)
+/**
+ * \internal Dodaje tekst na koniec bufora.
+ * 
+ * \param dst Wskaźnik na bufor roboczy
+ * \param pos Wskaźnik na aktualne położenie w buforze roboczym
+ * \param src Dodawany tekst
+ * \param len Długość dodawanego tekstu
+ */
+static void gg_append(char *dst, size_t *pos, const void *src, size_t len)
 {
-	GG_MESSAGE_CHECK(gm, -1);
-
-	gm->seq = seq;
+	if (dst != NULL)
+		memcpy(&dst[*pos], src, len);
 
-	return 0;
+	*pos += len;
 }
 
-uint32_t gg_message_get_seq(gg_message_t *gm)
-{
-	GG_MESSAGE_CHECK(gm, (uint32_t) -1);
-
-	return gm->seq;
-}
+/**
+ * \internal Cyfry szesnastkowe do zapisu kolorów i skrótów obrazków.
+ */
+static const char gg_message_hex_digits[] = "0123456789abcdef";
 
-int gg_message_set_text(gg_message_t *gm, const char *text)
+/**
+ * \internal Dokleja znacznik \c <span> z podanym kolorem.
+ *
+ * Stałe fragmenty znacznika są kopiowane w całości, a kolor jest zapisywany
+ * bezpośrednio z tablicy cyfr szesnastkowych.
+ *
+ * \param dst Wskaźnik na bufor roboczy (może być \c NULL)
+ * \param pos Wskaźnik na aktualne położenie w buforze roboczym
+ * \param color Kolor RGB
+ */
+static void gg_append_span(char *dst, size_t *pos, const unsigned char *color)
 {
-	GG_MESSAGE_CHECK(gm, -1);
+	static const char prefix[] = "<span style=\"color:#";
+	static const char suffix[] = "; font-family:'MS Shell Dlg 2'; font-size:9pt; \">";
 
-	if (text == NULL) {
-		free(gm->text);
-		gm->text = NULL;
-	} else {
-		char *tmp;
+	if (dst != NULL) {
+		char *p = &dst[*pos];
+		int i;
 
-		tmp = strdup(text);
+		memcpy(p, prefix, sizeof(prefix) - 1);
+		p += sizeof(prefix) - 1;
 
-		if (tmp == NULL)
-			return -1;
+		for (i = 0; i < 3; i++) {
+			*p++ = gg_message_hex_digits[color[i] >> 4];
+			*p++ = gg_message_hex_digits[color[i] & 0x0f];
+		}
 
-		free(gm->text);
-		gm->text = tmp;
+		memcpy(p, suffix, sizeof(suffix) - 1);
 	}
 
-	free(gm->html_converted);
-	gm->html_converted = NULL;
-
-	return 0;
+	*pos += sizeof(prefix) - 1 + 6 + sizeof(suffix) - 1;
 }
 
-const char *gg_message_get_text(gg_message_t *gm)
+/**
+ * \internal Dokleja znacznik \c <img> z podanym skrótem obrazka.
+ *
+ * \param dst Wskaźnik na bufor roboczy (może być \c NULL)
+ * \param pos Wskaźnik na aktualne położenie w buforze roboczym
+ * \param hash Rozmiar i suma kontrolna obrazka w kolejności z atrybutu
+ *             formatowania (zapisywane są od końca)
+ */
+static void gg_append_img(char *dst, size_t *pos, const unsigned char *hash)
 {
-	GG_MESSAGE_CHECK(gm, NULL);
-
-	if (gm->text_converted != NULL)
-		return gm->text_converted;
-
-	if (gm->text == NULL && gm->html != NULL && gm->auto_convert) {
-		size_t len;
+	static const char prefix[] = "<img name=\"";
+	static const char suffix[] = "\">";
 
-		free(gm->text_converted);
+	if (dst != NULL) {
+		char *p = &dst[*pos];
+		int i;
 
-		len = gg_message_html_to_text(NULL, gm->html);
+		memcpy(p, prefix, sizeof(prefix) - 1);
+		p += sizeof(prefix) - 1;
 
-		gm->text_converted = malloc(len + 1);
-
-		if (gm->text_converted == NULL)
-			return NULL;
-
-		gg_message_html_to_text(gm->text_converted, gm->html);
+		for (i = 7; i >= 0; i--) {
+			*p++ = gg_message_hex_digits[hash[i] >> 4];
+			*p++ = gg_message_hex_digits[hash[i] & 0x0f];
+		}
 
-		return gm->text_converted;
+		memcpy(p, suffix, sizeof(suffix) - 1);
 	}
 
-	return gm->text;
+	*pos += sizeof(prefix) - 1 + 16 + sizeof(suffix) - 1;
 }
 
-int gg_message_set_html(gg_message_t *gm, const char *html)
-{
-	GG_MESSAGE_CHECK(gm, -1);
-
-	if (html == NULL) {
-		free(gm->html);
-		gm->html = NULL;
-	} else {
-		char *tmp;
-
-		tmp = strdup(html);
-
-		if (tmp == NULL)
-			return -1;
-
-		free(gm->html);
-		gm->html = tmp;
-	}
-
-	free(gm->text_converted);
-	gm->text_converted = NULL;
-
-	return 0;
-}
+/**
+ * \internal Maksymalna liczba uporządkowanych ciągów w bloku atrybutów,
+ * dla której atrybuty są wyszukiwane bez przeglądania całego bloku.
+ */
+#define GG_MESSAGE_FORMAT_RUNS 4
 
-const char *gg_message_get_html(gg_message_t *gm)
+/**
+ * \internal Dzieli blok atrybutów na ciągi o niemalejących pozycjach.
+ *
+ * Oryginalny klient umieszcza atrybuty obrazków na końcu bloku, więc
+ * typowy blok składa się z dwóch takich ciągów. Dla każdego z nich można
+ * pamiętać miejsce, od którego zaczynają się atrybuty kolejnych znaków,
+ * zamiast przeglądać cały blok przy każdym znaku.
+ *
+ * \param format Atrybuty tekstu
+ * \param format_len Długość bloku atrybutów
+ * \param runs Tablica na początki ciągów, zakończona długością bloku
+ *
+ * \return Liczba ciągów lub 0, jeśli blok nie jest poprawny albo ciągów
+ *         jest więcej niż \c GG_MESSAGE_FORMAT_RUNS
+ */
+static int gg_message_format_runs(const unsigned char *format, size_t format_len, size_t *runs)
 {
-	GG_MESSAGE_CHECK(gm, NULL);
-
-	if (gm->html_converted != NULL)
-		return gm->html_converted;
+	size_t idx = 0, last_pos = 0;
+	int count = 0;
 
-	if (gm->html == NULL && gm->text != NULL && gm->auto_convert) {
-		size_t len;
+	while (idx + 3 <= format_len) {
+		size_t attr_pos;
+		unsigned char attr;
 
-		free(gm->html_converted);
+		attr_pos = format[idx] | (format[idx + 1] << 8);
+		attr = format[idx + 2];
 
-		len = gg_message_text_to_html(NULL, gm->text, GG_ENCODING_UTF8, gm->attributes, gm->attributes_length);
+		if (count == 0 || attr_pos < last_pos) {
+			if (count == GG_MESSAGE_FORMAT_RUNS)
+				return 0;
 
-		gm->html_converted = malloc(len + 1);
-
-		if (gm->html_converted == NULL)
-			return NULL;
-
-		gg_message_text_to_html(gm->html_converted, gm->text, GG_ENCODING_UTF8, gm->attributes, gm->attributes_length);
-
-		return gm->html_converted;
-	}
-
-	return gm->html;
-}
-
-int gg_message_set_attributes(gg_message_t *gm, const char *attributes, size_t length)
-{
-	GG_MESSAGE_CHECK(gm, -1);
-
-	if (length > 0xfffd) {
-		/* errno = XXX; */
-		return -1;
-	}
-
-	if ((attributes == NULL) || (length == 0)) {
-		free(gm->attributes);
-		gm->attributes = NULL;
-		gm->attributes_length = 0;
-	} else {
-		char *tmp;
-
-		tmp = realloc(gm->attributes, length);
+			runs[count++] = idx;
+		}
 
-		if (tmp == NULL)
-			return -1;
+		last_pos = attr_pos;
+		idx += 3;
 
-		gm->attributes = tmp;
-		gm->attributes_length = length;
+		if ((attr & GG_FONT_COLOR) != 0)
+			idx += 3;
+		if ((attr & GG_FONT_IMAGE) != 0)
+			idx += 10;
 	}
 
-	free(gm->html_converted);
-	gm->html_converted = NULL;
-
-	return 0;
-}
-
-int gg_message_get_attributes(gg_message_t *gm, const char **attributes, size_t *attributes_length)
-{
-	GG_MESSAGE_CHECK(gm, -1);
-
-	if (attributes != NULL)
-		*attributes = gm->attributes;
-
-	if (attributes_length != NULL)
-		*attributes_length = gm->attributes_length;
-
-	return 0;
-}
-
-#endif
+	if (idx != format_len)
+		return 0;
 
-/**
- * \internal Dodaje tekst na koniec bufora.
- * 
- * \param dst Wskaźnik na bufor roboczy
- * \param pos Wskaźnik na aktualne położenie w buforze roboczym
- * \param src Dodawany tekst
- * \param len Długość dodawanego tekstu
- */
-static void gg_append(char *dst, size_t *pos, const void *src, size_t len)
-{
-	if (dst != NULL)
-		memcpy(&dst[*pos], src, len);
+	runs[count] = format_len;
 
-	*pos += len;
+	return count;
 }
 
 /**
@@ -387,10 +217,6 @@ static void gg_append(char *dst, size_t *pos, const void *src, size_t len)
  */
 size_t gg_message_text_to_html(char *dst, const char *src, gg_encoding_t encoding, const unsigned char *format, size_t format_len)
 {
-	const char span_fmt[] = "<span style=\"color:#%02x%02x%02x; font-family:'MS Shell Dlg 2'; font-size:9pt; \">";
-	const size_t span_len = 75;
-	const char img_fmt[] = "<img name=\"%02x%02x%02x%02x%02x%02x%02x%02x\">";
-	const size_t img_len = 29;
 	size_t char_pos = 0;
 	unsigned char old_attr = 0;
 	const unsigned char default_color[] = {'\x00', '\x00', '\x00'};
@@ -398,13 +224,53 @@ size_t gg_message_text_to_html(char *dst, const char *src, gg_encoding_t encodin
 	int in_span = 0;
 	unsigned int i;
 	size_t len = 0;
+	size_t format_runs[GG_MESSAGE_FORMAT_RUNS + 1];
+	size_t format_cursor[GG_MESSAGE_FORMAT_RUNS];
+	int run, run_count;
+
+	/* Najczęstszy przypadek, czyli tekst bez formatowania (lub z domyślnym
+	 * czarnym kolorem) i bez znaków wymagających zamiany, to po prostu
+	 * tekst w domyślnym <span>. */
+
+	if ((format_len == 0 || (format_len == 6 && memcmp(format, "\x00\x00\x08\x00\x00\x00", 6) == 0)) && src[0] != 0) {
+		size_t src_len;
+
+		src_len = strcspn(src, "&<>'\"\r\n");
+
+		if (src[src_len] == 0) {
+			gg_append_span(dst, &len, default_color);
+			gg_append(dst, &len, src, src_len);
+			gg_append(dst, &len, "</span>", 7);
+
+			if (dst != NULL)
+				dst[len] = 0;
+
+			return len;
+		}
+	}
 
 	/* Pętla przechodzi też przez kończące \0, żeby móc dokleić obrazek
 	 * na końcu tekstu. */
 
+	run_count = gg_message_format_runs(format, format_len, format_runs);
+
+	for (run = 0; run < run_count; run++)
+		format_cursor[run] = format_runs[run];
+
 	for (i = 0; ; i++) {
-		int in_char = 0;
-		size_t format_idx = 0;
+		int in_char = 0, indexed = 0;
+		size_t format_idx = 0, format_end = format_len;
+
+		/* Na końcu tekstu atrybuty są analizowane po staremu, bo część
+		 * z nich jest wtedy ignorowana, co zmienia podział bloku. */
+
+		if (run_count > 0 && src[i] != 0) {
+			indexed = 1;
+			format_idx = format_cursor[0];
+			format_end = format_runs[1];
+		}
+
+		run = 0;
 
 		/* Sprawdź, czy bajt jest kontynuacją znaku UTF-8. */
 		if (encoding == GG_ENCODING_UTF8 && (src[i] & 0xc0) == 0x80)
@@ -424,10 +290,23 @@ size_t gg_message_text_to_html(char *dst, const char *src, gg_encoding_t encodin
 			if (in_char)
 				break;
 
-			if (format_idx + 3 > format_len)
-				break;
+			if (format_idx + 3 > format_end)
+				attr_pos = (size_t) -1;
+			else
+				attr_pos = format[format_idx] | (format[format_idx + 1] << 8);
+
+			/* Koniec ciągu atrybutów lub, jeśli ciąg jest uporządkowany,
+			 * koniec atrybutów aktualnego znaku. */
+
+			if (attr_pos == (size_t) -1 || (indexed && attr_pos > char_pos)) {
+				if (!indexed || ++run >= run_count)
+					break;
+
+				format_idx = format_cursor[run];
+				format_end = format_runs[run + 1];
+				continue;
+			}
 
-			attr_pos = format[format_idx] | (format[format_idx + 1] << 8);
 			attr = format[format_idx + 2];
 
 			/* Nie doklejaj atrybutów na końcu, co najwyżej obrazki. */
@@ -443,6 +322,11 @@ size_t gg_message_text_to_html(char *dst, const char *src, gg_encoding_t encodin
 				if ((attr & GG_FONT_IMAGE) != 0)
 					format_idx += 10;
 
+				/* Atrybut dotyczył wcześniejszego znaku, więc w kolejnych
+				 * można zacząć od następnego. */
+				if (indexed)
+					format_cursor[run] = format_idx;
+
 				continue;
 			}
 
@@ -472,10 +356,7 @@ size_t gg_message_text_to_html(char *dst, const char *src, gg_encoding_t encodin
 					}
 
 					if (src[i] != 0) {
-						if (dst != NULL)
-							sprintf(&dst[len], span_fmt, color[0], color[1], color[2]);
-
-						len += span_len;
+						gg_append_span(dst, &len, color);
 						in_span = 1;
 						old_color = color;
 					}
@@ -492,19 +373,7 @@ size_t gg_message_text_to_html(char *dst, const char *src, gg_encoding_t encodin
 				gg_append(dst, &len, "<u>", 3);
 
 			if (((attr & GG_FONT_IMAGE) != 0) && (format_idx + 10 <= format_len)) {
-				if (dst != NULL) {
-					sprintf(&dst[len], img_fmt,
-						format[format_idx + 9],
-						format[format_idx + 8], 
-						format[format_idx + 7],
-						format[format_idx + 6], 
-						format[format_idx + 5],
-						format[format_idx + 4],
-						format[format_idx + 3],
-						format[format_idx + 2]);
-				}
-
-				len += img_len;
+				gg_append_img(dst, &len, &format[format_idx + 2]);
 				format_idx += 10;
 			}
 
@@ -527,10 +396,7 @@ size_t gg_message_text_to_html(char *dst, const char *src, gg_encoding_t encodin
 		* znaku, ponieważ tekst nie jest pusty, trzeba otworzyć <span>. */
 
 		if (!in_span) {
-			if (dst != NULL)
-				sprintf(&dst[len], span_fmt, default_color[0], default_color[1], default_color[2]);
-
-			len += span_len;
+			gg_append_span(dst, &len, default_color);
 			in_span = 1;
 			old_color = default_color;
 		}
@@ -588,6 +454,70 @@ size_t gg_message_text_to_html(char *dst, const char *src, gg_encoding_t encodin
 	return len;
 }
 
+/**
+ * \internal Zwraca górne ograniczenie długości wyniku gg_message_text_to_html().
+ *
+ * Każdy bajt tekstu daje co najwyżej 6 bajtów (\c "&apos;"), a każdy
+ * atrybut (co najmniej 3 bajty) zamknięcie znaczników, nowy \c <span>,
+ * otwarcie znaczników i obrazek.
+ *
+ * \param src_len Długość tekstu źródłowego
+ * \param format_len Długość bloku atrybutów tekstu źródłowego
+ *
+ * \return Rozmiar bufora razem z kończącym \c \\0 lub 0, jeśli byłby za duży.
+ */
+size_t gg_message_text_to_html_bound(size_t src_len, size_t format_len)
+{
+	const size_t attr_max = 4 * 3 + 7 + 75 + 3 * 3 + 29;
+
+	if (src_len > ((size_t) -1) / 12 || format_len / 3 > ((size_t) -1) / (2 * attr_max))
+		return 0;
+
+	return src_len * 6 + (format_len / 3 + 1) * attr_max + 75 + 4 * 3 + 7 + 1;
+}
+
+/**
+ * \internal Zamienia tekst z formatowaniem Gadu-Gadu na HTML w jednym przebiegu.
+ *
+ * Zamiast wywoływać gg_message_text_to_html() dwukrotnie, najpierw
+ * w celu obliczenia długości, przydziela bufor o rozmiarze, którego wynik
+ * na pewno nie przekroczy (patrz gg_message_text_to_html_bound()), a po
+ * konwersji zmniejsza go do właściwego.
+ *
+ * \param src Tekst źródłowy
+ * \param encoding Kodowanie tekstu źródłowego oraz wynikowego
+ * \param format Atrybuty tekstu źródłowego
+ * \param format_len Długość bloku atrybutów tekstu źródłowego
+ *
+ * \return Zaalokowany bufor z tekstem HTML lub \c NULL w przypadku błędu.
+ */
+char *gg_message_text_to_html_alloc(const char *src, gg_encoding_t encoding, const unsigned char *format, size_t format_len)
+{
+	size_t bound, len;
+	char *result, *tmp;
+
+	bound = gg_message_text_to_html_bound(strlen(src), format_len);
+
+	if (bound == 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	result = malloc(bound);
+
+	if (result == NULL)
+		return NULL;
+
+	len = gg_message_text_to_html(result, src, encoding, format, format_len);
+
+	tmp = realloc(result, len + 1);
+
+	if (tmp != NULL)
+		result = tmp;
+
+	return result;
+}
+
 /**
  * \internal Dokleja nowe atrybuty formatowania, jeśli konieczne, oraz inkrementuje pozycję znaku w tekście.
  *
@@ -644,9 +574,264 @@ static void gg_after_append_formatted_char(uint16_t *pos, unsigned char attr_fla
 	*pos += 1;
 }
 
+/**
+ * \internal Zwraca długość początkowego fragmentu tekstu HTML, który nie
+ * zawiera znaczników ani encji.
+ *
+ * Tekst między znacznikami jest zwykle znacznie dłuższy od samych
+ * znaczników, więc jest przeszukiwany po 16 bajtów (SSE2, jeśli kompilator
+ * je udostępnia).
+ *
+ * \param src Tekst źródłowy
+ * \param length Długość tekstu źródłowego
+ *
+ * \return Liczba początkowych bajtów różnych od \c < i \c &
+ */
+static size_t gg_message_html_text_length(const char *src, size_t length)
+{
+	size_t i = 0;
+
+#ifdef GG_MESSAGE_SSE2
+	const __m128i lt = _mm_set1_epi8('<');
+	const __m128i amp = _mm_set1_epi8('&');
+
+	while (i + 16 <= length) {
+		__m128i chunk;
+		int mask;
+
+		chunk = _mm_loadu_si128((const __m128i*) (src + i));
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(chunk, amp)));
+
+		if (mask != 0) {
+			while ((mask & 1) == 0) {
+				mask >>= 1;
+				i++;
+			}
+
+			return i;
+		}
+
+		i += 16;
+	}
+#endif
+
+	while (i < length && src[i] != '<' && src[i] != '&')
+		i++;
+
+	return i;
+}
+
+/**
+ * \internal Dokleja zwykły tekst i uaktualnia atrybuty formatowania.
+ *
+ * Atrybuty nie zmieniają się wewnątrz dołączanego fragmentu, więc tylko
+ * pierwszy znak może wymagać dopisania atrybutu, a pozostałe jedynie
+ * przesuwają pozycję.
+ *
+ * \param dst Bufor wynikowy (może być \c NULL)
+ * \param len Wskaźnik na długość bufora wynikowego
+ * \param src Dołączany tekst
+ * \param src_len Długość dołączanego tekstu
+ * \param encoding Kodowanie tekstu
+ * \param pos Wskaźnik na zmienną przechowującą pozycję znaku w tekście
+ * \param attr_flag Aktualna flaga atrybutu formatowania
+ * \param old_attr_flag Wskaźnik na poprzednią flagę atrybutu formatowania
+ * \param color Wskaźnik na tablicę z aktualnym kolorem RGB
+ * \param old_color Wskaźnik na tablicę z poprzednim kolorem RGB
+ * \param imgs_size Rozmiar atrybutów formatowania obrazków, w bajtach
+ * \param format Wskaźnik na wskaźnik do tablicy atrybutów formatowania
+ * \param format_len Wskaźnik na długość tablicy atrybutów formatowania (może być \c NULL)
+ */
+static void gg_append_formatted_text(char *dst, size_t *len, const char *src, size_t src_len, gg_encoding_t encoding, uint16_t *pos, unsigned char attr_flag, unsigned char *old_attr_flag, const unsigned char *color, unsigned char *old_color, size_t imgs_size, unsigned char **format, size_t *format_len)
+{
+	size_t i, count;
+
+	gg_append(dst, len, src, src_len);
+
+	if (encoding == GG_ENCODING_UTF8) {
+		for (i = 0, count = 0; i < src_len; i++) {
+			if ((src[i] & 0xc0) != 0x80)
+				count++;
+		}
+	} else {
+		count = src_len;
+	}
+
+	if (count == 0)
+		return;
+
+	gg_after_append_formatted_char(pos, attr_flag, old_attr_flag, color, old_color, imgs_size, format, format_len);
+	*pos += (uint16_t) (count - 1);
+}
+
+/**
+ * \internal Zwraca wartość cyfry szesnastkowej.
+ *
+ * \param c Znak
+ *
+ * \return Wartość cyfry lub -1, jeśli znak nie jest cyfrą szesnastkową
+ */
+static int gg_message_hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+
+	c |= 0x20;
+
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+
+	return -1;
+}
+
+/**
+ * \internal Rodzaje znaczników HTML rozpoznawanych przy konwersji na tekst.
+ */
+enum gg_message_html_tag {
+	GG_HTML_TAG_UNKNOWN,
+	GG_HTML_TAG_BR,
+	GG_HTML_TAG_IMG,
+	GG_HTML_TAG_B,
+	GG_HTML_TAG_B_END,
+	GG_HTML_TAG_I,
+	GG_HTML_TAG_I_END,
+	GG_HTML_TAG_U,
+	GG_HTML_TAG_U_END,
+	GG_HTML_TAG_SPAN,
+	GG_HTML_TAG_SPAN_END
+};
+
+/**
+ * \internal Rozpoznaje znacznik HTML.
+ *
+ * \param tag Znacznik, począwszy od \c <
+ * \param len Długość znacznika bez zamykającego \c >
+ *
+ * \return Rodzaj znacznika
+ */
+static enum gg_message_html_tag gg_message_html_tag(const char *tag, size_t len)
+{
+	if (len < 2)
+		return GG_HTML_TAG_UNKNOWN;
+
+	switch (tag[1]) {
+		case 'b':
+			if (len == 2)
+				return GG_HTML_TAG_B;
+			if (tag[2] == 'r')
+				return GG_HTML_TAG_BR;
+			break;
+
+		case 'i':
+			if (len == 2)
+				return GG_HTML_TAG_I;
+			if (len >= 11 && memcmp(tag + 2, "mg name=", 8) == 0 && (tag[10] == '\"' || tag[10] == '\''))
+				return GG_HTML_TAG_IMG;
+			break;
+
+		case 'u':
+			if (len == 2)
+				return GG_HTML_TAG_U;
+			break;
+
+		case 's':
+			if (len >= 6 && memcmp(tag + 2, "pan ", 4) == 0)
+				return GG_HTML_TAG_SPAN;
+			break;
+
+		case '/':
+			if (len == 3) {
+				switch (tag[2]) {
+					case 'b':
+						return GG_HTML_TAG_B_END;
+					case 'i':
+						return GG_HTML_TAG_I_END;
+					case 'u':
+						return GG_HTML_TAG_U_END;
+				}
+			}
+			if (len >= 6 && memcmp(tag + 2, "span", 4) == 0)
+				return GG_HTML_TAG_SPAN_END;
+			break;
+	}
+
+	return GG_HTML_TAG_UNKNOWN;
+}
+
+/**
+ * \internal Sprawdza, czy znak może należeć do nazwy encji HTML.
+ *
+ * \param c Znak
+ *
+ * \return 1 jeśli może, 0 jeśli nie
+ */
+static int gg_message_html_entity_char(char c)
+{
+	if (c >= '0' && c <= '9')
+		return 1;
+
+	if (c == '#')
+		return 1;
+
+	c |= 0x20;
+
+	return (c >= 'a' && c <= 'z');
+}
+
+/**
+ * \internal Rozpoznaje encję HTML.
+ *
+ * \param name Nazwa encji, bez \c & i \c ;
+ * \param len Długość nazwy encji
+ *
+ * \return Znak odpowiadający encji, 0xa0 dla \c &nbsp; lub \c ? dla
+ *         nieznanych encji
+ */
+static int gg_message_html_entity(const char *name, size_t len)
+{
+	switch (len) {
+		case 2:
+			if (name[1] != 't')
+				break;
+			if (name[0] == 'l')
+				return '<';
+			if (name[0] == 'g')
+				return '>';
+			break;
+
+		case 3:
+			if (memcmp(name, "amp", 3) == 0)
+				return '&';
+			break;
+
+		case 4:
+			switch (name[0]) {
+				case 'q':
+					if (memcmp(name, "quot", 4) == 0)
+						return '"';
+					break;
+				case 'a':
+					if (memcmp(name, "apos", 4) == 0)
+						return '\'';
+					break;
+				case 'n':
+					if (memcmp(name, "nbsp", 4) == 0)
+						return 0xa0;
+					break;
+			}
+			break;
+	}
+
+	return '?';
+}
+
 /**
  * \internal Zamienia tekst w formacie HTML na czysty tekst.
  *
+ * Zwykły tekst jest kopiowany całymi fragmentami między znacznikami
+ * i encjami, a same znaczniki i encje są rozpoznawane bez porównywania
+ * z każdym znanym wzorcem po kolei.
+ *
  * \param dst Bufor wynikowy (może być \c NULL)
  * \param format Bufor wynikowy z atrybutami formatowania (może być \c NULL)
  * \param format_len Wskaźnik na zmienną, do której zostanie zapisana potrzebna wielkość bufora wynikowego z atrybutami formatowania, w bajtach (może być \c NULL)
@@ -659,8 +844,8 @@ static void gg_after_append_formatted_char(uint16_t *pos, unsigned char attr_fla
  */
 size_t gg_message_html_to_text(char *dst, unsigned char *format, size_t *format_len, const char *html, gg_encoding_t encoding)
 {
-	const char *src, *entity = NULL, *tag = NULL;
-	int in_tag = 0, in_entity = 0, in_bold = 0, in_italic = 0, in_underline = 0;
+	const char *src, *end;
+	int in_bold = 0, in_italic = 0, in_underline = 0;
 	unsigned char color[3] = { 0 }, old_color[3] = { 0 };
 	unsigned char attr_flag = 0, old_attr_flag = 0;
 	uint16_t pos = 0;
@@ -669,230 +854,289 @@ size_t gg_message_html_to_text(char *dst, unsigned char *format, size_t *format_
 	if (format_len != NULL)
 		*format_len = 0;
 
-	for (src = html; *src != 0; src++) {
-		if (in_entity && !(isalnum(*src) || *src == '#' || *src == ';')) {
-			int first = 1;
-			size_t i, append_len = src - entity;
-
-			gg_append(dst, &len, entity, append_len);
-			for (i = 0; i < append_len; i++) {
-				if (encoding != GG_ENCODING_UTF8 || (entity[i] & 0xc0) != 0x80) {
-					if (first) {
-						gg_after_append_formatted_char(&pos, attr_flag, &old_attr_flag, color, old_color, imgs_size, &format, format_len);
-						first = 0;
-					} else {
-						pos++;
-					}
-				}
-			}
+	src = html;
+	end = html + strlen(html);
+
+	while (src < end) {
+		const char *tag, *p;
+		size_t text_len;
 
-			in_entity = 0;
+		text_len = gg_message_html_text_length(src, end - src);
+
+		if (text_len > 0) {
+			gg_append_formatted_text(dst, &len, src, text_len, encoding, &pos, attr_flag, &old_attr_flag, color, old_color, imgs_size, &format, format_len);
+			src += text_len;
+			continue;
 		}
 
-		if (*src == '<') {
-			tag = src;
-			in_tag = 1;
+		if (*src == '&') {
+			for (p = src + 1; p < end && gg_message_html_entity_char(*p); p++);
+
+			/* Niezakończona encja na końcu tekstu jest pomijana */
+			if (p == end)
+				break;
+
+			if (*p != ';') {
+				gg_append_formatted_text(dst, &len, src, p - src, encoding, &pos, attr_flag, &old_attr_flag, color, old_color, imgs_size, &format, format_len);
+				src = p;
+				continue;
+			}
+
+			switch (gg_message_html_entity(src + 1, p - src - 1)) {
+				case '<':
+					gg_append(dst, &len, "<", 1);
+					break;
+				case '>':
+					gg_append(dst, &len, ">", 1);
+					break;
+				case '"':
+					gg_append(dst, &len, "\"", 1);
+					break;
+				case '\'':
+					gg_append(dst, &len, "\'", 1);
+					break;
+				case '&':
+					gg_append(dst, &len, "&", 1);
+					break;
+				case 0xa0:
+					if (dst == NULL || encoding == GG_ENCODING_UTF8)
+						gg_append(dst, &len, "\xc2\xa0", 2);
+					else
+						gg_append(dst, &len, "\xa0", 1);
+					break;
+				default:
+					gg_append(dst, &len, "?", 1);
+					break;
+			}
+
+			gg_after_append_formatted_char(&pos, attr_flag, &old_attr_flag, color, old_color, imgs_size, &format, format_len);
+
+			src = p + 1;
 			continue;
 		}
 
-		if (in_tag && (*src == '>')) {
-			if (strncmp(tag, "<br", 3) == 0) {
-				if (dst != NULL)
-					dst[len] = '\n';
-				len++;
+		/* Znacznik kończy się na pierwszym >, a każdy kolejny < zaczyna go od nowa */
+		for (tag = src, p = src + 1; p < end && *p != '>'; p++) {
+			if (*p == '<')
+				tag = p;
+		}
+
+		/* Niezakończony znacznik na końcu tekstu jest pomijany */
+		if (p == end)
+			break;
+
+		src = p + 1;
+
+		switch (gg_message_html_tag(tag, p - tag)) {
+			case GG_HTML_TAG_BR:
+				gg_append(dst, &len, "\n", 1);
 
 				gg_after_append_formatted_char(&pos, attr_flag, &old_attr_flag, color, old_color, imgs_size, &format, format_len);
-			} else if (strncmp(tag, "<img name=\"", 11) == 0 || strncmp(tag, "<img name=\'", 11) == 0) {
+				break;
+
+			case GG_HTML_TAG_IMG:
+			{
+				unsigned char img_attr[13];
+				int i;
+
 				tag += 11;
 
 				/* 17 bo jeszcze cudzysłów musi być zamknięty */
-				if (tag + 17 <= src) {
-					int i, ok = 1;
+				if (tag + 17 > p)
+					break;
 
-					for (i = 0; i < 16; i++) {
-						if ((tag[i] < '0' || tag[i] > '9') && (tolower(tag[i]) < 'a' || tolower(tag[i]) > 'f')) {
-							ok = 0;
-							break;
-						}
-					}
+				for (i = 0; i < 16; i++) {
+					if (gg_message_hex_value(tag[i]) == -1)
+						break;
+				}
 
-					if (ok) {
-						unsigned char img_attr[13];
-
-						if (format != NULL) {
-							char buf[3] = { 0 };
-
-							img_attr[0] = (unsigned char) (pos & (uint16_t) 0x00ffU);
-							img_attr[1] = (unsigned char) ((pos & (uint16_t) 0xff00U) >> 8);
-							img_attr[2] = GG_FONT_IMAGE;
-							img_attr[3] = '\x09';
-							img_attr[4] = '\x01';
-							for (i = 0; i < 16; i += 2) {
-								buf[0] = tag[i];
-								buf[1] = tag[i + 1];
-								/* buf[2] to '\0' */
-								img_attr[12 - i / 2] = (unsigned char) strtoul(buf, NULL, 16);
-							}
+				if (i < 16)
+					break;
 
-							memcpy(format, img_attr, sizeof(img_attr));
-							format += sizeof(img_attr);
-						}
+				if (format != NULL) {
+					img_attr[0] = (unsigned char) (pos & (uint16_t) 0x00ffU);
+					img_attr[1] = (unsigned char) ((pos & (uint16_t) 0xff00U) >> 8);
+					img_attr[2] = GG_FONT_IMAGE;
+					img_attr[3] = '\x09';
+					img_attr[4] = '\x01';
+					for (i = 0; i < 16; i += 2)
+						img_attr[12 - i / 2] = (unsigned char) ((gg_message_hex_value(tag[i]) << 4) | gg_message_hex_value(tag[i + 1]));
 
-						if (format_len != NULL)
-							*format_len += sizeof(img_attr);
-						imgs_size += sizeof(img_attr);
+					memcpy(format, img_attr, sizeof(img_attr));
+					format += sizeof(img_attr);
+				}
 
-						if (dst != NULL) {
-							if (encoding == GG_ENCODING_UTF8)
-								dst[len++] = '\xc2';
-							dst[len++] = '\xa0';
-						} else {
-							len += 2;
-						}
+				if (format_len != NULL)
+					*format_len += sizeof(img_attr);
+				imgs_size += sizeof(img_attr);
+
+				if (dst == NULL || encoding == GG_ENCODING_UTF8)
+					gg_append(dst, &len, "\xc2\xa0", 2);
+				else
+					gg_append(dst, &len, "\xa0", 1);
 
-						/* Nie używamy tutaj gg_after_append_formatted_char(). Po pierwsze to praktycznie niczego
-						 * by nie zmieniło, a po drugie nie wszystkim klientom mogłaby się spodobać redefinicja
-						 * atrybutów formatowania dla jednego znaku (bo np. najpierw byśmy zdefiniowali bolda od
-						 * znaku 10, a potem by się okazało, że znak 10 to obrazek).
-						 */
+				/* Nie używamy tutaj gg_after_append_formatted_char(). Po pierwsze to praktycznie niczego
+				 * by nie zmieniło, a po drugie nie wszystkim klientom mogłaby się spodobać redefinicja
+				 * atrybutów formatowania dla jednego znaku (bo np. najpierw byśmy zdefiniowali bolda od
+				 * znaku 10, a potem by się okazało, że znak 10 to obrazek).
+				 */
 
-						pos++;
+				pos++;
 
-						/* Resetujemy atrybuty, aby je w razie czego redefiniować od następnego znaku, co by sobie
-						 * nikt przypadkiem nie pomyślał, że GG_FONT_IMAGE dotyczy więcej, niż jednego znaku.
-						 * Tak samo robi oryginalny klient.
-						 */
+				/* Resetujemy atrybuty, aby je w razie czego redefiniować od następnego znaku, co by sobie
+				 * nikt przypadkiem nie pomyślał, że GG_FONT_IMAGE dotyczy więcej, niż jednego znaku.
+				 * Tak samo robi oryginalny klient.
+				 */
 
-						old_attr_flag = -1;
-					}
-				}
-			} else if (strncmp(tag, "<b>", 3) == 0) {
+				old_attr_flag = -1;
+				break;
+			}
+
+			case GG_HTML_TAG_B:
 				in_bold++;
 				attr_flag |= GG_FONT_BOLD;
-			} else if (strncmp(tag, "</b>", 4) == 0) {
+				break;
+
+			case GG_HTML_TAG_B_END:
 				if (in_bold > 0) {
 					in_bold--;
 					if (in_bold == 0)
 						attr_flag &= ~GG_FONT_BOLD;
 				}
-			} else if (strncmp(tag, "<i>", 3) == 0) {
+				break;
+
+			case GG_HTML_TAG_I:
 				in_italic++;
 				attr_flag |= GG_FONT_ITALIC;
-			} else if (strncmp(tag, "</i>", 4) == 0) {
+				break;
+
+			case GG_HTML_TAG_I_END:
 				if (in_italic > 0) {
 					in_italic--;
 					if (in_italic == 0)
 						attr_flag &= ~GG_FONT_ITALIC;
 				}
-			} else if (strncmp(tag, "<u>", 3) == 0) {
+				break;
+
+			case GG_HTML_TAG_U:
 				in_underline++;
 				attr_flag |= GG_FONT_UNDERLINE;
-			} else if (strncmp(tag, "</u>", 4) == 0) {
+				break;
+
+			case GG_HTML_TAG_U_END:
 				if (in_underline > 0) {
 					in_underline--;
 					if (in_underline == 0)
 						attr_flag &= ~GG_FONT_UNDERLINE;
 				}
-			} else if (strncmp(tag, "<span ", 6) == 0) {
-				for (tag += 6; tag < src - 8; tag++) {
+				break;
+
+			case GG_HTML_TAG_SPAN:
+				for (tag += 6; tag + 8 < p; tag++) {
 					if (*tag == '\"' || *tag == '\'' || *tag == ' ') {
-						if (strncmp(tag + 1, "color:#", 7) == 0) {
-							int i, ok = 1;
-							char buf[3] = { 0 };
+						if (memcmp(tag + 1, "color:#", 7) == 0) {
+							int i;
 
 							tag += 8;
-							if (tag + 6 > src)
+							if (tag + 6 > p)
 								break;
 
 							for (i = 0; i < 6; i++) {
-								if ((tag[i] < '0' || tag[i] > '9') && (tolower(tag[i]) < 'a' || tolower(tag[i]) > 'f')) {
-									ok = 0;
+								if (gg_message_hex_value(tag[i]) == -1)
 									break;
-								}
 							}
 
-							if (!ok)
+							if (i < 6)
 								break;
 
-							for (i = 0; i < 6; i += 2) {
-								buf[0] = tag[i];
-								buf[1] = tag[i + 1];
-								/* buf[2] to '\0' */
-								color[i / 2] = (unsigned char) strtoul(buf, NULL, 16);
-							}
+							for (i = 0; i < 6; i += 2)
+								color[i / 2] = (unsigned char) ((gg_message_hex_value(tag[i]) << 4) | gg_message_hex_value(tag[i + 1]));
 
 							attr_flag |= GG_FONT_COLOR;
 						}
 					}
 				}
-			} else if (strncmp(tag, "</span", 6) == 0) {
+				break;
+
+			case GG_HTML_TAG_SPAN_END:
 				/* Można by trzymać kolory na stosie i tutaj przywracać poprzedni, ale to raczej zbędne */
 
 				attr_flag &= ~GG_FONT_COLOR;
-			}
+				break;
 
-			tag = NULL;
-			in_tag = 0;
-			continue;
+			case GG_HTML_TAG_UNKNOWN:
+				break;
 		}
+	}
 
-		if (in_tag)
-			continue;
+	if (dst != NULL)
+		dst[len] = '\0';
+	
+	return len;
+}
 
-		if (*src == '&') {
-			in_entity = 1;
-			entity = src;
-			continue;
-		}
+/**
+ * \internal Zamienia tekst w formacie HTML na czysty tekst w jednym przebiegu.
+ *
+ * Tekst wynikowy nigdy nie jest dłuższy niż źródłowy, a każdy atrybut
+ * formatowania (do 6 bajtów) wymaga co najmniej jednego znacznika
+ * (co najmniej 3 bajty), więc bufory o rozmiarze odpowiednio tekstu
+ * i jego podwojonej długości wystarczą. Po konwersji bufory są zmniejszane
+ * do właściwego rozmiaru.
+ *
+ * \param html Tekst źródłowy
+ * \param encoding Kodowanie tekstu źródłowego oraz wynikowego
+ * \param format Wskaźnik na zmienną, do której zostanie zapisany zaalokowany bufor atrybutów formatowania (może być \c NULL)
+ * \param format_len Wskaźnik na zmienną, do której zostanie zapisana długość atrybutów formatowania (może być \c NULL)
+ * \param format_offset Liczba bajtów zarezerwowanych na początku bufora atrybutów formatowania, np. na nagłówek
+ *
+ * \return Zaalokowany bufor z czystym tekstem lub \c NULL w przypadku błędu.
+ */
+char *gg_message_html_to_text_alloc(const char *html, gg_encoding_t encoding, unsigned char **format, size_t *format_len, size_t format_offset)
+{
+	size_t html_len, len, fmt_len = 0;
+	unsigned char *fmt = NULL, *tmp_fmt;
+	char *result, *tmp;
 
-		if (in_entity && *src == ';') {
-			in_entity = 0;
-
-			if (dst != NULL) {
-				if (strncmp(entity, "&lt;", 4) == 0)
-					dst[len++] = '<';
-				else if (strncmp(entity, "&gt;", 4) == 0)
-					dst[len++] = '>';
-				else if (strncmp(entity, "&quot;", 6) == 0)
-					dst[len++] = '"';
-				else if (strncmp(entity, "&apos;", 6) == 0)
-					dst[len++] = '\'';
-				else if (strncmp(entity, "&amp;", 5) == 0)
-					dst[len++] = '&';
-				else if (strncmp(entity, "&nbsp;", 6) == 0) {
-					if (encoding == GG_ENCODING_UTF8)
-						dst[len++] = '\xc2';
-					dst[len++] = '\xa0';
-				} else
-					dst[len++] = '?';
-			} else {
-				if (strncmp(entity, "&nbsp;", 6) == 0)
-					len += 2;
-				else
-					len++;
-			}
+	html_len = strlen(html);
 
-			gg_after_append_formatted_char(&pos, attr_flag, &old_attr_flag, color, old_color, imgs_size, &format, format_len);
+	if (html_len > ((size_t) -1) / 4 || format_offset > ((size_t) -1) / 4) {
+		errno = ENOMEM;
+		return NULL;
+	}
 
-			continue;
+	result = malloc(html_len + 1);
+
+	if (result == NULL)
+		return NULL;
+
+	if (format != NULL) {
+		fmt = malloc(format_offset + html_len * 2 + 1);
+
+		if (fmt == NULL) {
+			free(result);
+			return NULL;
 		}
+	}
 
-		if (in_entity && !(isalnum(*src) || *src == '#'))
-			in_entity = 0;
+	len = gg_message_html_to_text(result, (fmt != NULL) ? (fmt + format_offset) : NULL, &fmt_len, html, encoding);
 
-		if (in_entity)
-			continue;
+	tmp = realloc(result, len + 1);
 
-		if (dst != NULL)
-			dst[len] = *src;
-		len++;
+	if (tmp != NULL)
+		result = tmp;
 
-		if (encoding != GG_ENCODING_UTF8 || (*src & 0xc0) != 0x80)
-			gg_after_append_formatted_char(&pos, attr_flag, &old_attr_flag, color, old_color, imgs_size, &format, format_len);
+	if (fmt != NULL) {
+		tmp_fmt = realloc(fmt, format_offset + fmt_len + 1);
+
+		if (tmp_fmt != NULL)
+			fmt = tmp_fmt;
+
+		*format = fmt;
 	}
 
-	if (dst != NULL)
-		dst[len] = '\0';
-	
-	return len;
+	if (format_len != NULL)
+		*format_len = fmt_len;
+
+	return result;
 }
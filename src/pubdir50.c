@@ -35,6 +35,50 @@
 #include "libgadu.h"
 #include "internal.h"
 #include "encoding.h"
+#include "pubdir50cache.h"
+
+/**
+ * \internal Znane pola odpowiedzi katalogu publicznego.
+ *
+ * Wartości tych pól są przechowywane w tablicy indeksowanej numerem wyniku
+ * i numerem pola, a pozostałe na liście \c entries.
+ */
+static const char *gg_pubdir50_fields[] = {
+	GG_PUBDIR50_UIN,
+	GG_PUBDIR50_STATUS,
+	GG_PUBDIR50_FIRSTNAME,
+	GG_PUBDIR50_LASTNAME,
+	GG_PUBDIR50_NICKNAME,
+	GG_PUBDIR50_BIRTHYEAR,
+	GG_PUBDIR50_CITY,
+	GG_PUBDIR50_GENDER,
+	GG_PUBDIR50_ACTIVE,
+	GG_PUBDIR50_START,
+	GG_PUBDIR50_FAMILYNAME,
+	GG_PUBDIR50_FAMILYCITY,
+};
+
+/** \internal Liczba znanych pól odpowiedzi */
+#define GG_PUBDIR50_FIELDS (sizeof(gg_pubdir50_fields) / sizeof(gg_pubdir50_fields[0]))
+
+/**
+ * \internal Zwraca numer znanego pola.
+ *
+ * \param field Nazwa pola (wielkość liter nie ma znaczenia)
+ *
+ * \return Numer pola lub -1, jeśli pole jest nieznane
+ */
+static int gg_pubdir50_field_index(const char *field)
+{
+	unsigned int i;
+
+	for (i = 0; i < GG_PUBDIR50_FIELDS; i++) {
+		if (strcasecmp(gg_pubdir50_fields[i], field) == 0)
+			return i;
+	}
+
+	return -1;
+}
 
 /**
  * Tworzy nowe zapytanie katalogu publicznego.
@@ -103,14 +147,19 @@ static int gg_pubdir50_add_n(gg_pubdir50_t req, int num, const char *field, cons
 		return -1;
 	}
 
-	if (!(tmp = realloc(req->entries, sizeof(struct gg_pubdir50_entry) * (req->entries_count + 1)))) {
-		gg_debug(GG_DEBUG_MISC, "// gg_pubdir50_add_n() out of memory\n");
-		free(dupfield);
-		free(dupvalue);
-		return -1;
-	}
+	if (req->entries_count == req->entries_size) {
+		int size = (req->entries_size != 0) ? req->entries_size * 2 : 16;
 
-	req->entries = tmp;
+		if (!(tmp = realloc(req->entries, sizeof(struct gg_pubdir50_entry) * size))) {
+			gg_debug(GG_DEBUG_MISC, "// gg_pubdir50_add_n() out of memory\n");
+			free(dupfield);
+			free(dupvalue);
+			return -1;
+		}
+
+		req->entries = tmp;
+		req->entries_size = size;
+	}
 
 	entry = &req->entries[req->entries_count];
 	entry->num = num;
@@ -122,6 +171,85 @@ static int gg_pubdir50_add_n(gg_pubdir50_t req, int num, const char *field, cons
 	return 0;
 }
 
+/**
+ * \internal Zapisuje pole wyniku odpowiedzi katalogu publicznego.
+ *
+ * Wartości znanych pól trafiają do wspólnego bufora, a ich położenie do
+ * tablicy wyników, dzięki czemu zapis i odczyt nie zależą od liczby
+ * wyników. Nieznane pola są dodawane do listy \c entries.
+ *
+ * \param res Odpowiedź
+ * \param num Numer wyniku odpowiedzi
+ * \param field Nazwa pola
+ * \param value Wartość pola
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+static int gg_pubdir50_set_n(gg_pubdir50_t res, int num, const char *field, const char *value)
+{
+	size_t len;
+	int index;
+
+	index = gg_pubdir50_field_index(field);
+
+	if (index == -1)
+		return gg_pubdir50_add_n(res, num, field, value);
+
+	if (num >= res->table_rows) {
+		uint32_t *tmp;
+		int rows;
+
+		rows = (res->table_rows != 0) ? res->table_rows * 2 : 8;
+
+		while (rows <= num)
+			rows *= 2;
+
+		tmp = realloc(res->table, rows * GG_PUBDIR50_FIELDS * sizeof(uint32_t));
+
+		if (tmp == NULL) {
+			gg_debug(GG_DEBUG_MISC, "// gg_pubdir50_set_n() out of memory\n");
+			return -1;
+		}
+
+		memset(tmp + res->table_rows * GG_PUBDIR50_FIELDS, 0, (rows - res->table_rows) * GG_PUBDIR50_FIELDS * sizeof(uint32_t));
+
+		res->table = tmp;
+		res->table_rows = rows;
+	}
+
+	len = strlen(value) + 1;
+
+	/* położenie 0 oznacza brak pola, więc pierwszy bajt bufora jest pusty */
+
+	if (res->arena_len == 0)
+		res->arena_len = 1;
+
+	if (res->arena_len + len > res->arena_size) {
+		size_t size = (res->arena_size != 0) ? res->arena_size : 256;
+		char *tmp;
+
+		while (res->arena_len + len > size)
+			size *= 2;
+
+		tmp = realloc(res->arena, size);
+
+		if (tmp == NULL) {
+			gg_debug(GG_DEBUG_MISC, "// gg_pubdir50_set_n() out of memory\n");
+			return -1;
+		}
+
+		res->arena = tmp;
+		res->arena_size = size;
+	}
+
+	memcpy(res->arena + res->arena_len, value, len);
+
+	res->table[num * GG_PUBDIR50_FIELDS + index] = res->arena_len;
+	res->arena_len += len;
+
+	return 0;
+}
+
 /**
  * Dodaje pole zapytania.
  *
@@ -183,6 +311,8 @@ void gg_pubdir50_free(gg_pubdir50_t s)
 	}
 
 	free(s->entries);
+	free(s->table);
+	free(s->arena);
 	free(s);
 }
 
@@ -226,27 +356,21 @@ uint32_t gg_pubdir50(struct gg_session *sess, gg_pubdir50_t req)
 			size += strlen(req->entries[i].field) + 1;
 			size += strlen(req->entries[i].value) + 1;
 		} else {
-			char *tmp;
+			int len;
 
-			/* XXX \todo zoptymalizować */
-			tmp = gg_encoding_convert(req->entries[i].field, sess->encoding, GG_ENCODING_CP1250, -1, -1);
+			len = gg_encoding_convert_buf(req->entries[i].field, sess->encoding, GG_ENCODING_CP1250, -1, NULL, 0);
 
-			if (tmp == NULL)
+			if (len == -1)
 				return -1;
 
-			size += strlen(tmp) + 1;
+			size += len + 1;
 
-			free(tmp);
+			len = gg_encoding_convert_buf(req->entries[i].value, sess->encoding, GG_ENCODING_CP1250, -1, NULL, 0);
 
-			/* XXX \todo zoptymalizować */
-			tmp = gg_encoding_convert(req->entries[i].value, sess->encoding, GG_ENCODING_CP1250, -1, -1);
-
-			if (tmp == NULL)
+			if (len == -1)
 				return -1;
 
-			size += strlen(tmp) + 1;
-
-			free(tmp);
+			size += len + 1;
 		}
 	}
 
@@ -275,37 +399,42 @@ uint32_t gg_pubdir50(struct gg_session *sess, gg_pubdir50_t req)
 			strcpy(p, req->entries[i].value);
 			p += strlen(p) + 1;
 		} else {
-			char *tmp;
+			int len;
 
-			/* XXX \todo zoptymalizować */
-			tmp = gg_encoding_convert(req->entries[i].field, sess->encoding, GG_ENCODING_CP1250, -1, -1);
+			/* Rozmiar bufora został policzony wcześniej, więc
+			 * konwertujemy od razu do pakietu. */
+			len = gg_encoding_convert_buf(req->entries[i].field, sess->encoding, GG_ENCODING_CP1250, -1, p, buf + size - p);
 
-			if (tmp == NULL) {
+			if (len == -1) {
 				free(buf);
 				return -1;
 			}
 
-			strcpy(p, tmp);
-			p += strlen(tmp) + 1;
-			free(tmp);
+			p += len + 1;
 
-			/* XXX \todo zoptymalizować */
-			tmp = gg_encoding_convert(req->entries[i].value, sess->encoding, GG_ENCODING_CP1250, -1, -1);
+			len = gg_encoding_convert_buf(req->entries[i].value, sess->encoding, GG_ENCODING_CP1250, -1, p, buf + size - p);
 
-
-			if (tmp == NULL) {
+			if (len == -1) {
 				free(buf);
 				return -1;
 			}
 
-			strcpy(p, tmp);
-			p += strlen(tmp) + 1;
-			free(tmp);
+			p += len + 1;
 		}
 	}
 
-	if (gg_send_packet(sess, GG_PUBDIR50_REQUEST, buf, size, NULL, 0) == -1)
+	/* identyczne zapytanie mogło zostać już wysłane lub odpowiedź na nie
+	 * jest w pamięci podręcznej */
+
+	if (gg_pubdir50_cache_request(sess, req->seq, buf, size) == 1) {
+		free(buf);
+		return res;
+	}
+
+	if (gg_send_packet(sess, GG_PUBDIR50_REQUEST, buf, size, NULL, 0) == -1) {
+		gg_pubdir50_cache_cancel(sess, req->seq);
 		res = 0;
+	}
 
 	free(buf);
 
@@ -420,22 +549,18 @@ int gg_pubdir50_handle_reply_sess(struct gg_session *sess, struct gg_event *e, c
 			num--;
 		} else {
 			if (sess->encoding == GG_ENCODING_CP1250) {
-				if (gg_pubdir50_add_n(res, num, field, value) == -1)
+				if (gg_pubdir50_set_n(res, num, field, value) == -1)
 					goto failure;
 			} else {
-				char *tmp;
+				const char *tmp;
 
-				tmp = gg_encoding_convert(value, GG_ENCODING_CP1250, sess->encoding, -1, -1);
+				tmp = gg_encoding_convert_session(sess, value, GG_ENCODING_CP1250, sess->encoding, -1);
 
 				if (tmp == NULL)
 					goto failure;
 
-				if (gg_pubdir50_add_n(res, num, field, tmp) == -1) {
-					free(tmp);
+				if (gg_pubdir50_set_n(res, num, field, tmp) == -1)
 					goto failure;
-				}
-
-				free(tmp);
 			}
 		}
 	}	
@@ -473,6 +598,13 @@ const char *gg_pubdir50_get(gg_pubdir50_t res, int num, const char *field)
 		return NULL;
 	}
 
+	if (res->table != NULL && num < res->table_rows) {
+		int index = gg_pubdir50_field_index(field);
+
+		if (index != -1 && res->table[num * GG_PUBDIR50_FIELDS + index] != 0)
+			return res->arena + res->table[num * GG_PUBDIR50_FIELDS + index];
+	}
+
 	for (i = 0; i < res->entries_count; i++) {
 		if (res->entries[i].num == num && !strcasecmp(res->entries[i].field, field)) {
 			value = res->entries[i].value;
@@ -0,0 +1,807 @@
+/* $Id$ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License Version
+ *  2.1 as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307,
+ *  USA.
+ */
+
+/**
+ * \file pubdir50cache.c
+ *
+ * \brief Pamięć podręczna zapytań katalogu publicznego
+ *
+ * Zapytania są identyfikowane rodzajem i posortowanymi parami pól, więc
+ * kolejność dodawania pól nie ma znaczenia. Jeśli identyczne zapytanie
+ * czeka już na odpowiedź, kolejne nie jest wysyłane do serwera, a jedna
+ * odpowiedź trafia do wszystkich oczekujących, również w innych sesjach.
+ * Odpowiedzi są przechowywane przez określony czas, a przy przekroczeniu
+ * rozmiaru usuwane są najdawniej używane.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libgadu.h"
+#include "pubdir50cache.h"
+#include "protocol.h"
+#include "debug.h"
+
+/** \internal Liczba kubełków tablicy mieszającej */
+#define GG_PUBDIR50_CACHE_HASH_SIZE 256
+
+/** \internal Czas, po którym zapytanie bez odpowiedzi jest wysyłane ponownie */
+#define GG_PUBDIR50_CACHE_PENDING_TIMEOUT 30
+
+/**
+ * \internal Sesja oczekująca na odpowiedź na zapytanie wysłane przez inną.
+ */
+struct gg_pubdir50_cache_waiter {
+	struct gg_session *sess;		/**< Struktura sesji */
+	uint32_t seq;				/**< Numer sekwencyjny zapytania */
+
+	struct gg_pubdir50_cache_waiter *next;	/**< Kolejny element listy */
+};
+
+/**
+ * \internal Zapytanie katalogu publicznego i odpowiedź na nie.
+ */
+struct gg_pubdir50_cache_entry {
+	char *key;				/**< Klucz zapytania */
+	size_t key_len;				/**< Długość klucza */
+	unsigned int hash;			/**< Skrót klucza */
+	char *request;				/**< Pakiet zapytania */
+	size_t request_len;			/**< Długość pakietu zapytania */
+	char *reply;				/**< Pakiet odpowiedzi lub \c NULL, jeśli jeszcze nie nadeszła */
+	size_t reply_len;			/**< Długość pakietu odpowiedzi */
+	time_t time;				/**< Czas wysłania zapytania lub odebrania odpowiedzi */
+
+	struct gg_session *owner;		/**< Sesja, która wysłała zapytanie */
+	uint32_t owner_seq;			/**< Numer sekwencyjny wysłanego zapytania */
+	struct gg_pubdir50_cache_waiter *waiters;	/**< Sesje oczekujące na odpowiedź */
+
+	struct gg_pubdir50_cache_entry *prev;	/**< Poprzedni (częściej używany) element listy */
+	struct gg_pubdir50_cache_entry *next;	/**< Kolejny (rzadziej używany) element listy */
+	struct gg_pubdir50_cache_entry *hash_next;	/**< Kolejny element w tablicy mieszającej */
+	struct gg_pubdir50_cache_entry *pending_next;	/**< Kolejne zapytanie oczekujące na odpowiedź */
+
+	int stale;				/**< Flaga nieaktualnego zapytania, którego odpowiedź nie zostanie przechowana */
+};
+
+/** \internal Pole zapytania wykorzystywane przy tworzeniu klucza */
+struct gg_pubdir50_cache_pair {
+	const char *field;
+	const char *value;
+};
+
+/** \internal Tablica mieszająca zapytań */
+static struct gg_pubdir50_cache_entry *gg_pubdir50_cache_hash[GG_PUBDIR50_CACHE_HASH_SIZE];
+
+/** \internal Najczęściej używane zapytanie */
+static struct gg_pubdir50_cache_entry *gg_pubdir50_cache_head;
+
+/** \internal Najrzadziej używane zapytanie */
+static struct gg_pubdir50_cache_entry *gg_pubdir50_cache_tail;
+
+/** \internal Lista zapytań oczekujących na odpowiedź */
+static struct gg_pubdir50_cache_entry *gg_pubdir50_cache_pending;
+
+/** \internal Łączny rozmiar przechowywanych odpowiedzi */
+static size_t gg_pubdir50_cache_size;
+
+/** \internal Maksymalny rozmiar pamięci podręcznej lub 0, jeśli wyłączona */
+static size_t gg_pubdir50_cache_limit;
+
+/** \internal Czas przechowywania odpowiedzi w sekundach */
+static int gg_pubdir50_cache_ttl;
+
+/**
+ * \internal Porównuje pola zapytania przy sortowaniu.
+ */
+static int gg_pubdir50_cache_pair_cmp(const void *a, const void *b)
+{
+	const struct gg_pubdir50_cache_pair *pa = a, *pb = b;
+	int res;
+
+	res = strcmp(pa->field, pb->field);
+
+	if (res == 0)
+		res = strcmp(pa->value, pb->value);
+
+	return res;
+}
+
+/**
+ * \internal Tworzy klucz zapytania.
+ *
+ * Klucz składa się z rodzaju zapytania, numeru użytkownika w przypadku
+ * pobierania informacji o sobie oraz posortowanych par pól.
+ *
+ * \param sess Struktura sesji
+ * \param packet Pakiet zapytania
+ * \param length Długość pakietu
+ * \param key_len Wskaźnik na zmienną, do której zostanie zapisana długość
+ *                klucza
+ *
+ * \return Klucz lub \c NULL w przypadku błędu
+ */
+static char *gg_pubdir50_cache_key(struct gg_session *sess, const char *packet, size_t length, size_t *key_len)
+{
+	struct gg_pubdir50_cache_pair *pairs;
+	const char *p, *end = packet + length;
+	unsigned int count = 0, i;
+	char *key, *q;
+
+	for (p = packet + 5; p < end; p++) {
+		if (*p == 0)
+			count++;
+	}
+
+	if (count % 2 != 0 || (length > 5 && packet[length - 1] != 0))
+		return NULL;
+
+	count /= 2;
+
+	pairs = malloc((count + 1) * sizeof(struct gg_pubdir50_cache_pair));
+
+	if (pairs == NULL)
+		return NULL;
+
+	for (i = 0, p = packet + 5; i < count; i++) {
+		pairs[i].field = p;
+		p += strlen(p) + 1;
+		pairs[i].value = p;
+		p += strlen(p) + 1;
+	}
+
+	qsort(pairs, count, sizeof(struct gg_pubdir50_cache_pair), gg_pubdir50_cache_pair_cmp);
+
+	key = malloc(1 + sizeof(uin_t) + length);
+
+	if (key == NULL) {
+		free(pairs);
+		return NULL;
+	}
+
+	q = key;
+	*q++ = packet[0];
+
+	if (packet[0] == GG_PUBDIR50_READ) {
+		memcpy(q, &sess->uin, sizeof(uin_t));
+		q += sizeof(uin_t);
+	}
+
+	for (i = 0; i < count; i++) {
+		size_t len;
+
+		len = strlen(pairs[i].field) + 1;
+		memcpy(q, pairs[i].field, len);
+		q += len;
+
+		len = strlen(pairs[i].value) + 1;
+		memcpy(q, pairs[i].value, len);
+		q += len;
+	}
+
+	free(pairs);
+
+	*key_len = q - key;
+
+	return key;
+}
+
+/**
+ * \internal Oblicza skrót klucza zapytania.
+ *
+ * \param key Klucz
+ * \param len Długość klucza
+ *
+ * \return Skrót klucza
+ */
+static unsigned int gg_pubdir50_cache_key_hash(const char *key, size_t len)
+{
+	unsigned int hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char) key[i]) * 16777619U;
+
+	return hash;
+}
+
+/**
+ * \internal Zwraca ilość pamięci zajmowanej przez zapytanie.
+ *
+ * \param ce Zapytanie
+ *
+ * \return Rozmiar w bajtach
+ */
+static size_t gg_pubdir50_cache_cost(const struct gg_pubdir50_cache_entry *ce)
+{
+	return sizeof(struct gg_pubdir50_cache_entry) + ce->key_len + ce->request_len + ce->reply_len;
+}
+
+/**
+ * \internal Wstawia zapytanie na początek listy używanych zapytań.
+ *
+ * \param ce Zapytanie
+ */
+static void gg_pubdir50_cache_link(struct gg_pubdir50_cache_entry *ce)
+{
+	ce->prev = NULL;
+	ce->next = gg_pubdir50_cache_head;
+
+	if (gg_pubdir50_cache_head != NULL)
+		gg_pubdir50_cache_head->prev = ce;
+	else
+		gg_pubdir50_cache_tail = ce;
+
+	gg_pubdir50_cache_head = ce;
+}
+
+/**
+ * \internal Usuwa zapytanie z listy używanych zapytań.
+ *
+ * \param ce Zapytanie
+ */
+static void gg_pubdir50_cache_unlink(struct gg_pubdir50_cache_entry *ce)
+{
+	if (ce->prev != NULL)
+		ce->prev->next = ce->next;
+	else
+		gg_pubdir50_cache_head = ce->next;
+
+	if (ce->next != NULL)
+		ce->next->prev = ce->prev;
+	else
+		gg_pubdir50_cache_tail = ce->prev;
+
+	ce->prev = NULL;
+	ce->next = NULL;
+}
+
+/**
+ * \internal Usuwa zapytanie z pamięci podręcznej i zwalnia je.
+ *
+ * \param ce Zapytanie
+ */
+static void gg_pubdir50_cache_remove(struct gg_pubdir50_cache_entry *ce)
+{
+	struct gg_pubdir50_cache_entry **cep;
+
+	for (cep = &gg_pubdir50_cache_hash[ce->hash % GG_PUBDIR50_CACHE_HASH_SIZE]; *cep != NULL; cep = &(*cep)->hash_next) {
+		if (*cep == ce) {
+			*cep = ce->hash_next;
+			break;
+		}
+	}
+
+	if (ce->reply == NULL) {
+		for (cep = &gg_pubdir50_cache_pending; *cep != NULL; cep = &(*cep)->pending_next) {
+			if (*cep == ce) {
+				*cep = ce->pending_next;
+				break;
+			}
+		}
+	}
+
+	gg_pubdir50_cache_unlink(ce);
+
+	gg_pubdir50_cache_size -= gg_pubdir50_cache_cost(ce);
+
+	while (ce->waiters != NULL) {
+		struct gg_pubdir50_cache_waiter *w = ce->waiters;
+
+		ce->waiters = w->next;
+		free(w);
+	}
+
+	free(ce->key);
+	free(ce->request);
+	free(ce->reply);
+	free(ce);
+}
+
+/**
+ * \internal Usuwa najdawniej używane odpowiedzi, aż rozmiar pamięci
+ * podręcznej nie przekroczy limitu.
+ *
+ * Zapytania oczekujące na odpowiedź nie są usuwane.
+ */
+static void gg_pubdir50_cache_evict(void)
+{
+	struct gg_pubdir50_cache_entry *ce = gg_pubdir50_cache_tail;
+
+	while (ce != NULL && gg_pubdir50_cache_size > gg_pubdir50_cache_limit) {
+		struct gg_pubdir50_cache_entry *prev = ce->prev;
+
+		if (ce->reply != NULL)
+			gg_pubdir50_cache_remove(ce);
+
+		ce = prev;
+	}
+}
+
+/**
+ * \internal Kolejkuje odpowiedź do przekazania aplikacji przez
+ * \c gg_watch_fd().
+ *
+ * \param sess Struktura sesji
+ * \param seq Numer sekwencyjny zapytania
+ * \param packet Pakiet odpowiedzi
+ * \param length Długość pakietu
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ */
+static int gg_pubdir50_cache_deliver(struct gg_session *sess, uint32_t seq, const char *packet, size_t length)
+{
+	struct gg_pubdir50_ready *pr, **prp;
+	uint32_t tmp;
+
+	pr = malloc(sizeof(struct gg_pubdir50_ready));
+
+	if (pr == NULL)
+		return -1;
+
+	pr->packet = malloc(length);
+
+	if (pr->packet == NULL) {
+		free(pr);
+		return -1;
+	}
+
+	memcpy(pr->packet, packet, length);
+
+	tmp = gg_fix32(seq);
+	memcpy(pr->packet + 1, &tmp, sizeof(tmp));
+
+	pr->length = length;
+	pr->next = NULL;
+
+	for (prp = &sess->pubdir50_ready; *prp != NULL; prp = &(*prp)->next)
+		;
+
+	*prp = pr;
+
+	sess->check |= GG_CHECK_WRITE;
+
+	return 0;
+}
+
+/**
+ * \internal Przekazuje wysłanie zapytania pierwszej oczekującej sesji.
+ *
+ * Wywoływana, gdy sesja, która wysłała zapytanie, nie otrzyma na nie
+ * odpowiedzi. Jeśli nie ma już oczekujących sesji, zapytanie jest usuwane.
+ *
+ * \param ce Zapytanie
+ */
+static void gg_pubdir50_cache_handover(struct gg_pubdir50_cache_entry *ce)
+{
+	while (ce->waiters != NULL) {
+		struct gg_pubdir50_cache_waiter *w = ce->waiters;
+		uint32_t tmp;
+
+		ce->waiters = w->next;
+
+		tmp = gg_fix32(w->seq);
+		memcpy(ce->request + 1, &tmp, sizeof(tmp));
+
+		if (w->sess->state == GG_STATE_CONNECTED && gg_send_packet(w->sess, GG_PUBDIR50_REQUEST, ce->request, ce->request_len, NULL) == 0) {
+			ce->owner = w->sess;
+			ce->owner_seq = w->seq;
+			ce->time = time(NULL);
+			free(w);
+			return;
+		}
+
+		gg_debug_session(w->sess, GG_DEBUG_MISC, "// gg_pubdir50_cache_handover() unable to send request\n");
+
+		free(w);
+	}
+
+	gg_pubdir50_cache_remove(ce);
+}
+
+/**
+ * \internal Usuwa przechowywane informacje o użytkowniku po ich zmianie.
+ *
+ * Odpowiedzi na zapytania, które jeszcze nie nadeszły, trafią do
+ * oczekujących sesji, ale nie zostaną przechowane.
+ *
+ * \param uin Numer użytkownika
+ */
+static void gg_pubdir50_cache_invalidate(uin_t uin)
+{
+	struct gg_pubdir50_cache_entry *ce, *next;
+
+	for (ce = gg_pubdir50_cache_head; ce != NULL; ce = next) {
+		next = ce->next;
+
+		if (ce->key[0] != GG_PUBDIR50_READ || memcmp(ce->key + 1, &uin, sizeof(uin_t)) != 0)
+			continue;
+
+		if (ce->reply != NULL)
+			gg_pubdir50_cache_remove(ce);
+		else
+			ce->stale = 1;
+	}
+}
+
+/**
+ * \internal Obsługuje zapytanie katalogu publicznego przed wysłaniem.
+ *
+ * Jeśli odpowiedź na identyczne zapytanie jest przechowywana, zostanie
+ * przekazana aplikacji przy najbliższym wywołaniu \c gg_watch_fd(). Jeśli
+ * identyczne zapytanie czeka na odpowiedź, sesja zostaje dopisana do
+ * oczekujących. W przeciwnym wypadku zapytanie jest zapamiętywane jako
+ * oczekujące na odpowiedź i musi zostać wysłane.
+ *
+ * \param sess Struktura sesji
+ * \param seq Numer sekwencyjny zapytania
+ * \param packet Pakiet zapytania
+ * \param length Długość pakietu
+ *
+ * \return 1 jeśli zapytanie nie musi być wysłane, 0 jeśli musi
+ */
+int gg_pubdir50_cache_request(struct gg_session *sess, uint32_t seq, const char *packet, size_t length)
+{
+	struct gg_pubdir50_cache_entry *ce;
+	struct gg_pubdir50_cache_waiter *w;
+	unsigned int hash;
+	size_t key_len;
+	time_t now;
+	char *key;
+
+	if (gg_pubdir50_cache_limit == 0 || length < 5)
+		return 0;
+
+	if (packet[0] == GG_PUBDIR50_WRITE) {
+		gg_pubdir50_cache_invalidate(sess->uin);
+		return 0;
+	}
+
+	if (packet[0] != GG_PUBDIR50_READ && packet[0] != GG_PUBDIR50_SEARCH_REQUEST)
+		return 0;
+
+	key = gg_pubdir50_cache_key(sess, packet, length, &key_len);
+
+	if (key == NULL)
+		return 0;
+
+	hash = gg_pubdir50_cache_key_hash(key, key_len);
+	now = time(NULL);
+
+	for (ce = gg_pubdir50_cache_hash[hash % GG_PUBDIR50_CACHE_HASH_SIZE]; ce != NULL; ce = ce->hash_next) {
+		if (ce->hash == hash && ce->key_len == key_len && memcmp(ce->key, key, key_len) == 0)
+			break;
+	}
+
+	if (ce != NULL && ce->reply != NULL && now - ce->time >= gg_pubdir50_cache_ttl) {
+		gg_pubdir50_cache_remove(ce);
+		ce = NULL;
+	}
+
+	if (ce != NULL && ce->reply != NULL) {
+		free(key);
+
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_pubdir50_cache_request() reply found in cache\n");
+
+		if (ce != gg_pubdir50_cache_head) {
+			gg_pubdir50_cache_unlink(ce);
+			gg_pubdir50_cache_link(ce);
+		}
+
+		return (gg_pubdir50_cache_deliver(sess, seq, ce->reply, ce->reply_len) == 0) ? 1 : 0;
+	}
+
+	if (ce != NULL) {
+		free(key);
+
+		/* na zapytanie dawno nie przyszła odpowiedź lub informacje
+		 * zmieniono po jego wysłaniu, więc wysyłamy je ponownie,
+		 * a dotychczas oczekujący dostaną nową odpowiedź */
+
+		if (ce->stale || now - ce->time > GG_PUBDIR50_CACHE_PENDING_TIMEOUT) {
+			ce->owner = sess;
+			ce->owner_seq = seq;
+			ce->time = now;
+			ce->stale = 0;
+			return 0;
+		}
+
+		w = malloc(sizeof(struct gg_pubdir50_cache_waiter));
+
+		if (w == NULL)
+			return 0;
+
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_pubdir50_cache_request() waiting for identical request\n");
+
+		w->sess = sess;
+		w->seq = seq;
+		w->next = ce->waiters;
+		ce->waiters = w;
+
+		return 1;
+	}
+
+	ce = malloc(sizeof(struct gg_pubdir50_cache_entry));
+
+	if (ce == NULL) {
+		free(key);
+		return 0;
+	}
+
+	memset(ce, 0, sizeof(struct gg_pubdir50_cache_entry));
+
+	ce->request = malloc(length);
+
+	if (ce->request == NULL) {
+		free(key);
+		free(ce);
+		return 0;
+	}
+
+	memcpy(ce->request, packet, length);
+
+	ce->key = key;
+	ce->key_len = key_len;
+	ce->hash = hash;
+	ce->request_len = length;
+	ce->time = now;
+	ce->owner = sess;
+	ce->owner_seq = seq;
+
+	ce->hash_next = gg_pubdir50_cache_hash[hash % GG_PUBDIR50_CACHE_HASH_SIZE];
+	gg_pubdir50_cache_hash[hash % GG_PUBDIR50_CACHE_HASH_SIZE] = ce;
+
+	ce->pending_next = gg_pubdir50_cache_pending;
+	gg_pubdir50_cache_pending = ce;
+
+	gg_pubdir50_cache_link(ce);
+
+	gg_pubdir50_cache_size += gg_pubdir50_cache_cost(ce);
+
+	return 0;
+}
+
+/**
+ * \internal Informuje, że zapytania nie udało się wysłać.
+ *
+ * \param sess Struktura sesji
+ * \param seq Numer sekwencyjny zapytania
+ */
+void gg_pubdir50_cache_cancel(struct gg_session *sess, uint32_t seq)
+{
+	struct gg_pubdir50_cache_entry *ce;
+
+	for (ce = gg_pubdir50_cache_pending; ce != NULL; ce = ce->pending_next) {
+		if (ce->owner == sess && ce->owner_seq == seq) {
+			gg_pubdir50_cache_handover(ce);
+			break;
+		}
+	}
+}
+
+/**
+ * \internal Obsługuje odpowiedź katalogu publicznego.
+ *
+ * Jeśli odpowiedź dotyczy zapytania zapamiętanego w pamięci podręcznej,
+ * jest przekazywana wszystkim oczekującym sesjom i przechowywana.
+ *
+ * \param sess Struktura sesji
+ * \param packet Pakiet odpowiedzi
+ * \param length Długość pakietu
+ */
+void gg_pubdir50_cache_reply(struct gg_session *sess, const char *packet, size_t length)
+{
+	struct gg_pubdir50_cache_entry *ce, **cep;
+	uint32_t seq;
+
+	if (length < 5)
+		return;
+
+	/* odpowiedź na zmianę informacji o sobie mogła nadejść później niż
+	 * odpowiedź na ich pobranie wysłane w międzyczasie */
+
+	if (packet[0] == GG_PUBDIR50_WRITE) {
+		gg_pubdir50_cache_invalidate(sess->uin);
+		return;
+	}
+
+	if (gg_pubdir50_cache_pending == NULL)
+		return;
+
+	memcpy(&seq, packet + 1, sizeof(seq));
+	seq = gg_fix32(seq);
+
+	for (cep = &gg_pubdir50_cache_pending; *cep != NULL; cep = &(*cep)->pending_next) {
+		if ((*cep)->owner == sess && (*cep)->owner_seq == seq)
+			break;
+	}
+
+	if (*cep == NULL)
+		return;
+
+	ce = *cep;
+	*cep = ce->pending_next;
+	ce->pending_next = NULL;
+
+	ce->reply = malloc(length);
+
+	if (ce->reply == NULL) {
+		gg_debug_session(sess, GG_DEBUG_MISC, "// gg_pubdir50_cache_reply() out of memory\n");
+		gg_pubdir50_cache_handover(ce);
+		return;
+	}
+
+	memcpy(ce->reply, packet, length);
+	ce->reply_len = length;
+	ce->time = time(NULL);
+	ce->owner = NULL;
+
+	gg_pubdir50_cache_size += length;
+
+	while (ce->waiters != NULL) {
+		struct gg_pubdir50_cache_waiter *w = ce->waiters;
+
+		ce->waiters = w->next;
+
+		if (gg_pubdir50_cache_deliver(w->sess, w->seq, packet, length) == -1)
+			gg_debug_session(w->sess, GG_DEBUG_MISC, "// gg_pubdir50_cache_reply() out of memory\n");
+
+		free(w);
+	}
+
+	if (gg_pubdir50_cache_limit == 0 || gg_pubdir50_cache_ttl == 0 || ce->stale)
+		gg_pubdir50_cache_remove(ce);
+	else
+		gg_pubdir50_cache_evict();
+}
+
+/**
+ * \internal Ponawia zapytania, na które nie przyszła odpowiedź.
+ *
+ * Zapytania, na które odpowiedź nie nadeszła w określonym czasie lub
+ * których sesja została rozłączona, są przekazywane innym oczekującym
+ * sesjom. Wywoływana przez \c gg_watch_fd() dla połączonych sesji, więc
+ * oczekujące sesje nie zależą od sesji, która wysłała zapytanie.
+ */
+void gg_pubdir50_cache_check(void)
+{
+	struct gg_pubdir50_cache_entry *ce, *next;
+	time_t now;
+
+	if (gg_pubdir50_cache_pending == NULL)
+		return;
+
+	now = time(NULL);
+
+	for (ce = gg_pubdir50_cache_pending; ce != NULL; ce = next) {
+		next = ce->pending_next;
+
+		if (ce->owner->state != GG_STATE_CONNECTED || ce->owner->fd == -1 || now - ce->time > GG_PUBDIR50_CACHE_PENDING_TIMEOUT) {
+			gg_debug_session(ce->owner, GG_DEBUG_MISC, "// gg_pubdir50_cache_check() no reply, handing over request\n");
+			gg_pubdir50_cache_handover(ce);
+		}
+	}
+}
+
+/**
+ * \internal Usuwa z pamięci podręcznej odwołania do rozłączanej sesji.
+ *
+ * Zapytania wysłane przez sesję są przekazywane innym oczekującym sesjom.
+ *
+ * \param sess Struktura sesji
+ */
+void gg_pubdir50_cache_disconnect(struct gg_session *sess)
+{
+	struct gg_pubdir50_cache_entry *ce, *next;
+
+	for (ce = gg_pubdir50_cache_pending; ce != NULL; ce = ce->pending_next) {
+		struct gg_pubdir50_cache_waiter **wp = &ce->waiters;
+
+		while (*wp != NULL) {
+			if ((*wp)->sess == sess) {
+				struct gg_pubdir50_cache_waiter *w = *wp;
+
+				*wp = w->next;
+				free(w);
+			} else {
+				wp = &(*wp)->next;
+			}
+		}
+	}
+
+	for (ce = gg_pubdir50_cache_pending; ce != NULL; ce = next) {
+		next = ce->pending_next;
+
+		if (ce->owner == sess)
+			gg_pubdir50_cache_handover(ce);
+	}
+}
+
+/**
+ * \internal Usuwa z pamięci podręcznej odwołania do zwalnianej sesji.
+ *
+ * \param sess Struktura sesji
+ */
+void gg_pubdir50_cache_free_session(struct gg_session *sess)
+{
+	gg_pubdir50_cache_disconnect(sess);
+
+	while (sess->pubdir50_ready != NULL) {
+		struct gg_pubdir50_ready *pr = sess->pubdir50_ready;
+
+		sess->pubdir50_ready = pr->next;
+
+		free(pr->packet);
+		free(pr);
+	}
+}
+
+/**
+ * Ustawia rozmiar wspólnej dla wszystkich sesji pamięci podręcznej
+ * zapytań katalogu publicznego.
+ *
+ * Dotyczy wyłącznie wyszukiwania i pobierania informacji o sobie.
+ * Identyczne zapytania wysłane przed nadejściem odpowiedzi, również
+ * w innych sesjach, nie są przesyłane do serwera, a odpowiedź trafia do
+ * wszystkich z ich numerami sekwencyjnymi. Odpowiedzi są przechowywane
+ * przez podany czas i przekazywane aplikacji przy najbliższym wywołaniu
+ * \c gg_watch_fd(), bez udziału serwera. Zmiana informacji o sobie
+ * usuwa przechowywaną odpowiedź na ich pobranie.
+ *
+ * Pamięć podręczna nie jest chroniona przed jednoczesnym dostępem,
+ * a każde wywołanie \c gg_watch_fd() może wysłać zapytanie lub
+ * przekazać odpowiedź innej sesji. Dopóki jest włączona, wszystkie sesje
+ * muszą być obsługiwane przez jeden wątek.
+ *
+ * \param size Maksymalny rozmiar pamięci podręcznej w bajtach lub 0, by ją
+ *             wyłączyć
+ * \param ttl Czas przechowywania odpowiedzi w sekundach lub 0, by jedynie
+ *            łączyć identyczne zapytania
+ *
+ * \return 0 jeśli się powiodło, -1 w przypadku błędu
+ *
+ * \ingroup pubdir50
+ */
+int gg_global_set_pubdir50_cache(size_t size, int ttl)
+{
+	gg_debug(GG_DEBUG_FUNCTION, "** gg_global_set_pubdir50_cache(%u, %d);\n", (unsigned int) size, ttl);
+
+	if (ttl < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	gg_pubdir50_cache_limit = size;
+	gg_pubdir50_cache_ttl = ttl;
+
+	if (size == 0 || ttl == 0) {
+		struct gg_pubdir50_cache_entry *ce, *next;
+
+		for (ce = gg_pubdir50_cache_head; ce != NULL; ce = next) {
+			next = ce->next;
+
+			if (ce->reply != NULL)
+				gg_pubdir50_cache_remove(ce);
+		}
+	} else {
+		gg_pubdir50_cache_evict();
+	}
+
+	return 0;
+}
@@ -114,11 +114,34 @@ static const struct test_data utf8_to_cp1250[] =
 
 	TEST("\xef\xbb\xbf", ""),
 	TEST("\xef\xbb\xbftest", "test"),
+
+	TEST("Lorem ipsum dolor sit amet, consectetur adipiscing elit", "Lorem ipsum dolor sit amet, consectetur adipiscing elit"),
+	TEST("Lorem ipsum dolor sit amet, żółć consectetur adipiscing elit", "Lorem ipsum dolor sit amet, \xbf\xf3\xb3\xe6 consectetur adipiscing elit"),
+	TEST("0123456789abcdeź0123456789abcdef0123456789abcdeź", "0123456789abcde\x9f" "0123456789abcdef0123456789abcde\x9f"),
+	TEST("0123456789abcdef\xc0" "0123456789abcdef", "0123456789abcdef?0123456789abcdef"),
+	TEST_SIZE("0123456789abcdef0123456789abcdef", "0123456789abcdef01234", -1, 21),
+	TEST_SIZE("0123456789abcdef0123456789abcdef", "0123456789abcdef01234", 21, -1),
+	TEST_SIZE("0123456789abcdef\xc0\xc1", "0123456789abcdef?", -1, 17),
+
+	TEST("\xc2\xa1", "?"),
+	TEST("\xc2\xbf", "?"),
+	TEST("\xe2\x84\xa2", "\x99"),
+	TEST("\xe2\x85\x80", "?"),
+	TEST("\xef\xbf\xbd", "?"),
+	TEST("\xf0\x9f\x98\x80", "?"),
 };
 
 static const struct test_data cp1250_to_utf8[] =
 {
 	TEST("za\xbf\xf3\xb3\xe6 g\xea\x9cl\xb9 ja\x9f\xf1", "zażółć gęślą jaźń"),
+
+	TEST("Lorem ipsum dolor sit amet, consectetur adipiscing elit", "Lorem ipsum dolor sit amet, consectetur adipiscing elit"),
+	TEST("Lorem ipsum dolor sit amet, \xbf\xf3\xb3\xe6 consectetur adipiscing elit", "Lorem ipsum dolor sit amet, żółć consectetur adipiscing elit"),
+	TEST("0123456789abcde\x9f" "0123456789abcdef0123456789abcde\x9f", "0123456789abcdeź0123456789abcdef0123456789abcdeź"),
+	TEST_SIZE("0123456789abcdef0123456789abcdef", "0123456789abcdef01234", -1, 21),
+	TEST_SIZE("0123456789abcdef0123456789abcdef", "0123456789abcdef01234", 21, -1),
+	TEST_SIZE("0123456789abcdef\x9f", "0123456789abcdef", -1, 17),
+	TEST_SIZE("0123456789abcdef\x80", "0123456789abcdef", -1, 18),
 };
 
 static void test_utf8_to_cp1250(const struct test_data *t)
@@ -149,6 +172,119 @@ static void test_cp1250_to_utf8(const struct test_data *t)
 	free(res);
 }
 
+static void test_cp1250_roundtrip(void)
+{
+	char src[129], *utf, *res;
+	int i, j;
+
+	/* Wszystkie znaki CP1250 oprócz niezdefiniowanych */
+	for (i = 0x80, j = 0; i < 0x100; i++) {
+		if (i != 0x81 && i != 0x83 && i != 0x88 && i != 0x90 && i != 0x98)
+			src[j++] = i;
+	}
+
+	src[j] = 0;
+
+	utf = gg_encoding_convert(src, GG_ENCODING_CP1250, GG_ENCODING_UTF8, -1, -1);
+	res = gg_encoding_convert(utf, GG_ENCODING_UTF8, GG_ENCODING_CP1250, -1, -1);
+
+	if (strcmp(res, src) != 0) {
+		printf("cp1250->utf8->cp1250: roundtrip failed\n");
+		exit(1);
+	}
+
+	free(utf);
+	free(res);
+}
+
+static void test_convert_buf(void)
+{
+	char buf[8];
+	int res;
+
+	/* Zapytanie o rozmiar */
+	res = gg_encoding_convert_buf("zażółć", GG_ENCODING_UTF8, GG_ENCODING_CP1250, -1, NULL, 0);
+
+	if (res != 6) {
+		printf("convert_buf: size query returned %d\n", res);
+		exit(1);
+	}
+
+	res = gg_encoding_convert_buf("za\xbf\xf3\xb3\xe6", GG_ENCODING_CP1250, GG_ENCODING_UTF8, -1, NULL, 0);
+
+	if (res != 10) {
+		printf("convert_buf: size query returned %d\n", res);
+		exit(1);
+	}
+
+	/* Obcięcie na granicy znaku, zwracana pełna długość */
+	memset(buf, 'x', sizeof(buf));
+	res = gg_encoding_convert_buf("za\xbf\xf3\xb3\xe6", GG_ENCODING_CP1250, GG_ENCODING_UTF8, -1, buf, 6);
+
+	if (res != 10 || strcmp(buf, "zaż") != 0) {
+		printf("convert_buf: truncation returned %d, \"%s\"\n", res, buf);
+		exit(1);
+	}
+
+	memset(buf, 'x', sizeof(buf));
+	res = gg_encoding_convert_buf("za\xbf\xf3\xb3\xe6", GG_ENCODING_CP1250, GG_ENCODING_UTF8, -1, buf, 7);
+
+	if (res != 10 || strcmp(buf, "zażó") != 0) {
+		printf("convert_buf: truncation returned %d, \"%s\"\n", res, buf);
+		exit(1);
+	}
+
+	memset(buf, 'x', sizeof(buf));
+	res = gg_encoding_convert_buf("zażółć", GG_ENCODING_UTF8, GG_ENCODING_CP1250, -1, buf, 4);
+
+	if (res != 6 || strcmp(buf, "za\xbf") != 0) {
+		printf("convert_buf: truncation returned %d, \"%s\"\n", res, buf);
+		exit(1);
+	}
+
+	memset(buf, 'x', sizeof(buf));
+	res = gg_encoding_convert_buf("test", GG_ENCODING_UTF8, GG_ENCODING_UTF8, -1, buf, 3);
+
+	if (res != 4 || strcmp(buf, "te") != 0) {
+		printf("convert_buf: copy returned %d, \"%s\"\n", res, buf);
+		exit(1);
+	}
+
+	res = gg_encoding_convert_buf("zażółć", GG_ENCODING_UTF8, GG_ENCODING_CP1250, -1, buf, sizeof(buf));
+
+	if (res != 6 || strcmp(buf, "za\xbf\xf3\xb3\xe6") != 0) {
+		printf("convert_buf: conversion returned %d, \"%s\"\n", res, buf);
+		exit(1);
+	}
+
+	/* Bajt zerowy kończy tekst niezależnie od podanej długości */
+	res = gg_encoding_convert_buf("ab\0cd\xb9xyz", GG_ENCODING_CP1250, GG_ENCODING_UTF8, 9, NULL, 0);
+
+	if (res != 2) {
+		printf("convert_buf: embedded NUL returned %d\n", res);
+		exit(1);
+	}
+
+	res = gg_encoding_convert_buf("ab\0cd\xc4\x85xyz", GG_ENCODING_UTF8, GG_ENCODING_CP1250, 10, NULL, 0);
+
+	if (res != 2) {
+		printf("convert_buf: embedded NUL returned %d\n", res);
+		exit(1);
+	}
+
+	res = gg_encoding_convert_buf("abcdefghijklmnopqrstuvw\0cd\xb9xyz", GG_ENCODING_CP1250, GG_ENCODING_UTF8, 32, NULL, 0);
+
+	if (res != 23) {
+		printf("convert_buf: embedded NUL after long run returned %d\n", res);
+		exit(1);
+	}
+
+	if (gg_encoding_convert_buf("test", GG_ENCODING_UTF8, GG_ENCODING_CP1250, -1, NULL, 1) != -1) {
+		printf("convert_buf: NULL buffer accepted\n");
+		exit(1);
+	}
+}
+
 int main(void)
 {
 	int i;
@@ -159,6 +295,10 @@ int main(void)
 	for (i = 0; i < sizeof(utf8_to_cp1250) / sizeof(utf8_to_cp1250[0]); i++)
 		test_utf8_to_cp1250(&utf8_to_cp1250[i]);
 
+	test_cp1250_roundtrip();
+
+	test_convert_buf();
+
 	printf("okay\n");
 
 	return 0;
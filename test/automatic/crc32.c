@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgadu.h"
+
+struct crc32_vector {
+	const char *data;
+	uint32_t expect;
+};
+
+struct crc32_vector crc32_vectors[] = {
+	{ "", 0x00000000 },
+	{ "a", 0xe8b7be43 },
+	{ "abc", 0x352441c2 },
+	{ "123456789", 0xcbf43926 },
+	{ "The quick brown fox jumps over the lazy dog", 0x414fa339 },
+};
+
+/* Wersja wzorcowa, przetwarzająca po jednym bicie */
+static uint32_t crc32_reference(uint32_t crc, const unsigned char *buf, int len)
+{
+	int i;
+
+	crc ^= 0xffffffff;
+
+	while (len--) {
+		crc ^= *buf++;
+
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+	}
+
+	return crc ^ 0xffffffff;
+}
+
+static void test_vector(const char *data, uint32_t expect)
+{
+	uint32_t result;
+
+	result = gg_crc32(0, (const unsigned char*) data, strlen(data));
+
+	if (result != expect) {
+		printf("crc32 failed for \"%s\", expected 0x%08x, got 0x%08x\n", data, expect, result);
+		exit(1);
+	}
+}
+
+static void test_buffer(const unsigned char *buf, int len)
+{
+	uint32_t expect, result;
+	int split;
+
+	expect = crc32_reference(0, buf, len);
+
+	result = gg_crc32(0, buf, len);
+
+	if (result != expect) {
+		printf("crc32 failed for %d bytes, expected 0x%08x, got 0x%08x\n", len, expect, result);
+		exit(1);
+	}
+
+	for (split = 0; split <= len; split++) {
+		result = gg_crc32(0, buf, split);
+		result = gg_crc32(result, buf + split, len - split);
+
+		if (result != expect) {
+			printf("crc32 failed for %d bytes split at %d, expected 0x%08x, got 0x%08x\n", len, split, expect, result);
+			exit(1);
+		}
+	}
+}
+
+int main(void)
+{
+	unsigned char buf[1024 + 8];
+	unsigned int i;
+	int offset, len;
+
+	for (i = 0; i < sizeof(crc32_vectors) / sizeof(crc32_vectors[0]); i++)
+		test_vector(crc32_vectors[i].data, crc32_vectors[i].expect);
+
+	srand(0);
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = rand();
+
+	/* Różne długości i wyrównania bufora */
+
+	for (offset = 0; offset < 8; offset++) {
+		for (len = 0; len <= 64; len++)
+			test_buffer(buf + offset, len);
+	}
+
+	test_buffer(buf, 1024);
+
+	if (gg_crc32(0x12345678, NULL, 10) != 0x12345678 || gg_crc32(0x12345678, buf, -1) != 0x12345678) {
+		printf("crc32 failed for invalid parameters\n");
+		exit(1);
+	}
+
+	return 0;
+}
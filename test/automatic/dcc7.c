@@ -0,0 +1,536 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "libgadu.h"
+
+#define FILE_SIZE 16384
+#define RATE 3000
+
+static struct gg_dcc7 *dcc_new(int type, int state, int fd, int file_fd)
+{
+	struct gg_dcc7 *dcc;
+
+	dcc = malloc(sizeof(struct gg_dcc7));
+
+	if (dcc == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	memset(dcc, 0, sizeof(struct gg_dcc7));
+	dcc->type = type;
+	dcc->dcc_type = GG_DCC7_TYPE_FILE;
+	dcc->state = state;
+	dcc->fd = fd;
+	dcc->file_fd = file_fd;
+	dcc->size = FILE_SIZE;
+	dcc->seek = 1;
+
+	return dcc;
+}
+
+static int temp_file(void)
+{
+	char name[32], buf[FILE_SIZE];
+	int fd;
+
+	strcpy(name, "dcc7.XXXXXX");
+
+	fd = mkstemp(name);
+
+	if (fd == -1) {
+		fprintf(stderr, "Unable to create temporary file\n");
+		exit(1);
+	}
+
+	unlink(name);
+
+	memset(buf, 'A', sizeof(buf));
+
+	if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+		fprintf(stderr, "Unable to write temporary file\n");
+		exit(1);
+	}
+
+	return fd;
+}
+
+/* Przesyła dane do momentu wstrzymania przez limit, zwraca liczbę bajtów */
+static unsigned int transfer_until_throttled(struct gg_dcc7 *dcc)
+{
+	unsigned int start = dcc->offset;
+	struct gg_event *ge;
+
+	for (;;) {
+		ge = gg_dcc7_watch_fd(dcc);
+
+		if (ge == NULL || ge->type != GG_EVENT_NONE) {
+			fprintf(stderr, "Unexpected event\n");
+			exit(1);
+		}
+
+		gg_event_free(ge);
+
+		if (dcc->check == GG_CHECK_NONE)
+			break;
+
+		if (dcc->offset - start > RATE * 2) {
+			printf("Rate limit not applied (%u bytes)\n", dcc->offset - start);
+			exit(1);
+		}
+	}
+
+	if (dcc->timeout != 1 || !dcc->soft_timeout) {
+		printf("Throttled connection not waiting for timeout\n");
+		exit(1);
+	}
+
+	return dcc->offset - start;
+}
+
+static void test_send_rate(void)
+{
+	struct gg_dcc7 *dcc;
+	int fds[2];
+	unsigned int sent;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		fprintf(stderr, "Unable to create socket pair\n");
+		exit(1);
+	}
+
+	dcc = dcc_new(GG_SESSION_DCC7_SEND, GG_STATE_SENDING_FILE, fds[0], temp_file());
+
+	gg_dcc7_set_rate(dcc, RATE);
+
+	sent = transfer_until_throttled(dcc);
+
+	if (sent == 0) {
+		printf("Nothing sent before throttling\n");
+		exit(1);
+	}
+
+	gg_dcc7_free(dcc);
+	close(fds[1]);
+}
+
+static void test_get_rate(void)
+{
+	struct gg_dcc7 *dcc;
+	char buf[FILE_SIZE];
+	int fds[2];
+	unsigned int received;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		fprintf(stderr, "Unable to create socket pair\n");
+		exit(1);
+	}
+
+	memset(buf, 'B', sizeof(buf));
+
+	if (send(fds[1], buf, sizeof(buf), 0) != sizeof(buf)) {
+		fprintf(stderr, "Unable to send data\n");
+		exit(1);
+	}
+
+	dcc = dcc_new(GG_SESSION_DCC7_GET, GG_STATE_GETTING_FILE, fds[0], temp_file());
+
+	gg_global_set_dcc7_rate(RATE);
+
+	received = transfer_until_throttled(dcc);
+
+	gg_global_set_dcc7_rate(0);
+
+	if (received == 0) {
+		printf("Nothing received before throttling\n");
+		exit(1);
+	}
+
+	gg_dcc7_free(dcc);
+	close(fds[1]);
+}
+
+static void test_rate_resume(void)
+{
+	struct gg_dcc7 *dcc;
+	struct gg_event *ge;
+	char buf[1500];
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		fprintf(stderr, "Unable to create socket pair\n");
+		exit(1);
+	}
+
+	memset(buf, 'D', sizeof(buf));
+
+	if (send(fds[1], buf, 1000, 0) != 1000) {
+		fprintf(stderr, "Unable to send data\n");
+		exit(1);
+	}
+
+	dcc = dcc_new(GG_SESSION_DCC7_GET, GG_STATE_GETTING_FILE, fds[0], temp_file());
+
+	gg_dcc7_set_rate(dcc, 1000);
+
+	if (transfer_until_throttled(dcc) != 1000) {
+		printf("Unexpected amount received before throttling\n");
+		exit(1);
+	}
+
+	/* Po wybudzeniu nie ma danych do odebrania, więc połączenie ma
+	 * wrócić do obserwowania deskryptora bez wywoływania recv() */
+
+	sleep(1);
+
+	ge = gg_dcc7_watch_fd(dcc);
+
+	if (ge == NULL || ge->type != GG_EVENT_NONE) {
+		printf("Error after waking up throttled connection\n");
+		exit(1);
+	}
+
+	gg_event_free(ge);
+
+	if (dcc->check != GG_CHECK_READ || dcc->soft_timeout || dcc->timeout != GG_DCC7_TIMEOUT_GET) {
+		printf("Throttled connection not watching descriptor after waking up\n");
+		exit(1);
+	}
+
+	if (send(fds[1], buf, 500, 0) != 500) {
+		fprintf(stderr, "Unable to send data\n");
+		exit(1);
+	}
+
+	ge = gg_dcc7_watch_fd(dcc);
+
+	if (ge == NULL || ge->type != GG_EVENT_NONE || dcc->offset != 1500) {
+		printf("Transfer not resumed after throttling\n");
+		exit(1);
+	}
+
+	gg_event_free(ge);
+
+	gg_dcc7_free(dcc);
+	close(fds[1]);
+}
+
+static void test_rate_weights(void)
+{
+	struct gg_dcc7 *dcc1, *dcc2;
+	struct gg_event *ge;
+	unsigned int sent1, sent2;
+	int fds1[2], fds2[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds1) == -1 || socketpair(AF_UNIX, SOCK_STREAM, 0, fds2) == -1) {
+		fprintf(stderr, "Unable to create socket pair\n");
+		exit(1);
+	}
+
+	dcc1 = dcc_new(GG_SESSION_DCC7_SEND, GG_STATE_SENDING_FILE, fds1[0], temp_file());
+	dcc2 = dcc_new(GG_SESSION_DCC7_SEND, GG_STATE_SENDING_FILE, fds2[0], temp_file());
+
+	gg_dcc7_set_weight(dcc1, 1);
+	gg_dcc7_set_weight(dcc2, 3);
+
+	gg_global_set_dcc7_rate(RATE);
+
+	/* Rozpoczęcie obu połączeń */
+
+	ge = gg_dcc7_watch_fd(dcc1);
+	gg_event_free(ge);
+	ge = gg_dcc7_watch_fd(dcc2);
+	gg_event_free(ge);
+
+	sleep(1);
+
+	sent1 = transfer_until_throttled(dcc1);
+	sent2 = transfer_until_throttled(dcc2);
+
+	gg_global_set_dcc7_rate(0);
+
+	/* Wiadra uzupełniają się również w trakcie pomiaru */
+
+	if (sent1 < RATE / 4 || sent1 > RATE / 4 + RATE / 20 || sent2 < RATE * 3 / 4 || sent2 > RATE * 3 / 4 + RATE / 20) {
+		printf("Global limit not shared by weight (%u and %u bytes)\n", sent1, sent2);
+		exit(1);
+	}
+
+	gg_dcc7_free(dcc1);
+	gg_dcc7_free(dcc2);
+	close(fds1[1]);
+	close(fds2[1]);
+}
+
+static int journal_sink(struct gg_dcc7 *dcc, const char *buf, size_t len, void *data)
+{
+	return 0;
+}
+
+static void test_journal(void)
+{
+	struct gg_session sess;
+	struct gg_dcc7 *dcc;
+	struct gg_dcc7_new pkt;
+	struct gg_event ge;
+	char name[32], buf[5000];
+	int fds[2], fd;
+
+	strcpy(name, "journal.XXXXXX");
+
+	fd = mkstemp(name);
+
+	if (fd == -1) {
+		fprintf(stderr, "Unable to create temporary file\n");
+		exit(1);
+	}
+
+	close(fd);
+
+	if (gg_global_set_dcc7_journal(name) == -1) {
+		printf("Unable to open journal\n");
+		goto fail;
+	}
+
+	/* Częściowe odebranie pliku */
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		fprintf(stderr, "Unable to create socket pair\n");
+		goto fail;
+	}
+
+	memset(buf, 'C', sizeof(buf));
+
+	if (send(fds[1], buf, sizeof(buf), 0) != sizeof(buf)) {
+		fprintf(stderr, "Unable to send data\n");
+		goto fail;
+	}
+
+	dcc = dcc_new(GG_SESSION_DCC7_GET, GG_STATE_GETTING_FILE, fds[0], temp_file());
+	memcpy(dcc->hash, "01234567890123456789", GG_DCC7_HASH_LEN);
+	strcpy((char*) dcc->filename, "journal.txt");
+
+	while (dcc->offset < sizeof(buf))
+		gg_event_free(gg_dcc7_watch_fd(dcc));
+
+	gg_dcc7_free(dcc);
+	close(fds[1]);
+
+	/* Ponowne otwarcie dziennika i ponowna oferta tego samego pliku */
+
+	if (gg_global_set_dcc7_journal(NULL) == -1 || gg_global_set_dcc7_journal(name) == -1) {
+		printf("Unable to reopen journal\n");
+		goto fail;
+	}
+
+	memset(&sess, 0, sizeof(sess));
+	sess.uin = 1;
+
+	memset(&pkt, 0, sizeof(pkt));
+	memcpy(&pkt.id, "\x01\x02\x03\x04\x05\x06\x07\x08", sizeof(pkt.id));
+	pkt.uin_from = gg_fix32(2);
+	pkt.uin_to = gg_fix32(1);
+	pkt.type = gg_fix32(GG_DCC7_TYPE_FILE);
+	pkt.size = gg_fix32(FILE_SIZE);
+	strcpy((char*) pkt.filename, "journal.txt");
+	memcpy(pkt.hash, "01234567890123456789", GG_DCC7_HASH_LEN);
+
+	memset(&ge, 0, sizeof(ge));
+
+	if (gg_dcc7_handle_new(&sess, &ge, &pkt, sizeof(pkt)) == -1 || ge.type != GG_EVENT_DCC7_NEW) {
+		printf("Unable to handle new transfer\n");
+		goto fail;
+	}
+
+	if (ge.event.dcc7_new->offset != sizeof(buf)) {
+		printf("Invalid resume offset, expected %d, got %d\n", (int) sizeof(buf), ge.event.dcc7_new->offset);
+		goto fail;
+	}
+
+	gg_dcc7_free(ge.event.dcc7_new);
+
+	/* Inny plik nie powinien być wznawiany */
+
+	memcpy(pkt.hash, "98765432109876543210", GG_DCC7_HASH_LEN);
+
+	memset(&ge, 0, sizeof(ge));
+
+	if (gg_dcc7_handle_new(&sess, &ge, &pkt, sizeof(pkt)) == -1 || ge.type != GG_EVENT_DCC7_NEW) {
+		printf("Unable to handle new transfer\n");
+		goto fail;
+	}
+
+	if (ge.event.dcc7_new->offset != 0) {
+		printf("Unexpected resume offset %d\n", ge.event.dcc7_new->offset);
+		goto fail;
+	}
+
+	gg_dcc7_free(ge.event.dcc7_new);
+
+	/* Plik odbierany przez funkcję nie trafia do dziennika */
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		fprintf(stderr, "Unable to create socket pair\n");
+		goto fail;
+	}
+
+	if (send(fds[1], buf, sizeof(buf), 0) != sizeof(buf)) {
+		fprintf(stderr, "Unable to send data\n");
+		goto fail;
+	}
+
+	dcc = dcc_new(GG_SESSION_DCC7_GET, GG_STATE_GETTING_FILE, fds[0], -1);
+	memcpy(dcc->hash, "ABCDEFGHIJABCDEFGHIJ", GG_DCC7_HASH_LEN);
+	strcpy((char*) dcc->filename, "journal.txt");
+	gg_dcc7_set_sink(dcc, journal_sink, NULL);
+
+	while (dcc->offset < sizeof(buf))
+		gg_event_free(gg_dcc7_watch_fd(dcc));
+
+	gg_dcc7_free(dcc);
+	close(fds[1]);
+
+	memcpy(pkt.hash, "ABCDEFGHIJABCDEFGHIJ", GG_DCC7_HASH_LEN);
+
+	memset(&ge, 0, sizeof(ge));
+
+	if (gg_dcc7_handle_new(&sess, &ge, &pkt, sizeof(pkt)) == -1 || ge.type != GG_EVENT_DCC7_NEW) {
+		printf("Unable to handle new transfer\n");
+		goto fail;
+	}
+
+	if (ge.event.dcc7_new->offset != 0) {
+		printf("Unexpected resume offset %d for sink transfer\n", ge.event.dcc7_new->offset);
+		goto fail;
+	}
+
+	gg_dcc7_free(ge.event.dcc7_new);
+
+	free(sess.dcc7_hash_id);
+	free(sess.dcc7_hash_uin);
+
+	gg_global_set_dcc7_journal(NULL);
+	unlink(name);
+	return;
+
+fail:
+	gg_global_set_dcc7_journal(NULL);
+	unlink(name);
+	exit(1);
+}
+
+struct sink_state {
+	char buf[FILE_SIZE];
+	unsigned int len;
+	int fail;
+};
+
+static int sink(struct gg_dcc7 *dcc, const char *buf, size_t len, void *data)
+{
+	struct sink_state *state = data;
+
+	if (state->fail || state->len + len > sizeof(state->buf))
+		return -1;
+
+	memcpy(state->buf + state->len, buf, len);
+	state->len += len;
+
+	return 0;
+}
+
+static void test_sink(void)
+{
+	struct sink_state state;
+	struct gg_dcc7 *dcc;
+	struct gg_event *ge;
+	char buf[FILE_SIZE];
+	unsigned int i;
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		fprintf(stderr, "Unable to create socket pair\n");
+		exit(1);
+	}
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i;
+
+	if (send(fds[1], buf, sizeof(buf), 0) != sizeof(buf)) {
+		fprintf(stderr, "Unable to send data\n");
+		exit(1);
+	}
+
+	memset(&state, 0, sizeof(state));
+
+	dcc = dcc_new(GG_SESSION_DCC7_GET, GG_STATE_GETTING_FILE, fds[0], -1);
+
+	if (gg_dcc7_set_sink(dcc, sink, &state) == -1) {
+		printf("Unable to set sink\n");
+		exit(1);
+	}
+
+	for (;;) {
+		ge = gg_dcc7_watch_fd(dcc);
+
+		if (ge == NULL) {
+			printf("gg_dcc7_watch_fd() failed\n");
+			exit(1);
+		}
+
+		if (ge->type == GG_EVENT_DCC7_DONE) {
+			gg_event_free(ge);
+			break;
+		}
+
+		if (ge->type != GG_EVENT_NONE) {
+			printf("Unexpected event %d\n", ge->type);
+			exit(1);
+		}
+
+		gg_event_free(ge);
+	}
+
+	if (state.len != sizeof(buf) || memcmp(state.buf, buf, sizeof(buf)) != 0) {
+		printf("Invalid data received by sink\n");
+		exit(1);
+	}
+
+	/* Błąd funkcji przerywa połączenie */
+
+	if (send(fds[1], buf, sizeof(buf), 0) != sizeof(buf)) {
+		fprintf(stderr, "Unable to send data\n");
+		exit(1);
+	}
+
+	dcc->offset = 0;
+	state.fail = 1;
+
+	ge = gg_dcc7_watch_fd(dcc);
+
+	if (ge == NULL || ge->type != GG_EVENT_DCC7_ERROR || ge->event.dcc7_error != GG_ERROR_DCC7_FILE) {
+		printf("Sink failure not reported\n");
+		exit(1);
+	}
+
+	gg_event_free(ge);
+
+	gg_dcc7_free(dcc);
+	close(fds[1]);
+}
+
+int main(void)
+{
+	test_send_rate();
+	test_get_rate();
+	test_rate_resume();
+	test_rate_weights();
+	test_journal();
+	test_sink();
+
+	return 0;
+}
@@ -0,0 +1,748 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "libgadu.h"
+
+struct http_reply {
+	const char *path;
+	const char *reply;
+	int close;
+};
+
+/* Odpowiedzi serwera wysyłane po jednym bajcie, żeby każdy fragment
+ * nagłówka i treści trafił do osobnego wywołania recv() */
+static const struct http_reply http_replies[] = {
+	{ "/length", "HTTP/1.0 200 OK\r\nContent-Length: 5\r\n\r\nHello", 1 },
+	{ "/close", "HTTP/1.0 200 OK\r\nServer: test\r\n\r\nUntil EOF", 1 },
+	{ "/lf", "HTTP/1.0 200 OK\nContent-Length: 2\n\nOK", 1 },
+	{ "/chunked", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n4\r\nWiki\r\n5;name=value\r\npedia\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\nExpires: never\r\n\r\n", 1 },
+	{ "/badchunk", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n", 1 },
+	{ "/truncated", "HTTP/1.0 200 OK\r\nContent-Length: 10\r\n\r\nshort", 1 },
+	{ "/notfound", "HTTP/1.0 404 Not Found\r\nContent-Length: 9\r\n\r\nNot Found", 1 },
+	{ "/keep", "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nkeep", 0 },
+	{ "/keepchunked", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n", 0 },
+	{ "/empty", "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n", 0 },
+	{ "/drop", NULL, 1 },
+	{ "/silent", NULL, 0 },
+};
+
+struct server_conn {
+	int fd;
+	char request[4096];
+	size_t request_len;
+	const struct http_reply *reply;
+	size_t reply_sent;
+};
+
+#define MAX_CONNS 8
+
+static int listen_fd;
+static int listen_port;
+static struct server_conn conns[MAX_CONNS];
+static int accept_count;
+static char last_request[4096];
+static int drop_count;
+
+static void server_start(void)
+{
+	struct sockaddr_in sin;
+	socklen_t sin_len = sizeof(sin);
+	int i, one = 1;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (listen_fd == -1) {
+		perror("socket");
+		exit(1);
+	}
+
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+	if (bind(listen_fd, (struct sockaddr*) &sin, sizeof(sin)) == -1 || listen(listen_fd, 5) == -1 || getsockname(listen_fd, (struct sockaddr*) &sin, &sin_len) == -1) {
+		perror("bind");
+		exit(1);
+	}
+
+	listen_port = ntohs(sin.sin_port);
+
+	for (i = 0; i < MAX_CONNS; i++)
+		conns[i].fd = -1;
+}
+
+static void server_close(struct server_conn *c)
+{
+	close(c->fd);
+	c->fd = -1;
+	c->request_len = 0;
+	c->reply = NULL;
+	c->reply_sent = 0;
+}
+
+static void server_accept(void)
+{
+	int i, fd;
+
+	fd = accept(listen_fd, NULL, NULL);
+
+	if (fd == -1) {
+		perror("accept");
+		exit(1);
+	}
+
+	for (i = 0; i < MAX_CONNS; i++) {
+		if (conns[i].fd == -1) {
+			conns[i].fd = fd;
+			accept_count++;
+			return;
+		}
+	}
+
+	printf("too many connections\n");
+	exit(1);
+}
+
+static void server_read(struct server_conn *c)
+{
+	char *end, *path;
+	unsigned int i;
+	int res;
+
+	res = recv(c->fd, c->request + c->request_len, sizeof(c->request) - c->request_len - 1, 0);
+
+	if (res <= 0) {
+		server_close(c);
+		return;
+	}
+
+	c->request_len += res;
+	c->request[c->request_len] = 0;
+
+	end = strstr(c->request, "\r\n\r\n");
+
+	if (end == NULL)
+		return;
+
+	strcpy(last_request, c->request);
+
+	path = strchr(c->request, ' ') + 1;
+
+	for (i = 0; i < sizeof(http_replies) / sizeof(http_replies[0]); i++) {
+		size_t len = strlen(http_replies[i].path);
+
+		if (strncmp(path, http_replies[i].path, len) == 0 && path[len] == ' ') {
+			c->reply = &http_replies[i];
+			c->reply_sent = 0;
+			break;
+		}
+	}
+
+	if (c->reply == NULL) {
+		printf("unknown request:\n%s\n", c->request);
+		exit(1);
+	}
+
+	/* Zapytanie odebrane, ale połączenie zamknięte lub pozostawione bez
+	 * odpowiedzi */
+
+	if (c->reply->reply == NULL) {
+		if (c->reply->close) {
+			drop_count++;
+			server_close(c);
+		} else {
+			c->reply = NULL;
+			c->request_len = 0;
+		}
+
+		return;
+	}
+
+	c->request_len = 0;
+}
+
+static void server_write(struct server_conn *c)
+{
+	if (send(c->fd, c->reply->reply + c->reply_sent, 1, 0) != 1) {
+		server_close(c);
+		return;
+	}
+
+	c->reply_sent++;
+
+	if (c->reply->reply[c->reply_sent] == 0) {
+		if (c->reply->close)
+			server_close(c);
+		else
+			c->reply = NULL;
+	}
+}
+
+static void server_poll(void)
+{
+	struct timeval tv;
+	fd_set rd, wd;
+	int i, max_fd, res;
+
+	FD_ZERO(&rd);
+	FD_ZERO(&wd);
+
+	FD_SET(listen_fd, &rd);
+	max_fd = listen_fd;
+
+	for (i = 0; i < MAX_CONNS; i++) {
+		if (conns[i].fd == -1)
+			continue;
+
+		if (conns[i].reply != NULL)
+			FD_SET(conns[i].fd, &wd);
+		else
+			FD_SET(conns[i].fd, &rd);
+
+		if (conns[i].fd > max_fd)
+			max_fd = conns[i].fd;
+	}
+
+	tv.tv_sec = 0;
+	tv.tv_usec = 1000;
+
+	res = select(max_fd + 1, &rd, &wd, NULL, &tv);
+
+	if (res < 1)
+		return;
+
+	if (FD_ISSET(listen_fd, &rd))
+		server_accept();
+
+	for (i = 0; i < MAX_CONNS; i++) {
+		if (conns[i].fd == -1)
+			continue;
+
+		if (FD_ISSET(conns[i].fd, &wd) && conns[i].reply != NULL)
+			server_write(&conns[i]);
+		else if (FD_ISSET(conns[i].fd, &rd))
+			server_read(&conns[i]);
+	}
+}
+
+static int resolver_count;
+
+/* Resolver zwracający od razu adres lokalny i zliczający wywołania */
+static int resolver_start(int *fd, void **priv_data, const char *hostname)
+{
+	struct in_addr addr;
+	int pipes[2];
+	int *priv;
+
+	resolver_count++;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pipes) == -1)
+		return -1;
+
+	addr.s_addr = inet_addr("127.0.0.1");
+
+	if (send(pipes[1], &addr, sizeof(addr), 0) != sizeof(addr) || (priv = malloc(sizeof(int))) == NULL) {
+		close(pipes[0]);
+		close(pipes[1]);
+		return -1;
+	}
+
+	*priv = pipes[1];
+	*priv_data = priv;
+	*fd = pipes[0];
+
+	return 0;
+}
+
+static void resolver_cleanup(void **priv_data, int force)
+{
+	int *priv = *priv_data;
+
+	if (priv == NULL)
+		return;
+
+	close(*priv);
+	free(priv);
+	*priv_data = NULL;
+}
+
+#define MULTI_COUNT 6
+
+static void test_multi(struct gg_http_multi *m)
+{
+	struct gg_http *h;
+	time_t start;
+	int i, done = 0;
+
+	for (i = 0; i < MULTI_COUNT; i++) {
+		h = gg_http_multi_connect(m, "localhost", listen_port, "GET", "/keep", "Host: localhost\r\n\r\n");
+
+		if (h == NULL) {
+			printf("multi: gg_http_multi_connect() failed\n");
+			exit(1);
+		}
+	}
+
+	start = time(NULL);
+
+	while (done < MULTI_COUNT) {
+		int res;
+
+		if (time(NULL) - start > 5) {
+			printf("multi: timeout\n");
+			exit(1);
+		}
+
+		server_poll();
+
+		res = gg_http_multi_perform(m, 1);
+
+		if (res == -1) {
+			printf("multi: gg_http_multi_perform() failed\n");
+			exit(1);
+		}
+
+		while ((h = gg_http_multi_next(m)) != NULL) {
+			if (h->state != GG_STATE_PARSING || h->body == NULL || strcmp(h->body, "keep") != 0) {
+				printf("multi: expected success, got state %d, error %d\n", h->state, h->error);
+				exit(1);
+			}
+
+			gg_http_free(h);
+			done++;
+		}
+
+		if (res == 0 && done < MULTI_COUNT) {
+			printf("multi: lost requests\n");
+			exit(1);
+		}
+	}
+}
+
+/* Połączenie, które wysłało już zapytanie, nie może czekać na swoją kolej */
+static void test_multi_started(struct gg_http_multi *m)
+{
+	struct gg_http *h;
+	time_t start;
+	int done = 0;
+
+	if (gg_http_multi_connect(m, "localhost", listen_port, "GET", "/keep", "Host: localhost\r\n\r\n") == NULL) {
+		printf("multi started: gg_http_multi_connect() failed\n");
+		exit(1);
+	}
+
+	h = gg_http_connect("localhost", listen_port, 1, "GET", "/keep", "Host: localhost\r\n\r\n");
+
+	if (h == NULL) {
+		printf("multi started: gg_http_connect() failed\n");
+		exit(1);
+	}
+
+	start = time(NULL);
+
+	while (h->state != GG_STATE_READING_HEADER) {
+		struct timeval tv;
+		fd_set rd, wd;
+
+		if (time(NULL) - start > 5 || h->state == GG_STATE_ERROR) {
+			printf("multi started: unable to send request, state %d\n", h->state);
+			exit(1);
+		}
+
+		server_poll();
+
+		FD_ZERO(&rd);
+		FD_ZERO(&wd);
+
+		if ((h->check & GG_CHECK_READ))
+			FD_SET(h->fd, &rd);
+
+		if ((h->check & GG_CHECK_WRITE))
+			FD_SET(h->fd, &wd);
+
+		tv.tv_sec = 0;
+		tv.tv_usec = 1000;
+
+		if (select(h->fd + 1, &rd, &wd, NULL, &tv) > 0 && gg_http_watch_fd(h) == -1) {
+			printf("multi started: gg_http_watch_fd() failed\n");
+			exit(1);
+		}
+	}
+
+	if (gg_http_multi_add(m, h) == -1) {
+		printf("multi started: gg_http_multi_add() failed\n");
+		exit(1);
+	}
+
+	start = time(NULL);
+
+	while (done < 2) {
+		int res;
+
+		if (time(NULL) - start > 5) {
+			printf("multi started: timeout\n");
+			exit(1);
+		}
+
+		server_poll();
+
+		res = gg_http_multi_perform(m, 1);
+
+		if (res == -1) {
+			printf("multi started: gg_http_multi_perform() failed\n");
+			exit(1);
+		}
+
+		while ((h = gg_http_multi_next(m)) != NULL) {
+			if (h->state != GG_STATE_PARSING || h->body == NULL || strcmp(h->body, "keep") != 0) {
+				printf("multi started: expected success, got state %d, error %d\n", h->state, h->error);
+				exit(1);
+			}
+
+			gg_http_free(h);
+			done++;
+		}
+
+		if (res == 0 && done < 2) {
+			printf("multi started: lost requests\n");
+			exit(1);
+		}
+	}
+}
+
+/* Serwer, który nie odpowiada, nie może zablokować oczekiwania bez
+ * ograniczeń */
+static void test_multi_silent(struct gg_http_multi *m)
+{
+	struct gg_http *h;
+	time_t start;
+	int res;
+
+	h = gg_http_multi_connect(m, "localhost", listen_port, "GET", "/silent", "Host: localhost\r\n\r\n");
+
+	if (h == NULL) {
+		printf("multi silent: gg_http_multi_connect() failed\n");
+		exit(1);
+	}
+
+	start = time(NULL);
+
+	while (h->state != GG_STATE_READING_HEADER) {
+		if (time(NULL) - start > 5 || gg_http_multi_perform(m, 1) != 1) {
+			printf("multi silent: unable to send request, state %d\n", h->state);
+			exit(1);
+		}
+
+		server_poll();
+	}
+
+	server_poll();
+
+	h->timeout = 1;
+
+	/* Bez uwzględnienia czasu połączenia select() czekałby w nieskończoność */
+	alarm(10);
+
+	res = gg_http_multi_perform(m, -1);
+
+	alarm(0);
+
+	if (res != 0 || gg_http_multi_next(m) != h || h->state != GG_STATE_ERROR || h->error != GG_ERROR_READING) {
+		printf("multi silent: expected timeout, got %d, state %d, error %d\n", res, h->state, h->error);
+		exit(1);
+	}
+
+	gg_http_free(h);
+}
+
+struct sink_buffer {
+	char buf[256];
+	size_t len;
+};
+
+static int sink(struct gg_http *h, const char *buf, size_t len, void *data)
+{
+	struct sink_buffer *sb = data;
+
+	if (sb->len + len >= sizeof(sb->buf))
+		return -1;
+
+	memcpy(sb->buf + sb->len, buf, len);
+	sb->len += len;
+	sb->buf[sb->len] = 0;
+
+	return 0;
+}
+
+static void test_method_request(const char *method, const char *path, const char *expect, int use_sink)
+{
+	struct sink_buffer sb;
+	struct gg_http *h;
+	const char *body;
+
+	h = gg_http_connect("127.0.0.1", listen_port, 1, method, path, "Host: 127.0.0.1\r\n\r\n");
+
+	if (h == NULL) {
+		printf("%s: gg_http_connect() failed\n", path);
+		exit(1);
+	}
+
+	memset(&sb, 0, sizeof(sb));
+
+	if (use_sink && gg_http_set_body_sink(h, sink, &sb) == -1) {
+		printf("%s: gg_http_set_body_sink() failed\n", path);
+		exit(1);
+	}
+
+	while (h->state != GG_STATE_PARSING && h->state != GG_STATE_ERROR) {
+		struct timeval tv;
+		fd_set rd, wd;
+		int i, max_fd, res;
+
+		FD_ZERO(&rd);
+		FD_ZERO(&wd);
+
+		FD_SET(listen_fd, &rd);
+		max_fd = listen_fd;
+
+		for (i = 0; i < MAX_CONNS; i++) {
+			if (conns[i].fd == -1)
+				continue;
+
+			if (conns[i].reply != NULL)
+				FD_SET(conns[i].fd, &wd);
+			else
+				FD_SET(conns[i].fd, &rd);
+
+			if (conns[i].fd > max_fd)
+				max_fd = conns[i].fd;
+		}
+
+		if ((h->check & GG_CHECK_READ))
+			FD_SET(h->fd, &rd);
+
+		if ((h->check & GG_CHECK_WRITE))
+			FD_SET(h->fd, &wd);
+
+		if (h->fd > max_fd)
+			max_fd = h->fd;
+
+		tv.tv_sec = 5;
+		tv.tv_usec = 0;
+
+		res = select(max_fd + 1, &rd, &wd, NULL, &tv);
+
+		if (res == -1 && errno == EINTR)
+			continue;
+
+		if (res < 1) {
+			printf("%s: timeout\n", path);
+			exit(1);
+		}
+
+		if (FD_ISSET(h->fd, &rd) || FD_ISSET(h->fd, &wd)) {
+			if (gg_http_watch_fd(h) == -1)
+				break;
+		}
+
+		if (FD_ISSET(listen_fd, &rd))
+			server_accept();
+
+		for (i = 0; i < MAX_CONNS; i++) {
+			if (conns[i].fd == -1)
+				continue;
+
+			if (FD_ISSET(conns[i].fd, &wd) && conns[i].reply != NULL)
+				server_write(&conns[i]);
+			else if (FD_ISSET(conns[i].fd, &rd))
+				server_read(&conns[i]);
+		}
+	}
+
+	if (expect == NULL) {
+		if (h->state != GG_STATE_ERROR) {
+			printf("%s: expected error, got state %d\n", path, h->state);
+			exit(1);
+		}
+
+		gg_http_free(h);
+		return;
+	}
+
+	if (h->state != GG_STATE_PARSING) {
+		printf("%s: expected success, got state %d, error %d\n", path, h->state, h->error);
+		exit(1);
+	}
+
+	body = (use_sink) ? sb.buf : h->body;
+
+	if (use_sink && h->body != NULL) {
+		printf("%s: body stored despite sink\n", path);
+		exit(1);
+	}
+
+	if (body == NULL || strcmp(body, expect) != 0 || h->body_size != strlen(expect)) {
+		printf("%s: expected \"%s\", got \"%s\" (%d bytes)\n", path, expect, (body) ? body : "(null)", h->body_size);
+		exit(1);
+	}
+
+	gg_http_free(h);
+}
+
+static void test_request(const char *path, const char *expect, int use_sink)
+{
+	test_method_request("GET", path, expect, use_sink);
+}
+
+int main(void)
+{
+	signal(SIGPIPE, SIG_IGN);
+
+	server_start();
+
+	test_request("/length", "Hello", 0);
+	test_request("/close", "Until EOF", 0);
+	test_request("/lf", "OK", 0);
+	test_request("/chunked", "Wikipedia in\r\n\r\nchunks.", 0);
+	test_request("/chunked", "Wikipedia in\r\n\r\nchunks.", 1);
+	test_request("/length", "Hello", 1);
+	test_request("/badchunk", NULL, 0);
+	test_request("/truncated", NULL, 0);
+	test_request("/notfound", NULL, 0);
+
+	if (strstr(last_request, "HTTP/1.0\r\n") == NULL) {
+		printf("expected HTTP/1.0 request without connection pool\n");
+		exit(1);
+	}
+
+	/* Utrzymywane połączenie, również po odpowiedzi w częściach
+	 * i pustej odpowiedzi */
+
+	gg_global_set_http_pool(1);
+
+	accept_count = 0;
+
+	test_request("/keep", "keep", 0);
+	test_request("/keepchunked", "abc", 0);
+	test_request("/empty", "", 0);
+	test_request("/keep", "keep", 0);
+
+	if (accept_count != 1) {
+		printf("expected one connection, got %d\n", accept_count);
+		exit(1);
+	}
+
+	if (strstr(last_request, "HTTP/1.1\r\n") == NULL) {
+		printf("expected HTTP/1.1 request with connection pool\n");
+		exit(1);
+	}
+
+	/* Zamknięte przez serwer połączenie nie jest wykorzystywane */
+
+	gg_global_set_http_pool(0);
+	gg_global_set_http_pool(1);
+
+	accept_count = 0;
+
+	test_request("/keep", "keep", 0);
+
+	if (accept_count != 1) {
+		printf("expected new connection, got %d\n", accept_count);
+		exit(1);
+	}
+
+	/* Po wysłaniu zapytania przez ponownie wykorzystane połączenie
+	 * ponawiane jest tylko zapytanie GET, ale już nie POST */
+
+	drop_count = 0;
+
+	test_request("/keep", "keep", 0);
+	test_method_request("POST", "/drop", NULL, 0);
+
+	if (drop_count != 1) {
+		printf("expected POST to be sent once, got %d\n", drop_count);
+		exit(1);
+	}
+
+	drop_count = 0;
+
+	test_request("/keep", "keep", 0);
+	test_request("/drop", NULL, 0);
+
+	if (drop_count != 2) {
+		printf("expected GET to be retried, got %d\n", drop_count);
+		exit(1);
+	}
+
+	/* Wiele jednoczesnych zapytań do jednego serwera z limitem połączeń
+	 * i wspólną pamięcią podręczną nazw serwerów */
+
+	{
+		struct gg_http_multi *m;
+
+		gg_global_set_http_pool(0);
+		gg_global_set_http_pool(2);
+		gg_global_set_custom_resolver(resolver_start, resolver_cleanup);
+
+		m = gg_http_multi_new(2);
+
+		if (m == NULL) {
+			printf("multi: gg_http_multi_new() failed\n");
+			exit(1);
+		}
+
+		accept_count = 0;
+		resolver_count = 0;
+
+		test_multi(m);
+
+		if (resolver_count != 1) {
+			printf("multi: expected one resolver call, got %d\n", resolver_count);
+			exit(1);
+		}
+
+		test_multi(m);
+
+		if (resolver_count != 1) {
+			printf("multi: expected cached address, got %d resolver calls\n", resolver_count - 1);
+			exit(1);
+		}
+
+		if (accept_count > 2) {
+			printf("multi: expected at most 2 connections, got %d\n", accept_count);
+			exit(1);
+		}
+
+		gg_http_multi_free(m);
+
+		m = gg_http_multi_new(1);
+
+		if (m == NULL) {
+			printf("multi: gg_http_multi_new() failed\n");
+			exit(1);
+		}
+
+		test_multi_started(m);
+		test_multi_silent(m);
+
+		gg_http_multi_free(m);
+
+		gg_global_set_resolver(GG_RESOLVER_DEFAULT);
+	}
+
+	gg_global_set_http_pool(0);
+
+	return 0;
+}
@@ -154,6 +154,12 @@ const struct test_data html_to_text[] =
 	/* Niedokończona encja */
 	{ "http://test/foo?ala=1&ma=2&kota=3", "http://test/foo?ala=1&ma=2&kota=3", GG_ENCODING_UTF8 },
 
+	/* Encja przerwana znacznikiem */
+	{ "foo&amp<b>bar</b>", "foo&ampbar", GG_ENCODING_UTF8, "\x07\x00\x01", 3 },
+
+	/* Długi tekst z encją w środku i niedokończoną encją na końcu */
+	{ "Zażółć gęślą jaźń &amp; tekst dłuższy niż szesnaście bajtów&lt", "Zażółć gęślą jaźń & tekst dłuższy niż szesnaście bajtów", GG_ENCODING_UTF8 },
+
 	/* Obrazek na początku tekstu, przed <span> */
 	{ "<img name=\"8877665544332211\">" SPAN("test"), "\xc2\xa0test", GG_ENCODING_UTF8, "\x01\x00\x08\x00\x00\x00\x00\x00\x80\x09\x01\x11\x22\x33\x44\x55\x66\x77\x88", 19 },
 
@@ -172,6 +178,9 @@ const struct test_data html_to_text[] =
 	/* Bez tekstu, tylko obrazek */
 	{ "<img name=\"8877665544332211\">", "\xc2\xa0", GG_ENCODING_UTF8, "\x00\x00\x80\x09\x01\x11\x22\x33\x44\x55\x66\x77\x88", 13 },
 
+	/* Obrazek z wielkimi literami w skrócie */
+	{ "<img name=\"AABBCCDDEEFF0011\">", "\xc2\xa0", GG_ENCODING_UTF8, "\x00\x00\x80\x09\x01\x11\x00\xff\xee\xdd\xcc\xbb\xaa", 13 },
+
 	/* Bez tekstu, dwa obrazki */
 	{ "<img name=\"8877665544332211\"><img name=\"1122334455667788\">", "\xc2\xa0\xc2\xa0", GG_ENCODING_UTF8, "\x00\x00\x80\x09\x01\x11\x22\x33\x44\x55\x66\x77\x88\x01\x00\x80\x09\x01\x88\x77\x66\x55\x44\x33\x22\x11", 26 },
 
@@ -220,10 +229,9 @@ const struct test_data html_to_text[] =
 
 static void test_text_to_html(const char *input, const unsigned char *attr, size_t attr_len, const char *output, gg_encoding_t encoding)
 {
-	char *result;
+	char *result, *tmp;
 	size_t len;
 #ifdef HAVE_LIBXML2
-	char *tmp;
 	xmlParserCtxtPtr ctxt;
 	xmlDocPtr doc;
 #endif
@@ -256,6 +264,17 @@ static void test_text_to_html(const char *input, const unsigned char *attr, size
 		exit(1);
 	}
 
+	tmp = gg_message_text_to_html_alloc(input, encoding, attr, attr_len);
+
+	if (tmp == NULL || strcmp(tmp, output) != 0) {
+		printf("single pass: \"%s\"\n", (tmp != NULL) ? tmp : "(null)");
+		free(tmp);
+		free(result);
+		exit(1);
+	}
+
+	free(tmp);
+
 #ifdef HAVE_LIBXML2
 	// Doklej <html></html>, żeby mieć tag dokumentu.
 
@@ -386,6 +405,17 @@ static void test_html_to_text(const char *input, const char *output, const unsig
 		exit(1);
 	}
 
+	free(result);
+	free(formats);
+
+	result = gg_message_html_to_text_alloc(input, encoding, &formats, &fmt_len2, 3);
+
+	if (result == NULL || strcmp(result, output) != 0 || fmt_len2 != fmt_len || memcmp(formats + 3, attr, fmt_len) != 0) {
+		printf("single pass: \"%s\", format_length %lu\n", (result != NULL) ? result : "(null)", (long unsigned int) fmt_len2);
+		free(result);
+		exit(1);
+	}
+
 	printf("correct\n\n");
 	free(result);
 	free(formats);
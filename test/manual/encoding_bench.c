@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libgadu.h"
+
+/* Teksty w UTF-8 o różnym udziale znaków spoza ASCII */
+static const char *samples[][2] =
+{
+	{ "ascii", "The quick brown fox jumps over the lazy dog. Meeting moved to 15:30, see you there. " },
+	{ "polish", "Cześć, będę za pół godziny, zamów mi proszę coś do jedzenia. Zażółć gęślą jaźń! " },
+	{ "dense", "ąćęłńóśźżĄĆĘŁŃÓŚŹŻąćęłńóśźżĄĆĘŁŃÓŚŹŻ " },
+};
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-n ITERATIONS] [-s SIZE]\n"
+	"\n"
+	"Measures CP1250 <-> UTF-8 conversion throughput on texts of SIZE bytes\n"
+	"with different share of non-ASCII characters.\n"
+	"\n", argv0);
+}
+
+static double elapsed(clock_t start)
+{
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static char *sample_generate(const char *sample, size_t size)
+{
+	size_t len = strlen(sample), i;
+	char *result;
+
+	result = malloc(size + len + 1);
+
+	if (result == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (i = 0; i < size; i += len)
+		memcpy(result + i, sample, len);
+
+	result[i] = 0;
+
+	return result;
+}
+
+static void bench(const char *name, const char *src, gg_encoding_t src_encoding, gg_encoding_t dst_encoding, int iterations)
+{
+	size_t src_len = strlen(src);
+	clock_t start;
+	double time;
+	char *dst;
+	int len, j;
+
+	len = gg_encoding_convert_buf(src, src_encoding, dst_encoding, -1, NULL, 0);
+
+	dst = malloc(len + 1);
+
+	if (dst == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	start = clock();
+
+	for (j = 0; j < iterations; j++)
+		gg_encoding_convert_buf(src, src_encoding, dst_encoding, -1, dst, len + 1);
+
+	time = elapsed(start);
+
+	printf("%-8s %-14s %8.1f MB/s\n", name, (src_encoding == GG_ENCODING_UTF8) ? "utf8->cp1250" : "cp1250->utf8",
+		(time > 0) ? ((double) src_len * iterations / time / 1048576) : 0.0);
+
+	free(dst);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = 1000, size = 65536;
+	size_t i;
+	int j;
+
+	for (j = 1; j < argc; j++) {
+		if (strcmp(argv[j], "-n") == 0 && j + 1 < argc) {
+			iterations = atoi(argv[++j]);
+		} else if (strcmp(argv[j], "-s") == 0 && j + 1 < argc) {
+			size = atoi(argv[++j]);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (iterations < 1 || size < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	printf("%d iterations over %d bytes\n\n", iterations, size);
+
+	for (i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+		char *utf, *cp;
+		int len;
+
+		utf = sample_generate(samples[i][1], size);
+
+		len = gg_encoding_convert_buf(utf, GG_ENCODING_UTF8, GG_ENCODING_CP1250, -1, NULL, 0);
+		cp = malloc(len + 1);
+
+		if (cp == NULL) {
+			perror("malloc");
+			return 1;
+		}
+
+		gg_encoding_convert_buf(utf, GG_ENCODING_UTF8, GG_ENCODING_CP1250, -1, cp, len + 1);
+
+		bench(samples[i][0], utf, GG_ENCODING_UTF8, GG_ENCODING_CP1250, iterations);
+		bench(samples[i][0], cp, GG_ENCODING_CP1250, GG_ENCODING_UTF8, iterations);
+
+		free(utf);
+		free(cp);
+	}
+
+	return 0;
+}
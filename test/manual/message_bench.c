@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libgadu.h"
+#include "message.h"
+
+static const char *default_corpus[] =
+{
+	"<span style=\"color:#000000; font-family:'MS Shell Dlg 2'; font-size:9pt; \">ok</span>",
+	"<span style=\"color:#000000; font-family:'MS Shell Dlg 2'; font-size:9pt; \">Cześć, będę za pół godziny, zamów mi proszę coś do jedzenia :)</span>",
+	"<span style=\"color:#000000; font-family:'MS Shell Dlg 2'; font-size:9pt; \">Zobacz: <b>ważne</b> &lt;- to <i>naprawdę</i> ważne &amp; pilne<br>Drugi wiersz<br>Trzeci wiersz</span>",
+	"<span style=\"color:#ff0000; font-family:'MS Shell Dlg 2'; font-size:9pt; \">czerwony </span><span style=\"color:#0000ff; font-family:'MS Shell Dlg 2'; font-size:9pt; \"><u>niebieski</u> </span><img name=\"0123456789abcdef\"><span style=\"color:#000000; font-family:'MS Shell Dlg 2'; font-size:9pt; \"> po obrazku</span>",
+	"<span style=\"color:#ff0000; font-family:'MS Shell Dlg 2'; font-size:9pt; \"><b>fragment 0 </b></span>"
+		"<span style=\"color:#00ff00; font-family:'MS Shell Dlg 2'; font-size:9pt; \"><i>fragment 1 </i></span>"
+		"<span style=\"color:#0000ff; font-family:'MS Shell Dlg 2'; font-size:9pt; \"><u>fragment 2 </u></span>"
+		"<span style=\"color:#123456; font-family:'MS Shell Dlg 2'; font-size:9pt; \"><b><i>fragment 3 </i></b></span>"
+		"<span style=\"color:#abcdef; font-family:'MS Shell Dlg 2'; font-size:9pt; \">fragment 4 </span>"
+		"<span style=\"color:#000000; font-family:'MS Shell Dlg 2'; font-size:9pt; \"><b><u>fragment 5 </u></b></span>"
+		"<span style=\"color:#ff0000; font-family:'MS Shell Dlg 2'; font-size:9pt; \"><b>fragment 6 </b></span>"
+		"<span style=\"color:#00ff00; font-family:'MS Shell Dlg 2'; font-size:9pt; \"><i>fragment 7 </i></span>"
+		"<span style=\"color:#0000ff; font-family:'MS Shell Dlg 2'; font-size:9pt; \"><u>fragment 8 </u></span>"
+		"<span style=\"color:#123456; font-family:'MS Shell Dlg 2'; font-size:9pt; \"><b><i>fragment 9 </i></b></span>"
+		"<span style=\"color:#abcdef; font-family:'MS Shell Dlg 2'; font-size:9pt; \">fragment 10 </span>"
+		"<span style=\"color:#000000; font-family:'MS Shell Dlg 2'; font-size:9pt; \"><b><u>fragment 11 </u></b></span>"
+		"<img name=\"0123456789abcdef\">",
+};
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-n ITERATIONS] [CORPUS]\n"
+	"\n"
+	"Compares two-pass and single-pass message conversion. CORPUS is a file\n"
+	"with one HTML message per line, a built-in sample is used by default.\n"
+	"\n", argv0);
+}
+
+static double elapsed(clock_t start)
+{
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+	const char **corpus = default_corpus;
+	size_t corpus_len = sizeof(default_corpus) / sizeof(default_corpus[0]);
+	char **texts;
+	unsigned char **formats;
+	size_t *formats_len;
+	int iterations = 100000;
+	double time_two, time_one;
+	clock_t start;
+	size_t i;
+	int j;
+
+	for (j = 1; j < argc; j++) {
+		if (strcmp(argv[j], "-n") == 0 && j + 1 < argc) {
+			iterations = atoi(argv[++j]);
+		} else if (argv[j][0] == '-') {
+			usage(argv[0]);
+			return 1;
+		} else {
+			FILE *f;
+			char line[4096];
+			size_t size = 0;
+
+			f = fopen(argv[j], "r");
+
+			if (f == NULL) {
+				perror(argv[j]);
+				return 1;
+			}
+
+			corpus = NULL;
+			corpus_len = 0;
+
+			while (fgets(line, sizeof(line), f) != NULL) {
+				line[strcspn(line, "\r\n")] = 0;
+
+				if (line[0] == 0)
+					continue;
+
+				if (corpus_len == size) {
+					size = (size != 0) ? (size * 2) : 64;
+					corpus = realloc(corpus, size * sizeof(char*));
+
+					if (corpus == NULL) {
+						perror("realloc");
+						return 1;
+					}
+				}
+
+				corpus[corpus_len++] = strdup(line);
+			}
+
+			fclose(f);
+
+			if (corpus_len == 0) {
+				fprintf(stderr, "%s: no messages\n", argv[j]);
+				return 1;
+			}
+		}
+	}
+
+	texts = calloc(corpus_len, sizeof(char*));
+	formats = calloc(corpus_len, sizeof(unsigned char*));
+	formats_len = calloc(corpus_len, sizeof(size_t));
+
+	if (texts == NULL || formats == NULL || formats_len == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	for (i = 0; i < corpus_len; i++) {
+		texts[i] = gg_message_html_to_text_alloc(corpus[i], GG_ENCODING_UTF8, &formats[i], &formats_len[i], 0);
+
+		if (texts[i] == NULL) {
+			perror("gg_message_html_to_text_alloc");
+			return 1;
+		}
+	}
+
+	printf("%d iterations over %d messages\n\n", iterations, (int) corpus_len);
+
+	/* HTML -> tekst */
+
+	start = clock();
+
+	for (j = 0; j < iterations; j++) {
+		for (i = 0; i < corpus_len; i++) {
+			size_t len, fmt_len;
+			unsigned char *fmt;
+			char *text;
+
+			len = gg_message_html_to_text(NULL, NULL, &fmt_len, corpus[i], GG_ENCODING_UTF8);
+			text = malloc(len + 1);
+			fmt = malloc(fmt_len + 1);
+			gg_message_html_to_text(text, fmt, NULL, corpus[i], GG_ENCODING_UTF8);
+			free(text);
+			free(fmt);
+		}
+	}
+
+	time_two = elapsed(start);
+
+	start = clock();
+
+	for (j = 0; j < iterations; j++) {
+		for (i = 0; i < corpus_len; i++) {
+			unsigned char *fmt;
+			size_t fmt_len;
+
+			free(gg_message_html_to_text_alloc(corpus[i], GG_ENCODING_UTF8, &fmt, &fmt_len, 0));
+			free(fmt);
+		}
+	}
+
+	time_one = elapsed(start);
+
+	printf("html_to_text: two-pass %.3fs, single-pass %.3fs\n", time_two, time_one);
+
+	/* Tekst -> HTML */
+
+	start = clock();
+
+	for (j = 0; j < iterations; j++) {
+		for (i = 0; i < corpus_len; i++) {
+			size_t len;
+			char *html;
+
+			len = gg_message_text_to_html(NULL, texts[i], GG_ENCODING_UTF8, formats[i], formats_len[i]);
+			html = malloc(len + 1);
+			gg_message_text_to_html(html, texts[i], GG_ENCODING_UTF8, formats[i], formats_len[i]);
+			free(html);
+		}
+	}
+
+	time_two = elapsed(start);
+
+	start = clock();
+
+	for (j = 0; j < iterations; j++) {
+		for (i = 0; i < corpus_len; i++)
+			free(gg_message_text_to_html_alloc(texts[i], GG_ENCODING_UTF8, formats[i], formats_len[i]));
+	}
+
+	time_one = elapsed(start);
+
+	printf("text_to_html: two-pass %.3fs, single-pass %.3fs\n", time_two, time_one);
+
+	for (i = 0; i < corpus_len; i++) {
+		free(texts[i]);
+		free(formats[i]);
+	}
+
+	free(texts);
+	free(formats);
+	free(formats_len);
+
+	return 0;
+}
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libgadu.h"
+#include "deflate.h"
+
+static const char *first_names[] = { "Jan", "Anna", "Piotr", "Katarzyna", "Tomasz", "Małgorzata", "Paweł", "Agnieszka" };
+static const char *last_names[] = { "Kowalski", "Nowak", "Wiśniewski", "Wójcik", "Kamińska", "Lewandowska", "Zieliński", "Szymańska" };
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-n ITERATIONS] [-c CONTACTS]\n"
+	"\n"
+	"Compares one-shot, per-session and fragment-by-fragment userlist100\n"
+	"compression on a generated GG 10.0 contact list.\n"
+	"\n", argv0);
+}
+
+static double elapsed(clock_t start)
+{
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+#define USERLIST_HEADER "<ContactBook><Groups><Group><Id>00000000-0000-0000-0000-000000000000</Id><Name>Pozostali</Name><IsExpanded>true</IsExpanded><IsRemovable>false</IsRemovable></Group></Groups><Contacts>"
+#define USERLIST_FOOTER "</Contacts></ContactBook>"
+
+static int contact_format(char *buf, int i)
+{
+	const char *first = first_names[i % 8];
+	const char *last = last_names[(i / 8) % 8];
+
+	return sprintf(buf, "<Contact><Guid>%08x-%04x-4000-8000-%012x</Guid><GGNumber>%d</GGNumber><ShowName>%s %s %d</ShowName><NickName>%s%d</NickName><FirstName>%s</FirstName><LastName>%s</LastName><MobilePhone>+4860%07d</MobilePhone><Email>%s.%s%d@example.com</Email><Groups><GroupId>00000000-0000-0000-0000-000000000000</GroupId></Groups><Avatars><URL>avatar-gg.pl/%d</URL></Avatars><FlagNormal>true</FlagNormal></Contact>",
+		i * 2654435761U, i & 0xffff, i, 1000000 + i * 7, first, last, i, first, i, first, last, (i * 37) % 10000000, first, last, i, 1000000 + i * 7);
+}
+
+static char *userlist_generate(int contacts)
+{
+	char *result;
+	size_t len = 0;
+	int i;
+
+	result = malloc(256 + contacts * 512);
+
+	if (result == NULL)
+		return NULL;
+
+	len += sprintf(result + len, USERLIST_HEADER);
+
+	for (i = 0; i < contacts; i++)
+		len += contact_format(result + len, i);
+
+	sprintf(result + len, USERLIST_FOOTER);
+
+	return result;
+}
+
+struct userlist_source_state {
+	int contacts;
+	int index;
+	char buf[512];
+};
+
+static int userlist_source(struct gg_session *gs, const char **buf, size_t *len, void *data)
+{
+	struct userlist_source_state *state = data;
+
+	if (state->index == -1) {
+		*buf = USERLIST_HEADER;
+		*len = strlen(*buf);
+	} else if (state->index < state->contacts) {
+		*buf = state->buf;
+		*len = contact_format(state->buf, state->index);
+	} else if (state->index == state->contacts) {
+		*buf = USERLIST_FOOTER;
+		*len = strlen(*buf);
+	} else {
+		*len = 0;
+		return 0;
+	}
+
+	state->index++;
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct gg_session sess;
+	struct userlist_source_state state;
+	int iterations = 20, contacts = 1000;
+	const int levels[] = { 1, 6, 9 };
+	unsigned char *compressed;
+	size_t compressed_len, len;
+	char *userlist;
+	clock_t start;
+	int i, j;
+
+	for (j = 1; j < argc; j++) {
+		if (strcmp(argv[j], "-n") == 0 && j + 1 < argc) {
+			iterations = atoi(argv[++j]);
+		} else if (strcmp(argv[j], "-c") == 0 && j + 1 < argc) {
+			contacts = atoi(argv[++j]);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	userlist = userlist_generate(contacts);
+
+	if (userlist == NULL) {
+		perror("userlist_generate");
+		return 1;
+	}
+
+	memset(&sess, 0, sizeof(sess));
+
+	printf("%d iterations over %d contacts (%d bytes)\n\n", iterations, contacts, (int) strlen(userlist));
+
+	/* Kompresja */
+
+	start = clock();
+
+	for (i = 0; i < iterations; i++) {
+		compressed = gg_deflate(userlist, &compressed_len);
+
+		if (compressed == NULL) {
+			fprintf(stderr, "gg_deflate failed\n");
+			return 1;
+		}
+
+		free(compressed);
+	}
+
+	printf("deflate one-shot level 9: %.3fs, %d bytes\n", elapsed(start), (int) compressed_len);
+
+	for (j = 0; j < (int) (sizeof(levels) / sizeof(levels[0])); j++) {
+		sess.deflate_level = levels[j];
+
+		start = clock();
+
+		for (i = 0; i < iterations; i++) {
+			compressed = gg_deflate_session(&sess, userlist, 0, &compressed_len);
+
+			if (compressed == NULL) {
+				fprintf(stderr, "gg_deflate_session failed\n");
+				return 1;
+			}
+
+			free(compressed);
+		}
+
+		printf("deflate session level %d: %.3fs, %d bytes\n", levels[j], elapsed(start), (int) compressed_len);
+	}
+
+	start = clock();
+
+	for (i = 0; i < iterations; i++) {
+		state.contacts = contacts;
+		state.index = -1;
+
+		compressed = gg_deflate_source(&sess, userlist_source, &state, 0, &compressed_len);
+
+		if (compressed == NULL) {
+			fprintf(stderr, "gg_deflate_source failed\n");
+			return 1;
+		}
+
+		free(compressed);
+	}
+
+	printf("deflate session level %d from source: %.3fs, %d bytes\n", sess.deflate_level, elapsed(start), (int) compressed_len);
+
+	/* Dekompresja */
+
+	compressed = gg_deflate(userlist, &compressed_len);
+
+	if (compressed == NULL) {
+		fprintf(stderr, "gg_deflate failed\n");
+		return 1;
+	}
+
+	start = clock();
+
+	for (i = 0; i < iterations; i++)
+		free(gg_inflate(compressed, compressed_len));
+
+	printf("\ninflate one-shot: %.3fs\n", elapsed(start));
+
+	len = strlen(userlist);
+
+	start = clock();
+
+	for (i = 0; i < iterations; i++)
+		free(gg_inflate_session(&sess, compressed, compressed_len, len));
+
+	printf("inflate session with size hint: %.3fs\n", elapsed(start));
+
+	free(compressed);
+	free(userlist);
+	gg_deflate_free_session(&sess);
+
+	return 0;
+}